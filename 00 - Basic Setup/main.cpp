@@ -210,7 +210,8 @@ void WebcamApp::Run() {
 					break;
 				}
 
-				// can access srcData here
+				// can access the frame here: rows start at pScanline0, and pitch is
+				// negative for bottom-up buffers
 
 				pBuffer2D2->Unlock2D();
 
@@ -1,18 +1,53 @@
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
 #endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
 #include <mfapi.h>
 #include <mfidl.h>
 #include <mfreadwrite.h>
 #include <Mferror.h>
 #include <wrl/client.h>
+#include <initguid.h>
+#include <codecapi.h>
+#include <strmif.h>
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
-#include <execution>
 
 #include "inc/Processing.NDI.Lib.h"
+#include "../common/CaptureClock.h"
+#include "../common/CapturePipeline.h"
+#include "../common/CaptureSource.h"
+#include "../common/ColorConvert.h"
+#include "../common/CropScale.h"
+#include "../common/D3D11TextureSink.h"
+#include "../common/FrameConverter.h"
+#include "../common/FrameJournal.h"
+#include "../common/FramePool.h"
+#include "../common/FrameRing.h"
+#include "../common/FrameSink.h"
+#include "../common/FrameTracer.h"
+#include "../common/MediaNegotiation.h"
+#include "../common/MultiCapture.h"
+#include "../common/MFCaptureSource.h"
+#include "../common/Orientation.h"
+#include "../common/PixelConvert.h"
+#include "../common/PixelFormat.h"
+#include "../common/ProxyPyramid.h"
+#include "../common/SinkFanOut.h"
+#include "../common/SyntheticCapture.h"
 
 #pragma comment(lib, "mf.lib")
 #pragma comment(lib, "mfplat.lib")
@@ -22,38 +57,124 @@
 
 using Microsoft::WRL::ComPtr;
 
-class WebcamApp {
+struct AppConfig {
+	NegotiationConstraints capture;
+	ConversionConfig conversion;
+	PipelineConfig pipeline;
+	MultiCaptureConfig cameras; // the conversion workers every camera shares
+	std::vector<uint32_t> devices; // capture devices to open; empty = the first
+	bool allDevices{ false };
+	unsigned decoderThreads{ 0 }; // per MJPG decoder MFT; 0 = one per hardware thread
+	std::string tracePath;      // Chrome trace JSON, written on F11 and at exit (FRAME_TRACING builds)
+	std::vector<SyntheticCaptureConfig> synthetic; // test patterns instead of cameras
+	PixelFormat syntheticFormat{ PixelFormat::YUY2 };
+	PixelFormat textureFormat{ PixelFormat::Unknown }; // also fill a shared D3D11 texture; Unknown = off
+	SinkQueueConfig textureQueue{ 1, HandoffPolicy::Latest };
+	FrameJournalConfig record;  // also record the NDI frames into record.directory; empty = off
+	SinkQueueConfig recordQueue{ 8, HandoffPolicy::DropOldest };
+};
+
+// One camera: its capture, its conversions on the shared workers, and the
+// NDI senders, and optionally the shared texture and the recording, it feeds.
+class CameraSender : public FrameSink {
 public:
-	bool Initialize();
-	void Run();
+	CameraSender(const AppConfig& config, std::string name) : config_(config), name_(std::move(name)) {}
+
+	// Opens a camera and picks its media type. Cameras can be opened at the
+	// same time; messages go to Log() rather than the console.
+	bool Open(IMFActivate* device);
+	void OpenSynthetic(const SyntheticCaptureConfig& synthetic);
+
+	// Adds the camera's pipeline to cameras and creates its NDI senders.
+	bool Initialize(MultiCapture& cameras, const NDIlib_v5* ndiLib);
 	void Cleanup();
+
+	const std::string& Name() const {
+		return name_;
+	}
+
+	std::string Log() const {
+		return log_.str();
+	}
+
+	void Send(SinkFrame& frame) override;
+	void Flush() override;
 private:
-	bool SetupMediaFoundation();
-	bool SetupCapture();
-	bool SetupNDI();
+	bool NegotiateMediaType(const std::vector<PixelFormat>& sinkFormats);
+	bool DecodesMJPG() const;
+	bool SetupMJPGCapture(IMFMediaType* nativeType);
+	bool SetupMJPGDecode(IMFMediaType* nativeType);
+	void ConfigureDecoder();
+	ConversionConfig TextureConversion() const;
 
-	bool LoadNDIRuntime();
 	bool CreateNDISender();
 	void InitializeNDIFrame();
-	void CleanupNDI();
 
-	bool CreateBuffers();
-	void DestroyBuffers();
+	AppConfig config_;
+	std::string name_; // of the NDI sender
+	std::string proxyNames_[ProxyPyramid::kLevelCount];
+	std::ostringstream log_;
 
 	ComPtr<IMFSourceReader> sourceReader;
 
 	UINT width_{ 0 };
 	UINT height_{ 0 };
+	PixelFormat nativeFormat_{ PixelFormat::Unknown };  // what the camera sends
+	PixelFormat captureFormat_{ PixelFormat::Unknown }; // what ReadSample returns
+	uint32_t frameRateNumerator_{ 0 };   // of the native media type
+	uint32_t frameRateDenominator_{ 1 };
+	YUVColorimetry colorimetry_;
+
+	std::unique_ptr<CaptureSource> source_;
+	D3D11TextureSink textureSink_;
+	std::unique_ptr<FrameJournal> journal_;
+	FanOutPipeline* pipeline_{ nullptr }; // owned by the MultiCapture
 
 	const NDIlib_v5* ndiLib_v5_{ nullptr };
 
 	NDIlib_send_instance_t ndi_sender_{ nullptr };
 	NDIlib_video_frame_v2_t ndi_video_frame_{ NULL };
+	NDIlib_send_instance_t ndi_proxy_senders_[ProxyPyramid::kLevelCount]{};
+	NDIlib_video_frame_v2_t ndi_proxy_frames_[ProxyPyramid::kLevelCount]{};
+	UtcTimecodeAnchor timecodeAnchor_; // frames are timecoded with their capture time
+
+	// NDI reads an async frame until the next send, so the last one sent on
+	// each sender is held here until then.
+	FrameRef sentFrame_;
+	FrameRef sentProxies_[ProxyPyramid::kLevelCount];
+};
 
-	uint8_t* buffer1_;
-	uint8_t* buffer2_;
+// Opens the selected cameras, or synthetic ones, and sends each over NDI from
+// a pipeline of its own, all converting on one shared worker pool.
+class WebcamApp {
+public:
+	explicit WebcamApp(const AppConfig& config) : config_(config), cameras_(config.cameras) {}
+
+	bool Initialize();
+	void Run();
+	void Cleanup();
+
+private:
+	bool SetupMediaFoundation();
+	bool OpenCameras();
+	bool SetupNDI();
+	bool LoadNDIRuntime();
+
+	void WriteTrace();
+
+	AppConfig config_;
+	const NDIlib_v5* ndiLib_v5_{ nullptr };
+
+	// Declared before cameras_, whose pipelines read the senders' sources.
+	std::vector<std::unique_ptr<CameraSender>> senders_;
+	MultiCapture cameras_;
 };
 
+// "webcam_to_ndi" for one camera, numbered by device for several.
+std::string NDISenderName(uint32_t index, size_t count) {
+	return count == 1 ? std::string("webcam_to_ndi") : "webcam_to_ndi " + std::to_string(index);
+}
+
 bool WebcamApp::Initialize() {
 
 	if (!SetupMediaFoundation()) {
@@ -61,7 +182,16 @@ bool WebcamApp::Initialize() {
 		return false;
 	}
 
-	if (!SetupCapture()) {
+	if (!config_.synthetic.empty()) {
+		for (size_t i = 0; i < config_.synthetic.size(); ++i) {
+			SyntheticCaptureConfig synthetic = config_.synthetic[i];
+			synthetic.format = config_.syntheticFormat;
+			senders_.push_back(std::make_unique<CameraSender>(config_, NDISenderName(static_cast<uint32_t>(i), config_.synthetic.size())));
+			senders_.back()->OpenSynthetic(synthetic);
+			std::cout << senders_.back()->Log();
+		}
+	}
+	else if (!OpenCameras()) {
 		std::cerr << "Failed to set up webcam capture." << std::endl;
 		return false;
 	}
@@ -71,11 +201,63 @@ bool WebcamApp::Initialize() {
 		return false;
 	}
 
-	if (!CreateBuffers()) {
-		std::cerr << "Failed to create buffers required for NDI." << std::endl;
+	for (std::unique_ptr<CameraSender>& sender : senders_) {
+		if (!sender->Initialize(cameras_, ndiLib_v5_)) {
+			std::cerr << "Failed to set up " << sender->Name() << "." << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CameraSender::OpenSynthetic(const SyntheticCaptureConfig& synthetic) {
+	source_ = std::make_unique<SyntheticCaptureSource>(synthetic);
+	const CaptureFormat format = source_->Format();
+	colorimetry_ = DefaultColorimetry(format.format, format.height);
+	log_ << "Synthetic capture: " << PixelFormatName(format.format) << " " << format.width << "x" << format.height
+		<< " @ " << format.FrameRate() << " fps" << std::endl;
+}
+
+// NDI's async send only queues the frame, so it runs inline; the texture
+// copy waits on the GPU and the recording on the disk, so they get a queue
+// each. The recording takes the NDI frames themselves.
+bool CameraSender::Initialize(MultiCapture& cameras, const NDIlib_v5* ndiLib) {
+	ndiLib_v5_ = ndiLib;
+
+	pipeline_ = &cameras.AddCamera(name_, *source_, config_.pipeline);
+	pipeline_->AddSink("NDI", *this, config_.conversion, SinkQueueConfig{ 0, HandoffPolicy::Latest });
+	if (config_.textureFormat != PixelFormat::Unknown) {
+		if (!textureSink_.Initialize()) {
+			std::cerr << "Failed to set up Direct3D 11." << std::endl;
+			return false;
+		}
+		pipeline_->AddSink("texture", textureSink_, TextureConversion(), config_.textureQueue);
+	}
+	if (!config_.record.directory.empty()) {
+		FrameJournalConfig record = config_.record;
+		record.name = name_;
+		std::replace(record.name.begin(), record.name.end(), ' ', '_');
+		journal_ = std::make_unique<FrameJournal>(record);
+		if (!journal_->Open()) {
+			std::cerr << "Failed to start recording into " << record.directory << "." << std::endl;
+			return false;
+		}
+		std::cout << "Recording " << name_ << " into " << journal_->SegmentPath(0) << " and on." << std::endl;
+		pipeline_->AddSink("record", *journal_, config_.conversion, config_.recordQueue);
+	}
+
+	if (!pipeline_->Initialize(colorimetry_)) {
+		std::cerr << "Failed to set up the conversions." << std::endl;
+		return false;
+	}
+
+	if (!CreateNDISender()) {
 		return false;
 	}
 
+	InitializeNDIFrame();
+
 	return true;
 }
 
@@ -116,7 +298,238 @@ void CleanupActivateArray(IMFActivate** activateArray, UINT32 count)
 	}
 }
 
-bool WebcamApp::SetupCapture() {
+PixelFormat PixelFormatFromSubtype(const GUID& subtype) {
+	if (subtype == MFVideoFormat_YUY2) return PixelFormat::YUY2;
+	if (subtype == MFVideoFormat_UYVY) return PixelFormat::UYVY;
+	if (subtype == MFVideoFormat_NV12) return PixelFormat::NV12;
+	if (subtype == MFVideoFormat_I420) return PixelFormat::I420;
+	if (subtype == MFVideoFormat_MJPG) return PixelFormat::MJPG;
+	if (subtype == MFVideoFormat_RGB32) return PixelFormat::RGB32;
+	return PixelFormat::Unknown;
+}
+
+// Colorimetry of a native media type, falling back to the usual defaults for
+// the format and size when the camera does not say.
+YUVColorimetry ColorimetryFromMediaType(IMFMediaType* mediaType, PixelFormat format, UINT32 height) {
+	YUVColorimetry colorimetry = DefaultColorimetry(format, height);
+
+	UINT32 matrix = 0;
+	if (SUCCEEDED(mediaType->GetUINT32(MF_MT_YUV_MATRIX, &matrix))) {
+		if (matrix == MFVideoTransferMatrix_BT601) colorimetry.matrix = YUVMatrix::BT601;
+		if (matrix == MFVideoTransferMatrix_BT709) colorimetry.matrix = YUVMatrix::BT709;
+	}
+
+	UINT32 range = 0;
+	if (SUCCEEDED(mediaType->GetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, &range))) {
+		if (range == MFNominalRange_0_255) colorimetry.range = YUVRange::Full;
+		if (range == MFNominalRange_16_235) colorimetry.range = YUVRange::Limited;
+	}
+
+	return colorimetry;
+}
+
+bool CameraSender::NegotiateMediaType(const std::vector<PixelFormat>& sinkFormats) {
+	std::vector<MediaTypeCandidate> candidates;
+	std::vector<ComPtr<IMFMediaType>> mediaTypes;
+
+	for (DWORD i = 0; ; i++) {
+		ComPtr<IMFMediaType> mediaType;
+		HRESULT hr = sourceReader->GetNativeMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, i, &mediaType);
+		if (hr == MF_E_NO_MORE_TYPES) {
+			break;
+		}
+		if (FAILED(hr)) {
+			log_ << "Failed to get native media type " << i << "." << std::endl;
+			return false;
+		}
+
+		GUID subtype;
+		MediaTypeCandidate candidate;
+		candidate.index = i;
+
+		if (FAILED(mediaType->GetGUID(MF_MT_SUBTYPE, &subtype)) ||
+			FAILED(MFGetAttributeSize(mediaType.Get(), MF_MT_FRAME_SIZE, &candidate.width, &candidate.height))) {
+			continue;
+		}
+
+		candidate.format = PixelFormatFromSubtype(subtype);
+		MFGetAttributeRatio(mediaType.Get(), MF_MT_FRAME_RATE, &candidate.frameRateNumerator, &candidate.frameRateDenominator);
+
+		candidates.push_back(candidate);
+		mediaTypes.push_back(mediaType);
+	}
+
+	NegotiationResult result = SelectMediaType(candidates, sinkFormats, config_.capture);
+	if (result.selected < 0) {
+		log_ << "None of the " << candidates.size() << " native media types can be converted to";
+		for (PixelFormat sinkFormat : sinkFormats) {
+			log_ << " " << PixelFormatName(sinkFormat);
+		}
+		log_ << "." << std::endl;
+		return false;
+	}
+
+	const MediaTypeCandidate& chosen = candidates[result.selected];
+	if (!result.meetsConstraints) {
+		log_ << "No native media type meets " << config_.capture.minWidth << "x" << config_.capture.minHeight
+			<< " @ " << config_.capture.minFrameRate << " fps, using the closest one." << std::endl;
+	}
+
+	log_ << "Selected native media type " << chosen.index << " of " << candidates.size() << ": "
+		<< PixelFormatName(chosen.format) << " " << chosen.width << "x" << chosen.height
+		<< " @ " << chosen.FrameRate() << " fps" << std::endl;
+
+	width_ = chosen.width;
+	height_ = chosen.height;
+	nativeFormat_ = chosen.format;
+	frameRateNumerator_ = chosen.frameRateNumerator;
+	frameRateDenominator_ = chosen.frameRateDenominator;
+
+	colorimetry_ = ColorimetryFromMediaType(mediaTypes[result.selected].Get(), chosen.format, chosen.height);
+
+	if (chosen.format == PixelFormat::MJPG) {
+		return DecodesMJPG() ? SetupMJPGCapture(mediaTypes[result.selected].Get()) : SetupMJPGDecode(mediaTypes[result.selected].Get());
+	}
+
+	HRESULT hr = sourceReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, mediaTypes[result.selected].Get());
+	if (FAILED(hr)) {
+		log_ << "Failed to set video output format" << std::endl;
+		return false;
+	}
+
+	captureFormat_ = chosen.format;
+
+	return true;
+}
+
+// The texture gets the NDI conversion's chroma filter in its own format.
+ConversionConfig CameraSender::TextureConversion() const {
+	ConversionConfig conversion;
+	conversion.outputFormat = config_.textureFormat;
+	conversion.chromaFilter = config_.conversion.chromaFilter;
+	return conversion;
+}
+
+// Whether every conversion of this camera can decode MJPG itself (see
+// FrameConverter::DecodesMJPG()): only then are the JPEG samples read as they
+// are, otherwise the source reader decodes them.
+bool CameraSender::DecodesMJPG() const {
+	return FrameConverter::DecodesMJPG(config_.conversion)
+		&& (config_.textureFormat == PixelFormat::Unknown || FrameConverter::DecodesMJPG(TextureConversion()));
+}
+
+// Reads the camera's JPEG samples without a decoder in the source reader. The
+// pipeline decodes them straight into the output frames on the shared
+// conversion workers, several frames at once when it falls behind.
+bool CameraSender::SetupMJPGCapture(IMFMediaType* nativeType) {
+	HRESULT hr = sourceReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, nativeType);
+	if (FAILED(hr)) {
+		log_ << "Failed to set native MJPG media type." << std::endl;
+		PrintError(hr);
+		return false;
+	}
+
+	captureFormat_ = PixelFormat::MJPG;
+	log_ << "MJPG decoder: libjpeg on the conversion workers" << std::endl;
+
+	return true;
+}
+
+// The fallback for builds without libjpeg and for outputs the pipeline cannot
+// decode into. Selects the MJPG mode on the camera and asks the source reader
+// for YUY2, which makes it insert the MJPEG decoder MFT. The decoder writes
+// YUY2 directly, so the existing YUY2 kernels produce the sink format without
+// an RGB step.
+bool CameraSender::SetupMJPGDecode(IMFMediaType* nativeType) {
+	ComPtr<IMFSourceReaderEx> sourceReaderEx;
+	HRESULT hr = sourceReader.As(&sourceReaderEx);
+	if (FAILED(hr)) {
+		log_ << "Failed to get IMFSourceReaderEx for MJPG decoding." << std::endl;
+		return false;
+	}
+
+	DWORD streamFlags = 0;
+	hr = sourceReaderEx->SetNativeMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, nativeType, &streamFlags);
+	if (FAILED(hr)) {
+		log_ << "Failed to set native MJPG media type." << std::endl;
+		return false;
+	}
+
+	ComPtr<IMFMediaType> decodedType;
+	hr = MFCreateMediaType(&decodedType);
+	if (FAILED(hr)) {
+		log_ << "Failed to create decoded media type." << std::endl;
+		return false;
+	}
+
+	decodedType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+	decodedType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_YUY2);
+	MFSetAttributeSize(decodedType.Get(), MF_MT_FRAME_SIZE, width_, height_);
+
+	hr = sourceReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, decodedType.Get());
+	if (FAILED(hr)) {
+		log_ << "Failed to set up MJPG to YUY2 decoding." << std::endl;
+		PrintError(hr);
+		return false;
+	}
+
+	captureFormat_ = PixelFormat::YUY2;
+
+	ConfigureDecoder();
+
+	return true;
+}
+
+// Lets the decoder work on several frames at once where it supports it, and
+// reports whether a hardware decoder was picked.
+void CameraSender::ConfigureDecoder() {
+	ComPtr<IMFSourceReaderEx> sourceReaderEx;
+	if (FAILED(sourceReader.As(&sourceReaderEx))) {
+		return;
+	}
+
+	unsigned threads = config_.decoderThreads ? config_.decoderThreads : std::max(1u, std::thread::hardware_concurrency());
+
+	for (DWORD i = 0; ; i++) {
+		GUID category;
+		ComPtr<IMFTransform> transform;
+		HRESULT hr = sourceReaderEx->GetTransformForStream(MF_SOURCE_READER_FIRST_VIDEO_STREAM, i, &category, &transform);
+		if (FAILED(hr)) {
+			break;
+		}
+
+		if (category != MFT_CATEGORY_VIDEO_DECODER) {
+			continue;
+		}
+
+		bool hardware = false;
+		ComPtr<IMFAttributes> attributes;
+		if (SUCCEEDED(transform->GetAttributes(&attributes))) {
+			UINT32 length = 0;
+			hardware = SUCCEEDED(attributes->GetStringLength(MFT_ENUM_HARDWARE_URL_Attribute, &length));
+		}
+
+		bool threaded = false;
+		ComPtr<ICodecAPI> codecApi;
+		if (SUCCEEDED(transform.As(&codecApi))) {
+			VARIANT value;
+			VariantInit(&value);
+			value.vt = VT_UI4;
+			value.ulVal = threads;
+			threaded = SUCCEEDED(codecApi->SetValue(&CODECAPI_AVDecNumWorkerThreads, &value));
+		}
+
+		log_ << "MJPG decoder: " << (hardware ? "hardware" : "software");
+		if (threaded) {
+			log_ << ", " << threads << " worker threads";
+		}
+		log_ << std::endl;
+	}
+}
+
+// Lists every capture device, then opens the selected ones side by side, as
+// activating a camera and reading its media types takes a while.
+bool WebcamApp::OpenCameras() {
 	ComPtr<IMFAttributes> attributes;
 	HRESULT hr = MFCreateAttributes(&attributes, 1);
 	if (FAILED(hr)) {
@@ -153,59 +566,94 @@ bool WebcamApp::SetupCapture() {
 		}
 	}
 
-	ComPtr<IMFMediaSource> mediaSource;
-	hr = activateArray[0]->ActivateObject(IID_PPV_ARGS(&mediaSource));
-	if (FAILED(hr) || count == 0) {
-		std::cerr << "Failed to activate IMFMediaSource." << std::endl;
-		CleanupActivateArray(activateArray, count);
-		return false;
+	std::vector<uint32_t> devices = config_.devices;
+	if (config_.allDevices) {
+		devices.clear();
+		for (UINT32 i = 0; i < count; i++) {
+			devices.push_back(i);
+		}
 	}
-
-	hr = MFCreateSourceReaderFromMediaSource(mediaSource.Get(), nullptr, &sourceReader);
-	if (FAILED(hr)) {
-		std::cerr << "Failed to create IMFSourceReader from IMFMediaSource." << std::endl;
-		CleanupActivateArray(activateArray, count);
-		return false;
+	else if (devices.empty()) {
+		devices.push_back(0);
+	}
+	for (uint32_t device : devices) {
+		if (device >= count) {
+			std::cerr << "There is no device " << device << "." << std::endl;
+			CleanupActivateArray(activateArray, count);
+			return false;
+		}
 	}
 
+	for (uint32_t device : devices) {
+		senders_.push_back(std::make_unique<CameraSender>(config_, NDISenderName(device, devices.size())));
+	}
+	std::vector<char> opened(devices.size(), 0);
+	std::vector<std::thread> openers;
+	for (size_t i = 0; i < devices.size(); i++) {
+		openers.emplace_back([&, i]() { opened[i] = senders_[i]->Open(activateArray[devices[i]]); });
+	}
+	for (std::thread& opener : openers) {
+		opener.join();
+	}
 	CleanupActivateArray(activateArray, count);
 
-	ComPtr<IMFMediaType> mediaType;
-	hr = sourceReader->GetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, &mediaType);
+	bool ok = true;
+	for (size_t i = 0; i < devices.size(); i++) {
+		std::cout << "Device " << devices[i] << " as " << senders_[i]->Name() << ":" << std::endl << senders_[i]->Log();
+		if (!opened[i]) {
+			std::cerr << "Failed to open device " << devices[i] << "." << std::endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+bool CameraSender::Open(IMFActivate* device) {
+	ComPtr<IMFMediaSource> mediaSource;
+	HRESULT hr = device->ActivateObject(IID_PPV_ARGS(&mediaSource));
 	if (FAILED(hr)) {
-		std::cerr << "Failed to get current media type." << std::endl;
+		log_ << "Failed to activate IMFMediaSource." << std::endl;
 		return false;
 	}
 
-	UINT32 width, height;
-	hr = MFGetAttributeSize(mediaType.Get(), MF_MT_FRAME_SIZE, &width, &height);
+	// Hardware transforms let the reader pick a hardware MJPEG decoder when one exists.
+	ComPtr<IMFAttributes> readerAttributes;
+	hr = MFCreateAttributes(&readerAttributes, 1);
 	if (FAILED(hr)) {
-		std::cerr << "Failed to get video frame size." << std::endl;
+		log_ << "Failed to create source reader attributes." << std::endl;
 		return false;
 	}
 
-	width_ = width;
-	height_ = height;
+	readerAttributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
 
-	GUID format;
-	hr = mediaType->GetGUID(MF_MT_SUBTYPE, &format);
+	hr = MFCreateSourceReaderFromMediaSource(mediaSource.Get(), readerAttributes.Get(), &sourceReader);
 	if (FAILED(hr)) {
-		std::cerr << "Failed to get format." << std::endl;
+		log_ << "Failed to create IMFSourceReader from IMFMediaSource." << std::endl;
 		return false;
 	}
 
-	hr = sourceReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, mediaType.Get());
-	if (FAILED(hr)) {
-		std::cerr << "Failed to set video output format" << std::endl;
+	std::vector<PixelFormat> sinkFormats = { config_.conversion.outputFormat };
+	if (config_.textureFormat != PixelFormat::Unknown) {
+		sinkFormats.push_back(config_.textureFormat);
+	}
+	if (!NegotiateMediaType(sinkFormats)) {
 		return false;
 	}
 
 	hr = sourceReader->SetStreamSelection((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, TRUE);
 	if (FAILED(hr)) {
-		std::cerr << "Failed to enable video stream" << std::endl;
+		log_ << "Failed to enable video stream" << std::endl;
 		return false;
 	}
 
+	CaptureFormat format;
+	format.format = captureFormat_;
+	format.width = width_;
+	format.height = height_;
+	format.frameRateNumerator = frameRateNumerator_;
+	format.frameRateDenominator = frameRateDenominator_;
+	source_ = std::make_unique<MFCaptureSource>(sourceReader, format);
+
 	return true;
 }
 
@@ -220,12 +668,6 @@ bool WebcamApp::SetupNDI() {
 		return false;
 	}
 
-	if (!CreateNDISender()) {
-		return false;
-	}
-
-	InitializeNDIFrame();
-
 	return true;
 }
 
@@ -268,9 +710,11 @@ bool WebcamApp::LoadNDIRuntime() {
 	return true;
 }
 
-bool WebcamApp::CreateNDISender() {
+bool CameraSender::CreateNDISender() {
 	NDIlib_send_create_t ndi_sender_desc;
-	ndi_sender_desc.p_ndi_name = "webcam_to_ndi";
+	ndi_sender_desc.p_ndi_name = name_.c_str();
+	// The pacer takes over from NDI's own clock.
+	ndi_sender_desc.clock_video = !config_.pipeline.pace;
 
 	ndi_sender_ = ndiLib_v5_->send_create(&ndi_sender_desc);
 	if (!ndi_sender_) {
@@ -278,172 +722,335 @@ bool WebcamApp::CreateNDISender() {
 		return false;
 	}
 
+	if (pipeline_->ConverterFor(0).Proxies()) {
+		static const char* const proxySuffixes[ProxyPyramid::kLevelCount] = { " (1/2)", " (1/4)" };
+		for (uint32_t i = 0; i < ProxyPyramid::kLevelCount; ++i) {
+			proxyNames_[i] = name_ + proxySuffixes[i];
+			NDIlib_send_create_t proxy_desc;
+			proxy_desc.p_ndi_name = proxyNames_[i].c_str();
+			proxy_desc.clock_video = !config_.pipeline.pace;
+			ndi_proxy_senders_[i] = ndiLib_v5_->send_create(&proxy_desc);
+			if (!ndi_proxy_senders_[i]) {
+				std::cerr << "Could not created NDI sender '" << proxy_desc.p_ndi_name << "'" << std::endl;
+				return false;
+			}
+		}
+	}
+
 	return true;
 }
 
-void WebcamApp::InitializeNDIFrame() {
-	ndi_video_frame_.FourCC = NDIlib_FourCC_type_UYVY;
-	ndi_video_frame_.xres = width_;
-	ndi_video_frame_.yres = height_;
-	ndi_video_frame_.line_stride_in_bytes = width_ * 2;
-	ndi_video_frame_.frame_rate_D = 1000;
-	ndi_video_frame_.frame_rate_N = 60000;
+NDIlib_FourCC_video_type_e NDIFourCCFor(PixelFormat format) {
+	switch (format) {
+	case PixelFormat::NV12: return NDIlib_FourCC_type_NV12;
+	case PixelFormat::I420: return NDIlib_FourCC_type_I420;
+	case PixelFormat::BGRA: return NDIlib_FourCC_type_BGRA;
+	case PixelFormat::BGRX: return NDIlib_FourCC_type_BGRX;
+	case PixelFormat::RGBA: return NDIlib_FourCC_type_RGBA;
+	case PixelFormat::RGBX: return NDIlib_FourCC_type_RGBX;
+	default: return NDIlib_FourCC_type_UYVY;
+	}
 }
 
-void WebcamApp::CleanupNDI() {
-	ndiLib_v5_->send_send_video_async_v2(ndi_sender_, NULL);
-	ndiLib_v5_->send_destroy(ndi_sender_);
-	ndiLib_v5_->destroy();
+void CameraSender::InitializeNDIFrame() {
+	FrameConverter& converter = pipeline_->ConverterFor(0);
+	const FrameLayout& outputLayout = converter.OutputLayout();
+	const CaptureFormat capture = source_->Format();
+	ndi_video_frame_.FourCC = NDIFourCCFor(outputLayout.format);
+	ndi_video_frame_.xres = static_cast<int>(outputLayout.width);
+	ndi_video_frame_.yres = static_cast<int>(outputLayout.height);
+	// For planar formats this is the luma stride; NDI derives the chroma planes from it.
+	ndi_video_frame_.line_stride_in_bytes = static_cast<int>(outputLayout.planePitch[0]);
+	// Receivers sync to the advertised rate, so it is the camera's own.
+	ndi_video_frame_.frame_rate_N = capture.frameRateNumerator ? static_cast<int>(capture.frameRateNumerator) : 60000;
+	ndi_video_frame_.frame_rate_D = capture.frameRateNumerator ? static_cast<int>(capture.frameRateDenominator) : 1000;
+
+	if (const ProxyPyramid* proxies = converter.Proxies()) {
+		for (uint32_t i = 0; i < ProxyPyramid::kLevelCount; ++i) {
+			const FrameLayout& layout = proxies->Layout(i);
+			ndi_proxy_frames_[i] = ndi_video_frame_;
+			ndi_proxy_frames_[i].FourCC = NDIlib_FourCC_type_UYVY;
+			ndi_proxy_frames_[i].xres = static_cast<int>(layout.width);
+			ndi_proxy_frames_[i].yres = static_cast<int>(layout.height);
+			ndi_proxy_frames_[i].line_stride_in_bytes = static_cast<int>(layout.planePitch[0]);
+		}
+	}
 }
 
-void YUY2ToUYVYWithPitch(const BYTE* srcData, BYTE* destData, UINT width, UINT height, LONG pitch) {
-	std::vector<UINT> rowIndices(height);
-	std::iota(rowIndices.begin(), rowIndices.end(), 0);
-
-	std::for_each(std::execution::par, rowIndices.begin(), rowIndices.end(),
-		[&](UINT y) {
-			const BYTE* srcRow = srcData + y * pitch;
-			BYTE* destRow = destData + y * width * 2;
-
-			for (UINT x = 0; x < width; x += 2) {
-				UINT idx = x * 2;
-				destRow[idx] = srcRow[idx + 1];     // U
-				destRow[idx + 1] = srcRow[idx];     // Y0
-				destRow[idx + 2] = srcRow[idx + 3]; // V
-				destRow[idx + 3] = srcRow[idx + 2]; // Y1
-			}
+void CameraSender::Cleanup() {
+	if (journal_) {
+		journal_->PrintStats(false);
+	}
+	for (NDIlib_send_instance_t proxySender : ndi_proxy_senders_) {
+		if (proxySender) {
+			ndiLib_v5_->send_send_video_async_v2(proxySender, NULL);
+			ndiLib_v5_->send_destroy(proxySender);
 		}
-	);
+	}
+	if (ndi_sender_) {
+		ndiLib_v5_->send_send_video_async_v2(ndi_sender_, NULL);
+		ndiLib_v5_->send_destroy(ndi_sender_);
+	}
 }
 
-void WebcamApp::Run() {
-	bool useBuffer0 = true;
-
-	DWORD streamIndex, flags;
-	LONGLONG timestamp;
-	BYTE* srcData = nullptr;
-	DWORD currentLength;
-	UINT rowBytesYUY2 = width_ * 2;
-	UINT totalBytesYUY2 = height_ * rowBytesYUY2;
-
-	ComPtr<IMF2DBuffer2> pBuffer2D2;
-	ComPtr<IMFMediaBuffer> buffer;
-
-	ComPtr<IMFSample> sample;
-
-	BYTE* pScanline0 = nullptr;
-	LONG pitch;
-
-	constexpr size_t NUM_RESULTS = 50;
-	std::vector<double> durations(NUM_RESULTS);
-	size_t currentResultIndex = 0;
-	std::chrono::time_point<std::chrono::steady_clock> lastOutputTime = std::chrono::steady_clock::now();
+// NDI is done with the previous frame once a send returns, so replacing
+// sentFrame_ (or a sentProxies_ entry) gives that buffer back to the pool.
+void CameraSender::Send(SinkFrame& frame) {
+	ndi_video_frame_.p_data = frame.frame.Data();
+	ndi_video_frame_.timecode = timecodeAnchor_.Timecode(frame.captured);
+	ndiLib_v5_->send_send_video_async_v2(ndi_sender_, &ndi_video_frame_);
+	sentFrame_ = std::move(frame.frame);
+
+	// A proxy level with no buffer free this frame is skipped on its sender.
+	for (uint32_t i = 0; i < ProxyPyramid::kLevelCount; ++i) {
+		if (!frame.proxies[i] || !ndi_proxy_senders_[i]) {
+			continue;
+		}
+		ndi_proxy_frames_[i].p_data = frame.proxies[i].Data();
+		ndi_proxy_frames_[i].timecode = ndi_video_frame_.timecode;
+		ndiLib_v5_->send_send_video_async_v2(ndi_proxy_senders_[i], &ndi_proxy_frames_[i]);
+		sentProxies_[i] = std::move(frame.proxies[i]);
+	}
+}
 
-	while (true) {
+// A null send waits until NDI has finished with the last frame.
+void CameraSender::Flush() {
+	ndiLib_v5_->send_send_video_async_v2(ndi_sender_, NULL);
+	for (NDIlib_send_instance_t proxySender : ndi_proxy_senders_) {
+		if (proxySender) {
+			ndiLib_v5_->send_send_video_async_v2(proxySender, NULL);
+		}
+	}
+	sentFrame_.Reset();
+	for (FrameRef& proxy : sentProxies_) {
+		proxy.Reset();
+	}
+}
 
-		streamIndex = 0;
-		flags = 0;
-		timestamp = 0;
+void WebcamApp::WriteTrace() {
+	if (config_.tracePath.empty() || !FrameTracer::Instance().Enabled()) {
+		return;
+	}
+	if (FrameTracer::Instance().WriteJson(config_.tracePath.c_str())) {
+		std::cout << "Wrote trace to " << config_.tracePath << std::endl;
+	}
+	else {
+		std::cerr << "Failed to write trace to " << config_.tracePath << std::endl;
+	}
+}
 
+// F12 stops every camera, F11 writes the trace so far.
+void WebcamApp::Run() {
+	bool traceKeyDown = false;
+	cameras_.Run([&]() {
 		if (GetAsyncKeyState(VK_F12)) {
-			break;
+			cameras_.Stop();
 		}
 
-		HRESULT hr = sourceReader->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &streamIndex, &flags, &timestamp, sample.GetAddressOf());
-		if (FAILED(hr)) {
-			std::cerr << "Failed to read video sample." << std::endl;
-			break;
+		const bool traceKey = (GetAsyncKeyState(VK_F11) & 0x8000) != 0;
+		if (traceKey && !traceKeyDown) {
+			WriteTrace();
 		}
+		traceKeyDown = traceKey;
+	});
+	WriteTrace();
+}
 
-		if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
-			std::cout << "End of stream." << std::endl;
-			break;
-		}
-
-		if (sample) {
-
-			hr = sample->ConvertToContiguousBuffer(buffer.GetAddressOf());
-			if (FAILED(hr)) {
-				std::cerr << "Failed to convert sample to contiguous buffer." << std::endl;
-				break;
-			}
-
-			hr = buffer.As(&pBuffer2D2);
-			if (SUCCEEDED(hr)) {
-
-				hr = pBuffer2D2->Lock2DSize(MF2DBuffer_LockFlags_Read, &srcData, &pitch, &pScanline0, &currentLength);
-
-				if (FAILED(hr)) {
-					std::cerr << "Failed to convert sample to contiguous buffer (2d2)." << std::endl;
-					pBuffer2D2.Reset();
-					break;
-				}
-
-				std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
-
-				if (useBuffer0) {
-					YUY2ToUYVYWithPitch(srcData, buffer1_, width_, height_, pitch);
-					ndi_video_frame_.p_data = buffer2_;
-				}
-				else {
-					YUY2ToUYVYWithPitch(srcData, buffer2_, width_, height_, pitch);
-					ndi_video_frame_.p_data = buffer1_;
-				}
-
-				std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
-				std::chrono::duration<double> duration = endTime - startTime;
-				durations[currentResultIndex] = duration.count();
-				currentResultIndex = (currentResultIndex + 1) % NUM_RESULTS;
-
-				ndiLib_v5_->send_send_video_async_v2(ndi_sender_, &ndi_video_frame_);
-
-				pBuffer2D2->Unlock2D();
-
-				srcData = nullptr;
+// Run() has flushed every sender and released every output frame.
+void WebcamApp::Cleanup() {
+	for (std::unique_ptr<CameraSender>& sender : senders_) {
+		sender->Cleanup();
+	}
+	ndiLib_v5_->destroy();
+	MFShutdown();
+}
 
-				pBuffer2D2.Reset();
-			}
+bool ParsePixelFormat(const char* name, PixelFormat& format) {
+	for (PixelFormat candidate : { PixelFormat::UYVY, PixelFormat::NV12, PixelFormat::I420,
+		PixelFormat::BGRA, PixelFormat::BGRX, PixelFormat::RGBA, PixelFormat::RGBX }) {
+		if (_stricmp(name, PixelFormatName(candidate)) == 0) {
+			format = candidate;
+			return true;
+		}
+	}
+	return false;
+}
 
-			useBuffer0 = !useBuffer0;
+bool ParseOrientation(const char* name, Orientation& orientation) {
+	for (Orientation candidate : kOrientations) {
+		if (_stricmp(name, OrientationName(candidate)) == 0) {
+			orientation = candidate;
+			return true;
+		}
+	}
+	return false;
+}
 
-			buffer.Reset();
-			sample.Reset();
+bool ParseHandoffPolicy(const char* name, HandoffPolicy& policy) {
+	for (HandoffPolicy candidate : kHandoffPolicies) {
+		if (_stricmp(name, HandoffPolicyName(candidate)) == 0) {
+			policy = candidate;
+			return true;
 		}
 	}
+	return false;
+}
 
-	float totalDuration = 0.0f;
-	for (size_t i = 0; i < NUM_RESULTS; ++i) {
-		totalDuration += (float)durations[i];
+// Formats the synthetic source can generate.
+bool ParseCaptureFormat(const char* name, PixelFormat& format) {
+	for (PixelFormat candidate : { PixelFormat::YUY2, PixelFormat::UYVY, PixelFormat::NV12 }) {
+		if (_stricmp(name, PixelFormatName(candidate)) == 0) {
+			format = candidate;
+			return true;
+		}
 	}
-	float averageDuration = totalDuration / NUM_RESULTS;
-	std::cout << "Average Duration: " << averageDuration * 1000 << " ms" << std::endl;
+	return false;
 }
 
-bool WebcamApp::CreateBuffers() {
-	buffer1_ = static_cast<uint8_t*>(_aligned_malloc(width_ * height_ * 2, 64));
-	buffer2_ = static_cast<uint8_t*>(_aligned_malloc(width_ * height_ * 2, 64));
+bool ParseCommandLine(int argc, char** argv, AppConfig& config) {
+	SyntheticCaptureConfig synthetic;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (arg == "--format" && value && ParsePixelFormat(value, config.conversion.outputFormat)) {
+			i++;
+		}
+		else if (arg == "--min-size" && value && sscanf_s(value, "%ux%u", &config.capture.minWidth, &config.capture.minHeight) == 2) {
+			i++;
+		}
+		else if (arg == "--min-fps" && value) {
+			config.capture.minFrameRate = atof(value);
+			i++;
+		}
+		else if (arg == "--chroma-filter" && value && (strcmp(value, "nearest") == 0 || strcmp(value, "linear") == 0)) {
+			config.conversion.chromaFilter = strcmp(value, "nearest") == 0 ? ChromaFilter::Nearest : ChromaFilter::Linear;
+			i++;
+		}
+		else if (arg == "--nt-threshold-mb" && value) {
+			config.conversion.nonTemporalThreshold = static_cast<size_t>(atof(value) * 1024 * 1024);
+			i++;
+		}
+		else if (arg == "--output-size" && value && sscanf_s(value, "%ux%u", &config.conversion.outputWidth, &config.conversion.outputHeight) == 2) {
+			i++;
+		}
+		else if (arg == "--crop" && value && sscanf_s(value, "%lf,%lf,%lf,%lf", &config.conversion.crop.x, &config.conversion.crop.y, &config.conversion.crop.width, &config.conversion.crop.height) == 4) {
+			i++;
+		}
+		else if (arg == "--scale-filter" && value && (strcmp(value, "bilinear") == 0 || strcmp(value, "bicubic") == 0)) {
+			config.conversion.scaleFilter = strcmp(value, "bicubic") == 0 ? ScaleFilter::Bicubic : ScaleFilter::Bilinear;
+			i++;
+		}
+		else if (arg == "--ptz-demo") {
+			config.conversion.ptzDemo = true;
+		}
+		else if (arg == "--proxies") {
+			config.conversion.proxies = true;
+		}
+		else if (arg == "--orientation" && value && ParseOrientation(value, config.conversion.orientation)) {
+			i++;
+		}
+		else if (arg == "--capture-slots" && value && atoi(value) > 0) {
+			config.pipeline.captureSlots = static_cast<uint32_t>(atoi(value));
+			i++;
+		}
+		else if (arg == "--handoff" && value && ParseHandoffPolicy(value, config.pipeline.captureHandoff)) {
+			i++;
+		}
+		else if (arg == "--trace" && value) {
+			config.tracePath = value;
+			i++;
+		}
+		else if (arg == "--pool-depth" && value && atoi(value) >= 2) {
+			config.pipeline.poolDepth = static_cast<uint32_t>(atoi(value));
+			i++;
+		}
+		else if (arg == "--pace") {
+			config.pipeline.pace = true;
+		}
+		else if (arg == "--jitter-buffer-ms" && value && atof(value) >= 0.0) {
+			config.pipeline.jitterBufferMs = atof(value);
+			i++;
+		}
+		else if (arg == "--synthetic" && value
+			&& sscanf_s(value, "%ux%u@%u", &synthetic.width, &synthetic.height, &synthetic.frameRateNumerator) == 3) {
+			config.synthetic.push_back(synthetic);
+			i++;
+		}
+		else if (arg == "--synthetic-format" && value && ParseCaptureFormat(value, config.syntheticFormat)) {
+			i++;
+		}
+		else if (arg == "--device" && value && strcmp(value, "all") == 0) {
+			config.allDevices = true;
+			i++;
+		}
+		else if (arg == "--device" && value && isdigit(static_cast<unsigned char>(value[0]))) {
+			const uint32_t device = static_cast<uint32_t>(atoi(value));
+			if (std::find(config.devices.begin(), config.devices.end(), device) == config.devices.end()) {
+				config.devices.push_back(device);
+			}
+			i++;
+		}
+		else if (arg == "--workers" && value && atoi(value) >= 0) {
+			config.cameras.workers = static_cast<unsigned>(atoi(value));
+			i++;
+		}
+		else if (arg == "--texture" && value && ParsePixelFormat(value, config.textureFormat) && D3D11TextureSink::Supports(config.textureFormat)) {
+			i++;
+		}
+		else if (arg == "--texture-queue" && value && atoi(value) >= 0) {
+			config.textureQueue.depth = static_cast<uint32_t>(atoi(value));
+			i++;
+		}
+		else if (arg == "--texture-handoff" && value && ParseHandoffPolicy(value, config.textureQueue.policy)) {
+			i++;
+		}
+		else if (arg == "--record" && value) {
+			config.record.directory = value;
+			i++;
+		}
+		else if (arg == "--record-segment-mb" && value && atoi(value) > 0) {
+			config.record.segmentBytes = static_cast<uint64_t>(atoi(value)) << 20;
+			i++;
+		}
+		else if (arg == "--record-segment-s" && value && atof(value) >= 0.0) {
+			config.record.segmentSeconds = atof(value);
+			i++;
+		}
+		else if (arg == "--record-queue" && value && atoi(value) > 0) {
+			config.recordQueue.depth = static_cast<uint32_t>(atoi(value));
+			i++;
+		}
+		else if (arg == "--decoder-threads" && value) {
+			config.decoderThreads = static_cast<unsigned>(atoi(value));
+			i++;
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--format uyvy|nv12|i420|bgra|bgrx|rgba|rgbx] [--min-size WxH] [--min-fps N] [--device N|all]... [--workers N] [--decoder-threads N] [--synthetic WxH@FPS]... [--synthetic-format yuy2|uyvy|nv12] [--texture bgra|bgrx|rgba|rgbx] [--texture-queue N] [--texture-handoff latest|drop-oldest|drop-newest|block] [--record dir] [--record-segment-mb N] [--record-segment-s N] [--record-queue N] [--capture-slots N] [--handoff latest|drop-oldest|drop-newest|block] [--pool-depth N] [--pace] [--jitter-buffer-ms N] [--trace file.json] [--chroma-filter nearest|linear] [--nt-threshold-mb N]"
+				<< " [--output-size WxH] [--crop x,y,w,h] [--scale-filter bilinear|bicubic] [--ptz-demo] [--proxies]"
+				<< " [--orientation none|mirror|flip|rotate90|rotate180|rotate270|transpose|transverse]" << std::endl;
+			return false;
+		}
+	}
 	return true;
 }
 
-void WebcamApp::DestroyBuffers() {
-	if (buffer1_) {
-		std::cout << "Freed buffer 1" << std::endl;
-		_aligned_free(buffer1_);
-	}
-	if (buffer2_) {
-		std::cout << "Freed buffer 2" << std::endl;
-		_aligned_free(buffer2_);
+int main(int argc, char** argv) {
+	AppConfig config;
+	if (!ParseCommandLine(argc, argv, config)) {
+		return 1;
 	}
-}
 
-void WebcamApp::Cleanup() {
-	CleanupNDI();
-	DestroyBuffers();
-	MFShutdown();
-}
+	if (!config.tracePath.empty()) {
+		if (FRAME_TRACING) {
+			FrameTracer::Instance().Start();
+		}
+		else {
+			std::cerr << "Built without FRAME_TRACING=1; --trace is ignored." << std::endl;
+		}
+	}
 
-int main() {
-	WebcamApp app;
+	WebcamApp app(config);
 
 	if (!app.Initialize()) {
 		std::cerr << "Failed to initialize webcam application." << std::endl;
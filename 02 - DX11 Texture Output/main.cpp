@@ -1,6 +1,9 @@
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
 #endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
 #include <mfapi.h>
 #include <mfidl.h>
@@ -9,7 +12,17 @@
 #include <wrl/client.h>
 #include <iostream>
 #include <d3d11_4.h>
+#include <cstring>
 #include <string>
+#include <vector>
+
+#include "../common/ColorConvert.h"
+#include "../common/FrameHandle.h"
+#include "../common/FrameTracer.h"
+#include "../common/MediaNegotiation.h"
+#include "../common/MFFrameHandle.h"
+#include "../common/Orientation.h"
+#include "../common/SlotPool.h"
 
 #pragma comment(lib, "mf.lib")
 #pragma comment(lib, "mfplat.lib")
@@ -21,6 +34,8 @@ using Microsoft::WRL::ComPtr;
 
 class WebcamApp {
 public:
+	WebcamApp(PixelFormat outputFormat, Orientation orientation) : outputFormat_(outputFormat), orientation_(orientation) {}
+
 	bool Initialize();
 	void Run();
 	void Cleanup();
@@ -28,7 +43,9 @@ public:
 private:
 	bool SetupMediaFoundation();
 	bool SetupCapture();
+	bool NegotiateMediaType(PixelFormat sinkFormat);
 
+	bool SetupOrientation();
 	bool SetupD3D11();
 	bool SetupD3D11StagingTexture();
 	bool SetupD3D11SharedTexture();
@@ -43,6 +60,23 @@ private:
 
 	UINT width_{ 0 };
 	UINT height_{ 0 };
+	PixelFormat captureFormat_{ PixelFormat::Unknown };
+	NegotiationConstraints captureConstraints_;
+
+	// YUY2 textures take the captured frames as they are; the RGB formats are
+	// converted on the CPU straight into the mapped staging texture.
+	PixelFormat outputFormat_{ PixelFormat::YUY2 };
+	YUY2ToRGBRowFunc yuy2ToRGBRow_{ YUY2ToRGBRow_Scalar<true> };
+	YUVToRGBCoefficients rgbCoefficients_{};
+	BandPool convertPool_;
+
+	// Applied on the CPU while writing the mapped staging texture, which is
+	// then textureWidth_ x textureHeight_. Bottom-up YUY2 frames take the same
+	// path, as UpdateSubresource needs a positive pitch.
+	Orientation orientation_{ Orientation::Identity };
+	OrientationKernels orientationKernels_;
+	UINT textureWidth_{ 0 };
+	UINT textureHeight_{ 0 };
 
 };
 
@@ -63,6 +97,11 @@ bool WebcamApp::Initialize() {
 		return false;
 	}
 
+	if (!SetupOrientation()) {
+		std::cerr << "Failed to set up orientation." << std::endl;
+		return false;
+	}
+
 	if (!SetupD3D11StagingTexture()) {
 		std::cerr << "Failed to set up D3D11 staging texture." << std::endl;
 		return false;
@@ -113,6 +152,28 @@ void CleanupActivateArray(IMFActivate** activateArray, UINT32 count)
 	}
 }
 
+bool WebcamApp::SetupOrientation() {
+	if (orientation_ != Orientation::Identity && outputFormat_ != PixelFormat::YUY2) {
+		std::cerr << "Orientation needs YUY2 output, got " << PixelFormatName(outputFormat_) << "." << std::endl;
+		return false;
+	}
+	if (SwapsAxes(orientation_) && (height_ & 1) != 0) {
+		std::cerr << "Cannot " << OrientationName(orientation_) << " an odd height of " << height_ << "." << std::endl;
+		return false;
+	}
+
+	uint32_t textureWidth = 0, textureHeight = 0;
+	OrientedSize(orientation_, width_, height_, textureWidth, textureHeight);
+	textureWidth_ = textureWidth;
+	textureHeight_ = textureHeight;
+	orientationKernels_ = GetOrientationKernels(ActiveSimdLevel(), PixelFormat::YUY2, PixelFormat::YUY2);
+
+	if (orientation_ != Orientation::Identity) {
+		std::cout << "Applying " << OrientationName(orientation_) << ", texture " << textureWidth_ << "x" << textureHeight_ << "." << std::endl;
+	}
+	return true;
+}
+
 bool WebcamApp::SetupD3D11() {
 	D3D_FEATURE_LEVEL featureLevels[] = { D3D_FEATURE_LEVEL_11_0, D3D_FEATURE_LEVEL_11_1 };
 	UINT creationFlags = D3D11_CREATE_DEVICE_SINGLETHREADED;
@@ -143,6 +204,104 @@ bool WebcamApp::SetupD3D11() {
 	return true;
 }
 
+PixelFormat PixelFormatFromSubtype(const GUID& subtype) {
+	if (subtype == MFVideoFormat_YUY2) return PixelFormat::YUY2;
+	if (subtype == MFVideoFormat_UYVY) return PixelFormat::UYVY;
+	if (subtype == MFVideoFormat_NV12) return PixelFormat::NV12;
+	if (subtype == MFVideoFormat_I420) return PixelFormat::I420;
+	if (subtype == MFVideoFormat_MJPG) return PixelFormat::MJPG;
+	if (subtype == MFVideoFormat_RGB32) return PixelFormat::RGB32;
+	return PixelFormat::Unknown;
+}
+
+// Colorimetry of a native media type, falling back to the usual defaults for
+// the format and size when the camera does not say.
+YUVColorimetry ColorimetryFromMediaType(IMFMediaType* mediaType, PixelFormat format, UINT32 height) {
+	YUVColorimetry colorimetry = DefaultColorimetry(format, height);
+
+	UINT32 matrix = 0;
+	if (SUCCEEDED(mediaType->GetUINT32(MF_MT_YUV_MATRIX, &matrix))) {
+		if (matrix == MFVideoTransferMatrix_BT601) colorimetry.matrix = YUVMatrix::BT601;
+		if (matrix == MFVideoTransferMatrix_BT709) colorimetry.matrix = YUVMatrix::BT709;
+	}
+
+	UINT32 range = 0;
+	if (SUCCEEDED(mediaType->GetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, &range))) {
+		if (range == MFNominalRange_0_255) colorimetry.range = YUVRange::Full;
+		if (range == MFNominalRange_16_235) colorimetry.range = YUVRange::Limited;
+	}
+
+	return colorimetry;
+}
+
+bool WebcamApp::NegotiateMediaType(PixelFormat sinkFormat) {
+	std::vector<MediaTypeCandidate> candidates;
+	std::vector<ComPtr<IMFMediaType>> mediaTypes;
+
+	for (DWORD i = 0; ; i++) {
+		ComPtr<IMFMediaType> mediaType;
+		HRESULT hr = sourceReader->GetNativeMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, i, &mediaType);
+		if (hr == MF_E_NO_MORE_TYPES) {
+			break;
+		}
+		if (FAILED(hr)) {
+			std::cerr << "Failed to get native media type " << i << "." << std::endl;
+			return false;
+		}
+
+		GUID subtype;
+		MediaTypeCandidate candidate;
+		candidate.index = i;
+
+		if (FAILED(mediaType->GetGUID(MF_MT_SUBTYPE, &subtype)) ||
+			FAILED(MFGetAttributeSize(mediaType.Get(), MF_MT_FRAME_SIZE, &candidate.width, &candidate.height))) {
+			continue;
+		}
+
+		candidate.format = PixelFormatFromSubtype(subtype);
+		MFGetAttributeRatio(mediaType.Get(), MF_MT_FRAME_RATE, &candidate.frameRateNumerator, &candidate.frameRateDenominator);
+
+		candidates.push_back(candidate);
+		mediaTypes.push_back(mediaType);
+	}
+
+	NegotiationResult result = SelectMediaType(candidates, sinkFormat, captureConstraints_);
+	if (result.selected < 0) {
+		std::cerr << "None of the " << candidates.size() << " native media types can be converted to " << PixelFormatName(sinkFormat) << "." << std::endl;
+		return false;
+	}
+
+	const MediaTypeCandidate& chosen = candidates[result.selected];
+	if (!result.meetsConstraints) {
+		std::cerr << "No native media type meets " << captureConstraints_.minWidth << "x" << captureConstraints_.minHeight
+			<< " @ " << captureConstraints_.minFrameRate << " fps, using the closest one." << std::endl;
+	}
+
+	std::cout << "Selected native media type " << chosen.index << " of " << candidates.size() << ": "
+		<< PixelFormatName(chosen.format) << " " << chosen.width << "x" << chosen.height
+		<< " @ " << chosen.FrameRate() << " fps" << std::endl;
+
+	HRESULT hr = sourceReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, mediaTypes[result.selected].Get());
+	if (FAILED(hr)) {
+		std::cerr << "Failed to set video output format" << std::endl;
+		return false;
+	}
+
+	width_ = chosen.width;
+	height_ = chosen.height;
+	captureFormat_ = chosen.format;
+
+	if (IsRGBFormat(outputFormat_)) {
+		const YUVColorimetry colorimetry = ColorimetryFromMediaType(mediaTypes[result.selected].Get(), chosen.format, chosen.height);
+		rgbCoefficients_ = MakeYUVToRGBCoefficients(colorimetry);
+		yuy2ToRGBRow_ = GetYUY2ToRGBRow(ActiveSimdLevel(), outputFormat_);
+		std::cout << "Converting to " << PixelFormatName(outputFormat_) << " with " << YUVMatrixName(colorimetry.matrix) << " "
+			<< YUVRangeName(colorimetry.range) << " range, " << SimdLevelName(ActiveSimdLevel()) << " kernels." << std::endl;
+	}
+
+	return true;
+}
+
 bool WebcamApp::SetupCapture() {
 	ComPtr<IMFAttributes> attributes;
 	HRESULT hr = MFCreateAttributes(&attributes, 1);
@@ -197,30 +356,7 @@ bool WebcamApp::SetupCapture() {
 
 	CleanupActivateArray(activateArray, count);
 
-	ComPtr<IMFMediaType> mediaType;
-	hr = sourceReader->GetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, &mediaType);
-	if (FAILED(hr)) {
-		std::cerr << "Failed to get current media type." << std::endl;
-		return false;
-	}
-
-	UINT32 width, height;
-	hr = MFGetAttributeSize(mediaType.Get(), MF_MT_FRAME_SIZE, &width, &height);
-	if (FAILED(hr)) {
-		std::cerr << "Failed to get video frame size." << std::endl;
-		return false;
-	}
-
-	GUID format;
-	hr = mediaType->GetGUID(MF_MT_SUBTYPE, &format);
-	if (FAILED(hr)) {
-		std::cerr << "Failed to get format." << std::endl;
-		return false;
-	}
-
-	hr = sourceReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, mediaType.Get());
-	if (FAILED(hr)) {
-		std::cerr << "Failed to set video output format" << std::endl;
+	if (!NegotiateMediaType(PixelFormat::YUY2)) {
 		return false;
 	}
 
@@ -230,18 +366,27 @@ bool WebcamApp::SetupCapture() {
 		return false;
 	}
 
-	width_ = width;
-	height_ = height;
-
 	return true;
 }
 
+// RGBX has no DXGI format of its own; the X byte is written as 255, so the
+// RGBA texture format holds it unchanged.
+DXGI_FORMAT DXGIFormatFor(PixelFormat format) {
+	switch (format) {
+	case PixelFormat::BGRA: return DXGI_FORMAT_B8G8R8A8_UNORM;
+	case PixelFormat::BGRX: return DXGI_FORMAT_B8G8R8X8_UNORM;
+	case PixelFormat::RGBA:
+	case PixelFormat::RGBX: return DXGI_FORMAT_R8G8B8A8_UNORM;
+	default: return DXGI_FORMAT_YUY2;
+	}
+}
+
 bool WebcamApp::SetupD3D11StagingTexture() {
 
-	DXGI_FORMAT dxgiFormat = DXGI_FORMAT_YUY2;
+	DXGI_FORMAT dxgiFormat = DXGIFormatFor(outputFormat_);
 	D3D11_TEXTURE2D_DESC1 textureDesc = {};
-	textureDesc.Width = width_;
-	textureDesc.Height = height_;
+	textureDesc.Width = textureWidth_;
+	textureDesc.Height = textureHeight_;
 	textureDesc.MipLevels = 1;
 	textureDesc.ArraySize = 1;
 	textureDesc.Format = dxgiFormat;
@@ -262,10 +407,10 @@ bool WebcamApp::SetupD3D11StagingTexture() {
 }
 
 bool WebcamApp::SetupD3D11SharedTexture() {
-	DXGI_FORMAT dxgiFormat = DXGI_FORMAT_YUY2;
+	DXGI_FORMAT dxgiFormat = DXGIFormatFor(outputFormat_);
 	D3D11_TEXTURE2D_DESC1 textureDesc = {};
-	textureDesc.Width = width_;
-	textureDesc.Height = height_;
+	textureDesc.Width = textureWidth_;
+	textureDesc.Height = textureHeight_;
 	textureDesc.MipLevels = 1;
 	textureDesc.ArraySize = 1;
 	textureDesc.Format = dxgiFormat;
@@ -311,27 +456,21 @@ HANDLE WebcamApp::GetSharedTextureHandle() {
 	std::string handleStr = std::to_string((long long)sharedHandle);
 
 	std::cout << "Shared texture handle is " << sharedHandle << " | " << handleStr << std::endl;;
-	std::cout << "Texture width/height is " << width_ << "/" << height_ << std::endl;
+	std::cout << "Texture width/height is " << textureWidth_ << "/" << textureHeight_ << std::endl;
 
 	return sharedHandle;
 
 }
 
 void WebcamApp::Run() {
-	bool useBuffer0 = true;
-
 	DWORD streamIndex, flags;
 	LONGLONG timestamp;
-	BYTE* srcData = nullptr;
-	DWORD currentLength;
-
-	ComPtr<IMF2DBuffer2> pBuffer2D2;
-	ComPtr<IMFMediaBuffer> buffer;
 
 	ComPtr<IMFSample> sample;
-
-	BYTE* pScanline0 = nullptr;
-	LONG pitch;
+	// One sample is read and locked at a time.
+	SlotPool samples(SlotPool::SlotBytesFor<MFSampleFrameSource>(), 1);
+	FrameHandleFactory frameHandles(captureFormat_, width_, height_, 1);
+	uint64_t frameIndex = 0;
 
 	GetSharedTextureHandle();
 
@@ -353,7 +492,11 @@ void WebcamApp::Run() {
 			break;
 		}
 
-		HRESULT hr = sourceReader->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &streamIndex, &flags, &timestamp, sample.GetAddressOf());
+		HRESULT hr;
+		{
+			TRACE_SPAN("ReadSample", frameIndex);
+			hr = sourceReader->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &streamIndex, &flags, &timestamp, sample.GetAddressOf());
+		}
 		if (FAILED(hr)) {
 			std::cerr << "Failed to read video sample." << std::endl;
 			break;
@@ -365,54 +508,107 @@ void WebcamApp::Run() {
 		}
 
 		if (sample) {
-
-			hr = sample->ConvertToContiguousBuffer(buffer.GetAddressOf());
-			if (FAILED(hr)) {
-				std::cerr << "Failed to convert sample to contiguous buffer." << std::endl;
+			auto sampleSource = std::allocate_shared<MFSampleFrameSource>(SlotAllocator<MFSampleFrameSource>(samples), sample.Get(), captureFormat_ == PixelFormat::MJPG);
+			FrameHandle source = frameHandles.Lock(sampleSource);
+			if (!source) {
+				std::cerr << "Failed to lock the captured frame." << std::endl;
 				break;
 			}
 
-			hr = buffer.As(&pBuffer2D2);
-			if (SUCCEEDED(hr)) {
-
-				hr = pBuffer2D2->Lock2DSize(MF2DBuffer_LockFlags_Read, &srcData, &pitch, &pScanline0, &currentLength);
-
-				if (FAILED(hr)) {
-					std::cerr << "Failed to convert sample to contiguous buffer (2d2)." << std::endl;
-					pBuffer2D2.Reset();
-					break;
+			const uint8_t* srcData = source->data[0];
+			const ptrdiff_t pitch = source->pitch[0];
+
+			if (IsRGBFormat(outputFormat_)) {
+				TRACE_SPAN("convert", frameIndex);
+				D3D11_MAPPED_SUBRESOURCE mapped;
+				hr = context->Map(webcamStagingTexture.Get(), 0, D3D11_MAP_WRITE, 0, &mapped);
+				if (SUCCEEDED(hr)) {
+					YUY2ToRGBWithPitch(convertPool_, yuy2ToRGBRow_, rgbCoefficients_, srcData, pitch,
+						static_cast<uint8_t*>(mapped.pData), mapped.RowPitch, width_, height_);
+					context->Unmap(webcamStagingTexture.Get(), 0);
 				}
+			}
+			else if (orientation_ != Orientation::Identity || pitch < 0) {
+				TRACE_SPAN("convert", frameIndex);
+				D3D11_MAPPED_SUBRESOURCE mapped;
+				hr = context->Map(webcamStagingTexture.Get(), 0, D3D11_MAP_WRITE, 0, &mapped);
+				if (SUCCEEDED(hr)) {
+					OrientPacked422WithPitch(convertPool_, orientationKernels_, orientation_, srcData, pitch, width_, height_,
+						static_cast<uint8_t*>(mapped.pData), static_cast<ptrdiff_t>(mapped.RowPitch));
+					context->Unmap(webcamStagingTexture.Get(), 0);
+				}
+			}
+			else {
+				TRACE_SPAN("UpdateSubresource", frameIndex);
+				context->UpdateSubresource(webcamStagingTexture.Get(), 0, &box, srcData, static_cast<UINT>(pitch), 0);
+			}
 
-				context->UpdateSubresource(webcamStagingTexture.Get(), 0, &box, pScanline0, pitch, 0);
-
-				pBuffer2D2->Unlock2D();
+			source.reset();
+			sample.Reset();
 
+			{
+				TRACE_SPAN("CopyResource", frameIndex);
 				context->CopyResource(webcamSharedTexture.Get(), webcamStagingTexture.Get());
-
-				srcData = nullptr;
-
-				pBuffer2D2.Reset();
 			}
-
-			useBuffer0 = !useBuffer0;
-
-			buffer.Reset();
-			sample.Reset();
+			++frameIndex;
 		}
 	}
 
-	pBuffer2D2.Reset();
-	buffer.Reset();
-	sample.Reset();
-	srcData = nullptr;
+	const FrameHandleStats stats = frameHandles.Stats();
+	std::cout << "Capture buffers: " << stats.direct << " read in place, " << stats.copied << " copied (fragmented), "
+		<< stats.failures << " failed to lock" << std::endl;
 }
 
 void WebcamApp::Cleanup() {
 	MFShutdown();
 }
 
-int main() {
-	WebcamApp app;
+int main(int argc, char** argv) {
+	PixelFormat outputFormat = PixelFormat::YUY2;
+	Orientation orientation = Orientation::Identity;
+	const char* tracePath = nullptr;
+	for (int i = 1; i < argc; i++) {
+		bool known = false;
+		if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+			for (PixelFormat candidate : { PixelFormat::YUY2, PixelFormat::BGRA, PixelFormat::BGRX, PixelFormat::RGBA, PixelFormat::RGBX }) {
+				if (_stricmp(argv[i + 1], PixelFormatName(candidate)) == 0) {
+					outputFormat = candidate;
+					known = true;
+				}
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "--orientation") == 0 && i + 1 < argc) {
+			for (Orientation candidate : kOrientations) {
+				if (_stricmp(argv[i + 1], OrientationName(candidate)) == 0) {
+					orientation = candidate;
+					known = true;
+				}
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			tracePath = argv[++i];
+			known = true;
+		}
+		if (!known) {
+			std::cerr << "Usage: " << argv[0] << " [--format yuy2|bgra|bgrx|rgba|rgbx]"
+				<< " [--orientation none|mirror|flip|rotate90|rotate180|rotate270|transpose|transverse] [--trace file.json]" << std::endl;
+			return 1;
+		}
+	}
+
+	// Spans are only recorded by builds with FRAME_TRACING=1.
+	if (tracePath) {
+		if (FRAME_TRACING) {
+			FrameTracer::Instance().Start();
+		}
+		else {
+			std::cerr << "Built without FRAME_TRACING=1; --trace is ignored." << std::endl;
+		}
+	}
+
+	WebcamApp app(outputFormat, orientation);
 
 	if (!app.Initialize()) {
 		std::cerr << "Failed to initialize webcam application." << std::endl;
@@ -422,5 +618,9 @@ int main() {
 	app.Run();
 	app.Cleanup();
 
+	if (tracePath && FrameTracer::Instance().Enabled() && FrameTracer::Instance().WriteJson(tracePath)) {
+		std::cout << "Wrote trace to " << tracePath << std::endl;
+	}
+
 	return 0;
 }
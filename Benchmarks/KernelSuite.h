@@ -0,0 +1,457 @@
+#pragma once
+
+// Kernel suite: every frame conversion in common/ over a grid of resolutions
+// (720p to 8K), source pitch paddings, thread counts and cache states.
+//
+//   benchmarks --suite [--json <file>] [--seconds S] [--threads N[,N...]]
+//
+// Each thread count first gets a STREAM-style copy and triad measurement on
+// the same BandPool, and every result is reported as ns/frame, GB/s and the
+// percentage of that copy bandwidth. GB/s counts the bytes a frame reads plus
+// the bytes it writes, with no write-allocate traffic, which is how STREAM
+// counts too, so %STREAM is how close a kernel gets to the memory roofline.
+//
+// Hot runs convert the same frame repeatedly, so whatever fits stays cached
+// and can go past 100%. Cold runs rotate through enough source/destination
+// pairs to exceed kColdWorkingSetBytes, so every frame comes from DRAM.
+//
+// --json writes every result for diffing across releases.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/BandPool.h"
+#include "../common/ColorConvert.h"
+#include "../common/CropScale.h"
+#include "../common/FrameConvert.h"
+#include "../common/Orientation.h"
+#include "../common/PixelConvert.h"
+#include "../common/PixelFormat.h"
+#include "../common/ProxyPyramid.h"
+
+struct SuiteResolution {
+	const char* name;
+	uint32_t width;
+	uint32_t height;
+};
+
+constexpr SuiteResolution kSuiteResolutions[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "1440p", 2560, 1440 },
+	{ "2160p", 3840, 2160 },
+	{ "4320p", 7680, 4320 },
+};
+
+// Bytes added to every source row: none, and one cache line.
+constexpr uint32_t kSuitePaddings[] = { 0, 64 };
+
+// Well past the LLC of current desktop parts.
+constexpr size_t kColdWorkingSetBytes = 256 * 1024 * 1024;
+
+//
+// STREAM-style bandwidth on a BandPool
+//
+
+struct StreamBandwidth {
+	double copyGBs{ 0.0 };  // c[i] = a[i], 16 bytes per element
+	double triadGBs{ 0.0 }; // a[i] = b[i] + s * c[i], 24 bytes per element
+};
+
+// Three arrays of 128 MiB each, and the best of the repetitions, as STREAM
+// reports.
+inline StreamBandwidth MeasureStreamBandwidth(BandPool& pool, double minSeconds) {
+	constexpr uint32_t kElements = 16 * 1024 * 1024;
+	constexpr uint32_t kBandElements = 32 * 1024;
+	std::vector<double> a(kElements, 1.0);
+	std::vector<double> b(kElements, 2.0);
+	std::vector<double> c(kElements, 0.0);
+	const double scalar = 3.0;
+
+	auto best = [&](auto&& pass) {
+		pass();
+		double fastest = 1e30;
+		std::chrono::duration<double> total{};
+		do {
+			const auto start = std::chrono::steady_clock::now();
+			pass();
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			fastest = (std::min)(fastest, elapsed.count());
+			total += elapsed;
+		} while (total.count() < minSeconds);
+		return fastest;
+	};
+
+	StreamBandwidth bandwidth;
+	const double copySeconds = best([&]() {
+		pool.Run(kElements, kBandElements, [&](uint32_t first, uint32_t last) {
+			for (uint32_t i = first; i < last; ++i) {
+				c[i] = a[i];
+			}
+		});
+	});
+	const double triadSeconds = best([&]() {
+		pool.Run(kElements, kBandElements, [&](uint32_t first, uint32_t last) {
+			for (uint32_t i = first; i < last; ++i) {
+				a[i] = b[i] + scalar * c[i];
+			}
+		});
+	});
+	bandwidth.copyGBs = 16.0 * kElements / copySeconds / 1e9;
+	bandwidth.triadGBs = 24.0 * kElements / triadSeconds / 1e9;
+	return bandwidth;
+}
+
+//
+// Kernels
+//
+
+// One kernel prepared for a frame size and source pitch.
+struct SuiteCase {
+	size_t srcBytes{ 0 };     // allocated per source frame, padding included
+	size_t destBytes{ 0 };
+	size_t trafficBytes{ 0 }; // read plus written per frame, padding excluded
+	std::function<void(BandPool&, const uint8_t*, uint8_t*)> convert;
+};
+
+struct SuiteKernel {
+	const char* name;
+	SuiteCase (*make)(uint32_t width, uint32_t height, uint32_t padding);
+};
+
+inline SuiteCase PackedSuiteCase(uint32_t width, uint32_t height, uint32_t padding, size_t destBytes) {
+	SuiteCase c;
+	c.srcBytes = (static_cast<size_t>(width) * 2 + padding) * height;
+	c.destBytes = destBytes;
+	c.trafficBytes = static_cast<size_t>(width) * 2 * height + destBytes;
+	return c;
+}
+
+inline ptrdiff_t PackedSuitePitch(uint32_t width, uint32_t padding) {
+	return static_cast<ptrdiff_t>(width) * 2 + padding;
+}
+
+// YUY2 to the packed, planar and RGB outputs the NDI sender supports.
+template <PixelFormat kFormat>
+inline SuiteCase MakeYUY2Case(uint32_t width, uint32_t height, uint32_t padding) {
+	const SimdLevel level = ActiveSimdLevel();
+	const FrameLayout layout = PackedFrameLayout(kFormat, width, height);
+	const ptrdiff_t pitch = PackedSuitePitch(width, padding);
+	SuiteCase c = PackedSuiteCase(width, height, padding, layout.totalBytes);
+
+	switch (kFormat) {
+	case PixelFormat::NV12:
+		c.convert = [=, row = GetYUY2ToNV12Row(level)](BandPool& pool, const uint8_t* src, uint8_t* dst) {
+			YUY2ToNV12WithPitch(pool, row, src, pitch, layout, dst);
+		};
+		break;
+	case PixelFormat::I420:
+		c.convert = [=, row = GetYUY2ToI420Row(level)](BandPool& pool, const uint8_t* src, uint8_t* dst) {
+			YUY2ToI420WithPitch(pool, row, src, pitch, layout, dst);
+		};
+		break;
+	case PixelFormat::BGRA:
+	case PixelFormat::RGBA:
+		c.convert = [=, row = GetYUY2ToRGBRow(level, kFormat), coefficients = MakeYUVToRGBCoefficients({ YUVMatrix::BT709, YUVRange::Limited })](
+			BandPool& pool, const uint8_t* src, uint8_t* dst) {
+			YUY2ToRGBWithPitch(pool, row, coefficients, src, pitch, dst, layout.planePitch[0], width, height);
+		};
+		break;
+	default:
+		c.convert = [=, row = GetYUY2ToUYVYRow(level)](BandPool& pool, const uint8_t* src, uint8_t* dst) {
+			YUY2ToUYVYWithPitch(pool, row, src, dst, width, height, pitch);
+		};
+		break;
+	}
+	return c;
+}
+
+inline SuiteCase MakeYUY2ToUYVYNonTemporalCase(uint32_t width, uint32_t height, uint32_t padding) {
+	const ptrdiff_t pitch = PackedSuitePitch(width, padding);
+	SuiteCase c = PackedSuiteCase(width, height, padding, static_cast<size_t>(width) * 2 * height);
+	c.convert = [=, row = GetYUY2ToUYVYRowNonTemporal(ActiveSimdLevel())](BandPool& pool, const uint8_t* src, uint8_t* dst) {
+		YUY2ToUYVYWithPitch(pool, row, src, dst, width, height, pitch);
+	};
+	return c;
+}
+
+inline SuiteCase MakeUYVYCopyCase(uint32_t width, uint32_t height, uint32_t padding) {
+	const ptrdiff_t pitch = PackedSuitePitch(width, padding);
+	SuiteCase c = PackedSuiteCase(width, height, padding, static_cast<size_t>(width) * 2 * height);
+	c.convert = [=](BandPool& pool, const uint8_t* src, uint8_t* dst) {
+		CopyRowsWithPitch(pool, src, dst, static_cast<size_t>(width) * 2, height, pitch);
+	};
+	return c;
+}
+
+// Y rows then UV rows, both with the padded pitch, as Media Foundation lays
+// out NV12.
+template <ChromaFilter kFilter>
+inline SuiteCase MakeNV12ToUYVYCase(uint32_t width, uint32_t height, uint32_t padding) {
+	const ptrdiff_t pitch = static_cast<ptrdiff_t>(width) + padding;
+	const size_t destBytes = static_cast<size_t>(width) * 2 * height;
+	SuiteCase c;
+	c.srcBytes = static_cast<size_t>(pitch) * (height + height / 2);
+	c.destBytes = destBytes;
+	c.trafficBytes = static_cast<size_t>(width) * (height + height / 2) + destBytes;
+	c.convert = [=, row = GetNV12ToUYVYRow(ActiveSimdLevel(), kFilter)](BandPool& pool, const uint8_t* src, uint8_t* dst) {
+		NV12ToUYVYWithPitch(pool, row, src, pitch, src + pitch * height, pitch, dst, width, height);
+	};
+	return c;
+}
+
+// The whole frame scaled to half size; every source row is still read.
+template <ScaleFilter kFilter>
+inline SuiteCase MakeHalfScaleCase(uint32_t width, uint32_t height, uint32_t padding) {
+	const ptrdiff_t pitch = PackedSuitePitch(width, padding);
+	const uint32_t outputWidth = (width / 2) & ~1u;
+	const uint32_t outputHeight = height / 2;
+	SuiteCase c = PackedSuiteCase(width, height, padding, static_cast<size_t>(outputWidth) * 2 * outputHeight);
+	auto scaler = std::make_shared<CropScaler>(width, height, outputWidth, outputHeight, kFilter);
+	c.convert = [=](BandPool& pool, const uint8_t* src, uint8_t* dst) {
+		scaler->Convert(pool, src, pitch, dst);
+	};
+	return c;
+}
+
+// YUY2->UYVY with both proxy levels built in the band hook, as the NDI sender
+// runs it with --proxies.
+inline SuiteCase MakeProxiesCase(uint32_t width, uint32_t height, uint32_t padding) {
+	const ptrdiff_t pitch = PackedSuitePitch(width, padding);
+	SuiteCase c = PackedSuiteCase(width, height, padding, static_cast<size_t>(width) * 2 * height);
+	auto pyramid = std::make_shared<ProxyPyramid>(width, height);
+	const size_t halfBytes = pyramid->Layout(0).totalBytes;
+	for (uint32_t i = 0; i < ProxyPyramid::kLevelCount; ++i) {
+		c.trafficBytes += pyramid->Layout(i).totalBytes;
+	}
+	// Both levels in one buffer, the quarter after the half.
+	auto levels = std::make_shared<std::vector<uint8_t>>(halfBytes + pyramid->Layout(1).totalBytes);
+	c.convert = [=, row = GetYUY2ToUYVYRow(ActiveSimdLevel())](BandPool& pool, const uint8_t* src, uint8_t* dst) {
+		uint8_t* const outputs[ProxyPyramid::kLevelCount] = { levels->data(), levels->data() + halfBytes };
+		pyramid->SetOutputs(outputs);
+		YUY2ToUYVYWithPitch(pool, row, src, dst, width, height, pitch, [&](uint32_t firstRow, uint32_t lastRow) {
+			pyramid->ProcessBand(src, pitch, PixelFormat::YUY2, firstRow, lastRow);
+		});
+	};
+	return c;
+}
+
+template <Orientation kOrientation>
+inline SuiteCase MakeOrientationCase(uint32_t width, uint32_t height, uint32_t padding) {
+	const ptrdiff_t pitch = PackedSuitePitch(width, padding);
+	SuiteCase c = PackedSuiteCase(width, height, padding, static_cast<size_t>(width) * 2 * height);
+	uint32_t outputWidth = 0, outputHeight = 0;
+	OrientedSize(kOrientation, width, height, outputWidth, outputHeight);
+	const ptrdiff_t destPitch = static_cast<ptrdiff_t>(outputWidth) * 2;
+	c.convert = [=, kernels = GetOrientationKernels(ActiveSimdLevel(), PixelFormat::YUY2, PixelFormat::UYVY)](
+		BandPool& pool, const uint8_t* src, uint8_t* dst) {
+		OrientPacked422WithPitch(pool, kernels, kOrientation, src, pitch, width, height, dst, destPitch);
+	};
+	return c;
+}
+
+constexpr SuiteKernel kSuiteKernels[] = {
+	{ "yuy2>uyvy", MakeYUY2Case<PixelFormat::UYVY> },
+	{ "yuy2>uyvy nt", MakeYUY2ToUYVYNonTemporalCase },
+	{ "uyvy copy", MakeUYVYCopyCase },
+	{ "yuy2>nv12", MakeYUY2Case<PixelFormat::NV12> },
+	{ "yuy2>i420", MakeYUY2Case<PixelFormat::I420> },
+	{ "yuy2>bgra", MakeYUY2Case<PixelFormat::BGRA> },
+	{ "yuy2>rgba", MakeYUY2Case<PixelFormat::RGBA> },
+	{ "nv12>uyvy nearest", MakeNV12ToUYVYCase<ChromaFilter::Nearest> },
+	{ "nv12>uyvy linear", MakeNV12ToUYVYCase<ChromaFilter::Linear> },
+	{ "scale 1/2 bilinear", MakeHalfScaleCase<ScaleFilter::Bilinear> },
+	{ "scale 1/2 bicubic", MakeHalfScaleCase<ScaleFilter::Bicubic> },
+	{ "yuy2>uyvy+proxies", MakeProxiesCase },
+	{ "mirror", MakeOrientationCase<Orientation::Mirror> },
+	{ "rotate90", MakeOrientationCase<Orientation::Rotate90> },
+};
+
+//
+// Runner
+//
+
+struct SuiteResult {
+	const char* kernel;
+	const SuiteResolution* resolution;
+	uint32_t padding;
+	unsigned threads;
+	bool cold;
+	double secondsPerFrame;
+	size_t trafficBytes;
+	double streamCopyGBs;
+
+	double GBs() const { return trafficBytes / secondsPerFrame / 1e9; }
+	double StreamPercent() const { return GBs() / streamCopyGBs * 100.0; }
+};
+
+// Source and destination frames for one case: one pair for hot runs, enough
+// pairs for kColdWorkingSetBytes for cold runs.
+struct SuiteFrames {
+	std::vector<std::vector<uint8_t>> src;
+	std::vector<std::vector<uint8_t>> dst;
+
+	explicit SuiteFrames(const SuiteCase& c) {
+		const size_t pairBytes = c.srcBytes + c.destBytes;
+		const size_t count = (std::max<size_t>)(2, (kColdWorkingSetBytes + pairBytes - 1) / pairBytes);
+		uint32_t state = 1;
+		for (size_t i = 0; i < count; ++i) {
+			src.emplace_back(c.srcBytes);
+			for (auto& value : src.back()) {
+				state = state * 1664525u + 1013904223u;
+				value = static_cast<uint8_t>(state >> 24);
+			}
+			dst.emplace_back(c.destBytes, 0);
+		}
+	}
+};
+
+inline double MeasureSuiteCase(BandPool& pool, const SuiteCase& c, SuiteFrames& frames, bool cold, double minSeconds) {
+	const size_t count = cold ? frames.src.size() : 1;
+	for (size_t i = 0; i < count; ++i) {
+		c.convert(pool, frames.src[i].data(), frames.dst[i].data());
+	}
+
+	size_t done = 0;
+	const auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed{};
+	do {
+		const size_t i = done % count;
+		c.convert(pool, frames.src[i].data(), frames.dst[i].data());
+		++done;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < minSeconds);
+
+	return elapsed.count() / done;
+}
+
+inline bool WriteSuiteJson(const char* path, const std::vector<unsigned>& threadCounts, const std::vector<StreamBandwidth>& stream,
+	const std::vector<SuiteResult>& results, double minSeconds) {
+	std::ofstream out(path);
+	if (!out) {
+		return false;
+	}
+
+	out << std::setprecision(6);
+	out << "{\n";
+	out << "  \"simd\": \"" << SimdLevelName(ActiveSimdLevel()) << "\",\n";
+	out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+	out << "  \"seconds_per_case\": " << minSeconds << ",\n";
+	out << "  \"cold_working_set_bytes\": " << kColdWorkingSetBytes << ",\n";
+
+	out << "  \"stream\": [\n";
+	for (size_t i = 0; i < threadCounts.size(); ++i) {
+		out << "    { \"threads\": " << threadCounts[i] << ", \"copy_gbps\": " << stream[i].copyGBs
+			<< ", \"triad_gbps\": " << stream[i].triadGBs << " }" << (i + 1 < threadCounts.size() ? "," : "") << "\n";
+	}
+	out << "  ],\n";
+
+	out << "  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const SuiteResult& r = results[i];
+		out << "    { \"kernel\": \"" << r.kernel << "\", \"resolution\": \"" << r.resolution->name << "\""
+			<< ", \"width\": " << r.resolution->width << ", \"height\": " << r.resolution->height
+			<< ", \"padding\": " << r.padding << ", \"threads\": " << r.threads << ", \"cache\": \"" << (r.cold ? "cold" : "hot") << "\""
+			<< ", \"ns_per_frame\": " << r.secondsPerFrame * 1e9 << ", \"bytes_per_frame\": " << r.trafficBytes
+			<< ", \"gbps\": " << r.GBs() << ", \"stream_percent\": " << r.StreamPercent() << " }"
+			<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+	return static_cast<bool>(out);
+}
+
+// args are the arguments after --suite.
+inline int RunKernelSuite(int argc, char** argv) {
+	const char* jsonPath = nullptr;
+	double minSeconds = 0.1;
+	std::vector<unsigned> threadCounts;
+
+	for (int i = 0; i < argc; ++i) {
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (strcmp(argv[i], "--json") == 0 && value) {
+			jsonPath = value;
+			++i;
+		}
+		else if (strcmp(argv[i], "--seconds") == 0 && value) {
+			minSeconds = atof(value);
+			++i;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && value) {
+			char* end = nullptr;
+			for (const char* p = value; *p; p = *end == ',' ? end + 1 : end) {
+				threadCounts.push_back(static_cast<unsigned>(strtoul(p, &end, 10)));
+				if (end == p) {
+					break;
+				}
+			}
+			++i;
+		}
+		else {
+			std::cerr << "Usage: benchmarks --suite [--json <file>] [--seconds S] [--threads N[,N...]]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (threadCounts.empty()) {
+		threadCounts = { 1u, (std::max)(1u, std::thread::hardware_concurrency()) };
+	}
+	std::sort(threadCounts.begin(), threadCounts.end());
+	threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+	threadCounts.erase(std::remove(threadCounts.begin(), threadCounts.end(), 0u), threadCounts.end());
+
+	std::cout << "Kernel suite, " << SimdLevelName(ActiveSimdLevel()) << " kernels." << std::endl;
+
+	std::vector<std::unique_ptr<BandPool>> pools;
+	std::vector<StreamBandwidth> stream;
+	for (unsigned threads : threadCounts) {
+		pools.push_back(std::make_unique<BandPool>(threads));
+		stream.push_back(MeasureStreamBandwidth(*pools.back(), (std::max)(minSeconds, 0.5)));
+		std::cout << "stream " << std::setw(2) << threads << "T: copy " << std::fixed << std::setprecision(2) << stream.back().copyGBs
+			<< " GB/s, triad " << stream.back().triadGBs << " GB/s" << std::endl;
+	}
+
+	std::vector<SuiteResult> results;
+	for (const SuiteResolution& res : kSuiteResolutions) {
+		for (uint32_t padding : kSuitePaddings) {
+			for (const SuiteKernel& kernel : kSuiteKernels) {
+				const SuiteCase c = kernel.make(res.width, res.height, padding);
+				SuiteFrames frames(c);
+
+				for (size_t t = 0; t < threadCounts.size(); ++t) {
+					for (bool cold : { false, true }) {
+						SuiteResult r{ kernel.name, &res, padding, threadCounts[t], cold,
+							MeasureSuiteCase(*pools[t], c, frames, cold, minSeconds), c.trafficBytes, stream[t].copyGBs };
+						results.push_back(r);
+
+						std::cout << "suite " << std::setw(5) << res.name << " pad " << std::setw(2) << padding << " "
+							<< std::setw(2) << r.threads << "T " << (cold ? "cold" : "hot ") << " " << std::setw(18) << kernel.name << ": "
+							<< std::fixed << std::setprecision(0) << std::setw(10) << r.secondsPerFrame * 1e9 << " ns/frame "
+							<< std::setprecision(2) << std::setw(7) << r.GBs() << " GB/s " << std::setprecision(0) << std::setw(4)
+							<< r.StreamPercent() << "% STREAM" << std::endl;
+					}
+				}
+			}
+		}
+	}
+
+	if (jsonPath) {
+		if (!WriteSuiteJson(jsonPath, threadCounts, stream, results, minSeconds)) {
+			std::cerr << "Failed to write " << jsonPath << "." << std::endl;
+			return 1;
+		}
+		std::cout << "Wrote " << results.size() << " results to " << jsonPath << "." << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,428 @@
+#pragma once
+
+// MJPEG decode benchmark.
+//
+// Decodes a directory of captured JPEG frames into the pipeline's YCbCr output
+// formats, UYVY or NV12, the way frames of an MJPG camera are. Decoders sit
+// behind MJPEGDecoder (common/MJPEGDecoder.h):
+//
+//   libjpeg  The decoder the capture pipeline runs for MJPG cameras, in builds
+//            with MJPEG_LIBJPEG defined and linked with libjpeg-turbo (-ljpeg,
+//            jpeg.lib). Runs anywhere.
+//   mft      Windows only: the Media Foundation decoder MFT the source reader
+//            inserts for MJPG cameras when libjpeg is not built in. It decodes
+//            to YUY2, which the conversion row kernels repack into the output.
+//
+// Every frame is decoded into a FramePool buffer. With N threads, N frames are
+// in flight at once: each is a band of a BandPool run, with a decoder and a
+// buffer of its own. Reports decode latency percentiles, aggregate fps, fps
+// per thread and fps per core (frames per CPU second of the process).
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mftransform.h>
+#include <Mferror.h>
+#include <wrl/client.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../common/BandPool.h"
+#include "../common/FramePool.h"
+#include "../common/MJPEGDecoder.h"
+#include "../common/PixelConvert.h"
+#include "../common/PixelFormat.h"
+#include "PipelineBench.h"
+#include "PipelineChecks.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "mfplat.lib")
+#pragma comment(lib, "mfuuid.lib")
+#endif
+
+// Reads the frame size from the first SOF marker.
+inline bool ReadJpegSize(const std::vector<uint8_t>& data, uint32_t& width, uint32_t& height) {
+	size_t i = 2;
+	while (i + 9 < data.size()) {
+		if (data[i] != 0xFF) {
+			return false;
+		}
+
+		const uint8_t marker = data[i + 1];
+		const size_t length = (static_cast<size_t>(data[i + 2]) << 8) | data[i + 3];
+
+		const bool startOfFrame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+		if (startOfFrame) {
+			height = (static_cast<uint32_t>(data[i + 5]) << 8) | data[i + 6];
+			width = (static_cast<uint32_t>(data[i + 7]) << 8) | data[i + 8];
+			return width > 0 && height > 0;
+		}
+
+		i += 2 + length;
+	}
+	return false;
+}
+
+#ifdef _WIN32
+
+inline Microsoft::WRL::ComPtr<IMFTransform> CreateMJPEGDecoder(uint32_t width, uint32_t height) {
+	using Microsoft::WRL::ComPtr;
+
+	MFT_REGISTER_TYPE_INFO input{ MFMediaType_Video, MFVideoFormat_MJPG };
+	MFT_REGISTER_TYPE_INFO output{ MFMediaType_Video, MFVideoFormat_YUY2 };
+
+	IMFActivate** activateArray = nullptr;
+	UINT32 count = 0;
+	HRESULT hr = MFTEnumEx(MFT_CATEGORY_VIDEO_DECODER, MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_LOCALMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+		&input, &output, &activateArray, &count);
+	if (FAILED(hr) || count == 0) {
+		CoTaskMemFree(activateArray);
+		return nullptr;
+	}
+
+	ComPtr<IMFTransform> decoder;
+	hr = activateArray[0]->ActivateObject(IID_PPV_ARGS(&decoder));
+	for (UINT32 i = 0; i < count; i++) {
+		activateArray[i]->Release();
+	}
+	CoTaskMemFree(activateArray);
+	if (FAILED(hr)) {
+		return nullptr;
+	}
+
+	ComPtr<IMFMediaType> inputType;
+	ComPtr<IMFMediaType> outputType;
+	if (FAILED(MFCreateMediaType(&inputType)) || FAILED(MFCreateMediaType(&outputType))) {
+		return nullptr;
+	}
+
+	inputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+	inputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_MJPG);
+	MFSetAttributeSize(inputType.Get(), MF_MT_FRAME_SIZE, width, height);
+
+	outputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+	outputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_YUY2);
+	MFSetAttributeSize(outputType.Get(), MF_MT_FRAME_SIZE, width, height);
+
+	if (FAILED(decoder->SetInputType(0, inputType.Get(), 0)) || FAILED(decoder->SetOutputType(0, outputType.Get(), 0))) {
+		return nullptr;
+	}
+
+	decoder->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0);
+	return decoder;
+}
+
+inline Microsoft::WRL::ComPtr<IMFSample> CreateSampleWithBuffer(DWORD size, const uint8_t* data) {
+	using Microsoft::WRL::ComPtr;
+
+	ComPtr<IMFMediaBuffer> buffer;
+	ComPtr<IMFSample> sample;
+	if (FAILED(MFCreateMemoryBuffer(size, &buffer)) || FAILED(MFCreateSample(&sample))) {
+		return nullptr;
+	}
+
+	if (data) {
+		BYTE* dst = nullptr;
+		buffer->Lock(&dst, nullptr, nullptr);
+		memcpy(dst, data, size);
+		buffer->Unlock();
+		buffer->SetCurrentLength(size);
+	}
+
+	sample->AddBuffer(buffer.Get());
+	return sample;
+}
+
+// A YUY2 sample whose 2D buffer has the pitch Media Foundation picks.
+inline Microsoft::WRL::ComPtr<IMFSample> CreateYUY2Sample(uint32_t width, uint32_t height) {
+	using Microsoft::WRL::ComPtr;
+
+	ComPtr<IMFMediaBuffer> buffer;
+	ComPtr<IMFSample> sample;
+	if (FAILED(MFCreate2DMediaBuffer(width, height, MFVideoFormat_YUY2.Data1, FALSE, &buffer)) || FAILED(MFCreateSample(&sample))) {
+		return nullptr;
+	}
+	sample->AddBuffer(buffer.Get());
+	return sample;
+}
+
+// The MFT decodes into a YUY2 sample of its own, repacked into the output.
+// Media Foundation must be started, on a multithreaded apartment, before any
+// decoder is made.
+class MFTMJPEGDecoder : public MJPEGDecoder {
+public:
+	MFTMJPEGDecoder(uint32_t width, uint32_t height) : decoder_(CreateMJPEGDecoder(width, height)) {
+		if (decoder_) {
+			MFT_OUTPUT_STREAM_INFO streamInfo{};
+			decoder_->GetOutputStreamInfo(0, &streamInfo);
+			providesSamples_ = (streamInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES) != 0;
+			outputSample_ = providesSamples_ ? nullptr : CreateYUY2Sample(width, height);
+		}
+	}
+
+	bool Valid() const {
+		return decoder_ != nullptr && (providesSamples_ || outputSample_ != nullptr);
+	}
+
+	const char* Name() const override {
+		return "mft";
+	}
+
+	// A frame the MFT holds back for more input counts as a failure, as the
+	// bench feeds it one whole frame at a time.
+	bool Decode(const uint8_t* jpeg, size_t size, const FrameLayout& layout, uint8_t* dest) override {
+		using Microsoft::WRL::ComPtr;
+
+		ComPtr<IMFSample> inputSample = CreateSampleWithBuffer(static_cast<DWORD>(size), jpeg);
+		if (!inputSample || FAILED(decoder_->ProcessInput(0, inputSample.Get(), 0))) {
+			return false;
+		}
+
+		MFT_OUTPUT_DATA_BUFFER output{};
+		output.pSample = outputSample_.Get();
+		DWORD status = 0;
+		HRESULT hr = decoder_->ProcessOutput(0, 1, &output, &status);
+		if (output.pEvents) {
+			output.pEvents->Release();
+		}
+		ComPtr<IMFSample> decoded = output.pSample;
+		if (providesSamples_ && output.pSample) {
+			output.pSample->Release();
+		}
+		if (FAILED(hr) || !decoded) {
+			return false;
+		}
+
+		ComPtr<IMFMediaBuffer> buffer;
+		ComPtr<IMF2DBuffer2> buffer2D;
+		BYTE* yuy2 = nullptr;
+		BYTE* bufferStart = nullptr;
+		LONG rowPitch = 0;
+		DWORD length = 0;
+		if (FAILED(decoded->GetBufferByIndex(0, &buffer)) || FAILED(buffer.As(&buffer2D))
+			|| FAILED(buffer2D->Lock2DSize(MF2DBuffer_LockFlags_Read, &yuy2, &rowPitch, &bufferStart, &length))) {
+			return false;
+		}
+		const ptrdiff_t pitch = rowPitch;
+		if (layout.format == PixelFormat::NV12) {
+			for (uint32_t y = 0; y < layout.height; y += 2) {
+				const uint32_t next = (std::min)(y + 1, layout.height - 1);
+				toNV12_(yuy2 + pitch * y, yuy2 + pitch * next, dest + layout.planePitch[0] * y, dest + layout.planePitch[0] * next,
+					dest + layout.planeOffset[1] + layout.planePitch[1] * (y / 2), layout.width);
+			}
+		}
+		else {
+			for (uint32_t y = 0; y < layout.height; ++y) {
+				toUYVY_(yuy2 + pitch * y, dest + layout.planePitch[0] * y, layout.width);
+			}
+		}
+		buffer2D->Unlock2D();
+		return true;
+	}
+
+private:
+	Microsoft::WRL::ComPtr<IMFTransform> decoder_;
+	Microsoft::WRL::ComPtr<IMFSample> outputSample_;
+	bool providesSamples_{ false };
+	YUY2ToUYVYRowFunc toUYVY_{ GetYUY2ToUYVYRow(ActiveSimdLevel()) };
+	YUY2ToNV12RowFunc toNV12_{ GetYUY2ToNV12Row(ActiveSimdLevel()) };
+};
+
+#endif // _WIN32
+
+// Decoder names this build has, the default first.
+inline std::vector<std::string> MJPEGDecoderNames() {
+	std::vector<std::string> names;
+#ifdef MJPEG_LIBJPEG
+	names.push_back("libjpeg");
+#endif
+#ifdef _WIN32
+	names.push_back("mft");
+#endif
+	return names;
+}
+
+inline std::unique_ptr<MJPEGDecoder> MakeMJPEGDecoder(const std::string& name, uint32_t width, uint32_t height) {
+#ifdef MJPEG_LIBJPEG
+	if (name == "libjpeg") {
+		return std::make_unique<LibjpegMJPEGDecoder>();
+	}
+#endif
+#ifdef _WIN32
+	if (name == "mft") {
+		auto decoder = std::make_unique<MFTMJPEGDecoder>(width, height);
+		return decoder->Valid() ? std::move(decoder) : nullptr;
+	}
+#endif
+	(void)name;
+	(void)width;
+	(void)height;
+	return nullptr;
+}
+
+// decoderName empty picks the build's default; format is UYVY or NV12.
+inline int RunMJPEGDecodeBench(const std::filesystem::path& directory, unsigned threadCount, int passes, PixelFormat format, std::string decoderName) {
+	const std::vector<std::string> available = MJPEGDecoderNames();
+	if (available.empty()) {
+		std::cerr << "This build has no MJPEG decoder; rebuild with -DMJPEG_LIBJPEG and link libjpeg-turbo (-ljpeg)." << std::endl;
+		return 1;
+	}
+	if (decoderName.empty()) {
+		decoderName = available[0];
+	}
+	if (std::find(available.begin(), available.end(), decoderName) == available.end()) {
+		std::cerr << "Unknown MJPEG decoder " << decoderName << "; this build has:";
+		for (const std::string& name : available) {
+			std::cerr << " " << name;
+		}
+		std::cerr << std::endl;
+		return 1;
+	}
+
+#ifdef MJPEG_LIBJPEG
+	if (decoderName == "libjpeg" && !VerifyMJPEGDecode()) {
+		std::cerr << "MJPEG decode verification failed." << std::endl;
+		return 1;
+	}
+#endif
+
+	std::vector<std::vector<uint8_t>> frames;
+	for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+		const auto extension = entry.path().extension().string();
+		if (extension != ".jpg" && extension != ".jpeg" && extension != ".JPG" && extension != ".JPEG") {
+			continue;
+		}
+		std::ifstream file(entry.path(), std::ios::binary);
+		frames.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	uint32_t width = 0, height = 0;
+	if (frames.empty() || !ReadJpegSize(frames[0], width, height)) {
+		std::cerr << "No readable JPEG frames in " << directory.string() << std::endl;
+		return 1;
+	}
+
+#ifdef _WIN32
+	// The worker threads join this multithreaded apartment implicitly.
+	const bool useMF = decoderName == "mft";
+	if (useMF && (FAILED(CoInitializeEx(nullptr, COINIT_MULTITHREADED)) || FAILED(MFStartup(MF_VERSION)))) {
+		std::cerr << "Failed to initialize Media Foundation." << std::endl;
+		return 1;
+	}
+#endif
+
+	int result = 0;
+	{
+		BandPool workers((std::max)(1u, threadCount));
+		threadCount = workers.WorkerCount();
+
+		const FrameLayout layout = PackedFrameLayout(format, width, height);
+		FramePool framePool;
+		uint32_t poolClass = 0;
+		std::vector<std::unique_ptr<MJPEGDecoder>> decoders;
+		for (unsigned i = 0; i < threadCount; ++i) {
+			decoders.push_back(MakeMJPEGDecoder(decoderName, width, height));
+			if (!decoders.back()) {
+				std::cerr << "Failed to create the " << decoderName << " MJPEG decoder." << std::endl;
+				result = 1;
+				break;
+			}
+		}
+		if (result == 0 && !framePool.AddClass(layout, threadCount, poolClass)) {
+			std::cerr << "Failed to allocate " << threadCount << " output buffers of " << layout.totalBytes << " bytes." << std::endl;
+			result = 1;
+		}
+
+		if (result == 0) {
+			const uint64_t total = static_cast<uint64_t>(frames.size()) * passes;
+			std::vector<std::vector<double>> latencies(threadCount);
+			for (auto& perSlot : latencies) {
+				perSlot.reserve(total / threadCount + 1);
+			}
+			std::vector<FrameRef> inFlight(threadCount);
+			std::atomic<bool> failed{ false };
+
+			const double cpuBefore = ProcessCpuSeconds();
+			const auto start = std::chrono::steady_clock::now();
+
+			// Slot i decodes frame next + i with decoder i into buffer i.
+			for (uint64_t next = 0; next < total && !failed; next += threadCount) {
+				const uint32_t batch = static_cast<uint32_t>((std::min<uint64_t>)(threadCount, total - next));
+				for (uint32_t i = 0; i < batch; ++i) {
+					inFlight[i] = framePool.Acquire(poolClass);
+				}
+				workers.Run(batch, 1, [&](uint32_t first, uint32_t last) {
+					for (uint32_t slot = first; slot < last; ++slot) {
+						const std::vector<uint8_t>& jpeg = frames[(next + slot) % frames.size()];
+						const auto frameStart = std::chrono::steady_clock::now();
+						if (!decoders[slot]->Decode(jpeg.data(), jpeg.size(), layout, inFlight[slot].Data())) {
+							failed = true;
+						}
+						latencies[slot].push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count());
+					}
+				});
+				for (uint32_t i = 0; i < batch; ++i) {
+					inFlight[i].Reset();
+				}
+			}
+
+			const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			const double cpuSeconds = ProcessCpuSeconds() - cpuBefore;
+
+			if (failed) {
+				std::cerr << "MJPEG decoding failed." << std::endl;
+				result = 1;
+			}
+			else {
+				std::vector<double> all;
+				for (const auto& perSlot : latencies) {
+					all.insert(all.end(), perSlot.begin(), perSlot.end());
+				}
+				std::sort(all.begin(), all.end());
+
+				auto percentile = [&](double p) {
+					return all[(std::min)(all.size() - 1, static_cast<size_t>(p * (all.size() - 1) + 0.5))] * 1000;
+				};
+
+				const double fps = all.size() / elapsed;
+				std::cout << "MJPEG " << width << "x" << height << " -> " << PixelFormatName(format) << " (" << decoderName << "), "
+					<< frames.size() << " frames x " << passes << " passes, " << threadCount << " threads" << std::endl;
+				std::cout << std::fixed << std::setprecision(3)
+					<< "  latency ms: p50 " << percentile(0.50) << ", p90 " << percentile(0.90)
+					<< ", p99 " << percentile(0.99) << ", max " << all.back() * 1000 << std::endl;
+				std::cout << std::setprecision(1)
+					<< "  " << fps << " fps total, " << fps / threadCount << " fps per thread, "
+					<< (cpuSeconds > 0.0 ? all.size() / cpuSeconds : 0.0) << " fps per core" << std::defaultfloat << std::endl;
+			}
+		}
+	}
+
+#ifdef _WIN32
+	if (useMF) {
+		MFShutdown();
+		CoUninitialize();
+	}
+#endif
+	return result;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+// Last-level cache miss counter for the benchmarks.
+//
+// Linux only, through perf_event_open; elsewhere (or when the kernel does not
+// allow user-space counting, see /proc/sys/kernel/perf_event_paranoid)
+// Available() is false and the benchmarks print throughput alone.
+//
+// The counter is inherited by threads created after Start(), but their counts
+// are only folded in when they exit, so join every thread before Stop().
+
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+class LLCMissCounter {
+public:
+	LLCMissCounter() = default;
+
+	~LLCMissCounter() {
+#if defined(__linux__)
+		if (fd_ >= 0) {
+			close(fd_);
+		}
+#endif
+	}
+
+	LLCMissCounter(const LLCMissCounter&) = delete;
+	LLCMissCounter& operator=(const LLCMissCounter&) = delete;
+
+	// Opens a fresh counter; returns false if LLC misses cannot be counted here.
+	bool Start() {
+#if defined(__linux__)
+		if (fd_ >= 0) {
+			close(fd_);
+		}
+
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		return fd_ >= 0;
+#else
+		return false;
+#endif
+	}
+
+	bool Available() const {
+		return fd_ >= 0;
+	}
+
+	// Misses since Start(), or 0 if the counter is unavailable.
+	uint64_t Stop() {
+#if defined(__linux__)
+		uint64_t count = 0;
+		if (fd_ >= 0 && read(fd_, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count))) {
+			count = 0;
+		}
+		return count;
+#else
+		return 0;
+#endif
+	}
+
+private:
+	int fd_{ -1 };
+};
@@ -0,0 +1,563 @@
+#pragma once
+
+// Headless pipeline benchmark: the whole capture -> convert -> send path of
+// CapturePipeline.h, from a synthetic or replayed source into a null or
+// counting sink, or into a frame journal on disk.
+//
+//   benchmarks --pipeline [--size WxH] [--capture yuy2|uyvy|nv12]
+//       [--format uyvy|nv12|i420|bgra|bgrx|rgba|rgbx] [--replay file]
+//       [--fps N] [--pace] [--frames N] [--threads N]
+//       [--handoff latest|drop-oldest|drop-newest|block] [--sink null|counting]
+//       [--trace file.json] [--camera WxH@FPS]... [--journal dir]
+//
+// Without --fps frames are generated as fast as the pipeline takes them, and
+// the handoff blocks rather than drops, so the sustained rate is the
+// pipeline's own; YUY2 capture to UYVY output (the default) is the
+// YUY2ToUYVYWithPitch path the NDI app runs. With --fps the source delivers
+// on that frame clock, like a camera, and --pace also turns on the output
+// pacer.
+//
+// --replay reads a file of back-to-back frames in the capture size and
+// format, with no row padding, and delivers them in a loop.
+//
+// Each --camera adds a synthetic camera in the capture format, delivering in
+// real time; with several, they run at once on one shared worker pool of
+// --threads workers (MultiCapture.h), each sending --frames frames (10 s by
+// default), and the report is per camera and over all of them.
+//
+// --journal records every frame into segments in dir (FrameJournal.h) on the
+// conversion thread, in place of the sink, so a disk that cannot keep up
+// shows as frames dropped at the capture ring with --fps: 4K60 UYVY is about
+// 1 GB/s. The segments are left in dir.
+//
+// Reports sustained fps, process CPU time per frame, heap allocations per
+// frame and the latency percentiles of every stage. Allocations are counted
+// by the operator new replacement in main.cpp.
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../common/CapturePipeline.h"
+#include "../common/CaptureSource.h"
+#include "../common/ColorConvert.h"
+#include "../common/FrameConverter.h"
+#include "../common/FrameJournal.h"
+#include "../common/FrameRing.h"
+#include "../common/FrameSink.h"
+#include "../common/FrameTracer.h"
+#include "../common/MultiCapture.h"
+#include "../common/PixelFormat.h"
+#include "../common/SlotPool.h"
+#include "../common/SyntheticCapture.h"
+
+// Heap allocations made through operator new since the process started.
+inline std::atomic<uint64_t> g_allocationCount{ 0 };
+
+inline void CountAllocation() {
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+// User plus kernel time of every thread in the process, in seconds.
+inline double ProcessCpuSeconds() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+		return 0.0;
+	}
+	auto seconds = [](const FILETIME& time) {
+		return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 1e7;
+	};
+	return seconds(kernel) + seconds(user);
+#else
+	timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return static_cast<double>(now.tv_sec) + now.tv_nsec / 1e9;
+#endif
+}
+
+// Frames from a file, delivered in a loop and timestamped on the nominal
+// frame clock. Like the synthetic source, frames are read in place.
+class ReplayCaptureSource : public CaptureSource {
+public:
+	ReplayCaptureSource(const CaptureFormat& format, std::vector<uint8_t> frames, bool realtime)
+		: format_(format), layout_(PackedFrameLayout(format.format, format.width, format.height)), frames_(std::move(frames)), realtime_(realtime) {
+		frameCount_ = layout_.totalBytes ? frames_.size() / layout_.totalBytes : 0;
+	}
+
+	uint64_t FrameCount() const {
+		return frameCount_;
+	}
+
+	const char* Name() const override {
+		return "replay";
+	}
+
+	CaptureFormat Format() const override {
+		return format_;
+	}
+
+	void ReserveSamples(uint32_t count) override {
+		samples_.Reserve(SlotPool::SlotBytesFor<SyntheticFrameSource>(), count);
+	}
+
+	CaptureReadStatus Read(CapturedSample& sample) override {
+		using Clock = std::chrono::steady_clock;
+		if (frameCount_ == 0) {
+			return CaptureReadStatus::EndOfStream;
+		}
+		if (next_ == 0) {
+			start_ = Clock::now();
+		}
+
+		const uint64_t index = next_++;
+		const int64_t slot = static_cast<int64_t>(index * 10'000'000ull * format_.frameRateDenominator / format_.frameRateNumerator);
+		if (realtime_) {
+			FramePacer::WaitUntil(start_ + std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(slot * 100)));
+		}
+
+		const uint8_t* frame = frames_.data() + (index % frameCount_) * layout_.totalBytes;
+		sample.frame = std::allocate_shared<SyntheticFrameSource>(SlotAllocator<SyntheticFrameSource>(samples_), frame,
+			static_cast<ptrdiff_t>(layout_.planePitch[0]));
+		sample.timestamp = slot;
+		sample.sourceNow = realtime_
+			? std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count() / 100
+			: kNoSourceClock;
+		return CaptureReadStatus::Sample;
+	}
+
+private:
+	CaptureFormat format_;
+	FrameLayout layout_;
+	std::vector<uint8_t> frames_;
+	bool realtime_;
+	uint64_t frameCount_{ 0 };
+	uint64_t next_{ 0 };
+	std::chrono::steady_clock::time_point start_;
+	SlotPool samples_;
+};
+
+// Lets go of every frame as soon as it is sent.
+class NullSink : public FrameSink {
+public:
+	void Send(SinkFrame&) override {}
+};
+
+// Holds each frame until the next send, as an asynchronous network sender
+// does, and reads one byte of every 4 KiB of it so the output is really
+// consumed.
+class CountingSink : public FrameSink {
+public:
+	void Send(SinkFrame& frame) override {
+		const uint8_t* data = frame.frame.Data();
+		const size_t size = frame.frame.Layout().totalBytes;
+		for (size_t offset = 0; offset < size; offset += 4096) {
+			checksum_ += data[offset];
+		}
+		bytes_ += size;
+		++frames_;
+		held_ = std::move(frame.frame);
+	}
+
+	void Flush() override {
+		held_.Reset();
+	}
+
+	uint64_t Frames() const {
+		return frames_;
+	}
+
+	uint64_t Bytes() const {
+		return bytes_;
+	}
+
+	uint64_t Checksum() const {
+		return checksum_;
+	}
+
+private:
+	FrameRef held_;
+	uint64_t frames_{ 0 };
+	uint64_t bytes_{ 0 };
+	uint64_t checksum_{ 0 };
+};
+
+inline bool PipelineBenchNameEquals(const char* a, const char* b) {
+	for (; *a && *b; ++a, ++b) {
+		if (std::tolower(static_cast<unsigned char>(*a)) != std::tolower(static_cast<unsigned char>(*b))) {
+			return false;
+		}
+	}
+	return *a == *b;
+}
+
+inline bool ParsePipelineBenchFormat(const char* name, std::initializer_list<PixelFormat> candidates, PixelFormat& format) {
+	for (PixelFormat candidate : candidates) {
+		if (PipelineBenchNameEquals(name, PixelFormatName(candidate))) {
+			format = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+// "WxH", both non-zero.
+inline bool ParsePipelineBenchSize(const char* value, uint32_t& width, uint32_t& height) {
+	char* end = nullptr;
+	const unsigned long w = strtoul(value, &end, 10);
+	if (end == value || *end != 'x') {
+		return false;
+	}
+	const char* rest = end + 1;
+	const unsigned long h = strtoul(rest, &end, 10);
+	if (end == rest || *end != '\0' || w == 0 || h == 0) {
+		return false;
+	}
+	width = static_cast<uint32_t>(w);
+	height = static_cast<uint32_t>(h);
+	return true;
+}
+
+// "WxH@FPS", all non-zero.
+inline bool ParsePipelineBenchCamera(const char* value, SyntheticCaptureConfig& camera) {
+	const char* at = strchr(value, '@');
+	if (!at) {
+		return false;
+	}
+	char* end = nullptr;
+	const unsigned long fps = strtoul(at + 1, &end, 10);
+	if (end == at + 1 || *end != '\0' || fps == 0) {
+		return false;
+	}
+	const std::string size(value, at);
+	camera.frameRateNumerator = static_cast<uint32_t>(fps);
+	camera.frameRateDenominator = 1;
+	return ParsePipelineBenchSize(size.c_str(), camera.width, camera.height);
+}
+
+inline bool ReadReplayFile(const char* path, std::vector<uint8_t>& data) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) {
+		return false;
+	}
+	data.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size())));
+}
+
+// Every camera converts on the shared pool into a sink of its own, for
+// frames frames or ten seconds.
+inline int RunMultiCameraBench(std::vector<SyntheticCaptureConfig> setups, const ConversionConfig& conversion, PipelineConfig pipeline,
+	uint64_t frames, bool countingSink) {
+	MultiCaptureConfig config;
+	config.workers = conversion.threads;
+	config.printStats = false;
+	MultiCapture cameras(config);
+
+	std::vector<std::unique_ptr<SyntheticCaptureSource>> sources;
+	std::vector<std::unique_ptr<FrameSink>> sinks;
+	for (SyntheticCaptureConfig& setup : setups) {
+		setup.realtime = true;
+		pipeline.maxFrames = frames ? frames : static_cast<uint64_t>(setup.frameRateNumerator) * 10;
+		sources.push_back(std::make_unique<SyntheticCaptureSource>(setup));
+		if (countingSink) {
+			sinks.push_back(std::make_unique<CountingSink>());
+		}
+		else {
+			sinks.push_back(std::make_unique<NullSink>());
+		}
+
+		const CaptureFormat capture = sources.back()->Format();
+		FanOutPipeline& camera = cameras.AddCamera(std::to_string(sources.size()) + " @ " + std::to_string(setup.frameRateNumerator), *sources.back(), pipeline);
+		camera.AddSink("bench", *sinks.back(), conversion, { 0, HandoffPolicy::Latest });
+		if (!camera.Initialize(DefaultColorimetry(capture.format, capture.height))) {
+			return 1;
+		}
+	}
+
+	std::cout << "Pipeline " << setups.size() << " synthetic " << PixelFormatName(setups[0].format) << " cameras -> "
+		<< PixelFormatName(conversion.outputFormat) << ", " << HandoffPolicyName(pipeline.captureHandoff) << " handoff, "
+		<< cameras.Workers().WorkerCount() << " shared workers, " << (countingSink ? "counting" : "null") << " sink" << std::endl;
+
+	const uint64_t allocationsBefore = g_allocationCount.load(std::memory_order_relaxed);
+	const double cpuBefore = ProcessCpuSeconds();
+	const auto start = std::chrono::steady_clock::now();
+	cameras.Run();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const double cpuSeconds = ProcessCpuSeconds() - cpuBefore;
+	const uint64_t allocations = g_allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+
+	const uint64_t sent = cameras.TotalStats().framesSent;
+	if (sent == 0) {
+		std::cerr << "No frames were sent." << std::endl;
+		return 1;
+	}
+	cameras.PrintStats(false);
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "  " << sent << " frames in " << seconds << " s; CPU " << cpuSeconds * 1000.0 / sent << " ms per frame ("
+		<< std::setprecision(2) << cpuSeconds / seconds << " cores busy), " << static_cast<double>(allocations) / sent
+		<< " heap allocations per frame" << std::defaultfloat << std::endl;
+	return 0;
+}
+
+inline int RunPipelineBench(int argc, char** argv) {
+	CaptureFormat capture;
+	capture.format = PixelFormat::YUY2;
+	capture.width = 1920;
+	capture.height = 1080;
+	ConversionConfig conversion;
+	PipelineConfig pipeline;
+	pipeline.printStats = false;
+	uint32_t fps = 0;
+	uint64_t frames = 0;
+	bool handoffSet = false;
+	bool countingSink = true;
+	const char* replayPath = nullptr;
+	const char* tracePath = nullptr;
+	const char* journalPath = nullptr;
+	std::vector<SyntheticCaptureConfig> cameras;
+
+	for (int i = 0; i < argc; ++i) {
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool handoffParsed = false;
+		if (value && strcmp(argv[i], "--handoff") == 0) {
+			for (HandoffPolicy policy : kHandoffPolicies) {
+				if (strcmp(value, HandoffPolicyName(policy)) == 0) {
+					pipeline.captureHandoff = policy;
+					handoffParsed = handoffSet = true;
+				}
+			}
+		}
+
+		if (handoffParsed) {
+			++i;
+		}
+		else if (strcmp(argv[i], "--size") == 0 && value && ParsePipelineBenchSize(value, capture.width, capture.height)) {
+			++i;
+		}
+		else if (strcmp(argv[i], "--capture") == 0 && value
+			&& ParsePipelineBenchFormat(value, { PixelFormat::YUY2, PixelFormat::UYVY, PixelFormat::NV12 }, capture.format)) {
+			++i;
+		}
+		else if (strcmp(argv[i], "--format") == 0 && value
+			&& ParsePipelineBenchFormat(value, { PixelFormat::UYVY, PixelFormat::NV12, PixelFormat::I420, PixelFormat::BGRA,
+				PixelFormat::BGRX, PixelFormat::RGBA, PixelFormat::RGBX }, conversion.outputFormat)) {
+			++i;
+		}
+		else if (strcmp(argv[i], "--replay") == 0 && value) {
+			replayPath = value;
+			++i;
+		}
+		else if (strcmp(argv[i], "--fps") == 0 && value) {
+			fps = static_cast<uint32_t>(atoi(value));
+			++i;
+		}
+		else if (strcmp(argv[i], "--pace") == 0) {
+			pipeline.pace = true;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && value) {
+			frames = static_cast<uint64_t>(atoll(value));
+			++i;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && value) {
+			conversion.threads = static_cast<unsigned>(atoi(value));
+			++i;
+		}
+		else if (strcmp(argv[i], "--sink") == 0 && value && (strcmp(value, "null") == 0 || strcmp(value, "counting") == 0)) {
+			countingSink = strcmp(value, "counting") == 0;
+			++i;
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && value) {
+			tracePath = value;
+			++i;
+		}
+		else if (strcmp(argv[i], "--camera") == 0 && value && ParsePipelineBenchCamera(value, cameras.emplace_back())) {
+			++i;
+		}
+		else if (strcmp(argv[i], "--journal") == 0 && value) {
+			journalPath = value;
+			++i;
+		}
+		else {
+			std::cerr << "Usage: benchmarks --pipeline [--size WxH] [--capture yuy2|uyvy|nv12] [--format uyvy|nv12|i420|bgra|bgrx|rgba|rgbx]"
+				<< " [--replay file] [--fps N] [--pace] [--frames N] [--threads N] [--handoff latest|drop-oldest|drop-newest|block]"
+				<< " [--sink null|counting] [--trace file.json] [--camera WxH@FPS]... [--journal dir]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (!cameras.empty()) {
+		if (replayPath || fps || pipeline.pace || journalPath) {
+			std::cerr << "--camera takes the place of --replay, --fps, --pace and --journal." << std::endl;
+			return 1;
+		}
+		for (SyntheticCaptureConfig& camera : cameras) {
+			camera.format = capture.format;
+		}
+		if (!handoffSet) {
+			pipeline.captureHandoff = HandoffPolicy::Latest;
+		}
+		return RunMultiCameraBench(std::move(cameras), conversion, pipeline, frames, countingSink);
+	}
+
+	const bool realtime = fps != 0;
+	if (!realtime && pipeline.pace) {
+		std::cerr << "--pace needs --fps." << std::endl;
+		return 1;
+	}
+	if (!handoffSet) {
+		pipeline.captureHandoff = realtime ? HandoffPolicy::Latest : HandoffPolicy::Block;
+	}
+	pipeline.maxFrames = frames ? frames : realtime ? static_cast<uint64_t>(fps) * 10 : 3000;
+
+	// Unpaced, the timestamps still advance at a nominal 60 fps.
+	capture.frameRateNumerator = realtime ? fps : 60;
+	capture.frameRateDenominator = 1;
+
+	std::unique_ptr<CaptureSource> source;
+	if (replayPath) {
+		std::vector<uint8_t> data;
+		if (!ReadReplayFile(replayPath, data)) {
+			std::cerr << "Failed to read " << replayPath << std::endl;
+			return 1;
+		}
+		auto replay = std::make_unique<ReplayCaptureSource>(capture, std::move(data), realtime);
+		if (replay->FrameCount() == 0) {
+			std::cerr << replayPath << " holds no whole " << PixelFormatName(capture.format) << " " << capture.width << "x" << capture.height
+				<< " frame." << std::endl;
+			return 1;
+		}
+		source = std::move(replay);
+	}
+	else {
+		SyntheticCaptureConfig synthetic;
+		synthetic.format = capture.format;
+		synthetic.width = capture.width;
+		synthetic.height = capture.height;
+		synthetic.frameRateNumerator = capture.frameRateNumerator;
+		synthetic.realtime = realtime;
+		source = std::make_unique<SyntheticCaptureSource>(synthetic);
+		capture = source->Format();
+	}
+
+	FrameConverter converter(conversion);
+	if (!converter.Setup(capture, DefaultColorimetry(capture.format, capture.height))) {
+		return 1;
+	}
+
+	NullSink nullSink;
+	CountingSink counter;
+	std::unique_ptr<FrameJournal> journal;
+	if (journalPath) {
+		FrameJournalConfig journalConfig;
+		journalConfig.directory = journalPath;
+		journalConfig.name = "bench";
+		journal = std::make_unique<FrameJournal>(journalConfig);
+		if (!journal->Open()) {
+			return 1;
+		}
+	}
+	FrameSink& sink = journal ? static_cast<FrameSink&>(*journal) : countingSink ? static_cast<FrameSink&>(counter) : nullSink;
+	const char* sinkName = journal ? "journal" : countingSink ? "counting" : "null";
+
+	CapturePipeline benchPipeline(pipeline, *source, converter, sink);
+	if (!benchPipeline.Initialize()) {
+		return 1;
+	}
+
+	if (tracePath) {
+		if (FRAME_TRACING) {
+			FrameTracer::Instance().Start();
+		}
+		else {
+			std::cerr << "Built without FRAME_TRACING=1; --trace is ignored." << std::endl;
+		}
+	}
+
+	std::cout << "Pipeline " << source->Name() << " " << PixelFormatName(capture.format) << " " << capture.width << "x" << capture.height
+		<< " -> " << PixelFormatName(converter.OutputLayout().format) << ", "
+		<< (realtime ? std::to_string(fps) + " fps" + (pipeline.pace ? " paced" : "") : std::string("unpaced")) << ", "
+		<< HandoffPolicyName(pipeline.captureHandoff) << " handoff, " << converter.WorkerCount() << " workers, "
+		<< sinkName << " sink" << std::endl;
+
+	const uint64_t allocationsBefore = g_allocationCount.load(std::memory_order_relaxed);
+	const double cpuBefore = ProcessCpuSeconds();
+	const auto start = std::chrono::steady_clock::now();
+	benchPipeline.Run();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const double cpuSeconds = ProcessCpuSeconds() - cpuBefore;
+	const uint64_t allocations = g_allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+
+	if (tracePath && FrameTracer::Instance().Enabled()) {
+		if (FrameTracer::Instance().WriteJson(tracePath)) {
+			std::cout << "Wrote trace to " << tracePath << std::endl;
+		}
+		else {
+			std::cerr << "Failed to write trace to " << tracePath << std::endl;
+		}
+	}
+
+	const uint64_t sent = benchPipeline.FramesSent();
+	if (sent == 0) {
+		std::cerr << "No frames were sent." << std::endl;
+		return 1;
+	}
+
+	const FrameRingStats ring = benchPipeline.RingStats();
+	const FramePoolStats pool = benchPipeline.PoolStats();
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "  " << sent << " frames in " << seconds << " s: " << std::setprecision(1) << sent / seconds << " fps sustained" << std::endl;
+	std::cout << "  CPU " << std::setprecision(3) << cpuSeconds * 1000.0 / sent << " ms per frame (" << std::setprecision(2)
+		<< cpuSeconds / seconds << " cores busy)" << std::endl;
+	std::cout << "  " << static_cast<double>(allocations) / sent << " heap allocations per frame" << std::endl;
+	std::cout << "  " << ring.Dropped() << " dropped at the capture ring, " << pool.exhausted << " with the pool exhausted" << std::endl;
+	if (journal) {
+		const FrameJournalStats stats = journal->Stats();
+		std::cout << "  journal: " << stats.records << " frames, " << std::setprecision(2) << stats.bytes / seconds / 1e9 << " GB/s into "
+			<< stats.segments << " segments in " << journalPath << ", " << stats.rejected << " rejected, " << stats.segmentWaits
+			<< " waits for a segment, flush p50 " << stats.flush.ValueAtPercentile(50.0) / 1e6 << " max " << stats.flush.max / 1e6
+			<< " ms" << std::endl;
+	}
+	else if (countingSink) {
+		std::cout << "  sink: " << counter.Frames() << " frames, " << std::setprecision(2) << counter.Bytes() / seconds / 1e9
+			<< " GB/s, checksum " << counter.Checksum() << std::endl;
+	}
+
+	// Unpaced timestamps run ahead of the clock, so glass-to-send means nothing.
+	std::cout << "  latency (ms)      p50      p90      p99    p99.9      max" << std::endl;
+	for (uint32_t stage = 0; stage < kStageCount; ++stage) {
+		if ((stage == kStagePace && !pipeline.pace) || (stage == kStageGlassToSend && !realtime)) {
+			continue;
+		}
+		const LatencySnapshot latency = benchPipeline.Latency(static_cast<LatencyStage>(stage));
+		auto ms = [](uint64_t nanoseconds) { return nanoseconds / 1e6; };
+		std::cout << "  " << std::left << std::setw(13) << kStageNames[stage] << std::right << std::setprecision(3)
+			<< std::setw(9) << ms(latency.ValueAtPercentile(50.0)) << std::setw(9) << ms(latency.ValueAtPercentile(90.0))
+			<< std::setw(9) << ms(latency.ValueAtPercentile(99.0)) << std::setw(9) << ms(latency.ValueAtPercentile(99.9))
+			<< std::setw(9) << ms(latency.max) << std::endl;
+	}
+	std::cout << std::defaultfloat;
+	return 0;
+}
@@ -0,0 +1,1546 @@
+#pragma once
+
+// Checks and benchmarks for the frame pipeline plumbing in common/: the
+// pieces between the camera and the converters that do not touch pixels. In
+// builds with MJPEG_LIBJPEG, also the MJPG decode in front of the converters,
+// from frames the checks encode themselves.
+//
+// Producers here are synthetic threads standing in for the capture thread, so
+// everything runs without a camera or Windows.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/BandPool.h"
+#include "../common/CaptureClock.h"
+#include "../common/CapturePipeline.h"
+#include "../common/FrameHandle.h"
+#include "../common/FrameJournal.h"
+#include "../common/FramePacer.h"
+#include "../common/FramePool.h"
+#include "../common/FrameRing.h"
+#include "../common/FrameTracer.h"
+#include "../common/LatencyHistogram.h"
+#include "../common/MediaNegotiation.h"
+#include "../common/MJPEGDecoder.h"
+#include "../common/MultiCapture.h"
+#include "../common/ProxyPyramid.h"
+#include "../common/SinkFanOut.h"
+#include "../common/SyntheticCapture.h"
+#include "PipelineBench.h"
+
+// A frame as the capture thread would hand it over.
+struct SyntheticFrame {
+	uint64_t sequence{ 0 };
+	std::chrono::steady_clock::time_point captured;
+};
+
+// Runs a producer at fps for frameCount frames into ring, pushing with the
+// ring's policy, while the calling thread consumes, sleeping consumeTime per
+// frame. Returns false if frames came out of order or the counters do not
+// add up.
+inline bool RunSyntheticCapture(FrameRing<SyntheticFrame>& ring, double fps, uint64_t frameCount,
+	std::chrono::microseconds consumeTime, uint64_t& consumed) {
+	std::thread producer([&]() {
+		const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+		auto next = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < frameCount; ++i) {
+			std::this_thread::sleep_until(next);
+			// Like a camera, a late frame does not make the next ones come early.
+			next = (std::max)(next + period, std::chrono::steady_clock::now());
+			SyntheticFrame frame{ i, std::chrono::steady_clock::now() };
+			ring.Push(frame);
+		}
+		ring.Close();
+	});
+
+	bool ordered = true;
+	uint64_t last = 0;
+	consumed = 0;
+	SyntheticFrame frame;
+	while (ring.Pop(frame)) {
+		ordered &= consumed == 0 || frame.sequence > last;
+		last = frame.sequence;
+		++consumed;
+		if (consumeTime.count() > 0) {
+			std::this_thread::sleep_for(consumeTime);
+		}
+	}
+	producer.join();
+
+	const FrameRingStats stats = ring.Stats();
+	return ordered && stats.popped == consumed && stats.pushed + stats.overflows == frameCount
+		&& stats.popped + stats.evicted == stats.pushed && stats.occupancy == 0;
+}
+
+inline bool VerifyFrameRing() {
+	bool ok = true;
+
+	// Overflow accounting without a consumer.
+	{
+		FrameRing<SyntheticFrame> ring(4);
+		uint32_t accepted = 0;
+		for (uint64_t i = 0; i < 6; ++i) {
+			SyntheticFrame frame{ i, {} };
+			accepted += ring.TryPush(frame) ? 1 : 0;
+		}
+		const FrameRingStats stats = ring.Stats();
+		bool burstOk = accepted == 4 && stats.overflows == 2 && stats.highWater == 4 && stats.occupancy == 4;
+		SyntheticFrame frame;
+		for (uint64_t i = 0; i < 4; ++i) {
+			burstOk &= ring.TryPop(frame) && frame.sequence == i;
+		}
+		burstOk &= !ring.TryPop(frame);
+		std::cout << "verify frame ring burst: " << (burstOk ? "ok" : "FAILED") << std::endl;
+		ok &= burstOk;
+	}
+
+	// 240 fps capture into a consumer that keeps up, and into one that takes
+	// 10 ms per frame and has to shed frames.
+	for (int slow = 0; slow < 2; ++slow) {
+		FrameRing<SyntheticFrame> ring(4);
+		uint64_t consumed = 0;
+		const bool runOk = RunSyntheticCapture(ring, 240.0, 120, std::chrono::microseconds(slow ? 10000 : 0), consumed);
+		const FrameRingStats stats = ring.Stats();
+		const bool expected = slow ? stats.overflows > 0 : stats.overflows == 0;
+		std::cout << "verify frame ring 240 fps, " << (slow ? "slow" : "fast") << " consumer: " << consumed << " frames, "
+			<< stats.overflows << " overflows, high water " << stats.highWater << "/" << stats.capacity << ": "
+			<< (runOk && expected ? "ok" : "FAILED") << std::endl;
+		ok &= runOk && expected;
+	}
+
+	return ok;
+}
+
+// What each policy keeps from a burst of six frames into four slots, and how
+// old the frames a stalled consumer sees are under each.
+inline bool VerifyHandoffPolicies() {
+	bool ok = true;
+
+	for (HandoffPolicy policy : kHandoffPolicies) {
+		FrameRing<SyntheticFrame> ring(4, policy);
+		std::vector<uint64_t> popped;
+		SyntheticFrame frame;
+
+		if (policy == HandoffPolicy::Block) {
+			std::thread producer([&]() {
+				for (uint64_t i = 0; i < 6; ++i) {
+					SyntheticFrame pushed{ i, {} };
+					ring.Push(pushed);
+				}
+				ring.Close();
+			});
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			while (ring.Pop(frame)) {
+				popped.push_back(frame.sequence);
+			}
+			producer.join();
+		}
+		else {
+			for (uint64_t i = 0; i < 6; ++i) {
+				SyntheticFrame pushed{ i, {} };
+				ring.Push(pushed);
+			}
+			while (ring.TryPop(frame)) {
+				popped.push_back(frame.sequence);
+			}
+		}
+
+		std::vector<uint64_t> expected;
+		switch (policy) {
+		case HandoffPolicy::DropNewest: expected = { 0, 1, 2, 3 }; break;
+		case HandoffPolicy::DropOldest: expected = { 2, 3, 4, 5 }; break;
+		case HandoffPolicy::Block: expected = { 0, 1, 2, 3, 4, 5 }; break;
+		case HandoffPolicy::Latest: expected = { 5 }; break;
+		}
+		const FrameRingStats stats = ring.Stats();
+		const bool burstOk = popped == expected && stats.Dropped() == 6 - expected.size()
+			&& (policy != HandoffPolicy::Block || stats.blocked == 1);
+		std::cout << "verify handoff " << HandoffPolicyName(policy) << " burst: " << (burstOk ? "ok" : "FAILED") << std::endl;
+		ok &= burstOk;
+	}
+
+	// 240 fps into a consumer taking 10 ms per frame. Dropping the oldest or
+	// keeping only the latest must hand it fresher frames than refusing new ones.
+	double newestAge = 0.0;
+	for (HandoffPolicy policy : { HandoffPolicy::DropNewest, HandoffPolicy::DropOldest, HandoffPolicy::Latest }) {
+		FrameRing<SyntheticFrame> ring(4, policy);
+		uint64_t consumed = 0;
+		bool runOk = RunSyntheticCapture(ring, 240.0, 120, std::chrono::microseconds(10000), consumed);
+		const FrameRingStats stats = ring.Stats();
+		if (policy == HandoffPolicy::DropNewest) {
+			newestAge = stats.meanAge;
+		}
+		else {
+			runOk &= stats.meanAge < newestAge;
+		}
+		std::cout << "verify handoff " << HandoffPolicyName(policy) << ", stalled consumer: " << consumed << " frames, "
+			<< stats.Dropped() << " dropped, age " << std::fixed << std::setprecision(1) << stats.meanAge * 1000.0 << " ms mean, "
+			<< stats.maxAge * 1000.0 << " ms max: " << (runOk ? "ok" : "FAILED") << std::endl;
+		ok &= runOk;
+	}
+
+	return ok;
+}
+
+// Pool accounting, and an asynchronous sink that holds each frame until the
+// next send, fed from a producer thread through a ring.
+inline bool VerifyFramePool() {
+	bool ok = true;
+
+	{
+		FramePool pool;
+		uint32_t full = 0;
+		uint32_t proxy = 0;
+		bool classesOk = pool.AddClass(PackedFrameLayout(PixelFormat::UYVY, 1920, 1080), 3, full)
+			&& pool.AddClass(PackedFrameLayout(PixelFormat::NV12, 960, 540), 2, proxy);
+
+		FrameRef held[3];
+		for (FrameRef& ref : held) {
+			ref = pool.Acquire(full);
+			classesOk &= ref && reinterpret_cast<uintptr_t>(ref.Data()) % FramePoolClass::kAlignment == 0;
+		}
+		classesOk &= !pool.Acquire(full) && pool.Stats(full).exhausted == 1;
+
+		FrameRef shared = held[0];
+		held[0].Reset();
+		classesOk &= shared.UseCount() == 1 && !pool.Acquire(full);
+		shared.Reset();
+		FrameRef reused = pool.Acquire(full);
+		classesOk &= reused && reused.Layout().format == PixelFormat::UYVY;
+
+		FrameRef small = pool.Acquire(proxy);
+		classesOk &= small && small.Layout().format == PixelFormat::NV12 && pool.Stats(proxy).inUse == 1;
+
+		const FramePoolStats stats = pool.Stats(full);
+		classesOk &= stats.acquired == 4 && stats.exhausted == 2 && stats.highWater == 3 && stats.inUse == 3;
+		std::cout << "verify frame pool classes: " << (classesOk ? "ok" : "FAILED") << std::endl;
+		ok &= classesOk;
+	}
+
+	{
+		constexpr uint64_t kFrames = 10000;
+		FramePool pool;
+		uint32_t index = 0;
+		bool sinkOk = pool.AddClass(PackedFrameLayout(PixelFormat::UYVY, 64, 16), 4, index);
+		std::vector<uint8_t*> preallocated;
+		{
+			std::vector<FrameRef> all(4);
+			for (FrameRef& ref : all) {
+				ref = pool.Acquire(index);
+				preallocated.push_back(ref.Data());
+			}
+		}
+
+		FrameRing<FrameRef> ring(2);
+		std::thread producer([&]() {
+			for (uint64_t i = 0; i < kFrames; ++i) {
+				FrameRef frame;
+				while (!(frame = pool.Acquire(index))) {
+					std::this_thread::yield();
+				}
+				frame.Data()[0] = static_cast<uint8_t>(i);
+				while (!ring.TryPush(frame)) {
+					std::this_thread::yield();
+				}
+			}
+			ring.Close();
+		});
+
+		// Like send_send_video_async_v2: the previous frame is released by the
+		// next send, so it must not be reused while it is still held.
+		FrameRef sent;
+		FrameRef frame;
+		uint64_t received = 0;
+		while (ring.Pop(frame)) {
+			sinkOk &= std::find(preallocated.begin(), preallocated.end(), frame.Data()) != preallocated.end();
+			sinkOk &= !sent || sent.Data()[0] == static_cast<uint8_t>(received - 1);
+			sinkOk &= frame.Data()[0] == static_cast<uint8_t>(received);
+			sent = std::move(frame);
+			++received;
+		}
+		producer.join();
+		sent.Reset();
+
+		const FramePoolStats stats = pool.Stats(index);
+		sinkOk &= received == kFrames && stats.inUse == 0 && stats.highWater <= stats.depth;
+		std::cout << "verify frame pool async sink: " << received << " frames, high water " << stats.highWater << "/" << stats.depth
+			<< ", " << stats.exhausted << " exhausted: " << (sinkOk ? "ok" : "FAILED") << std::endl;
+		ok &= sinkOk;
+	}
+
+	return ok;
+}
+
+// Capture buffer standing in for an IMF2DBuffer2: counts locks, and can be
+// bottom-up or refuse to lock.
+class FakeFrameBuffer : public LockableFrameBuffer {
+public:
+	FakeFrameBuffer(std::vector<uint8_t>& memory, size_t rowBytes, int& locks, bool bottomUp, bool lockable)
+		: memory_(memory), rowBytes_(rowBytes), locks_(locks), bottomUp_(bottomUp), lockable_(lockable) {}
+
+	bool Lock(const uint8_t*& scanline0, ptrdiff_t& pitch) override {
+		if (!lockable_) {
+			return false;
+		}
+		++locks_;
+		scanline0 = bottomUp_ ? memory_.data() + memory_.size() - rowBytes_ : memory_.data();
+		pitch = bottomUp_ ? -static_cast<ptrdiff_t>(rowBytes_) : static_cast<ptrdiff_t>(rowBytes_);
+		return true;
+	}
+
+	void Unlock() override {
+		--locks_;
+	}
+
+private:
+	std::vector<uint8_t>& memory_;
+	size_t rowBytes_;
+	int& locks_;
+	bool bottomUp_;
+	bool lockable_;
+};
+
+class FakeFrameSource : public CapturedFrameSource {
+public:
+	FakeFrameSource(std::vector<uint8_t>& memory, size_t rowBytes, uint32_t bufferCount, int& locks, bool bottomUp = false, bool lockable = true)
+		: bufferCount_(bufferCount), buffer_(memory, rowBytes, locks, bottomUp, lockable) {}
+
+	uint32_t BufferCount() override {
+		return bufferCount_;
+	}
+
+	LockableFrameBuffer* SingleBuffer() override {
+		return &buffer_;
+	}
+
+	LockableFrameBuffer* ContiguousCopy() override {
+		++copies;
+		return &buffer_;
+	}
+
+	int copies{ 0 };
+
+private:
+	uint32_t bufferCount_;
+	FakeFrameBuffer buffer_;
+};
+
+// The buffer stays locked while any copy of a handle lives and is unlocked
+// exactly once, and the handle keeps its sample; only fragmented samples are
+// copied. Handles past the factory's slots still work and are counted.
+inline bool VerifyFrameHandles() {
+	constexpr uint32_t kWidth = 64;
+	constexpr uint32_t kHeight = 16;
+	std::vector<uint8_t> memory(static_cast<size_t>(kWidth) * kHeight * 2);
+	int locks = 0;
+	bool ok = true;
+
+	{
+		FrameHandleFactory factory(PixelFormat::YUY2, kWidth, kHeight, 1);
+		auto single = std::make_shared<FakeFrameSource>(memory, kWidth * 2, 1, locks);
+		FrameHandle handle = factory.Lock(single);
+		ok &= handle && locks == 1 && single->copies == 0 && handle->data[0] == memory.data() && handle->pitch[0] == kWidth * 2;
+
+		FrameHandle consumer = handle;
+		handle.reset();
+		ok &= locks == 1;
+		std::weak_ptr<FakeFrameSource> sample = single;
+		single.reset();
+		ok &= !sample.expired();
+		consumer.reset();
+		ok &= locks == 0 && sample.expired();
+
+		auto fragmented = std::make_shared<FakeFrameSource>(memory, kWidth * 2, 3, locks);
+		handle = factory.Lock(fragmented);
+		ok &= handle && fragmented->copies == 1 && locks == 1;
+		consumer = factory.Lock(std::make_shared<FakeFrameSource>(memory, kWidth * 2, 1, locks));
+		ok &= consumer && locks == 2 && factory.Stats().overflows == 1;
+		handle.reset();
+		consumer.reset();
+
+		auto broken = std::make_shared<FakeFrameSource>(memory, kWidth * 2, 1, locks, false, false);
+		ok &= !factory.Lock(broken) && locks == 0;
+
+		const FrameHandleStats stats = factory.Stats();
+		ok &= stats.direct == 2 && stats.copied == 1 && stats.failures == 1 && stats.overflows == 1;
+	}
+
+	{
+		// A bottom-up NV12 buffer: data[0] is the top row, at the end of memory.
+		FrameHandleFactory factory(PixelFormat::NV12, kWidth, kHeight);
+		auto bottomUp = std::make_shared<FakeFrameSource>(memory, kWidth, 1, locks, true);
+		FrameHandle handle = factory.Lock(bottomUp);
+		ok &= handle && handle->planeCount == 2 && handle->pitch[0] == -static_cast<ptrdiff_t>(kWidth)
+			&& handle->data[0] == memory.data() + memory.size() - kWidth
+			&& handle->data[1] == handle->data[0] - static_cast<ptrdiff_t>(kWidth) * kHeight && handle->pitch[1] == handle->pitch[0];
+		handle.reset();
+		ok &= locks == 0;
+	}
+
+	std::cout << "verify frame handles: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// Bucket bounds and boundaries across the whole range, percentiles of a known distribution,
+// interval snapshots, and concurrent recording.
+inline bool VerifyLatencyHistogram() {
+	bool ok = true;
+
+	for (uint64_t value = 0; value < (uint64_t(1) << LatencyHistogram::kMaxExponent); value = value * 9 / 8 + 1) {
+		const uint64_t upper = LatencyHistogram::BucketUpperValue(LatencyHistogram::BucketFor(value));
+		ok &= upper >= value && upper - value <= value / LatencyHistogram::kSubBuckets;
+	}
+
+	// Every bucket starts right after the previous one ends.
+	for (uint32_t bucket = 0; bucket + 1 < LatencyHistogram::kBucketCount; ++bucket) {
+		const uint64_t upper = LatencyHistogram::BucketUpperValue(bucket);
+		ok &= LatencyHistogram::BucketFor(upper) == bucket && LatencyHistogram::BucketFor(upper + 1) == bucket + 1;
+	}
+	ok &= LatencyHistogram::BucketFor(UINT64_MAX) == LatencyHistogram::kBucketCount - 1;
+
+	LatencyHistogram histogram;
+	for (uint64_t value = 1; value <= 100000; ++value) {
+		histogram.Record(value);
+	}
+	const LatencySnapshot first = histogram.Snapshot();
+	for (double percentile : { 50.0, 90.0, 99.0, 99.9 }) {
+		const double expected = percentile * 1000.0;
+		const double reported = static_cast<double>(first.ValueAtPercentile(percentile));
+		ok &= reported >= expected && reported <= expected * (1.0 + 1.0 / LatencyHistogram::kSubBuckets);
+	}
+	ok &= first.count == 100000 && first.max == 100000 && first.Mean() == 50000.5;
+
+	for (int i = 0; i < 10; ++i) {
+		histogram.Record(std::chrono::milliseconds(5));
+	}
+	const LatencySnapshot interval = histogram.Snapshot().Since(first);
+	const uint64_t fiveMs = 5000000;
+	ok &= interval.count == 10 && interval.ValueAtPercentile(50.0) >= fiveMs && interval.max <= fiveMs + fiveMs / LatencyHistogram::kSubBuckets;
+
+	LatencyHistogram shared;
+	std::vector<std::thread> writers;
+	for (int t = 0; t < 4; ++t) {
+		writers.emplace_back([&shared, t]() {
+			for (uint64_t i = 0; i < 100000; ++i) {
+				shared.Record(i * 4 + t);
+			}
+		});
+	}
+	for (std::thread& writer : writers) {
+		writer.join();
+	}
+	const LatencySnapshot all = shared.Snapshot();
+	ok &= all.count == 400000 && all.max == 399999;
+
+	std::cout << "verify latency histogram: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// Spans from two threads, one of them overflowing its ring, written out as
+// trace-event JSON. Uses TraceSpan directly so it runs in builds without
+// FRAME_TRACING.
+inline bool VerifyFrameTracer() {
+	constexpr uint32_t kCapacity = 16;
+	FrameTracer& tracer = FrameTracer::Instance();
+	tracer.Start(kCapacity);
+
+	std::thread worker([]() {
+		FrameTracer::Instance().SetThreadName("check worker");
+		for (uint64_t frame = 0; frame < 100; ++frame) {
+			TraceSpan span("check band", "frame", frame);
+		}
+	});
+	worker.join();
+	for (uint64_t frame = 0; frame < 3; ++frame) {
+		TraceSpan span("check frame", "frame", frame);
+	}
+	tracer.Stop();
+
+	bool ok = true;
+	uint64_t bands = 0;
+	uint64_t frames = 0;
+	for (const auto& [buffer, events] : tracer.Collect()) {
+		for (const TraceEvent& event : events) {
+			const bool band = strcmp(event.name, "check band") == 0;
+			bands += band ? 1 : 0;
+			frames += strcmp(event.name, "check frame") == 0 ? 1 : 0;
+			ok &= event.end >= event.begin;
+			// The overflowing thread keeps its newest spans.
+			ok &= !band || (buffer->name == "check worker" && event.arg >= 100 - kCapacity);
+		}
+	}
+	ok &= bands == kCapacity && frames == 3;
+
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / "frame_tracer_check.json";
+	ok &= tracer.WriteJson(path.string().c_str());
+	std::ifstream in(path);
+	const std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	std::filesystem::remove(path);
+	ok &= json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0) == 0
+		&& json.find("\"args\":{\"name\":\"check worker\"}") != std::string::npos
+		&& json.find("\"name\":\"check frame\",\"ph\":\"X\"") != std::string::npos
+		&& json.size() > 2 && json.compare(json.size() - 4, 4, "\n]}\n") == 0;
+
+	std::cout << "verify frame tracer: " << bands + frames << " spans: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// Both clock mappings on a 30 fps stream with jittery delivery, and the gap
+// counts of a stream with frames missing.
+inline bool VerifyCaptureClock() {
+	using namespace std::chrono;
+	bool ok = true;
+	const int64_t period = FrameGapDetector::PeriodFor(30000, 1001);
+	const steady_clock::time_point start = steady_clock::now();
+	auto at = [&](int64_t hundredNs) { return start + duration_cast<steady_clock::duration>(nanoseconds(hundredNs * 100)); };
+	// Captured at i periods after start, delivered 5 ms later plus up to 4 ms
+	// of jitter; every 16th frame comes through without jitter.
+	auto jitter = [](int64_t i) { return i % 16 ? i * 7919 % 40000 : 0; };
+	auto delivered = [&](int64_t i) { return at(i * period + 50000 + jitter(i)); };
+
+	CaptureClock sourceClock;
+	const int64_t sourceEpoch = 123456789;
+	for (int64_t i = 0; i < 200; ++i) {
+		const int64_t delay = 50000 + jitter(i);
+		const steady_clock::time_point captured = sourceClock.Map(sourceEpoch + i * period, delivered(i), sourceEpoch + i * period + delay);
+		ok &= captured == at(i * period);
+	}
+	ok &= sourceClock.Mode() == CaptureClockMode::SourceClock;
+
+	// Stamps from a clock we cannot read: the estimate is never after arrival,
+	// and once the window has seen the quickest delivery it is that much
+	// before it, so the jitter is gone and only the fixed 5 ms remains.
+	CaptureClock estimated;
+	for (int64_t i = 0; i < 200; ++i) {
+		const steady_clock::time_point captured = estimated.Map(i * period, delivered(i));
+		ok &= captured <= delivered(i);
+		if (i >= CaptureClock::kWindow) {
+			ok &= captured == at(i * period + 50000);
+		}
+	}
+	ok &= estimated.Mode() == CaptureClockMode::Estimated;
+	ok &= estimated.Map(0, at(10'000'000)) == at(10'000'000); // clock restarted
+
+	FrameGapDetector gaps(period);
+	const int64_t stamps[] = { 0, 1, 2, 5, 6, 7, 9, 10, 4000, 4001 }; // in periods
+	uint32_t missed = 0;
+	for (int64_t stamp : stamps) {
+		missed += gaps.Observe(stamp * period + (stamp % 2 ? 20000 : -20000));
+	}
+	const FrameGapStats stats = gaps.Stats();
+	ok &= missed == 3 && stats.missed == 3 && stats.gaps == 2 && stats.discontinuities == 1 && stats.frames == 10;
+
+	std::cout << "verify capture clock: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// Paces simulated 60 fps frames that are ready 3 to 7 ms after capture, with
+// no real waiting: the sends happen exactly at the scheduled times.
+inline bool VerifyFramePacer() {
+	using namespace std::chrono;
+	bool ok = true;
+	const nanoseconds period(16666667);
+	const steady_clock::time_point start = steady_clock::now();
+	auto ready = [](int64_t i) { return milliseconds(3) + microseconds(i * 7919 % 4000); };
+
+	// On time: every frame goes out exactly one jitter buffer after capture.
+	FramePacer steady(period, milliseconds(8));
+	for (int64_t i = 0; i < 600; ++i) {
+		const steady_clock::time_point captured = start + period * i;
+		const steady_clock::time_point deadline = steady.Schedule(captured, captured + ready(i));
+		ok &= deadline == captured + milliseconds(8);
+		steady.Sent(deadline);
+	}
+	FramePacerStats stats = steady.Stats();
+	ok &= stats.frames == 600 && stats.late == 0 && stats.skipped == 0 && stats.restarts == 0;
+	ok &= stats.inputJitter.ValueAtPercentile(99.0) >= 1500000 && stats.outputJitter.max == 0;
+
+	// A camera 0.2% slower than its nominal rate drags the cadence along
+	// without slipping a slot.
+	FramePacer drifting(period, milliseconds(8));
+	for (int64_t i = 0; i < 6000; ++i) {
+		const steady_clock::time_point captured = start + period * i * 1002 / 1000;
+		drifting.Sent(drifting.Schedule(captured, captured + ready(i)));
+	}
+	stats = drifting.Stats();
+	ok &= stats.late == 0 && stats.skipped == 0 && stats.outputJitter.max < 100000;
+
+	// A missing frame leaves a slot empty, a frame ready past its slot goes out
+	// late, and a pause restarts the clock.
+	FramePacer gaps(period, milliseconds(8));
+	const int64_t frames[] = { 0, 1, 2, 4, 5, 6, 200, 201 };
+	for (int64_t i : frames) {
+		const steady_clock::time_point captured = start + period * i;
+		const steady_clock::time_point readyAt = captured + (i == 5 ? milliseconds(12) : ready(i));
+		const steady_clock::time_point deadline = gaps.Schedule(captured, readyAt);
+		ok &= deadline >= readyAt;
+		gaps.Sent(deadline);
+	}
+	stats = gaps.Stats();
+	ok &= stats.skipped == 1 && stats.late == 1 && stats.restarts == 1;
+
+	bool early = false;
+	for (int i = 0; i < 5; ++i) {
+		const steady_clock::time_point deadline = steady_clock::now() + microseconds(500 + i * 1000);
+		FramePacer::WaitUntil(deadline);
+		early |= steady_clock::now() < deadline;
+	}
+	ok &= !early;
+
+	std::cout << "verify frame pacer: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// Sink that counts frames and runs an optional check on each.
+class CheckingSink : public FrameSink {
+public:
+	explicit CheckingSink(std::function<bool(const SinkFrame&)> check = nullptr) : check_(std::move(check)) {}
+
+	void Send(SinkFrame& frame) override {
+		++frames_;
+		if (check_ && !check_(frame)) {
+			++failures_;
+		}
+	}
+
+	uint64_t Frames() const {
+		return frames_;
+	}
+
+	uint64_t Failures() const {
+		return failures_;
+	}
+
+private:
+	std::function<bool(const SinkFrame&)> check_;
+	uint64_t frames_{ 0 };
+	uint64_t failures_{ 0 };
+};
+
+// The whole pipeline behind the synthetic source: padded YUY2 to UYVY as fast
+// as it goes, every frame compared with the swapped source; then NV12 in real
+// time at 1000 fps with jittery timestamps and dropped frames, which the gap
+// detector has to find; then an endless source cut off at maxFrames, with
+// the capture ring full behind it, which must send exactly that many.
+inline bool VerifySyntheticPipeline() {
+	bool ok = true;
+
+	SyntheticCaptureConfig fast;
+	fast.width = 640;
+	fast.height = 360;
+	fast.pitchPadding = 96;
+	fast.realtime = false;
+	fast.frameCount = 3000;
+	SyntheticCaptureSource fastSource(fast);
+
+	ConversionConfig conversion;
+	conversion.threads = 2;
+	FrameConverter converter(conversion);
+	ok &= converter.Setup(fastSource.Format(), DefaultColorimetry(PixelFormat::YUY2, fast.height));
+
+	CheckingSink checking([&](const SinkFrame& frame) {
+		const uint8_t* src = fastSource.Frame(frame.index);
+		const uint8_t* dest = frame.frame.Data();
+		for (uint32_t y = 0; y < fast.height; y += 7) {
+			const uint8_t* srcRow = src + fastSource.Pitch() * y;
+			const uint8_t* destRow = dest + static_cast<size_t>(fast.width) * 2 * y;
+			for (uint32_t x = 0; x < fast.width * 2; x += 2) {
+				if (destRow[x] != srcRow[x + 1] || destRow[x + 1] != srcRow[x]) {
+					return false;
+				}
+			}
+		}
+		return true;
+	});
+
+	PipelineConfig config;
+	config.captureHandoff = HandoffPolicy::Block;
+	config.printStats = false;
+	CapturePipeline pipeline(config, fastSource, converter, checking);
+	ok &= pipeline.Initialize();
+	const auto start = std::chrono::steady_clock::now();
+	pipeline.Run();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	ok &= checking.Frames() == fast.frameCount && checking.Failures() == 0 && pipeline.RingStats().Dropped() == 0;
+	std::cout << "verify synthetic pipeline YUY2 640x360: " << checking.Frames() << " frames at "
+		<< static_cast<uint64_t>(checking.Frames() / seconds) << " fps: " << (ok ? "ok" : "FAILED") << std::endl;
+
+	SyntheticCaptureConfig lossy;
+	lossy.format = PixelFormat::NV12;
+	lossy.width = 320;
+	lossy.height = 180;
+	lossy.frameRateNumerator = 1000;
+	lossy.jitterMs = 0.2;
+	lossy.dropRate = 0.05;
+	lossy.frameCount = 500;
+	SyntheticCaptureSource lossySource(lossy);
+
+	conversion.outputFormat = PixelFormat::NV12;
+	FrameConverter copier(conversion);
+	ok &= copier.Setup(lossySource.Format(), DefaultColorimetry(PixelFormat::NV12, lossy.height));
+	CheckingSink counting;
+	config.captureHandoff = HandoffPolicy::DropOldest;
+	CapturePipeline lossyPipeline(config, lossySource, copier, counting);
+	ok &= lossyPipeline.Initialize();
+	lossyPipeline.Run();
+
+	const FrameGapStats gaps = lossyPipeline.GapStats();
+	const uint64_t seen = gaps.frames + gaps.missed;
+	const bool lossyOk = gaps.missed > 0 && seen <= lossy.frameCount && seen + 10 >= lossy.frameCount && gaps.discontinuities == 0
+		&& counting.Frames() + lossyPipeline.RingStats().Dropped() == gaps.frames;
+	ok &= lossyOk;
+	std::cout << "verify synthetic pipeline NV12 1000 fps: " << gaps.frames << " delivered, " << gaps.missed << " missed, "
+		<< counting.Frames() << " sent: " << (lossyOk ? "ok" : "FAILED") << std::endl;
+
+	SyntheticCaptureConfig endless = fast;
+	endless.frameCount = 0;
+	SyntheticCaptureSource endlessSource(endless);
+	CheckingSink limited;
+	config.captureHandoff = HandoffPolicy::Block;
+	config.maxFrames = 100;
+	CapturePipeline limitedPipeline(config, endlessSource, converter, limited);
+	ok &= limitedPipeline.Initialize();
+	limitedPipeline.Run();
+	const bool limitedOk = limited.Frames() == config.maxFrames && limitedPipeline.FramesSent() == config.maxFrames;
+	ok &= limitedOk;
+	std::cout << "verify synthetic pipeline max frames: " << limited.Frames() << " of " << config.maxFrames << " sent: "
+		<< (limitedOk ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// Past the first frames, the pipeline makes no heap allocation per frame on
+// either thread: samples and frame handles live in their slots and output
+// frames in the frame pool, whether the ring blocks or evicts. Counting needs
+// the operator new of main.cpp; without it the check is skipped.
+inline bool VerifySteadyStateAllocations() {
+	const uint64_t probe = g_allocationCount.load(std::memory_order_relaxed);
+	::operator delete(::operator new(1));
+	if (g_allocationCount.load(std::memory_order_relaxed) == probe) {
+		std::cout << "verify steady-state allocations: skipped, allocations are not counted" << std::endl;
+		return true;
+	}
+
+	constexpr uint64_t kWarmupFrames = 100;
+	constexpr uint64_t kMeasuredFrames = 1000;
+	bool ok = true;
+
+	for (HandoffPolicy policy : { HandoffPolicy::Block, HandoffPolicy::Latest }) {
+		SyntheticCaptureConfig capture;
+		capture.width = 640;
+		capture.height = 360;
+		capture.realtime = false;
+		SyntheticCaptureSource source(capture);
+
+		ConversionConfig conversion;
+		conversion.threads = 2;
+		FrameConverter converter(conversion);
+		bool policyOk = converter.Setup(source.Format(), DefaultColorimetry(PixelFormat::YUY2, capture.height));
+
+		CheckingSink sink;
+		PipelineConfig config;
+		config.captureHandoff = policy;
+		config.maxFrames = kWarmupFrames + kMeasuredFrames;
+		config.printStats = false;
+		CapturePipeline pipeline(config, source, converter, sink);
+		policyOk &= pipeline.Initialize();
+
+		uint64_t frames = 0;
+		uint64_t before = 0;
+		uint64_t after = 0;
+		pipeline.Run([&]() {
+			++frames;
+			if (frames == kWarmupFrames) {
+				before = g_allocationCount.load(std::memory_order_relaxed);
+			}
+			else if (frames == kWarmupFrames + kMeasuredFrames) {
+				after = g_allocationCount.load(std::memory_order_relaxed);
+			}
+		});
+
+		const double perFrame = static_cast<double>(after - before) / kMeasuredFrames;
+		policyOk &= frames == config.maxFrames && after == before && pipeline.HandleStats().overflows == 0;
+		ok &= policyOk;
+		std::cout << "verify steady-state allocations (" << HandoffPolicyName(policy) << "): " << std::fixed << std::setprecision(2)
+			<< perFrame << " per frame: " << (policyOk ? "ok" : "FAILED") << std::defaultfloat << std::endl;
+	}
+	return ok;
+}
+
+// One synthetic capture fanned out to five sinks: two UYVY sinks sharing a
+// conversion, one inline and one queued without drops, a UYVY sink too slow
+// for the capture, an NV12 sink on a second conversion, and a queued sink of
+// UYVY with proxies on a third. The slow sink has to drop its own frames
+// without holding up the others; the proxy sink has to get both levels of
+// every frame, still intact when its thread reads them.
+inline bool VerifySinkFanOut() {
+	SyntheticCaptureConfig capture;
+	capture.width = 320;
+	capture.height = 180;
+	capture.realtime = false;
+	capture.frameCount = 600;
+	SyntheticCaptureSource source(capture);
+
+	auto packedMatches = [&](const SinkFrame& frame) {
+		const uint8_t* src = source.Frame(frame.index);
+		const uint8_t* dest = frame.frame.Data();
+		for (uint32_t y = 0; y < capture.height; y += 7) {
+			const uint8_t* srcRow = src + source.Pitch() * y;
+			const uint8_t* destRow = dest + static_cast<size_t>(capture.width) * 2 * y;
+			for (uint32_t x = 0; x < capture.width * 2; x += 2) {
+				if (destRow[x] != srcRow[x + 1] || destRow[x + 1] != srcRow[x]) {
+					return false;
+				}
+			}
+		}
+		return true;
+	};
+	auto lumaMatches = [&](const SinkFrame& frame) {
+		const uint8_t* src = source.Frame(frame.index);
+		const uint8_t* dest = frame.frame.Data();
+		for (uint32_t y = 0; y < capture.height; y += 7) {
+			for (uint32_t x = 0; x < capture.width; ++x) {
+				if (dest[static_cast<size_t>(capture.width) * y + x] != src[source.Pitch() * y + x * 2]) {
+					return false;
+				}
+			}
+		}
+		return true;
+	};
+
+	CheckingSink inlineSink(packedMatches);
+	CheckingSink queuedSink(packedMatches);
+	CheckingSink slowSink([](const SinkFrame&) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		return true;
+	});
+	// Each level is the 2x2 box filter of the level above, the first of the
+	// frame itself.
+	auto proxiesMatch = [&](const SinkFrame& frame) {
+		const uint8_t* rows = frame.frame.Data();
+		size_t pitch = static_cast<size_t>(capture.width) * 2;
+		std::vector<uint8_t> expected(pitch);
+		for (const FrameRef& proxy : frame.proxies) {
+			if (!proxy) {
+				return false;
+			}
+			const FrameLayout& layout = proxy.Layout();
+			for (uint32_t y = 0; y < layout.height; y += 3) {
+				HalveRow422_Scalar<false>(rows + y * 2 * pitch, rows + (y * 2 + 1) * pitch, expected.data(), layout.width);
+				if (memcmp(expected.data(), proxy.Data() + y * layout.planePitch[0], static_cast<size_t>(layout.width) * 2) != 0) {
+					return false;
+				}
+			}
+			rows = proxy.Data();
+			pitch = layout.planePitch[0];
+		}
+		return true;
+	};
+
+	CheckingSink nv12Sink(lumaMatches);
+	CheckingSink proxySink(proxiesMatch);
+
+	ConversionConfig uyvy;
+	uyvy.threads = 2;
+	ConversionConfig nv12 = uyvy;
+	nv12.outputFormat = PixelFormat::NV12;
+	ConversionConfig withProxies = uyvy;
+	withProxies.proxies = true;
+
+	PipelineConfig config;
+	config.captureHandoff = HandoffPolicy::Block;
+	config.printStats = false;
+	FanOutPipeline pipeline(config, source);
+	pipeline.AddSink("inline", inlineSink, uyvy, { 0, HandoffPolicy::Latest });
+	pipeline.AddSink("queued", queuedSink, uyvy, { 4, HandoffPolicy::Block });
+	pipeline.AddSink("slow", slowSink, uyvy, { 1, HandoffPolicy::Latest });
+	pipeline.AddSink("nv12", nv12Sink, nv12, { 2, HandoffPolicy::DropOldest });
+	pipeline.AddSink("proxies", proxySink, withProxies, { 3, HandoffPolicy::Block });
+	bool ok = pipeline.Initialize(DefaultColorimetry(PixelFormat::YUY2, capture.height));
+
+	const auto start = std::chrono::steady_clock::now();
+	pipeline.Run();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	const SinkQueueStats slow = pipeline.SinkStats(2);
+	const SinkQueueStats nv12Stats = pipeline.SinkStats(3);
+	ok &= pipeline.ConversionCount() == 3;
+	ok &= inlineSink.Frames() == capture.frameCount && inlineSink.Failures() == 0;
+	ok &= queuedSink.Frames() == capture.frameCount && queuedSink.Failures() == 0;
+	ok &= slow.offered == capture.frameCount && slow.sent < capture.frameCount && slow.sent + slow.queue.Dropped() == slow.offered;
+	ok &= nv12Sink.Frames() == nv12Stats.sent && nv12Stats.sent + nv12Stats.queue.Dropped() == capture.frameCount && nv12Sink.Failures() == 0;
+	ok &= proxySink.Frames() == capture.frameCount && proxySink.Failures() == 0;
+	// Waiting for the slow sink would take 1.2 s.
+	ok &= seconds < 0.6;
+	std::cout << "verify sink fan-out: " << pipeline.ConversionCount() << " conversions, " << inlineSink.Frames() << " inline, "
+		<< queuedSink.Frames() << " queued, " << slow.sent << " slow, " << nv12Sink.Frames() << " nv12, "
+		<< proxySink.Frames() << " with proxies in "
+		<< seconds * 1000 << " ms: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// Four threads running frames on one pool at once: every band of every frame
+// has to run exactly once, on that frame's own function.
+inline bool VerifySharedBandPool() {
+	constexpr uint32_t kCallers = 4;
+	constexpr uint32_t kFrames = 500;
+	constexpr uint32_t kRows = 97;
+	BandPool pool(4);
+
+	std::atomic<bool> ok{ true };
+	std::vector<std::thread> callers;
+	for (uint32_t caller = 0; caller < kCallers; ++caller) {
+		callers.emplace_back([&, caller]() {
+			std::vector<uint32_t> rows(kRows);
+			for (uint32_t frame = 0; frame < kFrames; ++frame) {
+				std::fill(rows.begin(), rows.end(), 0u);
+				pool.Run(kRows, 3 + caller, [&](uint32_t first, uint32_t last) {
+					for (uint32_t y = first; y < last; ++y) {
+						rows[y] += frame + 1;
+					}
+				});
+				for (uint32_t y = 0; y < kRows; ++y) {
+					if (rows[y] != frame + 1) {
+						ok.store(false, std::memory_order_relaxed);
+					}
+				}
+			}
+		});
+	}
+	for (std::thread& caller : callers) {
+		caller.join();
+	}
+
+	const BandPoolStats stats = pool.Stats();
+	const bool passed = ok.load() && stats.runs == kCallers * kFrames;
+	std::cout << "verify shared band pool: " << kCallers << " callers, " << stats.runs << " frames, " << stats.waited
+		<< " waited for a turn: " << (passed ? "ok" : "FAILED") << std::endl;
+	return passed;
+}
+
+// Four synthetic cameras at different sizes, formats and frame rates, each
+// half a second long, converted to UYVY on one shared pool. Every frame has
+// to arrive and convert correctly, and the cameras have to run side by side:
+// one after another they would take two seconds.
+inline bool VerifyMultiCapture() {
+	struct CameraSetup {
+		PixelFormat format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t fps;
+	};
+	const CameraSetup setups[] = {
+		{ PixelFormat::YUY2, 1280, 720, 60 },
+		{ PixelFormat::NV12, 640, 360, 30 },
+		{ PixelFormat::UYVY, 1920, 1080, 30 },
+		{ PixelFormat::YUY2, 320, 240, 120 },
+	};
+
+	MultiCaptureConfig config;
+	config.workers = 4;
+	config.printStats = false;
+	MultiCapture cameras(config);
+
+	std::vector<std::unique_ptr<SyntheticCaptureSource>> sources;
+	std::vector<std::unique_ptr<CheckingSink>> sinks;
+	PipelineConfig pipeline;
+	pipeline.captureHandoff = HandoffPolicy::Block;
+	ConversionConfig uyvy;
+
+	bool ok = true;
+	for (const CameraSetup& setup : setups) {
+		SyntheticCaptureConfig capture;
+		capture.format = setup.format;
+		capture.width = setup.width;
+		capture.height = setup.height;
+		capture.frameRateNumerator = setup.fps;
+		capture.frameCount = setup.fps / 2;
+		sources.push_back(std::make_unique<SyntheticCaptureSource>(capture));
+		const SyntheticCaptureSource& source = *sources.back();
+
+		// Packed capture comes out byte-swapped (YUY2) or unchanged (UYVY).
+		const size_t swap = setup.format == PixelFormat::YUY2 ? 1 : 0;
+		sinks.push_back(std::make_unique<CheckingSink>([&source, setup, swap](const SinkFrame& frame) {
+			if (setup.format == PixelFormat::NV12) {
+				return true;
+			}
+			const uint8_t* src = source.Frame(frame.index);
+			const uint8_t* dest = frame.frame.Data();
+			for (uint32_t y = 0; y < setup.height; y += 13) {
+				const uint8_t* srcRow = src + source.Pitch() * y;
+				const uint8_t* destRow = dest + static_cast<size_t>(setup.width) * 2 * y;
+				for (uint32_t x = 0; x < setup.width * 2; x += 2) {
+					if (destRow[x] != srcRow[x + swap] || destRow[x + 1] != srcRow[x + 1 - swap]) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}));
+
+		const std::string name = std::string(PixelFormatName(setup.format)) + " " + std::to_string(setup.fps);
+		FanOutPipeline& camera = cameras.AddCamera(name, *sources.back(), pipeline);
+		camera.AddSink("check", *sinks.back(), uyvy, { 0, HandoffPolicy::Latest });
+		ok &= camera.Initialize(DefaultColorimetry(setup.format, setup.height));
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	cameras.Run();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint64_t expected = 0;
+	for (size_t i = 0; i < cameras.CameraCount(); ++i) {
+		const CameraStats stats = cameras.Stats(i);
+		ok &= stats.framesSent == setups[i].fps / 2 && stats.missed == 0 && stats.captureDropped == 0;
+		ok &= sinks[i]->Frames() == stats.framesSent && sinks[i]->Failures() == 0;
+		expected += setups[i].fps / 2;
+	}
+	const CameraStats total = cameras.TotalStats();
+	ok &= total.framesSent == expected && total.convert.count == expected;
+	ok &= seconds < 1.0;
+	std::cout << "verify multi-camera capture: " << cameras.CameraCount() << " cameras, " << total.framesSent << " frames in "
+		<< seconds * 1000 << " ms, convert p99 " << total.convert.ValueAtPercentile(99.0) / 1e6 << " ms: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// A synthetic capture recorded behind a blocking queue into segments of 4 MiB,
+// so 300 frames of 320x180 YUY2 roll over several times; then every segment
+// is read back: the frames have to be all there, in order, byte for byte the
+// converted frames, and findable by index, and each file trimmed to its data.
+// A second journal fed by hand has to roll over on time alone, and a third
+// has to stop and resume recording when a segment cannot be created, and a
+// record torn by a crash has to read as missing.
+inline bool VerifyFrameJournal() {
+	const std::filesystem::path directory = std::filesystem::temp_directory_path() / "frame_journal_check";
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+
+	SyntheticCaptureConfig capture;
+	capture.width = 320;
+	capture.height = 180;
+	capture.realtime = false;
+	capture.frameCount = 300;
+	SyntheticCaptureSource source(capture);
+
+	FrameJournalConfig journalConfig;
+	journalConfig.directory = directory.string();
+	journalConfig.name = "check";
+	journalConfig.segmentBytes = 4u << 20;
+	journalConfig.indexEntries = 256;
+	journalConfig.flushBytes = 1u << 20;
+	journalConfig.prefaultBytes = 2u << 20;
+	FrameJournal journal(journalConfig);
+	bool ok = journal.Open();
+
+	ConversionConfig uyvy;
+	uyvy.threads = 2;
+	PipelineConfig config;
+	config.captureHandoff = HandoffPolicy::Block;
+	config.printStats = false;
+	FanOutPipeline pipeline(config, source);
+	pipeline.AddSink("journal", journal, uyvy, { 8, HandoffPolicy::Block });
+	ok &= pipeline.Initialize(DefaultColorimetry(PixelFormat::YUY2, capture.height));
+	pipeline.Run();
+
+	const FrameJournalStats stats = journal.Stats();
+	const size_t frameBytes = static_cast<size_t>(capture.width) * 2 * capture.height;
+	ok &= stats.records == capture.frameCount && stats.rejected == 0 && stats.flushFailures == 0 && stats.segments > 2;
+
+	uint64_t nextFrame = 0;
+	uint64_t segments = 0;
+	for (uint64_t segment = 0; ok && std::filesystem::exists(journal.SegmentPath(segment)); ++segment, ++segments) {
+		FrameJournalReader reader;
+		if (!reader.Open(journal.SegmentPath(segment))) {
+			ok = false;
+			break;
+		}
+		const FrameJournalHeader& header = reader.Header();
+		ok &= header.segment == segment && header.closed == 1 && header.recordCount != 0 && reader.FileBytes() == header.dataEnd;
+		for (uint64_t i = 0; ok && i < reader.RecordCount(); ++i, ++nextFrame) {
+			const FrameJournalRecord* record = reader.Record(i);
+			ok &= record && record->frameIndex == nextFrame && record->format == static_cast<uint32_t>(PixelFormat::UYVY)
+				&& record->width == capture.width && record->height == capture.height && record->payloadBytes == frameBytes
+				&& strcmp(record->formatName, "UYVY") == 0;
+			if (!ok) {
+				break;
+			}
+			const uint8_t* src = source.Frame(nextFrame);
+			const uint8_t* dest = reader.Payload(*record);
+			for (uint32_t y = 0; y < capture.height; ++y) {
+				const uint8_t* srcRow = src + source.Pitch() * y;
+				const uint8_t* destRow = dest + static_cast<size_t>(capture.width) * 2 * y;
+				for (uint32_t x = 0; x < capture.width * 2; x += 2) {
+					ok &= destRow[x] == srcRow[x + 1] && destRow[x + 1] == srcRow[x];
+				}
+			}
+		}
+		const uint64_t first = reader.Entry(0).frameIndex;
+		const uint64_t last = first + reader.RecordCount() - 1;
+		ok &= reader.FindFrame(first) == reader.Record(0) && reader.FindFrame(last) == reader.Record(reader.RecordCount() - 1)
+			&& reader.FindFrame((first + last) / 2) && reader.FindFrame((first + last) / 2)->frameIndex == (first + last) / 2
+			&& !reader.FindFrame(last + 1);
+	}
+	ok &= nextFrame == capture.frameCount && segments == stats.segments;
+
+	// Ten small frames 20 ms apart into segments that last 50 ms.
+	FrameJournalConfig timedConfig = journalConfig;
+	timedConfig.name = "timed";
+	timedConfig.segmentSeconds = 0.05;
+	FrameJournal timed(timedConfig);
+	ok &= timed.Open();
+	const FrameLayout small = PackedFrameLayout(PixelFormat::UYVY, 64, 32);
+	std::vector<uint8_t> pixels(small.totalBytes, 0x80);
+	for (uint64_t i = 0; i < 10; ++i) {
+		ok &= timed.Append(small, pixels.data(), i, std::chrono::steady_clock::now());
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	timed.Close();
+	const FrameJournalStats timedStats = timed.Stats();
+	ok &= timedStats.records == 10 && timedStats.segments >= 3 && timedStats.segments <= 5;
+
+	// A directory where the third segment should go makes creating it fail:
+	// once the second is full, frames are rejected, and when the way is clear
+	// a retry brings the third in and recording resumes.
+	FrameJournalConfig blockedConfig = journalConfig;
+	blockedConfig.name = "blocked";
+	blockedConfig.indexEntries = 16;
+	blockedConfig.retrySeconds = 0.02;
+	FrameJournal blocked(blockedConfig);
+	std::filesystem::create_directories(blocked.SegmentPath(2), error);
+	ok &= blocked.Open();
+	uint64_t frame = 0;
+	for (; frame < 32; ++frame) {
+		ok &= blocked.Append(small, pixels.data(), frame, std::chrono::steady_clock::now());
+	}
+	for (int i = 0; i < 4; ++i) {
+		ok &= !blocked.Append(small, pixels.data(), frame, std::chrono::steady_clock::now());
+	}
+	const FrameJournalStats stalled = blocked.Stats();
+	ok &= stalled.stopped && stalled.rejected == 4 && stalled.segmentFailures == 1 && stalled.segments == 2;
+	std::filesystem::remove(blocked.SegmentPath(2), error);
+	bool resumed = false;
+	for (int attempt = 0; attempt < 200 && !resumed; ++attempt) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		resumed = blocked.Append(small, pixels.data(), frame, std::chrono::steady_clock::now());
+	}
+	blocked.Close();
+	const FrameJournalStats resumedStats = blocked.Stats();
+	FrameJournalReader third;
+	ok &= resumed && !resumedStats.stopped && resumedStats.segments == 3 && resumedStats.records == 33
+		&& third.Open(blocked.SegmentPath(2)) && third.RecordCount() == 1 && third.Entry(0).frameIndex == frame;
+
+	// A copy of the first segment whose last record was not written whole
+	// reads as one frame short.
+	const std::string tornPath = (directory / "torn.fjr").string();
+	std::filesystem::copy_file(blocked.SegmentPath(0), tornPath, error);
+	uint64_t tornOffset = 0;
+	{
+		FrameJournalReader first;
+		ok &= first.Open(blocked.SegmentPath(0)) && first.RecordCount() == blockedConfig.indexEntries;
+		tornOffset = ok ? first.Entry(first.RecordCount() - 1).offset : 0;
+	}
+	{
+		std::fstream file(tornPath, std::ios::in | std::ios::out | std::ios::binary);
+		const uint32_t zero = 0;
+		file.seekp(static_cast<std::streamoff>(tornOffset));
+		file.write(reinterpret_cast<const char*>(&zero), sizeof(zero));
+		ok &= !error && file.good();
+	}
+	FrameJournalReader torn;
+	ok &= torn.Open(tornPath) && torn.Record(0) && !torn.Record(torn.RecordCount() - 1);
+
+	std::filesystem::remove_all(directory, error);
+	std::cout << "verify frame journal: " << stats.records << " frames in " << segments << " segments, " << stats.flushes
+		<< " flushes, " << stats.segmentWaits << " waits for a segment; " << timedStats.segments << " timed segments; "
+		<< resumedStats.rejected << " rejected while stopped: "
+		<< (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+// Media type selection against type lists recorded from real devices: a
+// webcam with YUY2 only at low resolutions or rates and MJPG up to 4K, and a
+// capture device offering the same modes in NV12 and YUY2.
+inline bool VerifyMediaNegotiation() {
+	const std::vector<MediaTypeCandidate> webcam = {
+		{ 0, PixelFormat::YUY2, 640, 480, 30, 1 },
+		{ 1, PixelFormat::YUY2, 1280, 720, 10, 1 },
+		{ 2, PixelFormat::YUY2, 1920, 1080, 5, 1 },
+		{ 3, PixelFormat::MJPG, 1280, 720, 30, 1 },
+		{ 4, PixelFormat::MJPG, 1920, 1080, 30, 1 },
+		{ 5, PixelFormat::MJPG, 1920, 1080, 60, 1 },
+		{ 6, PixelFormat::MJPG, 3840, 2160, 30, 1 },
+	};
+	const std::vector<MediaTypeCandidate> capture = {
+		{ 0, PixelFormat::YUY2, 1920, 1080, 30, 1 },
+		{ 1, PixelFormat::NV12, 1920, 1080, 30, 1 },
+		{ 2, PixelFormat::NV12, 3840, 2160, 30, 1 },
+		{ 3, PixelFormat::NV12, 1920, 1080, 120, 1 },
+		{ 4, PixelFormat::YUY2, 1280, 720, 60, 1 },
+	};
+	const NegotiationConstraints hd;
+	NegotiationConstraints uhd60;
+	uhd60.minWidth = 3840;
+	uhd60.minHeight = 2160;
+	uhd60.minFrameRate = 60.0;
+	bool ok = true;
+	auto expect = [&](const NegotiationResult& result, ptrdiff_t selected, bool meets) {
+		ok &= result.selected == selected && result.meetsConstraints == meets;
+	};
+
+	// The webcam only makes 1080p30 in MJPG; the cheapest such mode wins.
+	const NegotiationResult webcamHD = SelectMediaType(webcam, PixelFormat::UYVY, hd);
+	expect(webcamHD, 4, true);
+	ok &= webcamHD.score == 6.0 * 1920 * 1080 * 30;
+	// Nothing reaches 4K60: the highest pixel rate is the fallback.
+	expect(SelectMediaType(webcam, PixelFormat::UYVY, uhd60), 6, false);
+
+	// YUY2 and NV12 1080p cost the same for UYVY, so the native order decides;
+	// NV12 alone passes through, so it wins for an NV12 sink.
+	expect(SelectMediaType(capture, PixelFormat::UYVY, hd), 0, true);
+	expect(SelectMediaType(capture, PixelFormat::NV12, hd), 1, true);
+	// 4K30 and 1080p120 cost the same: the higher frame rate wins, whichever
+	// comes first.
+	const std::vector<MediaTypeCandidate> sameRate = { capture[2], capture[3] };
+	const std::vector<MediaTypeCandidate> sameRateReversed = { capture[3], capture[2] };
+	expect(SelectMediaType(sameRate, PixelFormat::UYVY, hd), 1, true);
+	expect(SelectMediaType(sameRateReversed, PixelFormat::UYVY, hd), 0, true);
+
+	// NV12 cannot feed a BGRA sink, so NV12 and BGRA together need YUY2.
+	expect(SelectMediaType(capture, std::vector<PixelFormat>{ PixelFormat::NV12, PixelFormat::BGRA }, hd), 0, true);
+	ok &= MediaTypeScore(capture[1], std::vector<PixelFormat>{ PixelFormat::NV12, PixelFormat::BGRA }) < 0.0;
+	// Below the floor only convertible modes fall back: for I420, the NV12
+	// modes with higher pixel rates are passed over for 1080p YUY2.
+	expect(SelectMediaType(capture, PixelFormat::I420, uhd60), 0, false);
+
+	// Nothing to pick from, or nothing that converts.
+	const std::vector<MediaTypeCandidate> nv12Only = { capture[1], capture[2], capture[3] };
+	expect(SelectMediaType({}, PixelFormat::UYVY, hd), -1, false);
+	expect(SelectMediaType(nv12Only, PixelFormat::I420, hd), -1, false);
+	expect(SelectMediaType(nv12Only, std::vector<PixelFormat>{ PixelFormat::UYVY, PixelFormat::BGRA }, hd), -1, false);
+
+	std::cout << "verify media negotiation: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+#ifdef MJPEG_LIBJPEG
+
+// Encodes a UYVY frame with libjpeg at the given chroma subsampling.
+inline std::vector<uint8_t> EncodeJpegForCheck(const uint8_t* frame, size_t pitch, uint32_t width, uint32_t height, int chromaRows) {
+	jpeg_compress_struct info{};
+	jpeg_error_mgr error{};
+	info.err = jpeg_std_error(&error);
+	jpeg_create_compress(&info);
+
+	unsigned char* buffer = nullptr;
+	unsigned long size = 0;
+	jpeg_mem_dest(&info, &buffer, &size);
+	info.image_width = width;
+	info.image_height = height;
+	info.input_components = 3;
+	info.in_color_space = JCS_YCbCr;
+	jpeg_set_defaults(&info);
+	jpeg_set_quality(&info, 95, TRUE);
+	info.comp_info[0].h_samp_factor = 2;
+	info.comp_info[0].v_samp_factor = chromaRows;
+	jpeg_start_compress(&info, TRUE);
+
+	std::vector<uint8_t> row(static_cast<size_t>(width) * 3);
+	while (info.next_scanline < info.image_height) {
+		const uint8_t* src = frame + pitch * info.next_scanline;
+		for (uint32_t x = 0; x < width; ++x) {
+			row[3 * x + 0] = src[2 * x + 1];
+			row[3 * x + 1] = src[(x & ~1u) * 2];
+			row[3 * x + 2] = src[(x & ~1u) * 2 + 2];
+		}
+		JSAMPROW rowPointer = row.data();
+		jpeg_write_scanlines(&info, &rowPointer, 1);
+	}
+	jpeg_finish_compress(&info);
+	jpeg_destroy_compress(&info);
+
+	std::vector<uint8_t> jpeg(buffer, buffer + size);
+	free(buffer);
+	return jpeg;
+}
+
+// Mean absolute difference between the luma of a decoded frame and of the
+// UYVY frame it was encoded from, over every third row.
+inline double MeanLumaError(const uint8_t* decoded, const FrameLayout& layout, const uint8_t* source, size_t sourcePitch) {
+	const bool packed = layout.format == PixelFormat::UYVY;
+	double error = 0.0;
+	uint64_t samples = 0;
+	for (uint32_t y = 0; y < layout.height; y += 3) {
+		const uint8_t* src = source + sourcePitch * y;
+		const uint8_t* row = decoded + layout.planePitch[0] * y;
+		for (uint32_t x = 0; x < layout.width; ++x) {
+			error += std::abs(static_cast<int>(packed ? row[2 * x + 1] : row[x]) - src[2 * x + 1]);
+		}
+		samples += layout.width;
+	}
+	return error / static_cast<double>(samples);
+}
+
+// Synthetic frames encoded at 4:2:2 and 4:2:0 decode to UYVY and NV12 close
+// to the source, with an odd height to exercise the last strip.
+inline bool VerifyMJPEGDecode() {
+	SyntheticCaptureConfig config;
+	config.format = PixelFormat::UYVY;
+	config.width = 320;
+	config.height = 181;
+	config.realtime = false;
+	SyntheticCaptureSource source(config);
+	const uint8_t* frame = source.Frame(3);
+	const uint32_t width = source.Format().width;
+	const uint32_t height = source.Format().height;
+
+	bool ok = true;
+	LibjpegMJPEGDecoder decoder;
+	for (int chromaRows : { 1, 2 }) {
+		const std::vector<uint8_t> jpeg = EncodeJpegForCheck(frame, source.Pitch(), width, height, chromaRows);
+		for (PixelFormat format : { PixelFormat::UYVY, PixelFormat::NV12 }) {
+			const FrameLayout layout = PackedFrameLayout(format, width, height);
+			std::vector<uint8_t> decoded(layout.totalBytes);
+			bool caseOk = decoder.Decode(jpeg.data(), jpeg.size(), layout, decoded.data());
+
+			// Mean absolute error of luma and of chroma, against the source.
+			double lumaError = 0.0;
+			double chromaError = 0.0;
+			for (uint32_t y = 0; caseOk && y < height; ++y) {
+				const uint8_t* src = frame + source.Pitch() * y;
+				for (uint32_t x = 0; x < width; ++x) {
+					const uint8_t luma = format == PixelFormat::UYVY
+						? decoded[layout.planePitch[0] * y + 2 * x + 1]
+						: decoded[layout.planePitch[0] * y + x];
+					lumaError += std::abs(luma - src[2 * x + 1]);
+				}
+				for (uint32_t x = 0; x < width; x += 2) {
+					const uint8_t* chroma = format == PixelFormat::UYVY
+						? &decoded[layout.planePitch[0] * y + 2 * x]
+						: &decoded[layout.planeOffset[1] + layout.planePitch[1] * (y / 2) + x];
+					const size_t stride = format == PixelFormat::UYVY ? 2 : 1;
+					chromaError += std::abs(chroma[0] - src[2 * x]) + std::abs(chroma[stride] - src[2 * x + 2]);
+				}
+			}
+			lumaError /= static_cast<double>(width) * height;
+			chromaError /= static_cast<double>(width) * height;
+			caseOk &= lumaError < 2.0 && chromaError < 3.0;
+			ok &= caseOk;
+			std::cout << "verify MJPEG decode 4:2:" << (chromaRows == 1 ? "2" : "0") << " -> " << PixelFormatName(format) << ": mean error "
+				<< std::fixed << std::setprecision(2) << lumaError << " luma, " << chromaError << " chroma: " << (caseOk ? "ok" : "FAILED")
+				<< std::defaultfloat << std::endl;
+		}
+	}
+	return ok;
+}
+
+// Replays JPEG frames in turn as an MJPG camera would deliver them, as fast as
+// they are read.
+class JpegReplaySource : public CaptureSource {
+public:
+	JpegReplaySource(const std::vector<std::vector<uint8_t>>& frames, uint32_t width, uint32_t height, uint64_t frameCount)
+		: frames_(frames), width_(width), height_(height), frameCount_(frameCount) {}
+
+	const char* Name() const override {
+		return "JPEG replay";
+	}
+
+	CaptureFormat Format() const override {
+		return { PixelFormat::MJPG, width_, height_, 60, 1 };
+	}
+
+	CaptureReadStatus Read(CapturedSample& sample) override {
+		if (next_ == frameCount_) {
+			return CaptureReadStatus::EndOfStream;
+		}
+		const std::vector<uint8_t>& jpeg = frames_[next_ % frames_.size()];
+		sample.frame = std::make_shared<SyntheticFrameSource>(jpeg.data(), static_cast<ptrdiff_t>(jpeg.size()));
+		sample.timestamp = static_cast<int64_t>(next_++) * 166667;
+		return CaptureReadStatus::Sample;
+	}
+
+private:
+	const std::vector<std::vector<uint8_t>>& frames_;
+	uint32_t width_;
+	uint32_t height_;
+	uint64_t frameCount_;
+	uint64_t next_{ 0 };
+};
+
+// An MJPG capture through the pipeline into UYVY and NV12 outputs on a shared
+// pool: the capture runs ahead of the decode, so frames are decoded several
+// at once, every frame decodes close to its source, and the corrupt ones are
+// counted and not sent.
+inline bool VerifyMJPEGPipeline() {
+	SyntheticCaptureConfig synthetic;
+	synthetic.format = PixelFormat::UYVY;
+	synthetic.width = 1280;
+	synthetic.height = 720;
+	synthetic.realtime = false;
+	SyntheticCaptureSource frames(synthetic);
+
+	// One phase of the motion is replaced by a frame that is not a JPEG.
+	constexpr uint32_t kCorruptPhase = 5;
+	std::vector<std::vector<uint8_t>> jpegs;
+	for (uint32_t phase = 0; phase < SyntheticCaptureSource::kPhases; ++phase) {
+		jpegs.push_back(phase == kCorruptPhase ? std::vector<uint8_t>(4096, 0x5A)
+			: EncodeJpegForCheck(frames.Frame(phase), frames.Pitch(), synthetic.width, synthetic.height, 1));
+	}
+	constexpr uint64_t kFrames = 64;
+	JpegReplaySource source(jpegs, synthetic.width, synthetic.height, kFrames);
+
+	BandPool workers(4);
+	bool ok = true;
+	ConversionConfig conversion;
+	FrameConverter toUYVY(conversion, workers);
+	conversion.outputFormat = PixelFormat::NV12;
+	FrameConverter toNV12(conversion, workers);
+	const YUVColorimetry colorimetry = DefaultColorimetry(PixelFormat::MJPG, synthetic.height);
+	ok &= toUYVY.Setup(source.Format(), colorimetry) && toNV12.Setup(source.Format(), colorimetry);
+	ok &= toUYVY.FramesInFlight() == workers.WorkerCount();
+
+	auto decodedLikeSource = [&](const SinkFrame& frame) {
+		const uint64_t phase = frame.index % SyntheticCaptureSource::kPhases;
+		return phase != kCorruptPhase && MeanLumaError(frame.frame.Data(), frame.frame.Layout(), frames.Frame(phase), frames.Pitch()) < 2.0;
+	};
+	CheckingSink uyvy(decodedLikeSource);
+	CheckingSink nv12(decodedLikeSource);
+
+	PipelineConfig config;
+	config.captureHandoff = HandoffPolicy::Block;
+	config.printStats = false;
+	CapturePipeline pipeline(config, source, toUYVY, uyvy);
+	pipeline.AddOutput(toNV12, nv12, config.poolDepth);
+	ok &= pipeline.Initialize();
+	pipeline.Run();
+
+	const uint64_t corrupt = kFrames / SyntheticCaptureSource::kPhases;
+	ok &= uyvy.Frames() == kFrames - corrupt && nv12.Frames() == kFrames - corrupt && uyvy.Failures() == 0 && nv12.Failures() == 0
+		&& pipeline.ConvertFailures() == 2 * corrupt && pipeline.LargestBatch() > 1 && pipeline.PoolStats(0).exhausted == 0;
+	std::cout << "verify MJPEG pipeline: " << uyvy.Frames() << " + " << nv12.Frames() << " frames sent, " << pipeline.ConvertFailures()
+		<< " failed to decode, up to " << pipeline.LargestBatch() << " in flight: " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+#endif // MJPEG_LIBJPEG
+
+inline bool VerifyPipeline() {
+	bool ok = VerifyFrameRing();
+	ok &= VerifyHandoffPolicies();
+	ok &= VerifyFramePool();
+	ok &= VerifyFrameHandles();
+	ok &= VerifyLatencyHistogram();
+	ok &= VerifyFrameTracer();
+	ok &= VerifyCaptureClock();
+	ok &= VerifyFramePacer();
+	ok &= VerifySyntheticPipeline();
+	ok &= VerifySteadyStateAllocations();
+	ok &= VerifySinkFanOut();
+	ok &= VerifySharedBandPool();
+	ok &= VerifyMultiCapture();
+	ok &= VerifyFrameJournal();
+	ok &= VerifyMediaNegotiation();
+#ifdef MJPEG_LIBJPEG
+	ok &= VerifyMJPEGDecode();
+	ok &= VerifyMJPEGPipeline();
+#endif
+	return ok;
+}
+
+// Cost of one push/pop handoff between two threads, with the consumer
+// polling TryPop and with it sleeping in Pop.
+inline void BenchFrameRing() {
+	constexpr uint64_t kFrames = 1000000;
+
+	for (bool blocking : { false, true }) {
+		FrameRing<SyntheticFrame> ring(8);
+		const auto start = std::chrono::steady_clock::now();
+
+		std::thread producer([&]() {
+			for (uint64_t i = 0; i < kFrames; ++i) {
+				SyntheticFrame frame{ i, {} };
+				while (!ring.TryPush(frame)) {
+					std::this_thread::yield();
+				}
+			}
+			ring.Close();
+		});
+
+		uint64_t consumed = 0;
+		SyntheticFrame frame;
+		if (blocking) {
+			while (ring.Pop(frame)) {
+				++consumed;
+			}
+		}
+		else {
+			while (consumed < kFrames) {
+				if (ring.TryPop(frame)) {
+					++consumed;
+				}
+				else {
+					std::this_thread::yield();
+				}
+			}
+		}
+		producer.join();
+
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "frame ring " << (blocking ? "Pop   " : "TryPop") << ": " << std::fixed << std::setprecision(1)
+			<< elapsed.count() / consumed * 1e9 << " ns/frame" << std::endl;
+	}
+}
+
+// Cost of acquiring a buffer and dropping the last ref to it.
+inline void BenchFramePool() {
+	constexpr uint64_t kIterations = 10000000;
+	FramePool pool;
+	uint32_t index = 0;
+	if (!pool.AddClass(PackedFrameLayout(PixelFormat::UYVY, 1920, 1080), 3, index)) {
+		return;
+	}
+
+	FrameRef held = pool.Acquire(index);
+	const auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < kIterations; ++i) {
+		FrameRef frame = pool.Acquire(index);
+		held = std::move(frame);
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "frame pool acquire/release: " << std::fixed << std::setprecision(1)
+		<< elapsed.count() / kIterations * 1e9 << " ns/frame" << std::endl;
+}
+
+// Cost of one Record() from a single thread.
+inline void BenchLatencyHistogram() {
+	constexpr uint64_t kSamples = 50000000;
+	LatencyHistogram histogram;
+	uint64_t value = 12345;
+	const auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < kSamples; ++i) {
+		value = value * 6364136223846793005ull + 1442695040888963407ull;
+		histogram.Record((value >> 40) & 0xFFFFFF);
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "latency histogram record: " << std::fixed << std::setprecision(1)
+		<< elapsed.count() / kSamples * 1e9 << " ns/sample" << std::endl;
+}
+
+inline void BenchPipeline() {
+	BenchFrameRing();
+	BenchFramePool();
+	BenchLatencyHistogram();
+}
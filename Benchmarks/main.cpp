@@ -0,0 +1,1141 @@
+// Headless benchmarks for the conversion kernels in common/.
+//
+// Needs no camera, NDI runtime or Windows headers, so it builds with MSVC as
+// part of the solution and with any C++20 compiler elsewhere, e.g.
+//
+//   g++ -O2 -std=c++20 -pthread main.cpp -o benchmarks -ltbb
+//
+// (libstdc++ implements std::execution::par, used as the baseline for the
+// BandPool comparison, on top of TBB when it is installed.) Add
+// -DMJPEG_LIBJPEG -ljpeg to build the libjpeg-turbo MJPEG decoder the capture
+// pipeline uses for MJPG cameras, and its checks.
+//
+// Every SIMD variant is first checked for bit-exactness against the scalar
+// reference; the process exits non-zero on any mismatch.
+//
+// `--pipeline` instead runs the whole capture -> convert -> send pipeline from
+// a synthetic or replayed source into a null or counting sink (see
+// PipelineBench.h).
+//
+// `--suite` instead runs every kernel over resolutions, pitch paddings, thread
+// counts and cache states against measured memory bandwidth, optionally
+// writing JSON (see KernelSuite.h).
+//
+// `--mjpeg <dir> [--threads N] [--passes N] [--format uyvy|nv12]
+// [--decoder libjpeg|mft]` instead benchmarks MJPEG decoding of a directory of
+// JPEG frames, with libjpeg-turbo or, on Windows, the Media Foundation decoder
+// (see MJPEGDecodeBench.h).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <execution>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/BandPool.h"
+#include "../common/ColorConvert.h"
+#include "../common/CropScale.h"
+#include "../common/FrameConvert.h"
+#include "../common/Orientation.h"
+#include "../common/PixelConvert.h"
+#include "../common/PixelFormat.h"
+#include "../common/ProxyPyramid.h"
+#include "KernelSuite.h"
+#include "PerfCounters.h"
+#include "PipelineBench.h"
+#include "PipelineChecks.h"
+
+#include "MJPEGDecodeBench.h"
+
+// Counts heap allocations for the pipeline benchmark. The plain, array and
+// sized forms all go to malloc() and free(); over-aligned allocations (only
+// the frame pool's, at setup) keep the library's and are not counted.
+void* operator new(size_t size) {
+	CountAllocation();
+	if (void* p = malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+	CountAllocation();
+	if (void* p = malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+// GCC sees these inlined after operator new and takes free() for a mismatch.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+struct Resolution {
+	const char* name;
+	uint32_t width;
+	uint32_t height;
+};
+
+static const Resolution kResolutions[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "2160p", 3840, 2160 },
+};
+
+static std::vector<SimdLevel> SupportedLevels() {
+	std::vector<SimdLevel> levels;
+	for (int i = 0; i <= static_cast<int>(ActiveSimdLevel()); ++i) {
+		levels.push_back(static_cast<SimdLevel>(i));
+	}
+	return levels;
+}
+
+static void FillPattern(std::vector<uint8_t>& data, uint32_t seed) {
+	uint32_t state = seed * 2654435761u + 1;
+	for (auto& value : data) {
+		state = state * 1664525u + 1013904223u;
+		value = static_cast<uint8_t>(state >> 24);
+	}
+}
+
+// Converts a width x height YUY2 image with the given source pitch padding and
+// compares the packed result against the scalar reference. destOffset shifts
+// the destination to cover every alignment the streaming-store kernels handle.
+static bool VerifyYUY2ToUYVY(YUY2ToUYVYRowFunc row, uint32_t width, uint32_t height, uint32_t padding, uint32_t destOffset = 0) {
+	const size_t srcPitch = static_cast<size_t>(width) * 2 + padding;
+	const size_t dstPitch = static_cast<size_t>(width) * 2;
+
+	std::vector<uint8_t> src(srcPitch * height);
+	FillPattern(src, width * 131 + padding);
+
+	// Guard bytes after every row catch kernels that write past the row end.
+	std::vector<uint8_t> expected(dstPitch * height + 128, 0xCD);
+	std::vector<uint8_t> actual(dstPitch * height + 128, 0xCD);
+
+	for (uint32_t y = 0; y < height; ++y) {
+		YUY2ToUYVYRow_Scalar(src.data() + y * srcPitch, expected.data() + destOffset + y * dstPitch, width);
+		row(src.data() + y * srcPitch, actual.data() + destOffset + y * dstPitch, width);
+	}
+	StoreFence();
+
+	return expected == actual;
+}
+
+// Same for the planar outputs, through the frame-level functions so the odd
+// final row and the plane offsets are covered as well.
+template <typename RowFunc, typename FrameFunc>
+static bool VerifyYUY2ToPlanar(BandPool& pool, PixelFormat format, RowFunc reference, RowFunc row, FrameFunc convertFrame, uint32_t width, uint32_t height, uint32_t padding) {
+	const size_t srcPitch = static_cast<size_t>(width) * 2 + padding;
+	const FrameLayout layout = PackedFrameLayout(format, width, height);
+
+	std::vector<uint8_t> src(srcPitch * height);
+	FillPattern(src, width * 7 + padding);
+
+	std::vector<uint8_t> expected(layout.totalBytes + 64, 0xCD);
+	std::vector<uint8_t> actual(layout.totalBytes + 64, 0xCD);
+
+	convertFrame(pool, reference, src.data(), static_cast<ptrdiff_t>(srcPitch), layout, expected.data());
+	convertFrame(pool, row, src.data(), static_cast<ptrdiff_t>(srcPitch), layout, actual.data());
+
+	return expected == actual;
+}
+
+// NV12 input through the frame-level function, with separate (and different)
+// Y and UV pitches so a kernel reading the wrong plane shows up.
+static bool VerifyNV12ToUYVY(BandPool& pool, NV12ToUYVYRowFunc reference, NV12ToUYVYRowFunc row, uint32_t width, uint32_t height, uint32_t padding) {
+	const size_t pitchY = static_cast<size_t>(width) + padding;
+	const size_t pitchUV = static_cast<size_t>(width) + padding * 2;
+	const size_t destBytes = static_cast<size_t>(width) * 2 * height;
+
+	std::vector<uint8_t> srcY(pitchY * height);
+	std::vector<uint8_t> srcUV(pitchUV * ((height + 1) / 2));
+	FillPattern(srcY, width * 3 + padding);
+	FillPattern(srcUV, width * 5 + padding);
+
+	std::vector<uint8_t> expected(destBytes + 64, 0xCD);
+	std::vector<uint8_t> actual(destBytes + 64, 0xCD);
+
+	NV12ToUYVYWithPitch(pool, reference, srcY.data(), pitchY, srcUV.data(), pitchUV, expected.data(), width, height);
+	NV12ToUYVYWithPitch(pool, row, srcY.data(), pitchY, srcUV.data(), pitchUV, actual.data(), width, height);
+
+	return expected == actual;
+}
+
+static bool VerifyYUY2ToRGB(YUY2ToRGBRowFunc reference, YUY2ToRGBRowFunc row, const YUVToRGBCoefficients& coefficients, uint32_t width, uint32_t height, uint32_t padding) {
+	const size_t srcPitch = static_cast<size_t>(width) * 2 + padding;
+	const size_t dstPitch = static_cast<size_t>(width) * 4;
+
+	std::vector<uint8_t> src(srcPitch * height);
+	FillPattern(src, width * 11 + padding);
+
+	std::vector<uint8_t> expected(dstPitch * height + 64, 0xCD);
+	std::vector<uint8_t> actual(dstPitch * height + 64, 0xCD);
+
+	for (uint32_t y = 0; y < height; ++y) {
+		reference(src.data() + y * srcPitch, expected.data() + y * dstPitch, width, coefficients);
+		row(src.data() + y * srcPitch, actual.data() + y * dstPitch, width, coefficients);
+	}
+
+	return expected == actual;
+}
+
+static bool VerifyFilterColumns(FilterColumnsRowFunc row, uint32_t bytes, uint32_t taps) {
+	std::vector<std::vector<uint8_t>> rows(taps, std::vector<uint8_t>(bytes));
+	const uint8_t* rowPointers[CropScaler::kMaxTaps];
+	for (uint32_t k = 0; k < taps; ++k) {
+		FillPattern(rows[k], bytes * 17 + k);
+		rowPointers[k] = rows[k].data();
+	}
+
+	// Bicubic-like weights with negative lobes, summing to one.
+	int16_t weights[CropScaler::kMaxTaps];
+	int32_t sum = 0;
+	for (uint32_t k = 0; k < taps; ++k) {
+		weights[k] = static_cast<int16_t>((k == 0 || k + 1 == taps) ? -1200 : 3000 + 97 * k);
+		sum += weights[k];
+	}
+	weights[taps / 2] = static_cast<int16_t>(weights[taps / 2] + kScaleWeightOne - sum);
+
+	std::vector<uint8_t> expected(bytes + 64, 0xCD);
+	std::vector<uint8_t> actual(bytes + 64, 0xCD);
+	FilterColumnsRow_Scalar(rowPointers, weights, taps, expected.data(), bytes);
+	row(rowPointers, weights, taps, actual.data(), bytes);
+
+	return expected == actual;
+}
+
+// A full-frame window at the source size puts every tap on a whole pixel, so
+// both filters must reproduce the plain byte swap exactly.
+static bool VerifyCropScalerIdentity(ScaleFilter filter, uint32_t width, uint32_t height, uint32_t padding) {
+	const size_t srcPitch = static_cast<size_t>(width) * 2 + padding;
+	std::vector<uint8_t> src(srcPitch * height);
+	FillPattern(src, width * 19 + padding);
+
+	std::vector<uint8_t> expected(static_cast<size_t>(width) * 2 * height);
+	std::vector<uint8_t> actual(expected.size());
+	for (uint32_t y = 0; y < height; ++y) {
+		YUY2ToUYVYRow_Scalar(src.data() + y * srcPitch, expected.data() + y * width * 2, width);
+	}
+
+	BandPool pool(1);
+	CropScaler scaler(width, height, width, height, filter);
+	scaler.Convert(pool, src.data(), static_cast<ptrdiff_t>(srcPitch), actual.data());
+
+	return expected == actual;
+}
+
+template <typename Verify>
+static bool VerifyKernel(const char* name, SimdLevel level, Verify&& verify) {
+	size_t cases = 0;
+	size_t failures = 0;
+
+	for (uint32_t width = 2; width <= 512; width += 2) {
+		for (uint32_t padding = 0; padding <= 64; ++padding) {
+			++cases;
+			if (!verify(width, padding)) {
+				if (failures++ == 0) {
+					std::cerr << name << " " << SimdLevelName(level) << " mismatch at width "
+						<< width << ", padding " << padding << std::endl;
+				}
+			}
+		}
+	}
+
+	std::cout << "verify " << std::setw(18) << name << " " << std::setw(8) << SimdLevelName(level) << ": "
+		<< (cases - failures) << "/" << cases << " bit-exact" << std::endl;
+
+	return failures == 0;
+}
+
+// dstWidth output pixels from two source rows starting padding bytes into
+// their buffers, against the scalar kernel.
+static bool VerifyHalveRow(HalveRow422Func halve, HalveRow422Func reference, uint32_t dstWidth, uint32_t padding) {
+	std::vector<uint8_t> src(2 * (static_cast<size_t>(dstWidth) * 4 + padding));
+	FillPattern(src, dstWidth + padding);
+	const uint8_t* row0 = src.data() + padding;
+	const uint8_t* row1 = row0 + dstWidth * 4 + padding;
+
+	std::vector<uint8_t> expected(static_cast<size_t>(dstWidth) * 2 + 64, 0xCD);
+	std::vector<uint8_t> actual(expected);
+	reference(row0, row1, expected.data(), dstWidth);
+	halve(row0, row1, actual.data(), dstWidth);
+	return expected == actual;
+}
+
+// Both proxy levels of a banded YUY2->UYVY conversion against the scalar
+// kernels applied to whole frames.
+static bool VerifyProxyPyramid(BandPool& pool, uint32_t width, uint32_t height, uint32_t padding) {
+	const size_t pitch = static_cast<size_t>(width) * 2 + padding;
+	std::vector<uint8_t> src(pitch * height);
+	std::vector<uint8_t> dst(static_cast<size_t>(width) * 2 * height);
+	FillPattern(src, width + padding);
+
+	ProxyPyramid pyramid(width, height);
+	std::vector<uint8_t> levels[ProxyPyramid::kLevelCount];
+	uint8_t* outputs[ProxyPyramid::kLevelCount];
+	for (uint32_t i = 0; i < ProxyPyramid::kLevelCount; ++i) {
+		levels[i].resize(pyramid.Layout(i).totalBytes);
+		outputs[i] = levels[i].data();
+	}
+	pyramid.SetOutputs(outputs);
+	YUY2ToUYVYWithPitch(pool, GetYUY2ToUYVYRow(ActiveSimdLevel()), src.data(), dst.data(), width, height, static_cast<ptrdiff_t>(pitch),
+		[&](uint32_t firstRow, uint32_t lastRow) {
+			pyramid.ProcessBand(src.data(), static_cast<ptrdiff_t>(pitch), PixelFormat::YUY2, firstRow, lastRow);
+		});
+
+	const uint8_t* rows = src.data();
+	size_t rowPitch = pitch;
+	HalveRow422Func reference = HalveRow422_Scalar<true>;
+	for (uint32_t i = 0; i < ProxyPyramid::kLevelCount; ++i) {
+		const FrameLayout& layout = pyramid.Layout(i);
+		std::vector<uint8_t> expected(layout.totalBytes);
+		for (uint32_t y = 0; y < layout.height; ++y) {
+			reference(rows + y * 2 * rowPitch, rows + (y * 2 + 1) * rowPitch, expected.data() + y * layout.planePitch[0], layout.width);
+		}
+		// Narrow frames have no quarter level, and no pixels to compare.
+		if (layout.totalBytes != 0 && memcmp(expected.data(), outputs[i], layout.totalBytes) != 0) {
+			return false;
+		}
+		rows = outputs[i];
+		rowPitch = layout.planePitch[0];
+		reference = HalveRow422_Scalar<false>;
+	}
+	return true;
+}
+
+// Oriented frame from a per-pixel reference: each output pixel is looked up
+// at its source position; chroma comes from the source pair, or for
+// transposed orientations the rounded average of the two source pixels' pairs.
+static bool VerifyOrientation(BandPool& pool, const OrientationKernels& kernels, Orientation orientation,
+	PixelFormat srcFormat, PixelFormat dstFormat, uint32_t width, uint32_t height, uint32_t padding) {
+	const bool bottomUp = padding & 1;
+	const size_t pitch = static_cast<size_t>(width) * 2 + padding;
+	std::vector<uint8_t> src(pitch * height);
+	FillPattern(src, width + padding);
+	// A bottom-up buffer: the first row is last in memory.
+	const uint8_t* scanline0 = bottomUp ? src.data() + (height - 1) * pitch : src.data();
+	const ptrdiff_t signedPitch = bottomUp ? -static_cast<ptrdiff_t>(pitch) : static_cast<ptrdiff_t>(pitch);
+
+	uint32_t outWidth = 0, outHeight = 0;
+	OrientedSize(orientation, width, height, outWidth, outHeight);
+	const size_t outPitch = static_cast<size_t>(outWidth) * 2;
+	std::vector<uint8_t> actual(outPitch * outHeight);
+	OrientPacked422WithPitch(pool, kernels, orientation, scanline0, signedPitch, width, height, actual.data(), static_cast<ptrdiff_t>(outPitch));
+
+	const int srcY = srcFormat == PixelFormat::YUY2 ? 0 : 1;
+	const int srcU = 1 - srcY;
+	const int dstY = dstFormat == PixelFormat::YUY2 ? 0 : 1;
+	const int dstU = 1 - dstY;
+	// Returns the source pixel; pair is set to the start of its pixel pair.
+	auto sourcePixel = [&](uint32_t x, uint32_t y, const uint8_t*& pair) {
+		switch (orientation) {
+		case Orientation::Mirror: x = width - 1 - x; break;
+		case Orientation::Flip: y = height - 1 - y; break;
+		case Orientation::Rotate180: x = width - 1 - x; y = height - 1 - y; break;
+		case Orientation::Rotate90: { const uint32_t t = x; x = y; y = height - 1 - t; break; }
+		case Orientation::Rotate270: { const uint32_t t = x; x = width - 1 - y; y = t; break; }
+		case Orientation::Transpose: { const uint32_t t = x; x = y; y = t; break; }
+		case Orientation::Transverse: { const uint32_t t = x; x = width - 1 - y; y = height - 1 - t; break; }
+		default: break;
+		}
+		const uint8_t* row = scanline0 + static_cast<ptrdiff_t>(y) * signedPitch;
+		pair = row + (x & ~1u) * 2;
+		return row + x * 2;
+	};
+
+	for (uint32_t y = 0; y < outHeight; ++y) {
+		for (uint32_t x = 0; x < outWidth; x += 2) {
+			const uint8_t* pair0 = nullptr;
+			const uint8_t* pair1 = nullptr;
+			const uint8_t* p0 = sourcePixel(x, y, pair0);
+			const uint8_t* p1 = sourcePixel(x + 1, y, pair1);
+			const uint8_t* out = actual.data() + y * outPitch + x * 2;
+			const int u = (pair0[srcU] + pair1[srcU] + 1) >> 1;
+			const int v = (pair0[srcU + 2] + pair1[srcU + 2] + 1) >> 1;
+			if (out[dstY] != p0[srcY] || out[dstY + 2] != p1[srcY] || out[dstU] != u || out[dstU + 2] != v) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool VerifyAll() {
+	bool ok = true;
+	BandPool pool(1);
+
+	for (ScaleFilter filter : { ScaleFilter::Bilinear, ScaleFilter::Bicubic }) {
+		const std::string name = std::string("crop ") + ScaleFilterName(filter);
+		ok &= VerifyKernel(name.c_str(), ActiveSimdLevel(), [&](uint32_t width, uint32_t padding) {
+			return VerifyCropScalerIdentity(filter, width, 5, padding);
+		});
+	}
+
+	ok &= VerifyKernel("proxy pyramid", ActiveSimdLevel(), [&](uint32_t width, uint32_t padding) {
+		return VerifyProxyPyramid(pool, width, 9 + padding % 4, padding);
+	});
+
+	for (Orientation orientation : kOrientations) {
+		for (PixelFormat dstFormat : { PixelFormat::UYVY, PixelFormat::YUY2 }) {
+			const OrientationKernels kernels = GetOrientationKernels(ActiveSimdLevel(), PixelFormat::YUY2, dstFormat);
+			const std::string name = std::string(OrientationName(orientation)) + " ->" + PixelFormatName(dstFormat);
+			ok &= VerifyKernel(name.c_str(), ActiveSimdLevel(), [&](uint32_t width, uint32_t padding) {
+				return VerifyOrientation(pool, kernels, orientation, PixelFormat::YUY2, dstFormat, width, 18 + (padding % 5) * 2, padding);
+			});
+		}
+	}
+
+	ok &= VerifyKernel("copy NT", ActiveSimdLevel(), [&](uint32_t width, uint32_t padding) {
+		std::vector<uint8_t> src(width * 2);
+		std::vector<uint8_t> actual(width * 2 + 128, 0xCD);
+		std::vector<uint8_t> expected(actual);
+		FillPattern(src, width + padding);
+		memcpy(expected.data() + padding, src.data(), src.size());
+		CopyRowNonTemporal(src.data(), actual.data() + padding, src.size());
+		StoreFence();
+		return expected == actual;
+	});
+
+	for (SimdLevel level : SupportedLevels()) {
+		YUY2ToUYVYRowFunc uyvy = GetYUY2ToUYVYRow(level);
+		ok &= VerifyKernel("YUY2->UYVY", level, [&](uint32_t width, uint32_t padding) {
+			return VerifyYUY2ToUYVY(uyvy, width, 3, padding);
+		});
+
+		for (PixelFormat srcFormat : { PixelFormat::YUY2, PixelFormat::UYVY }) {
+			for (PixelFormat dstFormat : { PixelFormat::UYVY, PixelFormat::YUY2 }) {
+				const OrientationKernels kernels = GetOrientationKernels(level, srcFormat, dstFormat);
+				const OrientationKernels reference = GetOrientationKernels(SimdLevel::Scalar, srcFormat, dstFormat);
+				const std::string suffix = std::string(" ") + PixelFormatName(srcFormat) + ">" + PixelFormatName(dstFormat);
+
+				ok &= VerifyKernel(("mirror" + suffix).c_str(), level, [&](uint32_t width, uint32_t padding) {
+					std::vector<uint8_t> src(static_cast<size_t>(width) * 2 + padding);
+					FillPattern(src, width + padding);
+					std::vector<uint8_t> expected(static_cast<size_t>(width) * 2 + 64, 0xCD);
+					std::vector<uint8_t> actual(expected);
+					reference.mirror(src.data() + padding, expected.data(), width);
+					kernels.mirror(src.data() + padding, actual.data(), width);
+					return expected == actual;
+				});
+
+				// width source columns, an even number of rows, bottom-up for odd padding.
+				ok &= VerifyKernel(("transpose" + suffix).c_str(), level, [&](uint32_t width, uint32_t padding) {
+					const uint32_t rows = 2 + (padding % 13) * 2;
+					const size_t pitch = static_cast<size_t>(width) * 2 + padding;
+					std::vector<uint8_t> src(pitch * rows);
+					FillPattern(src, width + padding);
+					const uint8_t* first = (padding & 1) ? src.data() + (rows - 1) * pitch : src.data();
+					const ptrdiff_t signedPitch = (padding & 1) ? -static_cast<ptrdiff_t>(pitch) : static_cast<ptrdiff_t>(pitch);
+					std::vector<uint8_t> expected(static_cast<size_t>(width) * rows * 2, 0xCD);
+					std::vector<uint8_t> actual(expected);
+					reference.transpose(first, signedPitch, expected.data(), rows * 2, width, rows);
+					kernels.transpose(first, signedPitch, actual.data(), rows * 2, width, rows);
+					return expected == actual;
+				});
+			}
+		}
+
+		for (PixelFormat format : { PixelFormat::YUY2, PixelFormat::UYVY }) {
+			const HalveRow422Func halve = GetHalveRow422(level, format);
+			const HalveRow422Func reference = GetHalveRow422(SimdLevel::Scalar, format);
+			const std::string name = std::string("halve ") + PixelFormatName(format);
+			ok &= VerifyKernel(name.c_str(), level, [&](uint32_t width, uint32_t padding) {
+				return VerifyHalveRow(halve, reference, width, padding);
+			});
+		}
+
+		YUY2ToUYVYRowFunc uyvyNT = GetYUY2ToUYVYRowNonTemporal(level);
+		ok &= VerifyKernel("YUY2->UYVY NT", level, [&](uint32_t width, uint32_t padding) {
+			return VerifyYUY2ToUYVY(uyvyNT, width, 3, padding, padding);
+		});
+
+		YUY2ToNV12RowFunc nv12 = GetYUY2ToNV12Row(level);
+		ok &= VerifyKernel("YUY2->NV12", level, [&](uint32_t width, uint32_t padding) {
+			return VerifyYUY2ToPlanar(pool, PixelFormat::NV12, YUY2ToNV12Row_Scalar, nv12, YUY2ToNV12WithPitch, width, 3, padding);
+		});
+
+		YUY2ToI420RowFunc i420 = GetYUY2ToI420Row(level);
+		ok &= VerifyKernel("YUY2->I420", level, [&](uint32_t width, uint32_t padding) {
+			return VerifyYUY2ToPlanar(pool, PixelFormat::I420, YUY2ToI420Row_Scalar, i420, YUY2ToI420WithPitch, width, 3, padding);
+		});
+
+		for (ChromaFilter filter : { ChromaFilter::Nearest, ChromaFilter::Linear }) {
+			NV12ToUYVYRowFunc nv12ToUYVY = GetNV12ToUYVYRow(level, filter);
+			NV12ToUYVYRowFunc reference = GetNV12ToUYVYRow(SimdLevel::Scalar, filter);
+			const char* name = filter == ChromaFilter::Nearest ? "NV12->UYVY nearest" : "NV12->UYVY linear";
+			ok &= VerifyKernel(name, level, [&](uint32_t width, uint32_t padding) {
+				return VerifyNV12ToUYVY(pool, reference, nv12ToUYVY, width, 5, padding);
+			});
+		}
+
+		FilterColumnsRowFunc filterColumns = GetFilterColumnsRow(level);
+		for (uint32_t taps : { 2u, 4u, 8u, 16u }) {
+			const std::string name = "vfilter " + std::to_string(taps);
+			ok &= VerifyKernel(name.c_str(), level, [&](uint32_t width, uint32_t padding) {
+				return VerifyFilterColumns(filterColumns, width * 2 + padding, taps);
+			});
+		}
+
+		// Byte order is a template parameter and the matrix a runtime input, so
+		// both orders run against the matrix with the largest coefficients.
+		const YUVToRGBCoefficients coefficients = MakeYUVToRGBCoefficients({ YUVMatrix::BT709, YUVRange::Limited });
+		for (PixelFormat format : { PixelFormat::BGRA, PixelFormat::RGBA }) {
+			YUY2ToRGBRowFunc rgb = GetYUY2ToRGBRow(level, format);
+			YUY2ToRGBRowFunc reference = GetYUY2ToRGBRow(SimdLevel::Scalar, format);
+			const char* name = format == PixelFormat::BGRA ? "YUY2->BGRA" : "YUY2->RGBA";
+			ok &= VerifyKernel(name, level, [&](uint32_t width, uint32_t padding) {
+				return VerifyYUY2ToRGB(reference, rgb, coefficients, width, 3, padding);
+			});
+		}
+	}
+
+	return ok;
+}
+
+// Checks the fixed-point YUV->RGB path against a double-precision evaluation
+// of the same matrix for every Y, U, V combination. One row per (U, V) holds
+// all 256 luma values.
+static bool VerifyYUVToRGBAccuracy() {
+	bool ok = true;
+
+	for (YUVMatrix matrix : { YUVMatrix::BT601, YUVMatrix::BT709 }) {
+		for (YUVRange range : { YUVRange::Limited, YUVRange::Full }) {
+			const YUVColorimetry colorimetry{ matrix, range };
+			const YUVToRGBCoefficients coefficients = MakeYUVToRGBCoefficients(colorimetry);
+
+			double kr, kb;
+			YUVMatrixWeights(matrix, kr, kb);
+			const double kg = 1.0 - kr - kb;
+			const bool limited = range == YUVRange::Limited;
+			const double yScale = limited ? 255.0 / 219.0 : 1.0;
+			const double cScale = limited ? 255.0 / 224.0 : 1.0;
+			const double yOffset = limited ? 16.0 : 0.0;
+
+			std::vector<uint8_t> src(512);
+			std::vector<uint8_t> dst(1024);
+			uint64_t histogram[3] = {};
+			int maxError = 0;
+
+			for (int u = 0; u < 256; ++u) {
+				for (int v = 0; v < 256; ++v) {
+					for (int x = 0; x < 256; x += 2) {
+						src[x * 2 + 0] = static_cast<uint8_t>(x);
+						src[x * 2 + 1] = static_cast<uint8_t>(u);
+						src[x * 2 + 2] = static_cast<uint8_t>(x + 1);
+						src[x * 2 + 3] = static_cast<uint8_t>(v);
+					}
+					YUY2ToRGBRow_Scalar<false>(src.data(), dst.data(), 256, coefficients);
+
+					const double cb = cScale * (u - 128);
+					const double cr = cScale * (v - 128);
+					for (int y = 0; y < 256; ++y) {
+						const double luma = yScale * (y - yOffset);
+						const double expected[3] = {
+							luma + 2.0 * (1.0 - kr) * cr,
+							luma - (2.0 * kb * (1.0 - kb) * cb + 2.0 * kr * (1.0 - kr) * cr) / kg,
+							luma + 2.0 * (1.0 - kb) * cb,
+						};
+						for (int channel = 0; channel < 3; ++channel) {
+							const int reference = static_cast<int>(std::lround((std::min)(255.0, (std::max)(0.0, expected[channel]))));
+							const int error = std::abs(dst[y * 4 + channel] - reference);
+							maxError = (std::max)(maxError, error);
+							++histogram[(std::min)(error, 2)];
+						}
+					}
+				}
+			}
+
+			const double total = static_cast<double>(histogram[0] + histogram[1] + histogram[2]);
+			std::cout << "accuracy " << YUVMatrixName(matrix) << " " << std::setw(7) << YUVRangeName(range)
+				<< ": max error " << maxError << ", " << std::fixed << std::setprecision(3)
+				<< 100.0 * histogram[0] / total << "% exact, " << 100.0 * histogram[1] / total << "% off by one" << std::endl;
+
+			ok &= maxError <= 1;
+		}
+	}
+
+	return ok;
+}
+
+// One source pixel of a reference filter tap, clamped to the frame.
+struct ReferenceTap {
+	int32_t index;
+	double weight;
+};
+
+// Every source sample within the kernel's reach of center, with the kernel
+// widened by the scale factor when shrinking, normalised to sum to one.
+static std::vector<ReferenceTap> ReferenceScaleTaps(ScaleFilter filter, double center, double scale, int32_t size) {
+	auto kernel = [filter](double t) {
+		t = std::fabs(t);
+		if (filter == ScaleFilter::Bilinear) {
+			return t < 1.0 ? 1.0 - t : 0.0;
+		}
+		if (t < 1.0) {
+			return 1.5 * t * t * t - 2.5 * t * t + 1.0;
+		}
+		return t < 2.0 ? -0.5 * t * t * t + 2.5 * t * t - 4.0 * t + 2.0 : 0.0;
+	};
+	const double stretch = (std::max)(1.0, scale);
+	const double reach = (filter == ScaleFilter::Bicubic ? 2.0 : 1.0) * stretch;
+
+	std::vector<ReferenceTap> taps;
+	double total = 0.0;
+	for (int32_t i = static_cast<int32_t>(std::floor(center - reach)); i <= static_cast<int32_t>(std::ceil(center + reach)); ++i) {
+		const double weight = kernel((i - center) / stretch);
+		if (weight != 0.0) {
+			taps.push_back({ (std::clamp)(i, 0, size - 1), weight });
+			total += weight;
+		}
+	}
+	for (ReferenceTap& tap : taps) {
+		tap.weight /= total;
+	}
+	return taps;
+}
+
+// Largest difference between a UYVY frame from CropScaler and a double
+// precision model of it: vertical then horizontal filtering, the vertical
+// result clamped as the 8-bit intermediate row is, luma on the luma grid and
+// U/V on the chroma grid co-sited with even luma. histogram counts errors of
+// 0, 1 and more.
+static int CropScalerReferenceError(ScaleFilter filter, const uint8_t* src, size_t pitch, uint32_t width, uint32_t height,
+	const CropWindow& crop, const uint8_t* actual, uint32_t outputWidth, uint32_t outputHeight, uint64_t* histogram) {
+	const double scaleX = crop.width / outputWidth;
+	const double scaleY = crop.height / outputHeight;
+	std::vector<double> column(static_cast<size_t>(width) * 2);
+	int maxError = 0;
+
+	for (uint32_t y = 0; y < outputHeight; ++y) {
+		const std::vector<ReferenceTap> rowTaps = ReferenceScaleTaps(filter, crop.y + (y + 0.5) * scaleY - 0.5, scaleY, static_cast<int32_t>(height));
+		for (size_t i = 0; i < column.size(); ++i) {
+			double sum = 0.0;
+			for (const ReferenceTap& tap : rowTaps) {
+				sum += tap.weight * src[tap.index * pitch + i];
+			}
+			column[i] = (std::min)(255.0, (std::max)(0.0, sum));
+		}
+
+		auto filterRow = [&](const std::vector<ReferenceTap>& taps, uint32_t stride, uint32_t offset) {
+			double sum = 0.0;
+			for (const ReferenceTap& tap : taps) {
+				sum += tap.weight * column[tap.index * stride + offset];
+			}
+			return static_cast<int>(std::lround((std::min)(255.0, (std::max)(0.0, sum))));
+		};
+
+		const uint8_t* row = actual + static_cast<size_t>(y) * outputWidth * 2;
+		for (uint32_t k = 0; k < outputWidth / 2; ++k) {
+			const std::vector<ReferenceTap> chroma = ReferenceScaleTaps(filter, (crop.x + (2 * k + 0.5) * scaleX - 0.5) / 2.0, scaleX, static_cast<int32_t>(width / 2));
+			const std::vector<ReferenceTap> luma0 = ReferenceScaleTaps(filter, crop.x + (2 * k + 0.5) * scaleX - 0.5, scaleX, static_cast<int32_t>(width));
+			const std::vector<ReferenceTap> luma1 = ReferenceScaleTaps(filter, crop.x + (2 * k + 1.5) * scaleX - 0.5, scaleX, static_cast<int32_t>(width));
+			const int expected[4] = { filterRow(chroma, 4, 1), filterRow(luma0, 2, 0), filterRow(chroma, 4, 3), filterRow(luma1, 2, 0) };
+			for (int i = 0; i < 4; ++i) {
+				const int error = std::abs(row[k * 4 + i] - expected[i]);
+				maxError = (std::max)(maxError, error);
+				++histogram[(std::min)(error, 2)];
+			}
+		}
+	}
+	return maxError;
+}
+
+// CropScaler against the reference, shrinking and enlarging, through
+// fractional windows touching each edge of the frame. Each scaler converts its
+// windows in turn, so every window after the first was moved by SetCrop()
+// between frames.
+static bool VerifyCropScalerAccuracy() {
+	constexpr uint32_t kWidth = 258;
+	constexpr uint32_t kHeight = 146;
+	constexpr size_t kPitch = kWidth * 2 + 6;
+	std::vector<uint8_t> src(kPitch * kHeight);
+	FillPattern(src, 7);
+
+	struct Case {
+		uint32_t outputWidth;
+		uint32_t outputHeight;
+		std::vector<CropWindow> windows;
+	};
+	const Case cases[] = {
+		// Shrinking by 1.6x to 2x.
+		{ 160, 90, { { 0.0, 0.0, kWidth, kHeight }, { 3.5, 2.25, 200.5, 120.75 }, { kWidth - 230.3, kHeight - 130.6, 230.3, 130.6 } } },
+		// Enlarging by 2.6x to 4x, into each corner and along each edge.
+		{ 256, 144, { { 0.0, 0.0, 97.3, 55.7 }, { kWidth - 61.75, kHeight - 33.4, 61.75, 33.4 }, { 100.4, 0.0, 80.2, 40.0 },
+			{ 0.0, 60.6, 120.0, kHeight - 60.6 }, { 150.1, 20.7, kWidth - 150.1, 70.3 } } },
+		// Shrinking by almost 4x, the widest kernels that still fit kMaxTaps.
+		{ 66, 37, { { 0.0, 0.0, kWidth, kHeight } } },
+	};
+
+	BandPool pool(2);
+	bool ok = true;
+	for (ScaleFilter filter : { ScaleFilter::Bilinear, ScaleFilter::Bicubic }) {
+		uint64_t histogram[3] = {};
+		int maxError = 0;
+		for (const Case& test : cases) {
+			CropScaler scaler(kWidth, kHeight, test.outputWidth, test.outputHeight, filter);
+			std::vector<uint8_t> actual(static_cast<size_t>(test.outputWidth) * 2 * test.outputHeight);
+			for (const CropWindow& window : test.windows) {
+				scaler.SetCrop(window);
+				scaler.Convert(pool, src.data(), static_cast<ptrdiff_t>(kPitch), actual.data());
+				maxError = (std::max)(maxError, CropScalerReferenceError(filter, src.data(), kPitch, kWidth, kHeight, scaler.Crop(),
+					actual.data(), test.outputWidth, test.outputHeight, histogram));
+			}
+		}
+
+		const double total = static_cast<double>(histogram[0] + histogram[1] + histogram[2]);
+		std::cout << "accuracy crop " << std::setw(8) << ScaleFilterName(filter) << ": max error " << maxError << ", "
+			<< std::fixed << std::setprecision(3) << 100.0 * histogram[0] / total << "% exact, "
+			<< 100.0 * histogram[1] / total << "% off by one" << std::endl;
+		ok &= maxError <= 1;
+	}
+	return ok;
+}
+
+// Runs fn repeatedly for at least minSeconds after one warm-up call and
+// returns the mean seconds per call.
+template <typename Fn>
+static double MeasureSecondsPerFrame(Fn&& fn, double minSeconds = 0.5) {
+	fn();
+
+	int frames = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed{};
+	do {
+		fn();
+		++frames;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < minSeconds);
+
+	return elapsed.count() / frames;
+}
+
+static void BenchYUY2ToUYVY(const Resolution& res) {
+	const size_t pitch = static_cast<size_t>(res.width) * 2;
+	const size_t frameBytes = pitch * res.height;
+
+	std::vector<uint8_t> src(frameBytes);
+	std::vector<uint8_t> dst(frameBytes);
+	FillPattern(src, res.width);
+
+	for (SimdLevel level : SupportedLevels()) {
+		YUY2ToUYVYRowFunc row = GetYUY2ToUYVYRow(level);
+
+		const double secondsPerFrame = MeasureSecondsPerFrame([&]() {
+			for (uint32_t y = 0; y < res.height; ++y) {
+				row(src.data() + y * pitch, dst.data() + y * pitch, res.width);
+			}
+		});
+		const double gbPerSecond = (2.0 * frameBytes) / secondsPerFrame / 1e9;
+
+		std::cout << "YUY2->UYVY " << std::setw(6) << res.name << " " << std::setw(8) << SimdLevelName(level)
+			<< ": " << std::fixed << std::setprecision(3) << secondsPerFrame * 1000 << " ms/frame, "
+			<< std::setprecision(2) << gbPerSecond << " GB/s" << std::endl;
+	}
+}
+
+// The converter as it was before BandPool: a row index vector allocated per
+// frame and one std::execution::par task per row.
+static void YUY2ToUYVYParPolicy(YUY2ToUYVYRowFunc convertRow, const uint8_t* srcData, uint8_t* destData, uint32_t width, uint32_t height, ptrdiff_t pitch) {
+	std::vector<uint32_t> rowIndices(height);
+	std::iota(rowIndices.begin(), rowIndices.end(), 0);
+
+	std::for_each(std::execution::par, rowIndices.begin(), rowIndices.end(),
+		[&](uint32_t y) {
+			convertRow(srcData + static_cast<ptrdiff_t>(y) * pitch, destData + static_cast<size_t>(y) * width * 2, width);
+		}
+	);
+}
+
+static void BenchFrameDispatch(const Resolution& res, BandPool& pool) {
+	const size_t pitch = static_cast<size_t>(res.width) * 2;
+	const size_t frameBytes = pitch * res.height;
+	const YUY2ToUYVYRowFunc row = GetYUY2ToUYVYRow(ActiveSimdLevel());
+
+	std::vector<uint8_t> src(frameBytes);
+	std::vector<uint8_t> dst(frameBytes);
+	FillPattern(src, res.width);
+
+	const double parSeconds = MeasureSecondsPerFrame([&]() {
+		YUY2ToUYVYParPolicy(row, src.data(), dst.data(), res.width, res.height, pitch);
+	});
+
+	const double poolSeconds = MeasureSecondsPerFrame([&]() {
+		YUY2ToUYVYWithPitch(pool, row, src.data(), dst.data(), res.width, res.height, pitch);
+	});
+
+	std::cout << "dispatch " << std::setw(6) << res.name << ": par-policy " << std::fixed << std::setprecision(3)
+		<< parSeconds * 1000 << " ms/frame, BandPool(" << pool.WorkerCount() << ") "
+		<< poolSeconds * 1000 << " ms/frame (" << std::setprecision(2) << parSeconds / poolSeconds << "x)" << std::endl;
+}
+
+// Whole-frame throughput of each output format the NDI sender supports, with
+// the best kernels on the shared pool. GB/s counts source reads plus
+// destination writes.
+static void BenchOutputFormats(const Resolution& res, BandPool& pool) {
+	const SimdLevel level = ActiveSimdLevel();
+	const size_t pitch = static_cast<size_t>(res.width) * 2;
+	const size_t srcBytes = pitch * res.height;
+
+	std::vector<uint8_t> src(srcBytes);
+	FillPattern(src, res.width);
+
+	for (PixelFormat format : { PixelFormat::UYVY, PixelFormat::NV12, PixelFormat::I420 }) {
+		const FrameLayout layout = PackedFrameLayout(format, res.width, res.height);
+		std::vector<uint8_t> dst(layout.totalBytes);
+
+		const double secondsPerFrame = MeasureSecondsPerFrame([&]() {
+			switch (format) {
+			case PixelFormat::NV12:
+				YUY2ToNV12WithPitch(pool, GetYUY2ToNV12Row(level), src.data(), pitch, layout, dst.data());
+				break;
+			case PixelFormat::I420:
+				YUY2ToI420WithPitch(pool, GetYUY2ToI420Row(level), src.data(), pitch, layout, dst.data());
+				break;
+			default:
+				YUY2ToUYVYWithPitch(pool, GetYUY2ToUYVYRow(level), src.data(), dst.data(), res.width, res.height, pitch);
+				break;
+			}
+		});
+
+		const double gbPerSecond = static_cast<double>(srcBytes + layout.totalBytes) / secondsPerFrame / 1e9;
+		std::cout << "output " << std::setw(6) << res.name << " YUY2->" << PixelFormatName(format) << ": "
+			<< std::fixed << std::setprecision(3) << secondsPerFrame * 1000 << " ms/frame, "
+			<< std::setprecision(2) << gbPerSecond << " GB/s, " << layout.totalBytes / 1024 << " KiB written" << std::endl;
+	}
+}
+
+// NV12 camera input to the NDI sender's UYVY output, per chroma filter.
+static void BenchNV12Input(const Resolution& res, BandPool& pool) {
+	const SimdLevel level = ActiveSimdLevel();
+	const FrameLayout src = PackedFrameLayout(PixelFormat::NV12, res.width, res.height);
+	const size_t destBytes = static_cast<size_t>(res.width) * 2 * res.height;
+
+	std::vector<uint8_t> srcData(src.totalBytes);
+	std::vector<uint8_t> dst(destBytes);
+	FillPattern(srcData, res.width);
+
+	for (ChromaFilter filter : { ChromaFilter::Nearest, ChromaFilter::Linear }) {
+		const NV12ToUYVYRowFunc row = GetNV12ToUYVYRow(level, filter);
+		const double secondsPerFrame = MeasureSecondsPerFrame([&]() {
+			NV12ToUYVYWithPitch(pool, row, srcData.data(), src.planePitch[0], srcData.data() + src.planeOffset[1], src.planePitch[1],
+				dst.data(), res.width, res.height);
+		});
+
+		const double gbPerSecond = static_cast<double>(src.totalBytes + destBytes) / secondsPerFrame / 1e9;
+		std::cout << "input " << std::setw(6) << res.name << " NV12->UYVY " << std::setw(7) << ChromaFilterName(filter) << ": "
+			<< std::fixed << std::setprecision(3) << secondsPerFrame * 1000 << " ms/frame, "
+			<< std::setprecision(2) << gbPerSecond << " GB/s" << std::endl;
+	}
+}
+
+// YUY2 capture to the 32-bit RGB outputs, per SIMD level. GB/s counts
+// source reads plus destination writes.
+static void BenchYUY2ToRGB(const Resolution& res, BandPool& pool) {
+	const size_t srcPitch = static_cast<size_t>(res.width) * 2;
+	const size_t destPitch = static_cast<size_t>(res.width) * 4;
+	const YUVToRGBCoefficients coefficients = MakeYUVToRGBCoefficients({ YUVMatrix::BT709, YUVRange::Limited });
+
+	std::vector<uint8_t> src(srcPitch * res.height);
+	std::vector<uint8_t> dst(destPitch * res.height);
+	FillPattern(src, res.width);
+
+	for (SimdLevel level : SupportedLevels()) {
+		const YUY2ToRGBRowFunc row = GetYUY2ToRGBRow(level, PixelFormat::BGRA);
+		const double secondsPerFrame = MeasureSecondsPerFrame([&]() {
+			YUY2ToRGBWithPitch(pool, row, coefficients, src.data(), srcPitch, dst.data(), destPitch, res.width, res.height);
+		});
+
+		const double gbPerSecond = static_cast<double>(src.size() + dst.size()) / secondsPerFrame / 1e9;
+		std::cout << "rgb " << std::setw(6) << res.name << " YUY2->BGRA " << std::setw(8) << SimdLevelName(level) << ": "
+			<< std::fixed << std::setprecision(3) << secondsPerFrame * 1000 << " ms/frame, "
+			<< std::setprecision(2) << gbPerSecond << " GB/s" << std::endl;
+	}
+}
+
+// A 4K pipeline converts into output frames it never reads back while a
+// second, 1080p pipeline runs next to it with its own source and output.
+// Regular stores pull every 4K output line through the LLC and evict the
+// neighbour's frames; streaming stores do not. Reports the throughput of both
+// pipelines and the process-wide LLC misses per 4K frame for each store mode.
+static void BenchStoreModes(double seconds = 1.0) {
+	const Resolution& large = kResolutions[2];
+	const Resolution& small = kResolutions[1];
+	const SimdLevel level = ActiveSimdLevel();
+
+	const size_t largePitch = static_cast<size_t>(large.width) * 2;
+	const size_t smallPitch = static_cast<size_t>(small.width) * 2;
+	std::vector<uint8_t> largeSrc(largePitch * large.height);
+	std::vector<uint8_t> largeDst[2] = { std::vector<uint8_t>(largeSrc.size()), std::vector<uint8_t>(largeSrc.size()) };
+	std::vector<uint8_t> smallSrc(smallPitch * small.height);
+	std::vector<uint8_t> smallDst(smallSrc.size());
+	FillPattern(largeSrc, 1);
+	FillPattern(smallSrc, 2);
+
+	for (bool nonTemporal : { false, true }) {
+		LLCMissCounter counter;
+		const bool counting = counter.Start();
+
+		std::atomic<bool> stop{ false };
+		uint64_t smallFrames = 0;
+		uint64_t largeFrames = 0;
+		std::chrono::duration<double> elapsed{};
+
+		std::thread neighbour([&]() {
+			BandPool neighbourPool(1);
+			const YUY2ToUYVYRowFunc row = GetYUY2ToUYVYRow(level);
+			while (!stop.load(std::memory_order_relaxed)) {
+				YUY2ToUYVYWithPitch(neighbourPool, row, smallSrc.data(), smallDst.data(), small.width, small.height, smallPitch);
+				++smallFrames;
+			}
+		});
+
+		{
+			BandPool pool;
+			const YUY2ToUYVYRowFunc row = nonTemporal ? GetYUY2ToUYVYRowNonTemporal(level) : GetYUY2ToUYVYRow(level);
+			const auto start = std::chrono::steady_clock::now();
+			do {
+				YUY2ToUYVYWithPitch(pool, row, largeSrc.data(), largeDst[largeFrames & 1].data(), large.width, large.height, largePitch);
+				++largeFrames;
+				elapsed = std::chrono::steady_clock::now() - start;
+			} while (elapsed.count() < seconds);
+		}
+
+		stop = true;
+		neighbour.join();
+		const uint64_t misses = counter.Stop();
+
+		const double secondsPerFrame = elapsed.count() / largeFrames;
+		std::cout << "stores " << (nonTemporal ? "non-temporal" : "   temporal") << ": " << large.name << " "
+			<< std::fixed << std::setprecision(3) << secondsPerFrame * 1000 << " ms/frame, "
+			<< std::setprecision(2) << 2.0 * largeSrc.size() / secondsPerFrame / 1e9 << " GB/s; "
+			<< small.name << " neighbour " << std::setprecision(1) << smallFrames / elapsed.count() << " fps; LLC misses ";
+		if (counting) {
+			std::cout << std::setprecision(0) << static_cast<double>(misses) / largeFrames << "/frame" << std::endl;
+		}
+		else {
+			std::cout << "unavailable" << std::endl;
+		}
+	}
+}
+
+// Every orientation against plain YUY2->UYVY on the same pool.
+static void BenchOrientation(const Resolution& res, BandPool& pool) {
+	const size_t pitch = static_cast<size_t>(res.width) * 2;
+	const size_t frameBytes = pitch * res.height;
+	const OrientationKernels kernels = GetOrientationKernels(ActiveSimdLevel(), PixelFormat::YUY2, PixelFormat::UYVY);
+
+	std::vector<uint8_t> src(frameBytes);
+	std::vector<uint8_t> dst(frameBytes);
+	FillPattern(src, res.width);
+
+	const double plain = MeasureSecondsPerFrame([&]() {
+		YUY2ToUYVYWithPitch(pool, GetYUY2ToUYVYRow(ActiveSimdLevel()), src.data(), dst.data(), res.width, res.height, static_cast<ptrdiff_t>(pitch));
+	});
+	std::cout << "orient " << std::setw(6) << res.name << " " << std::setw(10) << "plain" << ": " << std::fixed << std::setprecision(3)
+		<< plain * 1000 << " ms/frame" << std::endl;
+
+	for (Orientation orientation : kOrientations) {
+		uint32_t outWidth = 0, outHeight = 0;
+		OrientedSize(orientation, res.width, res.height, outWidth, outHeight);
+
+		const double secondsPerFrame = MeasureSecondsPerFrame([&]() {
+			OrientPacked422WithPitch(pool, kernels, orientation, src.data(), static_cast<ptrdiff_t>(pitch), res.width, res.height,
+				dst.data(), static_cast<ptrdiff_t>(outWidth) * 2);
+		});
+		std::cout << "orient " << std::setw(6) << res.name << " " << std::setw(10) << OrientationName(orientation) << ": "
+			<< std::fixed << std::setprecision(3) << secondsPerFrame * 1000 << " ms/frame (" << std::setprecision(2)
+			<< secondsPerFrame / plain << "x)" << std::endl;
+	}
+}
+
+// Cost of the 1/2 and 1/4 proxies on top of YUY2->UYVY: built in the band
+// hook while the source rows are cached, and as separate passes that read the
+// finished full-resolution frame back.
+static void BenchProxyPyramid(const Resolution& res, BandPool& pool) {
+	const size_t pitch = static_cast<size_t>(res.width) * 2;
+	const size_t frameBytes = pitch * res.height;
+	const YUY2ToUYVYRowFunc row = GetYUY2ToUYVYRow(ActiveSimdLevel());
+
+	std::vector<uint8_t> src(frameBytes);
+	std::vector<uint8_t> dst(frameBytes);
+	FillPattern(src, res.width);
+	ProxyPyramid pyramid(res.width, res.height);
+	std::vector<uint8_t> levels[ProxyPyramid::kLevelCount];
+	uint8_t* outputs[ProxyPyramid::kLevelCount];
+	for (uint32_t i = 0; i < ProxyPyramid::kLevelCount; ++i) {
+		levels[i].resize(pyramid.Layout(i).totalBytes);
+		outputs[i] = levels[i].data();
+	}
+	pyramid.SetOutputs(outputs);
+
+	const double plain = MeasureSecondsPerFrame([&]() {
+		YUY2ToUYVYWithPitch(pool, row, src.data(), dst.data(), res.width, res.height, static_cast<ptrdiff_t>(pitch));
+	});
+
+	const double fused = MeasureSecondsPerFrame([&]() {
+		YUY2ToUYVYWithPitch(pool, row, src.data(), dst.data(), res.width, res.height, static_cast<ptrdiff_t>(pitch),
+			[&](uint32_t firstRow, uint32_t lastRow) {
+				pyramid.ProcessBand(src.data(), static_cast<ptrdiff_t>(pitch), PixelFormat::YUY2, firstRow, lastRow);
+			});
+	});
+
+	const uint32_t bandRows = BandPool::BandRowsFor(pitch * 2, 256 * 1024, ProxyPyramid::kRowMultiple);
+	const double separate = MeasureSecondsPerFrame([&]() {
+		YUY2ToUYVYWithPitch(pool, row, src.data(), dst.data(), res.width, res.height, static_cast<ptrdiff_t>(pitch));
+		pool.Run(res.height, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+			pyramid.ProcessBand(dst.data(), static_cast<ptrdiff_t>(pitch), PixelFormat::UYVY, firstRow, lastRow);
+		});
+	});
+
+	auto report = [&](const char* mode, double seconds) {
+		std::cout << "proxies " << std::setw(6) << res.name << " " << std::setw(8) << mode << ": " << std::fixed << std::setprecision(3)
+			<< seconds * 1000 << " ms/frame (+" << std::setprecision(1) << (seconds / plain - 1.0) * 100 << "%)" << std::endl;
+	};
+	std::cout << "proxies " << std::setw(6) << res.name << " " << std::setw(8) << "none" << ": " << std::fixed << std::setprecision(3)
+		<< plain * 1000 << " ms/frame" << std::endl;
+	report("fused", fused);
+	report("separate", separate);
+}
+
+// Animated PTZ: a 4K source cropped and scaled to 1080p with the window
+// zooming between the full frame and a quarter of it, moving every frame.
+static void BenchCropScale(unsigned threads) {
+	const Resolution& source = kResolutions[2];
+	const Resolution& output = kResolutions[1];
+	const size_t srcPitch = static_cast<size_t>(source.width) * 2;
+
+	std::vector<uint8_t> src(srcPitch * source.height);
+	std::vector<uint8_t> dst(static_cast<size_t>(output.width) * 2 * output.height);
+	FillPattern(src, 3);
+
+	BandPool pool(threads);
+	for (ScaleFilter filter : { ScaleFilter::Bilinear, ScaleFilter::Bicubic }) {
+		CropScaler scaler(source.width, source.height, output.width, output.height, filter);
+		uint32_t frame = 0;
+
+		const double secondsPerFrame = MeasureSecondsPerFrame([&]() {
+			const double zoom = 0.625 + 0.375 * std::cos(frame++ * 0.02);
+			const double width = source.width * zoom;
+			const double height = source.height * zoom;
+			scaler.SetCrop({ (source.width - width) * 0.5 * (1.0 + 0.5 * std::sin(frame * 0.013)), (source.height - height) * 0.5, width, height });
+			scaler.Convert(pool, src.data(), static_cast<ptrdiff_t>(srcPitch), dst.data());
+		});
+
+		std::cout << "ptz " << source.name << "->" << output.name << " " << std::setw(8) << ScaleFilterName(filter)
+			<< " on " << pool.WorkerCount() << " threads: " << std::fixed << std::setprecision(3) << secondsPerFrame * 1000
+			<< " ms/frame (" << std::setprecision(1) << 1.0 / secondsPerFrame << " fps)" << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc >= 2 && strcmp(argv[1], "--pipeline") == 0) {
+		return RunPipelineBench(argc - 2, argv + 2);
+	}
+
+	if (argc >= 2 && strcmp(argv[1], "--suite") == 0) {
+		return RunKernelSuite(argc - 2, argv + 2);
+	}
+
+	if (argc >= 3 && strcmp(argv[1], "--mjpeg") == 0) {
+		unsigned threads = 1;
+		int passes = 4;
+		PixelFormat format = PixelFormat::UYVY;
+		std::string decoder;
+		for (int i = 3; i + 1 < argc; i += 2) {
+			if (strcmp(argv[i], "--threads") == 0) {
+				threads = static_cast<unsigned>(atoi(argv[i + 1]));
+			}
+			else if (strcmp(argv[i], "--passes") == 0) {
+				passes = (std::max)(1, atoi(argv[i + 1]));
+			}
+			else if (strcmp(argv[i], "--format") == 0) {
+				if (!ParsePipelineBenchFormat(argv[i + 1], { PixelFormat::UYVY, PixelFormat::NV12 }, format)) {
+					std::cerr << "Unknown MJPEG output format " << argv[i + 1] << "; use uyvy or nv12." << std::endl;
+					return 1;
+				}
+			}
+			else if (strcmp(argv[i], "--decoder") == 0) {
+				decoder = argv[i + 1];
+			}
+		}
+		return RunMJPEGDecodeBench(argv[2], threads, passes, format, decoder);
+	}
+
+	std::cout << "Detected SIMD level: " << SimdLevelName(ActiveSimdLevel()) << std::endl;
+
+	if (!VerifyAll() || !VerifyYUVToRGBAccuracy() || !VerifyCropScalerAccuracy() || !VerifyPipeline()) {
+		std::cerr << "Kernel verification failed." << std::endl;
+		return 1;
+	}
+
+	for (const Resolution& res : kResolutions) {
+		BenchYUY2ToUYVY(res);
+	}
+
+	BandPool pool;
+	for (const Resolution& res : kResolutions) {
+		BenchFrameDispatch(res, pool);
+	}
+
+	for (const Resolution& res : kResolutions) {
+		BenchOutputFormats(res, pool);
+	}
+
+	for (const Resolution& res : kResolutions) {
+		BenchNV12Input(res, pool);
+	}
+
+	for (const Resolution& res : kResolutions) {
+		BenchYUY2ToRGB(res, pool);
+	}
+
+	for (const Resolution& res : kResolutions) {
+		BenchProxyPyramid(res, pool);
+	}
+
+	for (const Resolution& res : kResolutions) {
+		BenchOrientation(res, pool);
+	}
+
+	BenchStoreModes();
+
+	for (unsigned threads : { 1u, 2u }) {
+		BenchCropScale(threads);
+	}
+
+	BenchPipeline();
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+// Persistent worker pool that splits a frame into row bands.
+//
+// Workers are started once and sleep on an atomic generation counter. A Run()
+// call publishes the job, bumps the generation (one wake), works on bands
+// itself, then waits for the busy counter to drain (one join). Bands are
+// claimed with a single fetch_add each, and nothing is allocated per frame.
+//
+// One pool can be shared by several pipelines (MultiCapture.h). Run() calls
+// from different threads take turns in the order they arrive, a ticket each,
+// so every frame still gets all the workers; a frame of a single band runs on
+// the calling thread without taking a turn.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "FrameTracer.h"
+
+// Default for the optional per-band hooks of the frame functions, which run
+// on the worker that just finished a band, while its rows are still cached.
+struct NoBandHook {
+	void operator()(uint32_t, uint32_t) const {}
+};
+
+// runs counts the frames that took a turn on the workers, waited those that
+// found another frame's turn in progress.
+struct BandPoolStats {
+	uint64_t runs{ 0 };
+	uint64_t waited{ 0 };
+};
+
+class BandPool {
+public:
+	// workerCount is the total number of threads working on a frame, including
+	// the thread that calls Run(). Zero means one per hardware thread.
+	explicit BandPool(unsigned workerCount = 0) {
+		if (workerCount == 0) {
+			workerCount = (std::max)(1u, std::thread::hardware_concurrency());
+		}
+
+		workers_.reserve(workerCount - 1);
+		for (unsigned i = 1; i < workerCount; ++i) {
+			workers_.emplace_back([this]() { WorkerLoop(); });
+		}
+	}
+
+	~BandPool() {
+		stopping_.store(true, std::memory_order_relaxed);
+		generation_.fetch_add(1, std::memory_order_release);
+		generation_.notify_all();
+		for (auto& worker : workers_) {
+			worker.join();
+		}
+	}
+
+	BandPool(const BandPool&) = delete;
+	BandPool& operator=(const BandPool&) = delete;
+
+	unsigned WorkerCount() const {
+		return static_cast<unsigned>(workers_.size()) + 1;
+	}
+
+	BandPoolStats Stats() const {
+		BandPoolStats stats;
+		stats.runs = runs_.load(std::memory_order_relaxed);
+		stats.waited = waited_.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	// Rows per band so that one band of source plus destination rows stays
+	// within targetBytes (roughly a slice of L2). bytesPerRow should count
+	// every byte a row reads and writes. The result is a multiple of rowMultiple,
+	// for kernels that consume rows in pairs or quads.
+	static uint32_t BandRowsFor(size_t bytesPerRow, size_t targetBytes = 256 * 1024, uint32_t rowMultiple = 1) {
+		size_t rows = bytesPerRow > 0 ? targetBytes / bytesPerRow : 1;
+		rows = (std::max<size_t>)(rows, 1);
+		rows = ((rows + rowMultiple - 1) / rowMultiple) * rowMultiple;
+		return static_cast<uint32_t>((std::min<size_t>)(rows, UINT32_MAX));
+	}
+
+	// Calls fn(firstRow, lastRow) for every band of [0, rows), spread across the
+	// pool. Returns once every band has finished. Any thread.
+	template <typename Fn>
+	void Run(uint32_t rows, uint32_t bandRows, Fn&& fn) {
+		if (rows == 0) {
+			return;
+		}
+
+		bandRows = (std::max)(bandRows, 1u);
+		const uint32_t bands = (rows + bandRows - 1) / bandRows;
+
+		if (workers_.empty() || bands == 1) {
+			for (uint32_t first = 0; first < rows; first += bandRows) {
+				TRACE_SPAN_ARG("band", "first row", first);
+				fn(first, (std::min)(first + bandRows, rows));
+			}
+			return;
+		}
+
+		const uint32_t ticket = nextTicket_.fetch_add(1, std::memory_order_relaxed);
+		uint32_t serving = serving_.load(std::memory_order_acquire);
+		if (serving != ticket) {
+			TRACE_SPAN_ARG("band pool wait", "ticket", ticket);
+			waited_.fetch_add(1, std::memory_order_relaxed);
+			do {
+				serving_.wait(serving, std::memory_order_acquire);
+			} while ((serving = serving_.load(std::memory_order_acquire)) != ticket);
+		}
+		runs_.fetch_add(1, std::memory_order_relaxed);
+
+		context_ = const_cast<void*>(static_cast<const void*>(&fn));
+		invoke_ = [](void* context, uint32_t first, uint32_t last) {
+			(*static_cast<std::remove_reference_t<Fn>*>(context))(first, last);
+		};
+		rows_ = rows;
+		bandRows_ = bandRows;
+		nextBand_.store(0, std::memory_order_relaxed);
+		busyWorkers_.store(static_cast<uint32_t>(workers_.size()), std::memory_order_relaxed);
+
+		generation_.fetch_add(1, std::memory_order_release);
+		generation_.notify_all();
+
+		RunBands();
+
+		uint32_t busy;
+		while ((busy = busyWorkers_.load(std::memory_order_acquire)) != 0) {
+			busyWorkers_.wait(busy, std::memory_order_acquire);
+		}
+
+		serving_.fetch_add(1, std::memory_order_release);
+		serving_.notify_all();
+	}
+
+private:
+	void WorkerLoop() {
+		TRACE_THREAD_NAME("band worker");
+		uint64_t seen = 0;
+		for (;;) {
+			generation_.wait(seen, std::memory_order_acquire);
+			seen = generation_.load(std::memory_order_acquire);
+
+			if (stopping_.load(std::memory_order_relaxed)) {
+				return;
+			}
+
+			RunBands();
+
+			if (busyWorkers_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				busyWorkers_.notify_one();
+			}
+		}
+	}
+
+	void RunBands() {
+		for (;;) {
+			const uint32_t band = nextBand_.fetch_add(1, std::memory_order_relaxed);
+			const uint64_t first = static_cast<uint64_t>(band) * bandRows_;
+			if (first >= rows_) {
+				return;
+			}
+			const uint32_t last = static_cast<uint32_t>((std::min<uint64_t>)(first + bandRows_, rows_));
+			TRACE_SPAN_ARG("band", "first row", first);
+			invoke_(context_, static_cast<uint32_t>(first), last);
+		}
+	}
+
+	std::vector<std::thread> workers_;
+
+	// Job description, written by Run() before the generation bump.
+	void (*invoke_)(void* context, uint32_t first, uint32_t last) { nullptr };
+	void* context_{ nullptr };
+	uint32_t rows_{ 0 };
+	uint32_t bandRows_{ 1 };
+
+	alignas(64) std::atomic<uint64_t> generation_{ 0 };
+	std::atomic<bool> stopping_{ false };
+	alignas(64) std::atomic<uint32_t> nextBand_{ 0 };
+	alignas(64) std::atomic<uint32_t> busyWorkers_{ 0 };
+
+	// Turns of concurrent Run() calls: a caller runs once serving_ reaches
+	// the ticket it drew.
+	alignas(64) std::atomic<uint32_t> nextTicket_{ 0 };
+	alignas(64) std::atomic<uint32_t> serving_{ 0 };
+	std::atomic<uint64_t> runs_{ 0 };
+	std::atomic<uint64_t> waited_{ 0 };
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+// Capture timestamps on the local steady clock.
+//
+// Capture sources stamp samples in 100 ns units on their own clock.
+// CaptureClock maps those stamps onto std::chrono::steady_clock, so a frame
+// can carry the moment it was captured through the pipeline, and
+// FrameGapDetector compares consecutive stamps with the nominal frame period
+// to count the frames the source dropped before they reached us.
+//
+// When the source stamps on a clock the caller can also read (Media
+// Foundation's MFGetSystemTime), the mapping is exact: the sample was captured
+// sourceNow - sourceTime before it arrived. Otherwise the offset between the
+// clocks is estimated as the smallest arrival - sourceTime over the last
+// kWindow samples. That removes delivery jitter, but not the latency every
+// sample shares, so estimated capture times are late by that much.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+enum class CaptureClockMode {
+	Unknown,
+	SourceClock, // source stamps on a clock we read at arrival; exact
+	Estimated,   // offset estimated from arrival times
+};
+
+inline const char* CaptureClockModeName(CaptureClockMode mode) {
+	switch (mode) {
+	case CaptureClockMode::SourceClock: return "source clock";
+	case CaptureClockMode::Estimated: return "estimated";
+	default: return "unknown";
+	}
+}
+
+class CaptureClock {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr uint32_t kWindow = 128;
+	// A stamp this close behind the source clock at arrival is taken to be on it.
+	static constexpr int64_t kSameClockTolerance = 10'000'000; // 1 s
+
+	// Capture time of a sample stamped sourceTime, given the source clock read
+	// as sourceNow right after the sample arrived. The first sample decides
+	// whether the stamps are on that clock.
+	Clock::time_point Map(int64_t sourceTime, Clock::time_point arrived, int64_t sourceNow) {
+		if (mode_ == CaptureClockMode::Unknown) {
+			const int64_t age = sourceNow - sourceTime;
+			mode_ = age >= 0 && age < kSameClockTolerance ? CaptureClockMode::SourceClock : CaptureClockMode::Estimated;
+		}
+		if (mode_ == CaptureClockMode::SourceClock) {
+			const int64_t age = (std::max)(sourceNow - sourceTime, int64_t(0));
+			return arrived - std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(age * 100));
+		}
+		return Estimate(sourceTime, arrived);
+	}
+
+	// Capture time of a sample stamped sourceTime on a clock we cannot read.
+	Clock::time_point Map(int64_t sourceTime, Clock::time_point arrived) {
+		mode_ = CaptureClockMode::Estimated;
+		return Estimate(sourceTime, arrived);
+	}
+
+	CaptureClockMode Mode() const {
+		return mode_;
+	}
+
+private:
+	Clock::time_point Estimate(int64_t sourceTime, Clock::time_point arrived) {
+		// A stamp going backwards means the source restarted its clock; the
+		// offsets seen so far no longer apply.
+		if (count_ > 0 && sourceTime < lastSourceTime_) {
+			count_ = 0;
+		}
+		lastSourceTime_ = sourceTime;
+
+		const int64_t arrivedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(arrived.time_since_epoch()).count();
+		offsets_[count_ % kWindow] = arrivedNs - sourceTime * 100;
+		++count_;
+
+		const uint32_t filled = static_cast<uint32_t>((std::min<uint64_t>)(count_, kWindow));
+		const int64_t offset = *std::min_element(offsets_, offsets_ + filled);
+		return Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(sourceTime * 100 + offset)));
+	}
+
+	CaptureClockMode mode_{ CaptureClockMode::Unknown };
+	int64_t offsets_[kWindow]{};
+	uint64_t count_{ 0 };
+	int64_t lastSourceTime_{ 0 };
+};
+
+// Counters of a detector, read from any thread.
+struct FrameGapStats {
+	uint64_t frames{ 0 };
+	uint64_t gaps{ 0 };            // intervals of 1.5 periods or more
+	uint64_t missed{ 0 };          // frames those gaps are missing
+	uint64_t discontinuities{ 0 }; // stamps that went backwards or jumped past kMaxGapPeriods
+	int64_t maxInterval{ 0 };      // 100 ns units, excluding discontinuities
+};
+
+class FrameGapDetector {
+public:
+	// Longer gaps are counted as discontinuities, not as missed frames.
+	static constexpr int64_t kMaxGapPeriods = 300;
+
+	// nominalPeriod is in 100 ns units; 0 only tracks intervals.
+	explicit FrameGapDetector(int64_t nominalPeriod = 0) : period_(nominalPeriod) {}
+
+	// Period of a frame rate of numerator / denominator, in 100 ns units.
+	static int64_t PeriodFor(uint32_t numerator, uint32_t denominator) {
+		return numerator ? static_cast<int64_t>(10'000'000ull * denominator / numerator) : 0;
+	}
+
+	// Takes the next stamp and returns how many frames are missing before it.
+	// Called from one thread.
+	uint32_t Observe(int64_t sourceTime) {
+		const bool first = frames_.load(std::memory_order_relaxed) == 0;
+		Count(frames_);
+		const int64_t interval = sourceTime - last_;
+		last_ = sourceTime;
+		if (first) {
+			return 0;
+		}
+
+		if (interval <= 0 || (period_ > 0 && interval > period_ * kMaxGapPeriods)) {
+			Count(discontinuities_);
+			return 0;
+		}
+		if (interval > maxInterval_.load(std::memory_order_relaxed)) {
+			maxInterval_.store(interval, std::memory_order_relaxed);
+		}
+
+		// Whole periods in the interval, rounded, less the frame that arrived.
+		if (period_ <= 0 || interval * 2 < period_ * 3) {
+			return 0;
+		}
+		const uint32_t missed = static_cast<uint32_t>((interval + period_ / 2) / period_ - 1);
+		Count(gaps_);
+		missed_.store(missed_.load(std::memory_order_relaxed) + missed, std::memory_order_relaxed);
+		return missed;
+	}
+
+	FrameGapStats Stats() const {
+		FrameGapStats stats;
+		stats.frames = frames_.load(std::memory_order_relaxed);
+		stats.gaps = gaps_.load(std::memory_order_relaxed);
+		stats.missed = missed_.load(std::memory_order_relaxed);
+		stats.discontinuities = discontinuities_.load(std::memory_order_relaxed);
+		stats.maxInterval = maxInterval_.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	int64_t NominalPeriod() const {
+		return period_;
+	}
+
+private:
+	static void Count(std::atomic<uint64_t>& counter) {
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	int64_t period_;
+	int64_t last_{ 0 };
+	std::atomic<uint64_t> frames_{ 0 };
+	std::atomic<uint64_t> gaps_{ 0 };
+	std::atomic<uint64_t> missed_{ 0 };
+	std::atomic<uint64_t> discontinuities_{ 0 };
+	std::atomic<int64_t> maxInterval_{ 0 };
+};
+
+// Converts steady-clock times to 100 ns since the Unix epoch, the unit of NDI
+// timecodes. The two clocks are related once, so converted times keep their
+// steady-clock spacing even if the system clock is adjusted later.
+class UtcTimecodeAnchor {
+public:
+	UtcTimecodeAnchor()
+		: steady_(std::chrono::steady_clock::now()),
+		system_(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()) {}
+
+	int64_t Timecode(std::chrono::steady_clock::time_point time) const {
+		const int64_t since = std::chrono::duration_cast<std::chrono::nanoseconds>(time - steady_).count();
+		return (system_ + since) / 100;
+	}
+
+private:
+	std::chrono::steady_clock::time_point steady_;
+	int64_t system_; // nanoseconds since the Unix epoch at steady_
+};
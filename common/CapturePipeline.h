@@ -0,0 +1,572 @@
+#pragma once
+
+// Capture -> convert -> send, independent of where frames come from and go.
+//
+// A capture thread reads the CaptureSource, maps each sample's timestamp onto
+// the steady clock, checks it for gaps and queues it in a FrameRing, whose
+// handoff policy decides what to drop when conversion falls behind. Run()
+// takes samples off the ring on the calling thread, locks each in place,
+// converts it into a pooled output buffer with the FrameConverter, optionally
+// holds it for the FramePacer, and hands it to the FrameSink. Every stage
+// records its latency.
+//
+// Samples that queued up while Run() was busy are taken off the ring together
+// and converted as a batch, up to the frames the converters can have in
+// flight. That is one for raw captures; an MJPG capture decodes a frame per
+// worker side by side (FrameConverter::ConvertFrames()), so a decode that
+// falls behind catches up on several cores, while a decode that keeps up still
+// sends every frame as soon as it is done.
+//
+// AddOutput() adds more converter/sink pairs with pools of their own; each
+// sample is locked once and converted into every output before any is sent
+// (see SinkFanOut.h for several sinks on one conversion).
+//
+// The same code runs behind a camera and NDI in the apps and behind the
+// synthetic source and a null sink in Benchmarks.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "CaptureClock.h"
+#include "CaptureSource.h"
+#include "FrameConverter.h"
+#include "FrameHandle.h"
+#include "FramePacer.h"
+#include "FramePool.h"
+#include "FrameRing.h"
+#include "FrameSink.h"
+#include "FrameTracer.h"
+#include "LatencyHistogram.h"
+
+struct PipelineConfig {
+	uint32_t captureSlots{ 4 }; // samples queued between capture and conversion
+	HandoffPolicy captureHandoff{ HandoffPolicy::Latest }; // when conversion falls behind capture
+	uint32_t poolDepth{ 3 };    // output buffers: one converting, one held by an async sink, one spare
+	bool pace{ false };         // send on a steady cadence at the capture frame rate
+	double jitterBufferMs{ 8.0 }; // how far behind capture the paced cadence runs
+	uint64_t maxFrames{ 0 };    // stop after sending this many; 0 = until the source ends or Stop()
+	double reportSeconds{ 5.0 }; // interval of the periodic stats; 0 = only at the end
+	bool printStats{ true };    // stats periodically and at the end, and progress messages
+};
+
+// Pipeline stages with a latency histogram each. End-to-end runs from
+// Read() returning to Send() returning; glass-to-send starts at the sample's
+// capture timestamp instead.
+enum LatencyStage : uint32_t {
+	kStageRead,
+	kStageLock,
+	kStageConvert,
+	kStagePace,
+	kStageSend,
+	kStageEndToEnd,
+	kStageGlassToSend,
+	kStageCount,
+};
+
+constexpr const char* kStageNames[kStageCount] = { "read wait", "lock", "convert", "pace wait", "send", "end-to-end", "glass-to-send" };
+
+class CapturePipeline {
+public:
+	CapturePipeline(const PipelineConfig& config, CaptureSource& source, FrameConverter& converter, FrameSink& sink)
+		: config_(config), source_(source), format_(source.Format()),
+		ring_(config.captureSlots, config.captureHandoff),
+		frameHandles_(format_.format, format_.width, format_.height, config.captureSlots + config.poolDepth),
+		gaps_(FrameGapDetector::PeriodFor(format_.frameRateNumerator, format_.frameRateDenominator)) {
+		AddOutput(converter, sink, config.poolDepth);
+	}
+
+	CapturePipeline(const CapturePipeline&) = delete;
+	CapturePipeline& operator=(const CapturePipeline&) = delete;
+
+	// Another conversion of every sample, into poolDepth buffers of its own
+	// (and as many of each proxy level). Call before Initialize().
+	void AddOutput(FrameConverter& converter, FrameSink& sink, uint32_t poolDepth) {
+		outputs_.push_back({ &converter, &sink, poolDepth });
+	}
+
+	// Allocates the output buffers for each converter's layout, and for its
+	// proxy levels; Run() only recycles them.
+	bool Initialize();
+
+	// Runs until the source ends, maxFrames have been sent or Stop() is
+	// called. afterFrame, if set, is called on this thread after every frame.
+	void Run(const std::function<void()>& afterFrame = nullptr);
+
+	// Stops Run() once the frames already queued are sent. Any thread.
+	void Stop() {
+		ring_.Close();
+	}
+
+	void PrintStats(bool interval);
+
+	uint64_t FramesSent() const {
+		return framesSent_.load(std::memory_order_relaxed);
+	}
+
+	FrameRingStats RingStats() const {
+		return ring_.Stats();
+	}
+
+	FrameGapStats GapStats() const {
+		return gaps_.Stats();
+	}
+
+	FramePoolStats PoolStats(size_t output = 0) const {
+		return framePool_.Stats(outputs_[output].poolClass);
+	}
+
+	FrameHandleStats HandleStats() const {
+		return frameHandles_.Stats();
+	}
+
+	// The most samples converted in one batch so far.
+	uint32_t LargestBatch() const {
+		return largestBatch_.load(std::memory_order_relaxed);
+	}
+
+	// Frames that were not sent because they did not convert (corrupt MJPG).
+	uint64_t ConvertFailures() const {
+		return convertFailures_.load(std::memory_order_relaxed);
+	}
+
+	LatencySnapshot Latency(LatencyStage stage) const {
+		return latency_[stage].Snapshot();
+	}
+
+	// Null unless pacing; read from the Run() thread.
+	const FramePacer* Pacer() const {
+		return pacer_.get();
+	}
+
+private:
+	struct Output {
+		FrameConverter* converter;
+		FrameSink* sink;
+		uint32_t poolDepth;
+		uint32_t poolClass{ 0 };
+		uint32_t proxyClasses[ProxyPyramid::kLevelCount]{};
+	};
+
+	void CaptureLoop();
+	void PrintRingStats(const FrameRingStats& stats);
+	void PrintGapStats(const FrameGapStats& stats);
+	void PrintPoolStats(const char* name, const FramePoolStats& stats);
+	void PrintHandleStats(const FrameHandleStats& stats);
+	void PrintBatchStats();
+	void PrintPacerStats(const FramePacerStats& stats);
+	void PrintLatency(bool interval);
+
+	PipelineConfig config_;
+	CaptureSource& source_;
+	CaptureFormat format_;
+	std::vector<Output> outputs_;
+
+	FrameRing<CapturedSample> ring_;
+	FramePool framePool_;
+	FrameHandleFactory frameHandles_;
+	FrameGapDetector gaps_;
+	std::unique_ptr<FramePacer> pacer_;
+	std::atomic<uint64_t> framesSent_{ 0 };
+	uint32_t framesInFlight_{ 1 }; // the largest batch, set by Initialize()
+	std::atomic<uint32_t> largestBatch_{ 0 };
+	std::atomic<uint64_t> convertFailures_{ 0 };
+
+	LatencyHistogram latency_[kStageCount];
+	LatencySnapshot reportedLatency_[kStageCount]; // as of the last periodic report
+};
+
+inline bool CapturePipeline::Initialize() {
+	// A batch is bounded by what the ring can have queued behind the sample
+	// Run() waited for.
+	framesInFlight_ = ring_.Capacity() + 1;
+	for (const Output& output : outputs_) {
+		framesInFlight_ = (std::min)(framesInFlight_, output.converter->FramesInFlight());
+	}
+
+	// Besides the ones in the ring, the capture thread holds the sample it is
+	// reading and the one a full ring evicts for it, and Run() the batch it is
+	// converting.
+	source_.ReserveSamples(ring_.Capacity() + 2 + framesInFlight_);
+
+	// Every frame of a batch past the first needs a buffer of its own.
+	for (Output& output : outputs_) {
+		const FrameLayout& layout = output.converter->OutputLayout();
+		const uint32_t depth = output.poolDepth + framesInFlight_ - 1;
+		if (!framePool_.AddClass(layout, depth, output.poolClass)) {
+			std::cerr << "Failed to allocate " << depth << " output buffers of " << layout.totalBytes << " bytes." << std::endl;
+			return false;
+		}
+		if (config_.printStats) {
+			std::cout << "Frame pool: " << framePool_.Stats(output.poolClass).depth << " x " << layout.totalBytes << " bytes" << std::endl;
+		}
+
+		// Proxies go to the same sinks as the frame, so they are held as long.
+		const ProxyPyramid* proxies = output.converter->Proxies();
+		for (uint32_t level = 0; proxies && level < ProxyPyramid::kLevelCount; ++level) {
+			const FrameLayout& proxyLayout = proxies->Layout(level);
+			if (!framePool_.AddClass(proxyLayout, depth, output.proxyClasses[level])) {
+				std::cerr << "Failed to allocate " << depth << " proxy buffers of " << proxyLayout.totalBytes << " bytes." << std::endl;
+				return false;
+			}
+		}
+	}
+
+	if (config_.pace) {
+		const auto period = std::chrono::nanoseconds(gaps_.NominalPeriod() * 100);
+		const auto jitterBuffer = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double, std::milli>(config_.jitterBufferMs));
+		if (period.count() > 0) {
+			pacer_ = std::make_unique<FramePacer>(period, jitterBuffer);
+			if (config_.printStats) {
+				std::cout << "Pacing output at " << format_.frameRateNumerator << "/" << format_.frameRateDenominator << " fps with a "
+					<< config_.jitterBufferMs << " ms jitter buffer." << std::endl;
+			}
+		}
+		else {
+			std::cerr << "The capture format has no frame rate; sending unpaced." << std::endl;
+		}
+	}
+	return true;
+}
+
+// Capture thread: reads samples and queues them for Run() without waiting for
+// the conversion. When the ring is full, the handoff policy decides which
+// sample is dropped (and released back to the source), or whether to wait.
+// Every sample's timestamp is mapped onto the steady clock here and checked
+// for gaps, including the samples the ring drops later.
+inline void CapturePipeline::CaptureLoop() {
+	TRACE_THREAD_NAME("capture");
+	CaptureClock captureClock;
+	uint64_t sampleCount = 0;
+	bool clockReported = false;
+	while (!ring_.Closed()) {
+		CapturedSample captured;
+
+		const auto readStart = std::chrono::steady_clock::now();
+		CaptureReadStatus status;
+		{
+			TRACE_SPAN_ARG("read", "sample", sampleCount);
+			status = source_.Read(captured);
+		}
+		++sampleCount;
+		captured.arrived = std::chrono::steady_clock::now();
+		latency_[kStageRead].Record(captured.arrived - readStart);
+
+		if (status == CaptureReadStatus::Failed) {
+			std::cerr << "Failed to read video sample." << std::endl;
+			break;
+		}
+		if (status == CaptureReadStatus::EndOfStream) {
+			if (config_.printStats) {
+				std::cout << "End of stream." << std::endl;
+			}
+			break;
+		}
+		if (status != CaptureReadStatus::Sample) {
+			continue;
+		}
+
+		captured.captured = captured.sourceNow != kNoSourceClock
+			? captureClock.Map(captured.timestamp, captured.arrived, captured.sourceNow)
+			: captureClock.Map(captured.timestamp, captured.arrived);
+		gaps_.Observe(captured.timestamp);
+		if (!clockReported && config_.printStats) {
+			std::cout << "Capture timestamps: " << CaptureClockModeName(captureClock.Mode()) << "." << std::endl;
+			clockReported = true;
+		}
+		ring_.Push(captured);
+	}
+
+	ring_.Close();
+}
+
+inline void CapturePipeline::Run(const std::function<void()>& afterFrame) {
+	const size_t captureBytes = PackedFrameLayout(format_.format, format_.width, format_.height).totalBytes;
+	size_t outputBytes = 0;
+	for (const Output& output : outputs_) {
+		outputBytes += output.converter->OutputLayout().totalBytes;
+	}
+
+	uint64_t frameCount = 0;
+	std::chrono::time_point<std::chrono::steady_clock> lastOutputTime = std::chrono::steady_clock::now();
+
+	std::thread captureThread([this]() { CaptureLoop(); });
+	TRACE_THREAD_NAME("convert/send");
+
+	// Everything a batch holds, sized once for the largest.
+	std::vector<CapturedSample> batch(framesInFlight_);
+	std::vector<FrameHandle> sources(framesInFlight_);
+	std::vector<std::vector<SinkFrame>> frames(framesInFlight_, std::vector<SinkFrame>(outputs_.size()));
+	std::vector<ConvertJob> jobs(framesInFlight_);
+	std::vector<uint32_t> jobFrames(framesInFlight_); // batch position of each job
+	bool lockFailed = false;
+	while (!lockFailed && ring_.Pop(batch[0])) {
+		// Samples already queued go along with the first, without waiting for
+		// more, and never past maxFrames.
+		uint32_t count = 1;
+		while (count < framesInFlight_ && (config_.maxFrames == 0 || frameCount + count < config_.maxFrames) && ring_.TryPop(batch[count])) {
+			++count;
+		}
+
+		// An output whose buffers are all still held downstream misses a
+		// sample; if every output does, it is dropped unconverted.
+		uint32_t kept = 0;
+		for (uint32_t k = 0; k < count; ++k) {
+			bool anyFrame = false;
+			for (size_t i = 0; i < outputs_.size(); ++i) {
+				SinkFrame& output = frames[kept][i];
+				output.frame = framePool_.Acquire(outputs_[i].poolClass);
+				anyFrame = anyFrame || static_cast<bool>(output.frame);
+				if (output.frame && outputs_[i].converter->Proxies()) {
+					for (uint32_t level = 0; level < ProxyPyramid::kLevelCount; ++level) {
+						output.proxies[level] = framePool_.Acquire(outputs_[i].proxyClasses[level]);
+					}
+				}
+			}
+			if (!anyFrame) {
+				batch[k].frame.reset();
+				continue;
+			}
+			if (kept != k) {
+				batch[kept] = std::move(batch[k]);
+			}
+			++kept;
+		}
+		count = kept;
+		if (count == 0) {
+			continue;
+		}
+		const uint64_t firstIndex = frameCount;
+		frameCount += count;
+		if (count > largestBatch_.load(std::memory_order_relaxed)) {
+			largestBatch_.store(count, std::memory_order_relaxed);
+		}
+
+		for (uint32_t k = 0; k < count && !lockFailed; ++k) {
+			const auto lockStart = std::chrono::steady_clock::now();
+			{
+				TRACE_SPAN("lock", firstIndex + k);
+				sources[k] = frameHandles_.Lock(batch[k].frame);
+			}
+			latency_[kStageLock].Record(std::chrono::steady_clock::now() - lockStart);
+			if (!sources[k]) {
+				std::cerr << "Failed to lock the captured frame." << std::endl;
+				lockFailed = true;
+			}
+		}
+		if (lockFailed) {
+			break;
+		}
+
+		const auto convertStart = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < outputs_.size(); ++i) {
+			uint32_t jobCount = 0;
+			for (uint32_t k = 0; k < count; ++k) {
+				const SinkFrame& output = frames[k][i];
+				if (output.frame) {
+					ConvertJob& job = jobs[jobCount];
+					job = { sources[k].get(), output.frame.Data(), firstIndex + k };
+					for (uint32_t level = 0; level < ProxyPyramid::kLevelCount; ++level) {
+						job.proxies[level] = output.proxies[level] ? output.proxies[level].Data() : nullptr;
+					}
+					jobFrames[jobCount++] = k;
+				}
+			}
+			{
+				TRACE_SPAN("convert", firstIndex);
+				outputs_[i].converter->ConvertFrames(jobs.data(), jobCount);
+			}
+			// A frame that did not decode is not sent.
+			for (uint32_t j = 0; j < jobCount; ++j) {
+				if (!jobs[j].converted) {
+					frames[jobFrames[j]][i].Reset();
+					convertFailures_.store(convertFailures_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Nothing reads the capture buffers past the conversion; unlock them
+		// before sending rather than after.
+		for (uint32_t k = 0; k < count; ++k) {
+			sources[k].reset();
+			batch[k].frame.reset();
+		}
+
+		// Every frame of a batch waited for all of it.
+		const auto convertEnd = std::chrono::steady_clock::now();
+		for (uint32_t k = 0; k < count; ++k) {
+			latency_[kStageConvert].Record(convertEnd - convertStart);
+		}
+
+		for (uint32_t k = 0; k < count; ++k) {
+			const CapturedSample& captured = batch[k];
+			const uint64_t frameIndex = firstIndex + k;
+
+			const auto paceStart = std::chrono::steady_clock::now();
+			if (pacer_) {
+				TRACE_SPAN("pace", frameIndex);
+				FramePacer::WaitUntil(pacer_->Schedule(captured.captured, paceStart));
+			}
+
+			const auto sendStart = std::chrono::steady_clock::now();
+			latency_[kStagePace].Record(sendStart - paceStart);
+			if (pacer_) {
+				pacer_->Sent(sendStart);
+			}
+
+			for (size_t i = 0; i < outputs_.size(); ++i) {
+				SinkFrame& output = frames[k][i];
+				if (!output.frame) {
+					continue;
+				}
+				output.index = frameIndex;
+				output.captured = captured.captured;
+				{
+					TRACE_SPAN("send", frameIndex);
+					outputs_[i].sink->Send(output);
+				}
+				output.Reset();
+			}
+			framesSent_.store(frameIndex + 1, std::memory_order_relaxed);
+
+			const auto now = std::chrono::steady_clock::now();
+			latency_[kStageSend].Record(now - sendStart);
+			latency_[kStageEndToEnd].Record(now - captured.arrived);
+			latency_[kStageGlassToSend].Record(now - captured.captured);
+
+			if (config_.printStats && config_.reportSeconds > 0.0 && now - lastOutputTime >= std::chrono::duration<double>(config_.reportSeconds)) {
+				PrintStats(true);
+				lastOutputTime = now;
+			}
+
+			if (afterFrame) {
+				afterFrame();
+			}
+		}
+		if (config_.maxFrames != 0 && frameCount >= config_.maxFrames) {
+			break;
+		}
+	}
+
+	for (uint32_t k = 0; k < framesInFlight_; ++k) {
+		sources[k].reset();
+		batch[k].frame.reset();
+		for (SinkFrame& frame : frames[k]) {
+			frame.Reset();
+		}
+	}
+	ring_.Close();
+	captureThread.join();
+	// Past maxFrames, or after a failed lock, samples still queued are given
+	// back to the source unconverted.
+	CapturedSample captured;
+	while (ring_.TryPop(captured)) {
+		captured.frame.reset();
+	}
+	for (const Output& output : outputs_) {
+		output.sink->Flush();
+	}
+	if (!config_.printStats) {
+		return;
+	}
+	PrintStats(false);
+
+	const double averageDuration = latency_[kStageConvert].Snapshot().Mean() / 1e9;
+
+	// Every frame reads the captured frame and writes each output frame.
+	double bytesPerFrame = static_cast<double>(captureBytes) + outputBytes;
+	double gbPerSecond = averageDuration > 0.0 ? bytesPerFrame / averageDuration / 1e9 : 0.0;
+	std::cout << "Average Duration: " << averageDuration * 1000 << " ms (" << gbPerSecond << " GB/s)" << std::endl;
+}
+
+// Everything the pipeline counts; latency over the last interval or the whole run.
+inline void CapturePipeline::PrintStats(bool interval) {
+	PrintRingStats(ring_.Stats());
+	PrintGapStats(gaps_.Stats());
+	static const char* const proxyPoolNames[ProxyPyramid::kLevelCount] = { "Proxy 1/2 pool", "Proxy 1/4 pool" };
+	for (const Output& output : outputs_) {
+		PrintPoolStats("Frame pool", framePool_.Stats(output.poolClass));
+		for (uint32_t level = 0; output.converter->Proxies() && level < ProxyPyramid::kLevelCount; ++level) {
+			PrintPoolStats(proxyPoolNames[level], framePool_.Stats(output.proxyClasses[level]));
+		}
+	}
+	PrintHandleStats(frameHandles_.Stats());
+	PrintBatchStats();
+	if (pacer_) {
+		PrintPacerStats(pacer_->Stats());
+	}
+	PrintLatency(interval);
+	for (const Output& output : outputs_) {
+		output.sink->PrintStats(interval);
+	}
+}
+
+inline void CapturePipeline::PrintRingStats(const FrameRingStats& stats) {
+	std::cout << "Capture ring (" << HandoffPolicyName(stats.policy) << "): " << stats.pushed << " queued, " << stats.Dropped() << " dropped, "
+		<< stats.blocked << " blocked, " << stats.occupancy << "/" << stats.capacity << " in use (high water " << stats.highWater << "), age "
+		<< stats.meanAge * 1000 << " ms mean, " << stats.maxAge * 1000 << " ms max" << std::endl;
+}
+
+inline void CapturePipeline::PrintGapStats(const FrameGapStats& stats) {
+	std::cout << "Capture gaps: " << stats.missed << " frames missed in " << stats.gaps << " gaps, "
+		<< stats.discontinuities << " discontinuities, longest interval " << stats.maxInterval / 1e4 << " ms over "
+		<< stats.frames << " frames" << std::endl;
+}
+
+inline void CapturePipeline::PrintPoolStats(const char* name, const FramePoolStats& stats) {
+	std::cout << name << ": " << stats.acquired << " acquired, " << stats.exhausted << " exhausted, "
+		<< stats.inUse << "/" << stats.depth << " in use (high water " << stats.highWater << ")" << std::endl;
+}
+
+inline void CapturePipeline::PrintHandleStats(const FrameHandleStats& stats) {
+	std::cout << "Capture buffers: " << stats.direct << " read in place, " << stats.copied << " copied (fragmented), "
+		<< stats.failures << " failed to lock";
+	if (stats.overflows) {
+		std::cout << ", " << stats.overflows << " handles allocated past their slots";
+	}
+	std::cout << std::endl;
+}
+
+// Only of interest when frames can be in flight together, or fail to convert.
+inline void CapturePipeline::PrintBatchStats() {
+	const uint64_t failures = ConvertFailures();
+	if (framesInFlight_ <= 1 && failures == 0) {
+		return;
+	}
+	std::cout << "Conversion: up to " << LargestBatch() << " of " << framesInFlight_ << " frames in flight, "
+		<< failures << " failed to convert" << std::endl;
+}
+
+// Jitter of the converted frames and of the sends, in milliseconds.
+inline void CapturePipeline::PrintPacerStats(const FramePacerStats& stats) {
+	auto ms = [](uint64_t nanoseconds) { return nanoseconds / 1e6; };
+	std::cout << "Pacer: " << stats.frames << " frames, " << stats.late << " late, " << stats.skipped << " empty slots, "
+		<< stats.restarts << " restarts; jitter p99 " << ms(stats.inputJitter.ValueAtPercentile(99.0)) << " -> "
+		<< ms(stats.outputJitter.ValueAtPercentile(99.0)) << " ms, max " << ms(stats.inputJitter.max) << " -> "
+		<< ms(stats.outputJitter.max) << " ms" << std::endl;
+}
+
+// Percentiles of every stage, over the last reporting interval or the whole run.
+inline void CapturePipeline::PrintLatency(bool interval) {
+	auto ms = [](uint64_t nanoseconds) { return nanoseconds / 1e6; };
+
+	std::cout << (interval ? "Latency, last interval (ms):" : "Latency, whole run (ms):") << std::endl;
+	for (uint32_t stage = 0; stage < kStageCount; ++stage) {
+		const LatencySnapshot current = latency_[stage].Snapshot();
+		const LatencySnapshot shown = interval ? current.Since(reportedLatency_[stage]) : current;
+		std::cout << "  " << std::left << std::setw(13) << kStageNames[stage] << std::right << std::fixed << std::setprecision(3)
+			<< " p50 " << ms(shown.ValueAtPercentile(50.0)) << "  p90 " << ms(shown.ValueAtPercentile(90.0))
+			<< "  p99 " << ms(shown.ValueAtPercentile(99.0)) << "  p99.9 " << ms(shown.ValueAtPercentile(99.9))
+			<< "  max " << ms(shown.max) << "  (" << shown.count << " samples)" << std::defaultfloat << std::endl;
+		if (interval) {
+			reportedLatency_[stage] = current;
+		}
+	}
+}
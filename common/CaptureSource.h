@@ -0,0 +1,72 @@
+#pragma once
+
+// Where the pipeline gets its frames.
+//
+// A CaptureSource is read from one thread and hands out one sample per
+// Read(). The pipeline keeps the sample queued and locks its frame (see
+// FrameHandle.h) once it gets to convert it, by which time the source may have
+// delivered several more, so a sample owns what its frame needs.
+//
+// A source that makes its samples from a SlotPool sizes it in
+// ReserveSamples(), which the pipeline calls with the most samples it holds at
+// once, so reading a sample does not touch the heap.
+//
+// Backends: MFCaptureSource reads a camera through a Media Foundation source
+// reader (MFCaptureSource.h); SyntheticCaptureSource generates test patterns
+// and runs anywhere (SyntheticCapture.h).
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "FrameHandle.h"
+#include "PixelFormat.h"
+
+struct CaptureFormat {
+	PixelFormat format{ PixelFormat::Unknown }; // as Read() delivers it
+	uint32_t width{ 0 };
+	uint32_t height{ 0 };
+	uint32_t frameRateNumerator{ 0 }; // 0 = unknown
+	uint32_t frameRateDenominator{ 1 };
+
+	double FrameRate() const {
+		return frameRateDenominator ? static_cast<double>(frameRateNumerator) / frameRateDenominator : 0.0;
+	}
+};
+
+enum class CaptureReadStatus {
+	Sample,
+	NoSample,    // the read succeeded without a frame (a stream tick); read again
+	EndOfStream,
+	Failed,
+};
+
+// sourceNow of a source whose clock cannot be read.
+constexpr int64_t kNoSourceClock = INT64_MIN;
+
+// One sample on its way from the capture thread to the conversion.
+struct CapturedSample {
+	std::shared_ptr<CapturedFrameSource> frame;
+	int64_t timestamp{ 0 };             // 100 ns units, on the source clock
+	int64_t sourceNow{ kNoSourceClock }; // the source clock right after the read
+	std::chrono::steady_clock::time_point arrived;  // when Read() returned it
+	std::chrono::steady_clock::time_point captured; // timestamp on the steady clock
+};
+
+class CaptureSource {
+public:
+	virtual ~CaptureSource() = default;
+
+	virtual const char* Name() const = 0;
+	virtual CaptureFormat Format() const = 0;
+
+	// The most samples alive at once: queued in the ring, being read and
+	// being converted. Called before the first Read().
+	virtual void ReserveSamples(uint32_t count) {
+		(void)count;
+	}
+
+	// Blocks until the next sample and fills its frame, timestamp and
+	// sourceNow.
+	virtual CaptureReadStatus Read(CapturedSample& sample) = 0;
+};
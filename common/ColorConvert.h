@@ -0,0 +1,300 @@
+#pragma once
+
+// YUV -> RGB conversion kernels.
+//
+// Fixed point throughout: the matrix is folded into Q13 coefficients so every
+// output channel is one or two pmaddwd per four pixels, and the scalar
+// reference uses exactly the same integer formula, so the SIMD variants are
+// bit-exact against it. Against a double-precision reference the error is at
+// most one code value.
+//
+// Like PixelConvert.h this header has no Windows / Media Foundation
+// dependencies; the examples map MF_MT_YUV_MATRIX / MF_MT_VIDEO_NOMINAL_RANGE
+// onto YUVColorimetry themselves.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "BandPool.h"
+#include "PixelConvert.h"
+#include "PixelFormat.h"
+
+enum class YUVMatrix {
+	BT601,
+	BT709,
+};
+
+enum class YUVRange {
+	Limited, // Y 16-235, Cb/Cr 16-240
+	Full,    // Y and Cb/Cr 0-255
+};
+
+struct YUVColorimetry {
+	YUVMatrix matrix{ YUVMatrix::BT709 };
+	YUVRange range{ YUVRange::Limited };
+};
+
+inline const char* YUVMatrixName(YUVMatrix matrix) {
+	return matrix == YUVMatrix::BT601 ? "BT.601" : "BT.709";
+}
+
+inline const char* YUVRangeName(YUVRange range) {
+	return range == YUVRange::Full ? "full" : "limited";
+}
+
+// What to assume when the media type carries no colorimetry: JPEG (JFIF) is
+// full-range BT.601, SD video BT.601 and HD video BT.709, both limited range.
+inline YUVColorimetry DefaultColorimetry(PixelFormat nativeFormat, uint32_t height) {
+	if (nativeFormat == PixelFormat::MJPG) {
+		return { YUVMatrix::BT601, YUVRange::Full };
+	}
+	return { height < 720 ? YUVMatrix::BT601 : YUVMatrix::BT709, YUVRange::Limited };
+}
+
+// Luma and chroma-difference weights (Kr, Kb) of each matrix.
+inline void YUVMatrixWeights(YUVMatrix matrix, double& kr, double& kb) {
+	if (matrix == YUVMatrix::BT601) {
+		kr = 0.299;
+		kb = 0.114;
+	}
+	else {
+		kr = 0.2126;
+		kb = 0.0722;
+	}
+}
+
+// R = y * (Y - yOffset) + rv * (V - 128)
+// G = y * (Y - yOffset) + gu * (U - 128) + gv * (V - 128)
+// B = y * (Y - yOffset) + bu * (U - 128)
+// with every coefficient in Q13. The largest (bu for limited-range BT.709,
+// about 2.11) still fits an int16_t.
+struct YUVToRGBCoefficients {
+	int16_t yOffset;
+	int16_t y;
+	int16_t rv;
+	int16_t gu;
+	int16_t gv;
+	int16_t bu;
+};
+
+constexpr int kYUVToRGBShift = 13;
+constexpr int32_t kYUVToRGBRound = 1 << (kYUVToRGBShift - 1);
+
+inline YUVToRGBCoefficients MakeYUVToRGBCoefficients(const YUVColorimetry& colorimetry) {
+	double kr, kb;
+	YUVMatrixWeights(colorimetry.matrix, kr, kb);
+	const double kg = 1.0 - kr - kb;
+
+	const bool limited = colorimetry.range == YUVRange::Limited;
+	const double yScale = limited ? 255.0 / 219.0 : 1.0;
+	const double cScale = limited ? 255.0 / 224.0 : 1.0;
+
+	auto q13 = [](double value) {
+		return static_cast<int16_t>(std::lround(value * (1 << kYUVToRGBShift)));
+	};
+
+	YUVToRGBCoefficients c;
+	c.yOffset = limited ? 16 : 0;
+	c.y = q13(yScale);
+	c.rv = q13(cScale * 2.0 * (1.0 - kr));
+	c.gu = q13(-cScale * 2.0 * kb * (1.0 - kb) / kg);
+	c.gv = q13(-cScale * 2.0 * kr * (1.0 - kr) / kg);
+	c.bu = q13(cScale * 2.0 * (1.0 - kb));
+	return c;
+}
+
+//
+// YUY2 -> BGRA / BGRX / RGBA / RGBX
+//
+// The alpha / X byte is always 255. Width is in pixels and must be even.
+//
+
+using YUY2ToRGBRowFunc = void (*)(const uint8_t* src, uint8_t* dst, uint32_t width, const YUVToRGBCoefficients& c);
+
+inline uint8_t ClampToByte(int32_t value) {
+	return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+// kBGR selects B, G, R, A byte order; otherwise R, G, B, A.
+template <bool kBGR>
+inline void YUY2ToRGBRow_Scalar(const uint8_t* src, uint8_t* dst, uint32_t width, const YUVToRGBCoefficients& c) {
+	for (uint32_t x = 0; x < width; x += 2) {
+		const int32_t u = src[x * 2 + 1] - 128;
+		const int32_t v = src[x * 2 + 3] - 128;
+		const int32_t r = c.rv * v + kYUVToRGBRound;
+		const int32_t g = c.gu * u + c.gv * v + kYUVToRGBRound;
+		const int32_t b = c.bu * u + kYUVToRGBRound;
+
+		for (uint32_t i = 0; i < 2; ++i) {
+			const int32_t y = (src[x * 2 + i * 2] - c.yOffset) * c.y;
+			uint8_t* pixel = dst + (x + i) * 4;
+			pixel[kBGR ? 2 : 0] = ClampToByte((y + r) >> kYUVToRGBShift);
+			pixel[1] = ClampToByte((y + g) >> kYUVToRGBShift);
+			pixel[kBGR ? 0 : 2] = ClampToByte((y + b) >> kYUVToRGBShift);
+			pixel[3] = 255;
+		}
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+// Two int16 coefficients as one pmaddwd operand: lo multiplies the even
+// (first) element of each pair, hi the odd one.
+inline int32_t PackCoefficientPair(int16_t lo, int16_t hi) {
+	return static_cast<int32_t>((static_cast<uint32_t>(static_cast<uint16_t>(hi)) << 16) | static_cast<uint16_t>(lo));
+}
+
+// Pixels are widened to int16 straight out of the YUY2 bytes (pshufb with
+// zeroing lanes), with U and V repeated for both pixels of a pair. Then
+// (Y, U) and (Y, V) pairs go through pmaddwd: B and R need one each, G one
+// more for its V term. The 32-bit sums are shifted, saturated down to bytes
+// and interleaved into 4-byte pixels. Only SSSE3 is needed, so this variant
+// also serves every SSE4.1 CPU.
+PIXEL_CONVERT_TARGET("ssse3")
+inline void YUY2ToRGB8_SSSE3(const uint8_t* src, uint8_t* dst, bool bgr, __m128i yOffset, __m128i yBu, __m128i yRv, __m128i yGu, __m128i gv) {
+	const __m128i lumaBytes = _mm_setr_epi8(0, -1, 2, -1, 4, -1, 6, -1, 8, -1, 10, -1, 12, -1, 14, -1);
+	const __m128i uBytes = _mm_setr_epi8(1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1, 13, -1);
+	const __m128i vBytes = _mm_setr_epi8(3, -1, 3, -1, 7, -1, 7, -1, 11, -1, 11, -1, 15, -1, 15, -1);
+	const __m128i chromaOffset = _mm_set1_epi16(128);
+	const __m128i round = _mm_set1_epi32(kYUVToRGBRound);
+	const __m128i zero = _mm_setzero_si128();
+
+	const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+	const __m128i y = _mm_sub_epi16(_mm_shuffle_epi8(s, lumaBytes), yOffset);
+	const __m128i u = _mm_sub_epi16(_mm_shuffle_epi8(s, uBytes), chromaOffset);
+	const __m128i v = _mm_sub_epi16(_mm_shuffle_epi8(s, vBytes), chromaOffset);
+
+	const __m128i yuLo = _mm_unpacklo_epi16(y, u);
+	const __m128i yuHi = _mm_unpackhi_epi16(y, u);
+	const __m128i yvLo = _mm_unpacklo_epi16(y, v);
+	const __m128i yvHi = _mm_unpackhi_epi16(y, v);
+
+	const __m128i b = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yuLo, yBu), round), kYUVToRGBShift),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yuHi, yBu), round), kYUVToRGBShift));
+	const __m128i r = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yvLo, yRv), round), kYUVToRGBShift),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yvHi, yRv), round), kYUVToRGBShift));
+	const __m128i g = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(yuLo, yGu), _mm_madd_epi16(_mm_unpacklo_epi16(v, zero), gv)), round), kYUVToRGBShift),
+		_mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(yuHi, yGu), _mm_madd_epi16(_mm_unpackhi_epi16(v, zero), gv)), round), kYUVToRGBShift));
+
+	// c0 c2 and c1 A as bytes, then byte- and word-interleaved into c0 c1 c2 A.
+	const __m128i c02 = bgr ? _mm_packus_epi16(b, r) : _mm_packus_epi16(r, b);
+	const __m128i c1a = _mm_packus_epi16(g, _mm_set1_epi16(255));
+	const __m128i c01 = _mm_unpacklo_epi8(c02, c1a);
+	const __m128i c2a = _mm_unpackhi_epi8(c02, c1a);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(c01, c2a));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi16(c01, c2a));
+}
+
+template <bool kBGR>
+PIXEL_CONVERT_TARGET("ssse3")
+inline void YUY2ToRGBRow_SSSE3(const uint8_t* src, uint8_t* dst, uint32_t width, const YUVToRGBCoefficients& c) {
+	const __m128i yOffset = _mm_set1_epi16(c.yOffset);
+	const __m128i yBu = _mm_set1_epi32(PackCoefficientPair(c.y, c.bu));
+	const __m128i yRv = _mm_set1_epi32(PackCoefficientPair(c.y, c.rv));
+	const __m128i yGu = _mm_set1_epi32(PackCoefficientPair(c.y, c.gu));
+	const __m128i gv = _mm_set1_epi32(PackCoefficientPair(c.gv, 0));
+	uint32_t x = 0;
+
+	for (; x + 8 <= width; x += 8) {
+		YUY2ToRGB8_SSSE3(src + x * 2, dst + x * 4, kBGR, yOffset, yBu, yRv, yGu, gv);
+	}
+
+	YUY2ToRGBRow_Scalar<kBGR>(src + x * 2, dst + x * 4, width - x, c);
+}
+
+// Same steps on 16 pixels; everything stays in-lane until the final
+// cross-lane permute that restores pixel order.
+template <bool kBGR>
+PIXEL_CONVERT_TARGET("avx2")
+inline void YUY2ToRGBRow_AVX2(const uint8_t* src, uint8_t* dst, uint32_t width, const YUVToRGBCoefficients& c) {
+	const __m256i lumaBytes = _mm256_setr_epi8(
+		0, -1, 2, -1, 4, -1, 6, -1, 8, -1, 10, -1, 12, -1, 14, -1,
+		0, -1, 2, -1, 4, -1, 6, -1, 8, -1, 10, -1, 12, -1, 14, -1);
+	const __m256i uBytes = _mm256_setr_epi8(
+		1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1, 13, -1,
+		1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1, 13, -1);
+	const __m256i vBytes = _mm256_setr_epi8(
+		3, -1, 3, -1, 7, -1, 7, -1, 11, -1, 11, -1, 15, -1, 15, -1,
+		3, -1, 3, -1, 7, -1, 7, -1, 11, -1, 11, -1, 15, -1, 15, -1);
+	const __m256i yOffset = _mm256_set1_epi16(c.yOffset);
+	const __m256i chromaOffset = _mm256_set1_epi16(128);
+	const __m256i round = _mm256_set1_epi32(kYUVToRGBRound);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alpha = _mm256_set1_epi16(255);
+	const __m256i yBu = _mm256_set1_epi32(PackCoefficientPair(c.y, c.bu));
+	const __m256i yRv = _mm256_set1_epi32(PackCoefficientPair(c.y, c.rv));
+	const __m256i yGu = _mm256_set1_epi32(PackCoefficientPair(c.y, c.gu));
+	const __m256i gv = _mm256_set1_epi32(PackCoefficientPair(c.gv, 0));
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 2));
+		const __m256i y = _mm256_sub_epi16(_mm256_shuffle_epi8(s, lumaBytes), yOffset);
+		const __m256i u = _mm256_sub_epi16(_mm256_shuffle_epi8(s, uBytes), chromaOffset);
+		const __m256i v = _mm256_sub_epi16(_mm256_shuffle_epi8(s, vBytes), chromaOffset);
+
+		const __m256i yuLo = _mm256_unpacklo_epi16(y, u);
+		const __m256i yuHi = _mm256_unpackhi_epi16(y, u);
+		const __m256i yvLo = _mm256_unpacklo_epi16(y, v);
+		const __m256i yvHi = _mm256_unpackhi_epi16(y, v);
+
+		const __m256i b = _mm256_packs_epi32(
+			_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yuLo, yBu), round), kYUVToRGBShift),
+			_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yuHi, yBu), round), kYUVToRGBShift));
+		const __m256i r = _mm256_packs_epi32(
+			_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yvLo, yRv), round), kYUVToRGBShift),
+			_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yvHi, yRv), round), kYUVToRGBShift));
+		const __m256i g = _mm256_packs_epi32(
+			_mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(yuLo, yGu), _mm256_madd_epi16(_mm256_unpacklo_epi16(v, zero), gv)), round), kYUVToRGBShift),
+			_mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(yuHi, yGu), _mm256_madd_epi16(_mm256_unpackhi_epi16(v, zero), gv)), round), kYUVToRGBShift));
+
+		const __m256i c02 = kBGR ? _mm256_packus_epi16(b, r) : _mm256_packus_epi16(r, b);
+		const __m256i c1a = _mm256_packus_epi16(g, alpha);
+		const __m256i c01 = _mm256_unpacklo_epi8(c02, c1a);
+		const __m256i c2a = _mm256_unpackhi_epi8(c02, c1a);
+
+		// lo holds pixels 0-3 | 8-11, hi pixels 4-7 | 12-15.
+		const __m256i lo = _mm256_unpacklo_epi16(c01, c2a);
+		const __m256i hi = _mm256_unpackhi_epi16(c01, c2a);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	YUY2ToRGBRow_SSSE3<kBGR>(src + x * 2, dst + x * 4, width - x, c);
+}
+
+#endif
+
+// format picks the byte order (BGRA/BGRX vs RGBA/RGBX); the matrix and range
+// come in through the coefficients at call time.
+inline YUY2ToRGBRowFunc GetYUY2ToRGBRow(SimdLevel level, PixelFormat format) {
+	const bool bgr = format == PixelFormat::BGRA || format == PixelFormat::BGRX;
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+	case SimdLevel::AVX512:
+	case SimdLevel::AVX2: return bgr ? YUY2ToRGBRow_AVX2<true> : YUY2ToRGBRow_AVX2<false>;
+	case SimdLevel::SSSE3: return bgr ? YUY2ToRGBRow_SSSE3<true> : YUY2ToRGBRow_SSSE3<false>;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return bgr ? YUY2ToRGBRow_Scalar<true> : YUY2ToRGBRow_Scalar<false>;
+}
+
+// Converts a YUY2 frame into 32-bit RGB rows destPitch bytes apart, so it can
+// write straight into a mapped texture.
+inline void YUY2ToRGBWithPitch(BandPool& pool, YUY2ToRGBRowFunc convertRow, const YUVToRGBCoefficients& coefficients, const uint8_t* srcData, ptrdiff_t pitch, uint8_t* destData, size_t destPitch, uint32_t width, uint32_t height) {
+	const uint32_t bandRows = BandPool::BandRowsFor(static_cast<size_t>(width) * 6);
+
+	pool.Run(height, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+		for (uint32_t y = firstRow; y < lastRow; ++y) {
+			convertRow(srcData + static_cast<ptrdiff_t>(y) * pitch, destData + y * destPitch, width, coefficients);
+		}
+	});
+}
@@ -0,0 +1,427 @@
+#pragma once
+
+// Single-pass crop + resample + YUY2 -> UYVY.
+//
+// CropScaler reads only the source rows and columns the current crop window
+// touches, straight from the locked capture buffer, and writes UYVY at the
+// output size. The filter is separable. For every output row the needed
+// source rows are filtered vertically into a scratch row (luma and chroma
+// bytes alike, since 4:2:2 chroma is full height). That row is then filtered
+// horizontally, luma on the luma grid and U/V on the half-width chroma grid,
+// with output chroma co-sited with the even luma sample. When shrinking, the
+// kernels are widened by the scale factor so zoomed-out views do not alias.
+// The scratch row is padded with copies of the edge pixels, so every output
+// sample reads its taps from consecutive source pixels without clamping.
+//
+// All tables and scratch rows are sized for the worst case at construction;
+// SetCrop() only rewrites them, so the window can move every frame (animated
+// PTZ) without allocating.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "BandPool.h"
+#include "PixelConvert.h"
+
+enum class ScaleFilter {
+	Bilinear,
+	Bicubic,
+};
+
+inline const char* ScaleFilterName(ScaleFilter filter) {
+	return filter == ScaleFilter::Bicubic ? "bicubic" : "bilinear";
+}
+
+// Source region in pixels. Fractional values are allowed, so a window moving
+// by less than a pixel per frame still moves smoothly.
+struct CropWindow {
+	double x{ 0.0 };
+	double y{ 0.0 };
+	double width{ 0.0 };
+	double height{ 0.0 };
+};
+
+constexpr int kScaleWeightShift = 14;
+constexpr int32_t kScaleWeightOne = 1 << kScaleWeightShift;
+
+//
+// Vertical filter: dst[i] = clamp((sum_k weights[k] * rows[k][i] + round) >> 14)
+// for every byte i. taps must be even.
+//
+
+using FilterColumnsRowFunc = void (*)(const uint8_t* const* rows, const int16_t* weights, uint32_t taps, uint8_t* dst, size_t bytes);
+
+inline void FilterColumnsRow_Scalar(const uint8_t* const* rows, const int16_t* weights, uint32_t taps, uint8_t* dst, size_t bytes) {
+	for (size_t i = 0; i < bytes; ++i) {
+		int32_t sum = kScaleWeightOne / 2;
+		for (uint32_t k = 0; k < taps; ++k) {
+			sum += weights[k] * rows[k][i];
+		}
+		sum >>= kScaleWeightShift;
+		dst[i] = static_cast<uint8_t>(sum < 0 ? 0 : (sum > 255 ? 255 : sum));
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+// Rows are taken two at a time: their bytes are interleaved and widened to
+// int16 pairs, and one pmaddwd applies both weights.
+PIXEL_CONVERT_TARGET("sse2")
+inline void FilterColumnsRow_SSE2(const uint8_t* const* rows, const int16_t* weights, uint32_t taps, uint8_t* dst, size_t bytes) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(kScaleWeightOne / 2);
+	size_t i = 0;
+
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+
+		for (uint32_t k = 0; k < taps; k += 2) {
+			const __m128i w = _mm_set1_epi32(static_cast<int32_t>((static_cast<uint32_t>(static_cast<uint16_t>(weights[k + 1])) << 16) | static_cast<uint16_t>(weights[k])));
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + i));
+			const __m128i lo = _mm_unpacklo_epi8(a, b);
+			const __m128i hi = _mm_unpackhi_epi8(a, b);
+
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		}
+
+		const __m128i lo = _mm_packs_epi32(_mm_srai_epi32(acc0, kScaleWeightShift), _mm_srai_epi32(acc1, kScaleWeightShift));
+		const __m128i hi = _mm_packs_epi32(_mm_srai_epi32(acc2, kScaleWeightShift), _mm_srai_epi32(acc3, kScaleWeightShift));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	if (i < bytes) {
+		const uint8_t* tailRows[32];
+		for (uint32_t k = 0; k < taps; ++k) {
+			tailRows[k] = rows[k] + i;
+		}
+		FilterColumnsRow_Scalar(tailRows, weights, taps, dst + i, bytes - i);
+	}
+}
+
+// Same steps on 32 bytes; unpack, pack and pmaddwd are all in-lane, so the
+// byte order comes back out unchanged.
+PIXEL_CONVERT_TARGET("avx2")
+inline void FilterColumnsRow_AVX2(const uint8_t* const* rows, const int16_t* weights, uint32_t taps, uint8_t* dst, size_t bytes) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32(kScaleWeightOne / 2);
+	size_t i = 0;
+
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+
+		for (uint32_t k = 0; k < taps; k += 2) {
+			const __m256i w = _mm256_set1_epi32(static_cast<int32_t>((static_cast<uint32_t>(static_cast<uint16_t>(weights[k + 1])) << 16) | static_cast<uint16_t>(weights[k])));
+			const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[k] + i));
+			const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[k + 1] + i));
+			const __m256i lo = _mm256_unpacklo_epi8(a, b);
+			const __m256i hi = _mm256_unpackhi_epi8(a, b);
+
+			acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), w));
+			acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), w));
+			acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), w));
+			acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), w));
+		}
+
+		const __m256i lo = _mm256_packs_epi32(_mm256_srai_epi32(acc0, kScaleWeightShift), _mm256_srai_epi32(acc1, kScaleWeightShift));
+		const __m256i hi = _mm256_packs_epi32(_mm256_srai_epi32(acc2, kScaleWeightShift), _mm256_srai_epi32(acc3, kScaleWeightShift));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+
+	if (i < bytes) {
+		const uint8_t* tailRows[32];
+		for (uint32_t k = 0; k < taps; ++k) {
+			tailRows[k] = rows[k] + i;
+		}
+		FilterColumnsRow_SSE2(tailRows, weights, taps, dst + i, bytes - i);
+	}
+}
+
+#endif
+
+inline FilterColumnsRowFunc GetFilterColumnsRow(SimdLevel level) {
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+	case SimdLevel::AVX512:
+	case SimdLevel::AVX2: return FilterColumnsRow_AVX2;
+	case SimdLevel::SSSE3: return FilterColumnsRow_SSE2;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return FilterColumnsRow_Scalar;
+}
+
+class CropScaler {
+public:
+	// Upper bound on taps per axis. Past 4x (bilinear) or 2x (bicubic)
+	// shrinking the kernel stops widening.
+	static constexpr uint32_t kMaxTaps = 16;
+
+	// sourceWidth/outputWidth are in pixels and must be even.
+	CropScaler(uint32_t sourceWidth, uint32_t sourceHeight, uint32_t outputWidth, uint32_t outputHeight, ScaleFilter filter, SimdLevel level = ActiveSimdLevel())
+		: sourceWidth_(sourceWidth),
+		sourceHeight_(sourceHeight),
+		outputWidth_(outputWidth),
+		outputHeight_(outputHeight),
+		filter_(filter),
+		filterColumns_(GetFilterColumnsRow(level)),
+		lumaOffsets_(outputWidth),
+		lumaWeights_(static_cast<size_t>(outputWidth) * kMaxTaps),
+		chromaOffsets_(outputWidth / 2),
+		chromaWeights_(static_cast<size_t>(outputWidth / 2) * kMaxTaps),
+		rowIndices_(static_cast<size_t>(outputHeight) * kMaxTaps),
+		rowWeights_(rowIndices_.size()) {
+		bandRows_ = BandPool::BandRowsFor(static_cast<size_t>(outputWidth) * 2 + static_cast<size_t>(sourceWidth) * 2, 256 * 1024, 4);
+		const size_t bands = (outputHeight + bandRows_ - 1) / bandRows_;
+		// Room for the edge padding: up to kMaxTaps chroma samples each side.
+		scratchPitch_ = (static_cast<size_t>(sourceWidth) * 2 + kMaxTaps * 8 + 63) & ~static_cast<size_t>(63);
+		scratch_.resize(bands * scratchPitch_);
+
+		SetCrop({ 0.0, 0.0, static_cast<double>(sourceWidth), static_cast<double>(sourceHeight) });
+	}
+
+	uint32_t OutputWidth() const { return outputWidth_; }
+	uint32_t OutputHeight() const { return outputHeight_; }
+	const CropWindow& Crop() const { return crop_; }
+
+	// Moves the window. It is clamped to the source frame; call between frames,
+	// from the thread that calls Convert().
+	void SetCrop(const CropWindow& requested) {
+		CropWindow crop = requested;
+		crop.width = (std::clamp)(crop.width, 1.0, static_cast<double>(sourceWidth_));
+		crop.height = (std::clamp)(crop.height, 1.0, static_cast<double>(sourceHeight_));
+		crop.x = (std::clamp)(crop.x, 0.0, sourceWidth_ - crop.width);
+		crop.y = (std::clamp)(crop.y, 0.0, sourceHeight_ - crop.height);
+		crop_ = crop;
+
+		const double scaleX = crop.width / outputWidth_;
+		const double scaleY = crop.height / outputHeight_;
+
+		// First taps in source pixels (luma) and chroma samples, unclamped.
+		taps_ = TapsFor(scaleX);
+		int32_t firstPair = INT32_MAX;
+		int32_t lastPair = INT32_MIN;
+		for (uint32_t x = 0; x < outputWidth_; ++x) {
+			const double center = crop.x + (x + 0.5) * scaleX - 0.5;
+			const int32_t first = ComputeTaps(center, scaleX, taps_, &lumaWeights_[x * kMaxTaps]);
+			lumaOffsets_[x] = first;
+			firstPair = (std::min)(firstPair, FloorDiv2(first));
+			lastPair = (std::max)(lastPair, FloorDiv2(first + static_cast<int32_t>(taps_) - 1));
+		}
+
+		// Output chroma k sits on output luma 2k; source chroma j on source luma 2j.
+		for (uint32_t k = 0; k < outputWidth_ / 2; ++k) {
+			const double center = (crop.x + (2 * k + 0.5) * scaleX - 0.5) / 2.0;
+			const int32_t first = ComputeTaps(center, scaleX, taps_, &chromaWeights_[k * kMaxTaps]);
+			chromaOffsets_[k] = first;
+			firstPair = (std::min)(firstPair, first);
+			lastPair = (std::max)(lastPair, first + static_cast<int32_t>(taps_) - 1);
+		}
+
+		// The scratch row holds pixel pairs [firstPair, lastPair]: the part
+		// inside the frame is filtered vertically, the rest replicates the edge.
+		// Offsets become byte offsets into it, so U is at 4j + 1 and V at 4j + 3.
+		const int32_t sourcePairs = static_cast<int32_t>(sourceWidth_ / 2);
+		spanFirstPair_ = firstPair;
+		spanPairs_ = static_cast<uint32_t>(lastPair - firstPair + 1);
+		frameFirstPair_ = (std::max)(firstPair, 0);
+		framePairs_ = static_cast<uint32_t>((std::min)(lastPair, sourcePairs - 1) - frameFirstPair_ + 1);
+
+		for (uint32_t x = 0; x < outputWidth_; ++x) {
+			lumaOffsets_[x] = (lumaOffsets_[x] - firstPair * 2) * 2;
+		}
+		for (uint32_t k = 0; k < outputWidth_ / 2; ++k) {
+			chromaOffsets_[k] = (chromaOffsets_[k] - firstPair) * 4 + 1;
+		}
+
+		rowTaps_ = TapsFor(scaleY);
+		for (uint32_t y = 0; y < outputHeight_; ++y) {
+			const double center = crop.y + (y + 0.5) * scaleY - 0.5;
+			const int32_t first = ComputeTaps(center, scaleY, rowTaps_, &rowWeights_[y * kMaxTaps]);
+			for (uint32_t k = 0; k < rowTaps_; ++k) {
+				rowIndices_[y * kMaxTaps + k] = (std::clamp)(first + static_cast<int32_t>(k), 0, static_cast<int32_t>(sourceHeight_) - 1);
+			}
+		}
+
+		switch (taps_) {
+		case 2: filterRow_ = &CropScaler::FilterRow<2>; break;
+		case 4: filterRow_ = &CropScaler::FilterRow<4>; break;
+		case 6: filterRow_ = &CropScaler::FilterRow<6>; break;
+		case 8: filterRow_ = &CropScaler::FilterRow<8>; break;
+		case 10: filterRow_ = &CropScaler::FilterRow<10>; break;
+		case 12: filterRow_ = &CropScaler::FilterRow<12>; break;
+		case 14: filterRow_ = &CropScaler::FilterRow<14>; break;
+		default: filterRow_ = &CropScaler::FilterRow<16>; break;
+		}
+	}
+
+	// Writes the current window of a YUY2 frame as a packed UYVY frame of
+	// OutputWidth() x OutputHeight(). bandDone(firstRow, lastRow) runs after
+	// each band of output rows; bands start at multiples of 4 rows.
+	template <typename BandHook = NoBandHook>
+	void Convert(BandPool& pool, const uint8_t* srcData, ptrdiff_t pitch, uint8_t* destData, const BandHook& bandDone = BandHook()) {
+		const size_t destPitch = static_cast<size_t>(outputWidth_) * 2;
+
+		pool.Run(outputHeight_, bandRows_, [&](uint32_t firstRow, uint32_t lastRow) {
+			uint8_t* scratch = scratch_.data() + (firstRow / bandRows_) * scratchPitch_;
+			const uint8_t* rows[kMaxTaps];
+
+			uint8_t* frameSpan = scratch + (frameFirstPair_ - spanFirstPair_) * 4;
+			const size_t frameOffset = static_cast<size_t>(frameFirstPair_) * 4;
+
+			for (uint32_t y = firstRow; y < lastRow; ++y) {
+				const int32_t* indices = &rowIndices_[y * kMaxTaps];
+				for (uint32_t k = 0; k < rowTaps_; ++k) {
+					rows[k] = srcData + static_cast<ptrdiff_t>(indices[k]) * pitch + frameOffset;
+				}
+
+				filterColumns_(rows, &rowWeights_[y * kMaxTaps], rowTaps_, frameSpan, static_cast<size_t>(framePairs_) * 4);
+				ReplicateEdges(scratch, frameSpan);
+				(this->*filterRow_)(scratch, destData + y * destPitch);
+			}
+			bandDone(firstRow, lastRow);
+		});
+	}
+
+private:
+	static double Kernel(ScaleFilter filter, double t) {
+		t = std::fabs(t);
+		if (filter == ScaleFilter::Bilinear) {
+			return t < 1.0 ? 1.0 - t : 0.0;
+		}
+		// Keys cubic, a = -0.5 (Catmull-Rom).
+		if (t < 1.0) {
+			return (1.5 * t - 2.5) * t * t + 1.0;
+		}
+		if (t < 2.0) {
+			return ((-0.5 * t + 2.5) * t - 4.0) * t + 2.0;
+		}
+		return 0.0;
+	}
+
+	// Even tap count covering the kernel support, widened when shrinking.
+	uint32_t TapsFor(double scale) const {
+		const double support = filter_ == ScaleFilter::Bicubic ? 2.0 : 1.0;
+		const uint32_t taps = static_cast<uint32_t>(std::ceil(2.0 * support * (std::max)(1.0, scale)));
+		return (std::min)(kMaxTaps, (taps + 1) & ~1u);
+	}
+
+	static int32_t FloorDiv2(int32_t value) {
+		return value >= 0 ? value / 2 : -((1 - value) / 2);
+	}
+
+	// Q14 weights summing to exactly kScaleWeightOne for a sample centred at
+	// center; returns the position of the first tap.
+	int32_t ComputeTaps(double center, double scale, uint32_t taps, int16_t* weights) const {
+		const double stretch = (std::max)(1.0, scale);
+		const int32_t first = static_cast<int32_t>(std::floor(center)) - static_cast<int32_t>(taps / 2) + 1;
+
+		double raw[kMaxTaps];
+		double total = 0.0;
+		for (uint32_t k = 0; k < taps; ++k) {
+			raw[k] = Kernel(filter_, (first + static_cast<int32_t>(k) - center) / stretch);
+			total += raw[k];
+		}
+
+		int32_t sum = 0;
+		uint32_t largest = 0;
+		for (uint32_t k = 0; k < taps; ++k) {
+			weights[k] = static_cast<int16_t>(std::lround(raw[k] / total * kScaleWeightOne));
+			sum += weights[k];
+			if (weights[k] > weights[largest]) {
+				largest = k;
+			}
+		}
+		weights[largest] = static_cast<int16_t>(weights[largest] + kScaleWeightOne - sum);
+		return first;
+	}
+
+	// Pairs left of the frame repeat pixel 0 (Y0 U0 Y0 V0), pairs right of it
+	// the last pixel, which is what clamping every tap would have read.
+	void ReplicateEdges(uint8_t* span, const uint8_t* frameSpan) const {
+		const uint32_t leftPairs = static_cast<uint32_t>(frameFirstPair_ - spanFirstPair_);
+		const uint8_t left[4] = { frameSpan[0], frameSpan[1], frameSpan[0], frameSpan[3] };
+		for (uint32_t j = 0; j < leftPairs; ++j) {
+			memcpy(span + j * 4, left, 4);
+		}
+
+		const uint8_t* last = frameSpan + (framePairs_ - 1) * 4;
+		const uint8_t right[4] = { last[2], last[1], last[2], last[3] };
+		for (uint32_t j = leftPairs + framePairs_; j < spanPairs_; ++j) {
+			memcpy(span + j * 4, right, 4);
+		}
+	}
+
+	// Luma taps are consecutive pixels (2 bytes apart), chroma taps consecutive
+	// pairs (4 bytes apart); kTaps is a template parameter so both loops unroll.
+	template <uint32_t kTaps>
+	void FilterRow(const uint8_t* span, uint8_t* dst) const {
+		auto clamp = [](int32_t sum) {
+			sum >>= kScaleWeightShift;
+			return static_cast<uint8_t>(sum < 0 ? 0 : (sum > 255 ? 255 : sum));
+		};
+
+		for (uint32_t k = 0; k < outputWidth_ / 2; ++k) {
+			const uint32_t x = k * 2;
+			const uint8_t* chroma = span + chromaOffsets_[k];
+			const uint8_t* luma0 = span + lumaOffsets_[x];
+			const uint8_t* luma1 = span + lumaOffsets_[x + 1];
+			const int16_t* chromaWeights = &chromaWeights_[k * kMaxTaps];
+			const int16_t* lumaWeights0 = &lumaWeights_[x * kMaxTaps];
+			const int16_t* lumaWeights1 = &lumaWeights_[(x + 1) * kMaxTaps];
+
+			int32_t u = kScaleWeightOne / 2, v = u, y0 = u, y1 = u;
+			for (uint32_t t = 0; t < kTaps; ++t) {
+				u += chromaWeights[t] * chroma[t * 4];
+				v += chromaWeights[t] * chroma[t * 4 + 2];
+				y0 += lumaWeights0[t] * luma0[t * 2];
+				y1 += lumaWeights1[t] * luma1[t * 2];
+			}
+
+			dst[x * 2 + 0] = clamp(u);
+			dst[x * 2 + 1] = clamp(y0);
+			dst[x * 2 + 2] = clamp(v);
+			dst[x * 2 + 3] = clamp(y1);
+		}
+	}
+
+	uint32_t sourceWidth_;
+	uint32_t sourceHeight_;
+	uint32_t outputWidth_;
+	uint32_t outputHeight_;
+	ScaleFilter filter_;
+	FilterColumnsRowFunc filterColumns_;
+	CropWindow crop_;
+
+	// Weights: kMaxTaps slots per output sample, the first taps_ (rowTaps_) in
+	// use. Horizontal offsets are the byte offset of the first tap in the
+	// scratch row; vertical indices are clamped source rows.
+	uint32_t taps_{ 2 };
+	uint32_t rowTaps_{ 2 };
+	void (CropScaler::*filterRow_)(const uint8_t*, uint8_t*) const { &CropScaler::FilterRow<2> };
+	std::vector<int32_t> lumaOffsets_;
+	std::vector<int16_t> lumaWeights_;
+	std::vector<int32_t> chromaOffsets_;
+	std::vector<int16_t> chromaWeights_;
+	std::vector<int32_t> rowIndices_;
+	std::vector<int16_t> rowWeights_;
+
+	int32_t spanFirstPair_{ 0 };
+	uint32_t spanPairs_{ 0 };
+	int32_t frameFirstPair_{ 0 };
+	uint32_t framePairs_{ 0 };
+
+	// One vertically filtered row per band, so bands never share scratch.
+	uint32_t bandRows_{ 1 };
+	size_t scratchPitch_{ 0 };
+	std::vector<uint8_t> scratch_;
+};
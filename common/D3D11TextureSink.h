@@ -0,0 +1,145 @@
+#pragma once
+
+// Copies converted frames into a shared D3D11 texture another process can
+// open, as the DX11 example does with captured frames.
+//
+// Each frame is written into a CPU-writable staging texture and copied into a
+// D3D11_RESOURCE_MISC_SHARED texture. Both are created for the layout of the
+// first frame, on the thread that sends it, and the shared handle is printed
+// then. Map() can wait on the GPU, so the sink belongs behind a SinkQueue
+// (SinkFanOut.h); a reader of the texture only wants the latest frame anyway.
+//
+// Takes packed YUY2 and the RGB formats.
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <d3d11.h>
+#include <dxgi.h>
+#include <wrl/client.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "FramePool.h"
+#include "FrameSink.h"
+#include "PixelFormat.h"
+
+#pragma comment(lib, "d3d11.lib")
+
+class D3D11TextureSink : public FrameSink {
+public:
+	static bool Supports(PixelFormat format) {
+		return format == PixelFormat::YUY2 || IsRGBFormat(format);
+	}
+
+	// Creates the device; false if there is no hardware D3D11 device.
+	bool Initialize() {
+		UINT creationFlags = 0;
+#if defined(_DEBUG)
+		creationFlags |= D3D11_CREATE_DEVICE_DEBUG;
+#endif
+		D3D_FEATURE_LEVEL featureLevels[] = { D3D_FEATURE_LEVEL_11_0 };
+		D3D_FEATURE_LEVEL featureLevel;
+		HRESULT hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, creationFlags, featureLevels, 1, D3D11_SDK_VERSION,
+			&device_, &featureLevel, &context_);
+		if (FAILED(hr)) {
+			std::cerr << "Failed to create D3D11 device and context." << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	void Send(SinkFrame& frame) override {
+		if (failed_) {
+			return;
+		}
+		const FrameLayout& layout = frame.frame.Layout();
+		if (!staging_ && !CreateTextures(layout)) {
+			failed_ = true;
+			return;
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (FAILED(context_->Map(staging_.Get(), 0, D3D11_MAP_WRITE, 0, &mapped))) {
+			return;
+		}
+		const uint8_t* src = frame.frame.Data();
+		uint8_t* dest = static_cast<uint8_t*>(mapped.pData);
+		const size_t rowBytes = layout.planePitch[0];
+		for (uint32_t y = 0; y < layout.height; ++y) {
+			memcpy(dest + static_cast<size_t>(mapped.RowPitch) * y, src + rowBytes * y, rowBytes);
+		}
+		context_->Unmap(staging_.Get(), 0);
+		context_->CopyResource(shared_.Get(), staging_.Get());
+	}
+
+	// The texture's shared handle, or null before the first frame.
+	HANDLE SharedHandle() const {
+		return sharedHandle_;
+	}
+
+private:
+	// RGBX has no DXGI format of its own; the X byte is written as 255, so the
+	// RGBA texture format holds it unchanged.
+	static DXGI_FORMAT DXGIFormatFor(PixelFormat format) {
+		switch (format) {
+		case PixelFormat::BGRA: return DXGI_FORMAT_B8G8R8A8_UNORM;
+		case PixelFormat::BGRX: return DXGI_FORMAT_B8G8R8X8_UNORM;
+		case PixelFormat::RGBA:
+		case PixelFormat::RGBX: return DXGI_FORMAT_R8G8B8A8_UNORM;
+		default: return DXGI_FORMAT_YUY2;
+		}
+	}
+
+	bool CreateTextures(const FrameLayout& layout) {
+		if (!Supports(layout.format)) {
+			std::cerr << "No shared texture format for " << PixelFormatName(layout.format) << "." << std::endl;
+			return false;
+		}
+
+		D3D11_TEXTURE2D_DESC textureDesc = {};
+		textureDesc.Width = layout.width;
+		textureDesc.Height = layout.height;
+		textureDesc.MipLevels = 1;
+		textureDesc.ArraySize = 1;
+		textureDesc.Format = DXGIFormatFor(layout.format);
+		textureDesc.SampleDesc.Count = 1;
+		textureDesc.Usage = D3D11_USAGE_STAGING;
+		textureDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		if (FAILED(device_->CreateTexture2D(&textureDesc, nullptr, &staging_))) {
+			std::cerr << "Failed to create D3D11 staging texture." << std::endl;
+			return false;
+		}
+
+		textureDesc.Usage = D3D11_USAGE_DEFAULT;
+		textureDesc.CPUAccessFlags = 0;
+		textureDesc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
+		if (FAILED(device_->CreateTexture2D(&textureDesc, nullptr, &shared_))) {
+			std::cerr << "Failed to create D3D11 (shared) rendering texture." << std::endl;
+			return false;
+		}
+
+		Microsoft::WRL::ComPtr<IDXGIResource> dxgiResource;
+		if (FAILED(shared_.As(&dxgiResource)) || FAILED(dxgiResource->GetSharedHandle(&sharedHandle_))) {
+			std::cerr << "Failed to create shared handle for the rendering texture." << std::endl;
+			return false;
+		}
+
+		std::cout << "Shared texture handle is " << sharedHandle_ << " | " << reinterpret_cast<uintptr_t>(sharedHandle_) << ", "
+			<< PixelFormatName(layout.format) << " " << layout.width << "x" << layout.height << std::endl;
+		return true;
+	}
+
+	Microsoft::WRL::ComPtr<ID3D11Device> device_;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context_;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> staging_;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> shared_;
+	HANDLE sharedHandle_{ nullptr };
+	bool failed_{ false };
+};
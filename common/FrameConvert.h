@@ -0,0 +1,156 @@
+#pragma once
+
+// Frame-level conversions: row kernels from PixelConvert.h driven across a
+// BandPool. Pitches are in bytes.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "BandPool.h"
+#include "PixelConvert.h"
+#include "PixelFormat.h"
+
+// Output frames at least this large are written with streaming stores when a
+// non-temporal kernel exists. 4K UYVY (16 MB) is above it and would otherwise
+// flush most of a client LLC every frame; 1080p (4 MB) still fits alongside
+// the working set and is cheaper with regular stores.
+constexpr size_t kDefaultNonTemporalThreshold = 8 * 1024 * 1024;
+
+inline bool UseNonTemporalStores(size_t frameBytes, size_t thresholdBytes) {
+	return frameBytes >= thresholdBytes;
+}
+
+// Bands of the packed 4:2:2 functions start at multiples of this many rows, so
+// a band hook can consume whole row quads (see ProxyPyramid).
+constexpr uint32_t kPackedBandRowMultiple = 4;
+
+template <typename BandHook = NoBandHook>
+inline void YUY2ToUYVYWithPitch(BandPool& pool, YUY2ToUYVYRowFunc convertRow, const uint8_t* srcData, uint8_t* destData, uint32_t width, uint32_t height, ptrdiff_t pitch, const BandHook& bandDone = BandHook()) {
+	const size_t destPitch = static_cast<size_t>(width) * 2;
+	const uint32_t bandRows = BandPool::BandRowsFor(destPitch * 2, 256 * 1024, kPackedBandRowMultiple);
+
+	pool.Run(height, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+		for (uint32_t y = firstRow; y < lastRow; ++y) {
+			const uint8_t* srcRow = srcData + static_cast<ptrdiff_t>(y) * pitch;
+			uint8_t* destRow = destData + y * destPitch;
+
+			convertRow(srcRow, destRow, width);
+		}
+		// convertRow may be a streaming-store kernel.
+		StoreFence();
+		bandDone(firstRow, lastRow);
+	});
+}
+
+// Packed passthrough: copies rowBytes of every source row into a tightly
+// packed destination, with streaming stores if nonTemporal is set.
+template <typename BandHook = NoBandHook>
+inline void CopyRowsWithPitch(BandPool& pool, const uint8_t* srcData, uint8_t* destData, size_t rowBytes, uint32_t height, ptrdiff_t pitch, bool nonTemporal = false, const BandHook& bandDone = BandHook()) {
+	const uint32_t bandRows = BandPool::BandRowsFor(rowBytes * 2, 256 * 1024, kPackedBandRowMultiple);
+
+	pool.Run(height, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+		for (uint32_t y = firstRow; y < lastRow; ++y) {
+			if (nonTemporal) {
+				CopyRowNonTemporal(srcData + static_cast<ptrdiff_t>(y) * pitch, destData + y * rowBytes, rowBytes);
+			}
+			else {
+				memcpy(destData + y * rowBytes, srcData + static_cast<ptrdiff_t>(y) * pitch, rowBytes);
+			}
+		}
+		if (nonTemporal) {
+			StoreFence();
+		}
+		bandDone(firstRow, lastRow);
+	});
+}
+
+// Packed 4:2:2 to planar 4:2:0. Bands are whole row pairs so every chroma row
+// is produced by exactly one band.
+inline void YUY2ToNV12WithPitch(BandPool& pool, YUY2ToNV12RowFunc convertRows, const uint8_t* srcData, ptrdiff_t pitch, const FrameLayout& dest, uint8_t* destData) {
+	const uint32_t width = dest.width;
+	const uint32_t height = dest.height;
+	const uint32_t bandRows = BandPool::BandRowsFor(static_cast<size_t>(width) * 3 + dest.planePitch[0] / 2, 256 * 1024, 2);
+
+	pool.Run(height, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+		for (uint32_t y = firstRow; y < lastRow; y += 2) {
+			const uint32_t y1 = y + 1 < height ? y + 1 : y;
+			convertRows(
+				srcData + static_cast<ptrdiff_t>(y) * pitch,
+				srcData + static_cast<ptrdiff_t>(y1) * pitch,
+				destData + y * dest.planePitch[0],
+				destData + y1 * dest.planePitch[0],
+				destData + dest.planeOffset[1] + (y / 2) * dest.planePitch[1],
+				width);
+		}
+	});
+}
+
+inline void YUY2ToI420WithPitch(BandPool& pool, YUY2ToI420RowFunc convertRows, const uint8_t* srcData, ptrdiff_t pitch, const FrameLayout& dest, uint8_t* destData) {
+	const uint32_t width = dest.width;
+	const uint32_t height = dest.height;
+	const uint32_t bandRows = BandPool::BandRowsFor(static_cast<size_t>(width) * 3 + dest.planePitch[0] / 2, 256 * 1024, 2);
+
+	pool.Run(height, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+		for (uint32_t y = firstRow; y < lastRow; y += 2) {
+			const uint32_t y1 = y + 1 < height ? y + 1 : y;
+			convertRows(
+				srcData + static_cast<ptrdiff_t>(y) * pitch,
+				srcData + static_cast<ptrdiff_t>(y1) * pitch,
+				destData + y * dest.planePitch[0],
+				destData + y1 * dest.planePitch[0],
+				destData + dest.planeOffset[1] + (y / 2) * dest.planePitch[1],
+				destData + dest.planeOffset[2] + (y / 2) * dest.planePitch[2],
+				width);
+		}
+	});
+}
+
+// Planar 4:2:0 to packed 4:2:2. The Y and UV planes have their own pitches, as
+// reported by the capture buffer. Every output row reads its near and far
+// chroma rows (see NV12ToUYVYRowFunc); bands only share source rows, never
+// destination rows, so any band size works.
+inline void NV12ToUYVYWithPitch(BandPool& pool, NV12ToUYVYRowFunc convertRow, const uint8_t* srcY, ptrdiff_t pitchY, const uint8_t* srcUV, ptrdiff_t pitchUV, uint8_t* destData, uint32_t width, uint32_t height) {
+	const size_t destPitch = static_cast<size_t>(width) * 2;
+	const uint32_t chromaRows = (height + 1) / 2;
+	const uint32_t bandRows = BandPool::BandRowsFor(static_cast<size_t>(width) * 4);
+
+	pool.Run(height, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+		for (uint32_t y = firstRow; y < lastRow; ++y) {
+			const uint32_t nearRow = y / 2;
+			uint32_t farRow;
+			if (y & 1) {
+				farRow = nearRow + 1 < chromaRows ? nearRow + 1 : nearRow;
+			}
+			else {
+				farRow = nearRow > 0 ? nearRow - 1 : 0;
+			}
+
+			convertRow(
+				srcY + static_cast<ptrdiff_t>(y) * pitchY,
+				srcUV + static_cast<ptrdiff_t>(nearRow) * pitchUV,
+				srcUV + static_cast<ptrdiff_t>(farRow) * pitchUV,
+				destData + y * destPitch,
+				width);
+		}
+	});
+}
+
+// Planar passthrough: copies every plane of a captured frame into the packed
+// layout, each source plane with its own pitch.
+inline void CopyPlanesWithPitch(BandPool& pool, const uint8_t* const srcPlanes[], const ptrdiff_t srcPitches[], const FrameLayout& dest, uint8_t* destData) {
+	for (uint32_t plane = 0; plane < dest.planeCount; ++plane) {
+		const uint32_t rows = plane == 0 ? dest.height : (dest.height + 1) / 2;
+		const size_t rowBytes = dest.planePitch[plane];
+		const uint32_t bandRows = BandPool::BandRowsFor(rowBytes * 2);
+		const uint8_t* src = srcPlanes[plane];
+		const ptrdiff_t pitch = srcPitches[plane];
+		uint8_t* dst = destData + dest.planeOffset[plane];
+
+		pool.Run(rows, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+			for (uint32_t y = firstRow; y < lastRow; ++y) {
+				memcpy(dst + y * rowBytes, src + static_cast<ptrdiff_t>(y) * pitch, rowBytes);
+			}
+		});
+	}
+}
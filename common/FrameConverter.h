@@ -0,0 +1,430 @@
+#pragma once
+
+// Turns captured frames into output frames.
+//
+// FrameConverter owns everything between a locked capture buffer and an
+// output buffer: the output layout, the SIMD kernels picked for it, the band
+// worker pool (its own, or one shared with other converters), and the
+// optional crop/scale, orientation and proxy stages. Setup() is called once
+// the capture format is known and reports anything it cannot convert;
+// Convert() then runs once per frame and never allocates.
+//
+// An MJPG capture is decoded straight into the output (MJPEGDecoder.h), with a
+// decoder per worker, so ConvertFrames() can decode several frames at once.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "BandPool.h"
+#include "CaptureSource.h"
+#include "ColorConvert.h"
+#include "CropScale.h"
+#include "FrameConvert.h"
+#include "FrameHandle.h"
+#include "MediaNegotiation.h"
+#include "MJPEGDecoder.h"
+#include "Orientation.h"
+#include "PixelConvert.h"
+#include "PixelFormat.h"
+#include "ProxyPyramid.h"
+
+struct ConversionConfig {
+	PixelFormat outputFormat{ PixelFormat::UYVY };
+	ChromaFilter chromaFilter{ ChromaFilter::Linear }; // NV12 capture -> UYVY
+	size_t nonTemporalThreshold{ kDefaultNonTemporalThreshold }; // output frame bytes
+	uint32_t outputWidth{ 0 };  // 0 = capture size
+	uint32_t outputHeight{ 0 };
+	CropWindow crop;            // width 0 = whole frame
+	ScaleFilter scaleFilter{ ScaleFilter::Bilinear };
+	bool ptzDemo{ false };      // sweep the crop window across the frame
+	bool proxies{ false };      // also produce 1/2 and 1/4 resolution UYVY
+	Orientation orientation{ Orientation::Identity }; // applied while converting
+	unsigned threads{ 0 };      // band workers; 0 = one per hardware thread; unused with a shared pool
+
+	bool Scaling() const { return outputWidth != 0 || crop.width > 0.0 || ptzDemo; }
+};
+
+// One frame of a ConvertFrames() batch.
+struct ConvertJob {
+	const SourcePlanes* source{ nullptr };
+	uint8_t* dest{ nullptr };
+	uint64_t frameIndex{ 0 };
+	uint8_t* proxies[ProxyPyramid::kLevelCount]{}; // buffers of the proxy levels, see ProxyPyramid::SetOutputs()
+	bool converted{ false }; // set by ConvertFrames()
+};
+
+class FrameConverter {
+public:
+	explicit FrameConverter(const ConversionConfig& config)
+		: config_(config), ownPool_(std::make_unique<BandPool>(config.threads)), convertPool_(*ownPool_) {}
+
+	// Converts on pool, which other converters may be running frames on too.
+	FrameConverter(const ConversionConfig& config, BandPool& pool) : config_(config), convertPool_(pool) {}
+
+	FrameConverter(const FrameConverter&) = delete;
+	FrameConverter& operator=(const FrameConverter&) = delete;
+
+	// Whether an MJPG capture can be decoded straight into config's output.
+	// When it cannot, the capture API has to decode to YUY2 first.
+	static bool DecodesMJPG(const ConversionConfig& config) {
+		return MJPEGDecodesTo(config.outputFormat) && !config.Scaling() && config.orientation == Orientation::Identity && !config.proxies;
+	}
+
+	// Picks the output layout and kernels for frames in the capture format.
+	// colorimetry is only used for RGB output.
+	bool Setup(const CaptureFormat& capture, const YUVColorimetry& colorimetry);
+
+	// Converts one captured frame into dest, which has OutputLayout(), and
+	// with proxies into the proxy buffers, one per level of Proxies(); null
+	// ones are skipped. frameIndex drives the PTZ demo. Only an MJPG frame
+	// that does not decode fails, leaving dest unfit to send.
+	bool Convert(const SourcePlanes& source, uint8_t* dest, uint64_t frameIndex, uint8_t* const* proxyDests = nullptr);
+
+	// Converts count frames, setting each job's converted. An MJPG capture
+	// decodes up to FramesInFlight() of them at once, a frame per worker;
+	// anything else converts them in turn, each split into bands.
+	void ConvertFrames(ConvertJob* jobs, uint32_t count);
+
+	// Frames ConvertFrames() works on at once.
+	uint32_t FramesInFlight() const {
+		return decoders_.empty() ? 1 : static_cast<uint32_t>(decoders_.size());
+	}
+
+	const FrameLayout& OutputLayout() const {
+		return outputLayout_;
+	}
+
+	// The proxy stage, for the layouts of its levels, or null without proxies.
+	const ProxyPyramid* Proxies() const {
+		return proxies_.get();
+	}
+
+	unsigned WorkerCount() const {
+		return convertPool_.WorkerCount();
+	}
+
+private:
+	bool SetupCropScale();
+	bool SetupMJPEGDecode();
+	bool SetupOrientation();
+	bool SetupProxies();
+	void SelectKernels();
+	bool HasNonTemporalPath() const;
+	void EmitProxies(const uint8_t* rows, ptrdiff_t pitch, PixelFormat format, uint32_t firstRow, uint32_t lastRow);
+	void UpdatePTZ(uint64_t frame);
+
+	ConversionConfig config_;
+	PixelFormat captureFormat_{ PixelFormat::Unknown };
+	uint32_t width_{ 0 };
+	uint32_t height_{ 0 };
+	FrameLayout outputLayout_;
+
+	YUY2ToUYVYRowFunc yuy2ToUYVYRow_{ YUY2ToUYVYRow_Scalar };
+	YUY2ToNV12RowFunc yuy2ToNV12Row_{ YUY2ToNV12Row_Scalar };
+	YUY2ToI420RowFunc yuy2ToI420Row_{ YUY2ToI420Row_Scalar };
+	NV12ToUYVYRowFunc nv12ToUYVYRow_{ NV12ToUYVYRow_Linear_Scalar };
+	YUY2ToRGBRowFunc yuy2ToRGBRow_{ YUY2ToRGBRow_Scalar<true> };
+	OrientationKernels orientationKernels_;
+	YUVToRGBCoefficients rgbCoefficients_{};
+	bool nonTemporalStores_{ false };
+	std::unique_ptr<CropScaler> cropScaler_;
+	std::unique_ptr<ProxyPyramid> proxies_;
+	std::vector<std::unique_ptr<MJPEGDecoder>> decoders_; // one per worker for an MJPG capture
+	std::unique_ptr<BandPool> ownPool_; // null when the pool is shared
+	BandPool& convertPool_;
+};
+
+inline bool FrameConverter::Setup(const CaptureFormat& capture, const YUVColorimetry& colorimetry) {
+	captureFormat_ = capture.format;
+	width_ = capture.width;
+	height_ = capture.height;
+
+	if (IsRGBFormat(config_.outputFormat)) {
+		rgbCoefficients_ = MakeYUVToRGBCoefficients(colorimetry);
+		std::cout << "Converting to RGB with " << YUVMatrixName(colorimetry.matrix) << " " << YUVRangeName(colorimetry.range) << " range." << std::endl;
+	}
+
+	if (config_.Scaling()) {
+		if (!SetupCropScale()) {
+			std::cerr << "Failed to set up crop and scale." << std::endl;
+			return false;
+		}
+	}
+	else if (config_.orientation != Orientation::Identity) {
+		if (!SetupOrientation()) {
+			std::cerr << "Failed to set up orientation." << std::endl;
+			return false;
+		}
+	}
+	else if (captureFormat_ == PixelFormat::MJPG) {
+		if (!SetupMJPEGDecode()) {
+			std::cerr << "Failed to set up MJPG decoding." << std::endl;
+			return false;
+		}
+	}
+	else {
+		if (ConversionCostFor(captureFormat_, config_.outputFormat) < 0) {
+			std::cerr << "No conversion from " << PixelFormatName(captureFormat_) << " to " << PixelFormatName(config_.outputFormat) << "." << std::endl;
+			return false;
+		}
+		outputLayout_ = PackedFrameLayout(config_.outputFormat, width_, height_);
+	}
+
+	if (config_.proxies && !SetupProxies()) {
+		std::cerr << "Failed to set up proxies." << std::endl;
+		return false;
+	}
+
+	SelectKernels();
+	return true;
+}
+
+// The scaler reads YUY2 straight from the capture buffer and writes UYVY, so
+// cropping needs a YUY2 (or MJPG, decoded to YUY2) capture and UYVY output.
+inline bool FrameConverter::SetupCropScale() {
+	if (captureFormat_ != PixelFormat::YUY2 || config_.outputFormat != PixelFormat::UYVY) {
+		std::cerr << "Crop and scale need YUY2 capture and UYVY output, got " << PixelFormatName(captureFormat_)
+			<< " -> " << PixelFormatName(config_.outputFormat) << "." << std::endl;
+		return false;
+	}
+	if (config_.orientation != Orientation::Identity) {
+		std::cerr << "Crop and scale cannot be combined with " << OrientationName(config_.orientation) << "." << std::endl;
+		return false;
+	}
+
+	const uint32_t outputWidth = config_.outputWidth != 0 ? config_.outputWidth & ~1u : width_;
+	const uint32_t outputHeight = config_.outputHeight != 0 ? config_.outputHeight : height_;
+	if (outputWidth == 0 || outputHeight == 0) {
+		std::cerr << "Invalid output size." << std::endl;
+		return false;
+	}
+
+	cropScaler_ = std::make_unique<CropScaler>(width_, height_, outputWidth, outputHeight, config_.scaleFilter);
+	if (config_.crop.width > 0.0 && config_.crop.height > 0.0) {
+		cropScaler_->SetCrop(config_.crop);
+	}
+	outputLayout_ = PackedFrameLayout(PixelFormat::UYVY, outputWidth, outputHeight);
+
+	const CropWindow& crop = cropScaler_->Crop();
+	std::cout << "Scaling " << crop.width << "x" << crop.height << " at (" << crop.x << ", " << crop.y << ") to "
+		<< outputWidth << "x" << outputHeight << " with " << ScaleFilterName(config_.scaleFilter) << " filtering"
+		<< (config_.ptzDemo ? ", PTZ demo." : ".") << std::endl;
+	return true;
+}
+
+// Every worker gets a decoder, so a batch can have a frame on each of them.
+inline bool FrameConverter::SetupMJPEGDecode() {
+	if (!MJPEGDecodesTo(config_.outputFormat)) {
+		std::cerr << "This build cannot decode MJPG to " << PixelFormatName(config_.outputFormat) << "." << std::endl;
+		return false;
+	}
+	outputLayout_ = PackedFrameLayout(config_.outputFormat, width_, height_);
+
+	decoders_.clear();
+#ifdef MJPEG_LIBJPEG
+	for (unsigned i = 0; i < convertPool_.WorkerCount(); ++i) {
+		decoders_.push_back(std::make_unique<LibjpegMJPEGDecoder>());
+	}
+#endif
+	if (decoders_.empty()) {
+		return false;
+	}
+	std::cout << "Decoding MJPG with " << decoders_[0]->Name() << " into " << PixelFormatName(config_.outputFormat)
+		<< ", up to " << decoders_.size() << " frames at once." << std::endl;
+	return true;
+}
+
+// Orientation is applied by the packed 4:2:2 conversion, so it needs a YUY2
+// or UYVY capture and UYVY output, and is not combined with the scaler.
+inline bool FrameConverter::SetupOrientation() {
+	const bool packedCapture = captureFormat_ == PixelFormat::YUY2 || captureFormat_ == PixelFormat::UYVY;
+	if (!packedCapture || config_.outputFormat != PixelFormat::UYVY) {
+		std::cerr << "Orientation needs YUY2 or UYVY capture and UYVY output, got " << PixelFormatName(captureFormat_)
+			<< " -> " << PixelFormatName(config_.outputFormat) << "." << std::endl;
+		return false;
+	}
+	if (SwapsAxes(config_.orientation) && (height_ & 1) != 0) {
+		std::cerr << "Cannot " << OrientationName(config_.orientation) << " an odd height of " << height_ << "." << std::endl;
+		return false;
+	}
+
+	uint32_t outputWidth = 0, outputHeight = 0;
+	OrientedSize(config_.orientation, width_, height_, outputWidth, outputHeight);
+	outputLayout_ = PackedFrameLayout(PixelFormat::UYVY, outputWidth, outputHeight);
+
+	std::cout << "Applying " << OrientationName(config_.orientation) << ", output " << outputWidth << "x" << outputHeight << "." << std::endl;
+	return true;
+}
+
+// Proxies are filtered from the packed 4:2:2 rows the conversion is already
+// touching: the YUY2/UYVY capture rows, or the scaler's or orientation's UYVY
+// output rows.
+inline bool FrameConverter::SetupProxies() {
+	const bool packedCapture = captureFormat_ == PixelFormat::YUY2 || captureFormat_ == PixelFormat::UYVY;
+	if (!packedCapture || outputLayout_.format != PixelFormat::UYVY) {
+		std::cerr << "Proxies need YUY2 or UYVY capture and UYVY output, got " << PixelFormatName(captureFormat_)
+			<< " -> " << PixelFormatName(outputLayout_.format) << "." << std::endl;
+		return false;
+	}
+
+	proxies_ = std::make_unique<ProxyPyramid>(outputLayout_.width, outputLayout_.height);
+	for (uint32_t i = 0; i < ProxyPyramid::kLevelCount; ++i) {
+		std::cout << "Proxy " << i + 1 << ": " << proxies_->Layout(i).width << "x" << proxies_->Layout(i).height << std::endl;
+	}
+	return true;
+}
+
+// Band hook of Convert().
+inline void FrameConverter::EmitProxies(const uint8_t* rows, ptrdiff_t pitch, PixelFormat format, uint32_t firstRow, uint32_t lastRow) {
+	if (proxies_) {
+		proxies_->ProcessBand(rows, pitch, format, firstRow, lastRow);
+	}
+}
+
+// Zooms between the whole frame and a quarter of it while panning, one step
+// per frame, to exercise moving the window without reallocating.
+inline void FrameConverter::UpdatePTZ(uint64_t frame) {
+	const double zoom = 0.625 + 0.375 * std::cos(frame * 0.011);
+	const double width = width_ * zoom;
+	const double height = height_ * zoom;
+	const double pan = 0.5 + 0.5 * std::sin(frame * 0.017);
+	const double tilt = 0.5 + 0.5 * std::sin(frame * 0.007);
+	cropScaler_->SetCrop({ (width_ - width) * pan, (height_ - height) * tilt, width, height });
+}
+
+// Only the packed 4:2:2 row copy and the YUY2 -> UYVY row, which a vertical
+// flip also uses, have streaming variants. The planar, RGB, scaling,
+// mirroring, transposing and MJPG paths keep regular stores at any size.
+inline bool FrameConverter::HasNonTemporalPath() const {
+	if (cropScaler_ || !decoders_.empty()) {
+		return false;
+	}
+	if (config_.orientation != Orientation::Identity) {
+		const OrientationSteps steps = StepsFor(config_.orientation);
+		return captureFormat_ == PixelFormat::YUY2 && !steps.transpose && !steps.mirror;
+	}
+	if (captureFormat_ == PixelFormat::UYVY) {
+		return true;
+	}
+	return captureFormat_ == PixelFormat::YUY2 && (outputLayout_.format == PixelFormat::YUY2 || outputLayout_.format == PixelFormat::UYVY);
+}
+
+// Runs once the output size is known: frames above the threshold go out with
+// streaming stores where the path has them, since nothing in this process
+// reads them back.
+inline void FrameConverter::SelectKernels() {
+	SimdLevel level = ActiveSimdLevel();
+	nonTemporalStores_ = HasNonTemporalPath() && UseNonTemporalStores(outputLayout_.totalBytes, config_.nonTemporalThreshold);
+	yuy2ToUYVYRow_ = nonTemporalStores_ ? GetYUY2ToUYVYRowNonTemporal(level) : GetYUY2ToUYVYRow(level);
+	yuy2ToNV12Row_ = GetYUY2ToNV12Row(level);
+	yuy2ToI420Row_ = GetYUY2ToI420Row(level);
+	nv12ToUYVYRow_ = GetNV12ToUYVYRow(level, config_.chromaFilter);
+	yuy2ToRGBRow_ = GetYUY2ToRGBRow(level, config_.outputFormat);
+	orientationKernels_ = GetOrientationKernels(level, captureFormat_, PixelFormat::UYVY);
+	if (captureFormat_ == PixelFormat::YUY2) {
+		orientationKernels_.row = yuy2ToUYVYRow_;
+	}
+	std::cout << "Using " << SimdLevelName(level) << " conversion kernels on " << convertPool_.WorkerCount() << " threads"
+		<< (nonTemporalStores_ ? " with non-temporal stores." : ".") << std::endl;
+}
+
+inline bool FrameConverter::Convert(const SourcePlanes& source, uint8_t* destData, uint64_t frameIndex, uint8_t* const* proxyDests) {
+	const uint8_t* srcData = source.data[0];
+	const ptrdiff_t pitch = source.pitch[0];
+
+	if (!decoders_.empty()) {
+		return decoders_[0]->Decode(srcData, static_cast<size_t>(pitch), outputLayout_, destData);
+	}
+
+	if (proxies_) {
+		proxies_->SetOutputs(proxyDests);
+	}
+
+	if (cropScaler_) {
+		if (config_.ptzDemo) {
+			UpdatePTZ(frameIndex);
+		}
+		const ptrdiff_t destPitch = static_cast<ptrdiff_t>(outputLayout_.planePitch[0]);
+		cropScaler_->Convert(convertPool_, srcData, pitch, destData, [&](uint32_t firstRow, uint32_t lastRow) {
+			EmitProxies(destData, destPitch, PixelFormat::UYVY, firstRow, lastRow);
+		});
+		return true;
+	}
+
+	if (config_.orientation != Orientation::Identity) {
+		const ptrdiff_t destPitch = static_cast<ptrdiff_t>(outputLayout_.planePitch[0]);
+		OrientPacked422WithPitch(convertPool_, orientationKernels_, config_.orientation, srcData, pitch, width_, height_,
+			destData, destPitch, [&](uint32_t firstRow, uint32_t lastRow) {
+			EmitProxies(destData, destPitch, PixelFormat::UYVY, firstRow, lastRow);
+		});
+		return true;
+	}
+
+	if (captureFormat_ == PixelFormat::UYVY) {
+		CopyRowsWithPitch(convertPool_, srcData, destData, width_ * 2, height_, pitch, nonTemporalStores_, [&](uint32_t firstRow, uint32_t lastRow) {
+			EmitProxies(srcData, pitch, PixelFormat::UYVY, firstRow, lastRow);
+		});
+		return true;
+	}
+
+	if (captureFormat_ == PixelFormat::NV12) {
+		if (outputLayout_.format == PixelFormat::NV12) {
+			CopyPlanesWithPitch(convertPool_, source.data, source.pitch, outputLayout_, destData);
+		}
+		else {
+			NV12ToUYVYWithPitch(convertPool_, nv12ToUYVYRow_, srcData, pitch, source.data[1], source.pitch[1], destData, width_, height_);
+		}
+		return true;
+	}
+
+	switch (outputLayout_.format) {
+	case PixelFormat::YUY2:
+		CopyRowsWithPitch(convertPool_, srcData, destData, width_ * 2, height_, pitch, nonTemporalStores_);
+		break;
+	case PixelFormat::UYVY:
+		YUY2ToUYVYWithPitch(convertPool_, yuy2ToUYVYRow_, srcData, destData, width_, height_, pitch, [&](uint32_t firstRow, uint32_t lastRow) {
+			EmitProxies(srcData, pitch, PixelFormat::YUY2, firstRow, lastRow);
+		});
+		break;
+	case PixelFormat::NV12:
+		YUY2ToNV12WithPitch(convertPool_, yuy2ToNV12Row_, srcData, pitch, outputLayout_, destData);
+		break;
+	case PixelFormat::I420:
+		YUY2ToI420WithPitch(convertPool_, yuy2ToI420Row_, srcData, pitch, outputLayout_, destData);
+		break;
+	case PixelFormat::BGRA:
+	case PixelFormat::BGRX:
+	case PixelFormat::RGBA:
+	case PixelFormat::RGBX:
+		YUY2ToRGBWithPitch(convertPool_, yuy2ToRGBRow_, rgbCoefficients_, srcData, pitch, destData, outputLayout_.planePitch[0], width_, height_);
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+// Decoder i decodes frame i of each round on whichever worker claims it; a
+// round of one frame runs on this thread.
+inline void FrameConverter::ConvertFrames(ConvertJob* jobs, uint32_t count) {
+	if (decoders_.empty()) {
+		for (uint32_t i = 0; i < count; ++i) {
+			jobs[i].converted = Convert(*jobs[i].source, jobs[i].dest, jobs[i].frameIndex, jobs[i].proxies);
+		}
+		return;
+	}
+
+	for (uint32_t first = 0; first < count; first += FramesInFlight()) {
+		const uint32_t round = (std::min)(count - first, FramesInFlight());
+		convertPool_.Run(round, 1, [&](uint32_t firstFrame, uint32_t lastFrame) {
+			for (uint32_t i = firstFrame; i < lastFrame; ++i) {
+				ConvertJob& job = jobs[first + i];
+				job.converted = decoders_[i]->Decode(job.source->data[0], static_cast<size_t>(job.source->pitch[0]), outputLayout_, job.dest);
+			}
+		});
+	}
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+// Captured frames read in place.
+//
+// A FrameHandle points at the planes of a capture buffer while the buffer is
+// locked. Copies of the handle share the lock, and the last one to go unlocks
+// the buffer, so a stage holds the frame exactly as long as it reads it and
+// nobody has to pair Lock and Unlock by hand.
+//
+// FrameHandleFactory locks the sample's own buffer when it has just one, and
+// only asks for a contiguous copy when the sample is fragmented across several;
+// it counts how often that happens. The capture API is reached through the
+// LockableFrameBuffer and CapturedFrameSource interfaces (Media Foundation in
+// MFFrameHandle.h), so this part runs anywhere.
+//
+// A handle keeps its sample alive, and the sample owns the buffer it locked,
+// so locking makes nothing but the handle itself, which lives in one of the
+// factory's slots (see SlotPool.h): no heap allocation per frame.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "PixelFormat.h"
+#include "SlotPool.h"
+
+// Planes of a locked capture buffer. Pitches are signed: negative for
+// bottom-up buffers, with data[0] pointing at the top row.
+struct SourcePlanes {
+	PixelFormat format{ PixelFormat::Unknown };
+	uint32_t width{ 0 };
+	uint32_t height{ 0 };
+	uint32_t planeCount{ 0 };
+	const uint8_t* data[3]{};
+	ptrdiff_t pitch[3]{};
+};
+
+// Planes of a capture buffer whose first row is scanline0. NV12 capture
+// buffers hold the UV plane right after the Y plane, with the same pitch; the
+// other capture formats are packed. An MJPG buffer holds one compressed frame,
+// whose length in bytes stands in for the pitch.
+inline SourcePlanes SourcePlanesFor(PixelFormat format, uint32_t width, uint32_t height, const uint8_t* scanline0, ptrdiff_t pitch) {
+	SourcePlanes planes;
+	planes.format = format;
+	planes.width = width;
+	planes.height = height;
+	planes.planeCount = 1;
+	planes.data[0] = scanline0;
+	planes.pitch[0] = pitch;
+	if (format == PixelFormat::NV12) {
+		planes.planeCount = 2;
+		planes.data[1] = scanline0 + pitch * static_cast<ptrdiff_t>(height);
+		planes.pitch[1] = pitch;
+	}
+	return planes;
+}
+
+using FrameHandle = std::shared_ptr<const SourcePlanes>;
+
+// One buffer of a captured sample.
+class LockableFrameBuffer {
+public:
+	virtual ~LockableFrameBuffer() = default;
+
+	// Locks the buffer for reading and returns its first row and signed pitch,
+	// or, compressed, its data and length.
+	virtual bool Lock(const uint8_t*& scanline0, ptrdiff_t& pitch) = 0;
+	virtual void Unlock() = 0;
+};
+
+// A captured sample, which may be split over several buffers. The buffers it
+// returns belong to it and stay valid while it lives.
+class CapturedFrameSource {
+public:
+	virtual ~CapturedFrameSource() = default;
+
+	virtual uint32_t BufferCount() = 0;
+	// The sample's only buffer, without copying.
+	virtual LockableFrameBuffer* SingleBuffer() = 0;
+	// All buffers copied into one.
+	virtual LockableFrameBuffer* ContiguousCopy() = 0;
+};
+
+// Counters of a factory, read from any thread.
+struct FrameHandleStats {
+	uint64_t direct{ 0 };   // frames locked in the sample's own buffer
+	uint64_t copied{ 0 };   // fragmented frames copied into a contiguous buffer
+	uint64_t failures{ 0 }; // frames that could not be locked
+	uint64_t overflows{ 0 }; // handles that found every slot held and went to the heap
+};
+
+class FrameHandleFactory {
+public:
+	// handleSlots is the most handles alive at once that are made without
+	// touching the heap.
+	FrameHandleFactory(PixelFormat format, uint32_t width, uint32_t height, uint32_t handleSlots = 4)
+		: format_(format), width_(width), height_(height), slots_(SlotPool::SlotBytesFor<LockedFrame>(), handleSlots) {}
+
+	// Locks the frame of source, or returns an empty handle. The handle keeps
+	// source alive until the last copy is dropped.
+	FrameHandle Lock(const std::shared_ptr<CapturedFrameSource>& source) {
+		const bool fragmented = source->BufferCount() != 1;
+		LockableFrameBuffer* buffer = fragmented ? source->ContiguousCopy() : source->SingleBuffer();
+
+		const uint8_t* scanline0 = nullptr;
+		ptrdiff_t pitch = 0;
+		if (!buffer || !buffer->Lock(scanline0, pitch)) {
+			Count(failures_);
+			return FrameHandle();
+		}
+		Count(fragmented ? copied_ : direct_);
+
+		auto owner = std::allocate_shared<LockedFrame>(SlotAllocator<LockedFrame>(slots_),
+			SourcePlanesFor(format_, width_, height_, scanline0, pitch), source, buffer);
+		return FrameHandle(owner, &owner->planes);
+	}
+
+	FrameHandleStats Stats() const {
+		FrameHandleStats stats;
+		stats.direct = direct_.load(std::memory_order_relaxed);
+		stats.copied = copied_.load(std::memory_order_relaxed);
+		stats.failures = failures_.load(std::memory_order_relaxed);
+		stats.overflows = slots_.Overflows();
+		return stats;
+	}
+
+private:
+	// The last copy of the handle unlocks the buffer and lets go of the sample.
+	struct LockedFrame {
+		LockedFrame(const SourcePlanes& planes, std::shared_ptr<CapturedFrameSource> source, LockableFrameBuffer* buffer)
+			: planes(planes), source(std::move(source)), buffer(buffer) {}
+
+		LockedFrame(const LockedFrame&) = delete;
+		LockedFrame& operator=(const LockedFrame&) = delete;
+
+		~LockedFrame() {
+			buffer->Unlock();
+		}
+
+		SourcePlanes planes;
+		std::shared_ptr<CapturedFrameSource> source;
+		LockableFrameBuffer* buffer;
+	};
+
+	// Lock() is called from one thread.
+	static void Count(std::atomic<uint64_t>& counter) {
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	PixelFormat format_;
+	uint32_t width_;
+	uint32_t height_;
+	SlotPool slots_;
+	std::atomic<uint64_t> direct_{ 0 };
+	std::atomic<uint64_t> copied_{ 0 };
+	std::atomic<uint64_t> failures_{ 0 };
+};
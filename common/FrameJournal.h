@@ -0,0 +1,846 @@
+#pragma once
+
+// Append-only raw frame journal: records converted frames into memory-mapped
+// segment files for later analysis.
+//
+// A segment is a preallocated file laid out as
+//
+//   header   4 KiB           FrameJournalHeader: sizes and records committed
+//   index    indexEntries    FrameJournalIndexEntry: where each record starts
+//   records  4 KiB aligned   FrameJournalRecord, then the frame's planes
+//
+// Append() copies a frame into the mapping with streaming stores, then writes
+// its index entry. The writing thread makes no system calls: a background
+// thread writes every flushBytes batch back to disk, and only once a batch and
+// its index entries are there does it raise the header's record count to
+// cover them and write the header back. The header on disk so never counts a
+// record that is not, though records past its count may be there in part. It
+// also faults in the pages ahead of the writer, creates and maps the next
+// segment before it is needed, and closes finished ones, trimmed to what was
+// written. A segment rolls over when the next record or index entry does not
+// fit, or after segmentSeconds. If the next segment cannot be created (a full
+// disk, a file held open elsewhere), frames that do not fit the current one
+// are rejected and creating it is retried every retrySeconds until it works.
+//
+// FrameJournal is a FrameSink; behind a SinkQueue (SinkFanOut.h) a slow disk
+// drops recorded frames instead of holding up live sinks. FrameJournalReader
+// maps a finished segment read-only and finds any record through the index.
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "CaptureClock.h"
+#include "FrameRing.h"
+#include "FrameSink.h"
+#include "FrameTracer.h"
+#include "LatencyHistogram.h"
+#include "PixelConvert.h"
+#include "PixelFormat.h"
+
+struct FrameJournalConfig {
+	std::string directory;       // created if missing
+	std::string name{ "frames" }; // segments are <directory>/<name>-<number>.fjr
+	uint64_t segmentBytes{ 2ull << 30 }; // file size, header and index included
+	double segmentSeconds{ 0.0 };  // also roll over after this long; 0 = by size only
+	uint32_t indexEntries{ 65536 }; // records per segment at most
+	size_t flushBytes{ 64u << 20 };  // written back to disk in batches of this much
+	size_t prefaultBytes{ 256u << 20 }; // pages faulted in ahead of the writer
+	double retrySeconds{ 1.0 };    // between attempts at a segment that could not be created
+};
+
+constexpr size_t kFrameJournalAlignment = 4096;
+constexpr char kFrameJournalMagic[8] = { 'F', 'R', 'M', 'J', 'R', 'N', 'L', '1' };
+constexpr uint32_t kFrameJournalRecordMagic = 0x43524A46; // "FJRC"
+
+// Fields are only ever appended; readers check headerBytes and recordBytes.
+struct FrameJournalHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;
+	uint64_t segment;        // number within the recording, from 0
+	uint64_t fileBytes;      // as preallocated; a closed segment is trimmed to dataEnd
+	uint64_t indexOffset;
+	uint32_t indexEntries;
+	uint32_t recordBytes;    // sizeof(FrameJournalRecord)
+	uint64_t dataOffset;
+	uint64_t recordCount;    // records written back to disk; written last
+	uint64_t dataEnd;        // end of the last of them
+	int64_t createdTimecode; // 100 ns units since the Unix epoch
+	uint32_t closed;         // 1 once the segment was closed cleanly
+};
+
+struct FrameJournalIndexEntry {
+	uint64_t offset;      // of the record, from the start of the file
+	uint64_t frameIndex;
+	int64_t timecode;     // capture time, 100 ns units since the Unix epoch
+	uint64_t payloadBytes;
+};
+
+// One record: this header, then the planes at planeOffset from its end.
+struct FrameJournalRecord {
+	uint32_t magic;
+	uint32_t recordBytes;
+	uint64_t frameIndex;
+	int64_t timecode;     // capture time, 100 ns units since the Unix epoch
+	int64_t steadyNs;     // capture time on the recording machine's steady clock
+	char formatName[8];   // PixelFormatName()
+	uint32_t format;      // PixelFormat
+	uint32_t width;
+	uint32_t height;
+	uint32_t planeCount;
+	uint64_t planeOffset[3];
+	uint64_t planePitch[3];
+	uint64_t payloadBytes;
+	uint8_t reserved[16];
+};
+
+static_assert(sizeof(FrameJournalHeader) <= kFrameJournalAlignment, "the journal header must fit its page");
+static_assert(sizeof(FrameJournalIndexEntry) == 32, "index entries are packed");
+static_assert(sizeof(FrameJournalRecord) == 128, "record headers keep the planes 128-byte aligned");
+
+inline size_t AlignJournalBytes(uint64_t bytes) {
+	return static_cast<size_t>((bytes + kFrameJournalAlignment - 1) & ~uint64_t(kFrameJournalAlignment - 1));
+}
+
+// A file mapped whole into memory, read-write for a new preallocated file or
+// read-only for an existing one.
+class MappedFile {
+public:
+	MappedFile() = default;
+
+	~MappedFile() {
+		Close(0);
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Creates (or replaces) path at size bytes, allocated on disk up front.
+	// Fails, leaving no file, if the space cannot be reserved: writing
+	// through the mapping into space the disk does not have would fault.
+	bool Create(const std::string& path, uint64_t size);
+
+	bool OpenReadOnly(const std::string& path);
+
+	uint8_t* Data() const {
+		return data_;
+	}
+
+	uint64_t Size() const {
+		return size_;
+	}
+
+	// Writes [offset, offset + bytes) back to disk and waits for it.
+	bool Flush(uint64_t offset, uint64_t bytes);
+
+	// Faults in [offset, offset + bytes) so the writer does not take the page
+	// faults. Where the OS cannot fault pages in for writing, they are read,
+	// which still saves the writer the expensive part of the fault.
+	void Prefault(uint64_t offset, uint64_t bytes);
+
+	// Unmaps and closes; a writable file is first cut to keepBytes unless
+	// that is 0.
+	void Close(uint64_t keepBytes);
+
+private:
+	uint8_t* data_{ nullptr };
+	uint64_t size_{ 0 };
+	bool writable_{ false };
+#ifdef _WIN32
+	HANDLE file_{ INVALID_HANDLE_VALUE };
+	HANDLE mapping_{ nullptr };
+#else
+	int fd_{ -1 };
+#endif
+};
+
+#ifdef _WIN32
+
+inline bool MappedFile::Create(const std::string& path, uint64_t size) {
+	file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	FILE_ALLOCATION_INFO allocation = {};
+	allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+	LARGE_INTEGER end;
+	end.QuadPart = static_cast<LONGLONG>(size);
+	if (!SetFileInformationByHandle(file_, FileAllocationInfo, &allocation, sizeof(allocation))
+		|| !SetFilePointerEx(file_, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file_)) {
+		Close(0);
+		DeleteFileA(path.c_str());
+		return false;
+	}
+	mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+	if (mapping_) {
+		data_ = static_cast<uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(size)));
+	}
+	if (!data_) {
+		Close(0);
+		DeleteFileA(path.c_str());
+		return false;
+	}
+	size_ = size;
+	writable_ = true;
+	return true;
+}
+
+inline bool MappedFile::OpenReadOnly(const std::string& path) {
+	file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+		Close(0);
+		return false;
+	}
+	mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping_) {
+		Close(0);
+		return false;
+	}
+	data_ = static_cast<uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+	if (!data_) {
+		Close(0);
+		return false;
+	}
+	size_ = static_cast<uint64_t>(size.QuadPart);
+	return true;
+}
+
+inline bool MappedFile::Flush(uint64_t offset, uint64_t bytes) {
+	return FlushViewOfFile(data_ + offset, static_cast<SIZE_T>(bytes)) && FlushFileBuffers(file_);
+}
+
+inline void MappedFile::Prefault(uint64_t offset, uint64_t bytes) {
+	const uint64_t end = (std::min)(offset + bytes, size_);
+	for (uint64_t page = offset; page < end; page += kFrameJournalAlignment) {
+		(void)*static_cast<volatile const uint8_t*>(data_ + page);
+	}
+}
+
+inline void MappedFile::Close(uint64_t keepBytes) {
+	if (data_) {
+		UnmapViewOfFile(data_);
+		data_ = nullptr;
+	}
+	if (mapping_) {
+		CloseHandle(mapping_);
+		mapping_ = nullptr;
+	}
+	if (file_ != INVALID_HANDLE_VALUE) {
+		if (writable_ && keepBytes != 0) {
+			LARGE_INTEGER end;
+			end.QuadPart = static_cast<LONGLONG>(keepBytes);
+			SetFilePointerEx(file_, end, nullptr, FILE_BEGIN);
+			SetEndOfFile(file_);
+		}
+		CloseHandle(file_);
+		file_ = INVALID_HANDLE_VALUE;
+	}
+	size_ = 0;
+	writable_ = false;
+}
+
+#else
+
+inline bool MappedFile::Create(const std::string& path, uint64_t size) {
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd_ < 0) {
+		return false;
+	}
+	// Only a filesystem that cannot preallocate at all gets a sparse file; a
+	// full disk (ENOSPC) or a file too large (EFBIG) fails here.
+	const int allocated = posix_fallocate(fd_, 0, static_cast<off_t>(size));
+	const bool sized = allocated == 0
+		|| ((allocated == EOPNOTSUPP || allocated == EINVAL) && ftruncate(fd_, static_cast<off_t>(size)) == 0);
+	void* data = sized ? mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0) : MAP_FAILED;
+	if (data == MAP_FAILED) {
+		Close(0);
+		unlink(path.c_str());
+		return false;
+	}
+	data_ = static_cast<uint8_t*>(data);
+	size_ = size;
+	writable_ = true;
+	return true;
+}
+
+inline bool MappedFile::OpenReadOnly(const std::string& path) {
+	fd_ = open(path.c_str(), O_RDONLY);
+	if (fd_ < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(fd_, &status) != 0 || status.st_size == 0) {
+		Close(0);
+		return false;
+	}
+	void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd_, 0);
+	if (data == MAP_FAILED) {
+		Close(0);
+		return false;
+	}
+	data_ = static_cast<uint8_t*>(data);
+	size_ = static_cast<uint64_t>(status.st_size);
+	return true;
+}
+
+inline bool MappedFile::Flush(uint64_t offset, uint64_t bytes) {
+	return msync(data_ + offset, static_cast<size_t>(bytes), MS_SYNC) == 0;
+}
+
+inline void MappedFile::Prefault(uint64_t offset, uint64_t bytes) {
+	const uint64_t end = (std::min)(offset + bytes, size_);
+	if (end <= offset) {
+		return;
+	}
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(data_ + offset, static_cast<size_t>(end - offset), MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+	for (uint64_t page = offset; page < end; page += kFrameJournalAlignment) {
+		(void)*static_cast<volatile const uint8_t*>(data_ + page);
+	}
+}
+
+inline void MappedFile::Close(uint64_t keepBytes) {
+	if (data_) {
+		munmap(data_, static_cast<size_t>(size_));
+		data_ = nullptr;
+	}
+	if (fd_ >= 0) {
+		if (writable_ && keepBytes != 0 && ftruncate(fd_, static_cast<off_t>(keepBytes)) != 0) {
+			std::cerr << "Failed to trim a journal segment." << std::endl;
+		}
+		close(fd_);
+		fd_ = -1;
+	}
+	size_ = 0;
+	writable_ = false;
+}
+
+#endif
+
+struct FrameJournalStats {
+	uint64_t records{ 0 };
+	uint64_t bytes{ 0 };        // payload written
+	uint64_t segments{ 0 };     // opened, including the current one
+	uint64_t rejected{ 0 };     // frames too large for a segment, or that came while recording was stopped or closed
+	uint64_t segmentWaits{ 0 }; // rollovers that had to wait for the next segment
+	uint64_t segmentFailures{ 0 }; // attempts at creating a segment that failed
+	bool stopped{ false };      // the current segment is done and no next one could be created
+	uint64_t flushes{ 0 };
+	uint64_t flushFailures{ 0 };
+	LatencySnapshot flush;      // time to write one batch back
+};
+
+class FrameJournal : public FrameSink {
+public:
+	explicit FrameJournal(const FrameJournalConfig& config)
+		: config_(config), jobs_(16, HandoffPolicy::Block) {
+		config_.segmentBytes = AlignJournalBytes(config_.segmentBytes);
+		config_.indexEntries = (std::max)(config_.indexEntries, 1u);
+		config_.flushBytes = AlignJournalBytes((std::max<size_t>)(config_.flushBytes, kFrameJournalAlignment));
+	}
+
+	~FrameJournal() override {
+		Close();
+	}
+
+	FrameJournal(const FrameJournal&) = delete;
+	FrameJournal& operator=(const FrameJournal&) = delete;
+
+	// Creates the directory and the first segment, and starts the background
+	// thread, which prepares the second.
+	bool Open();
+
+	// Appends one frame of layout from data. False if it was not recorded.
+	bool Append(const FrameLayout& layout, const uint8_t* data, uint64_t frameIndex, std::chrono::steady_clock::time_point captured);
+
+	// Closes the current segment and waits for everything to reach the disk.
+	void Close();
+
+	void Send(SinkFrame& frame) override {
+		Append(frame.frame.Layout(), frame.frame.Data(), frame.index, frame.captured);
+	}
+
+	void Flush() override {
+		Close();
+	}
+
+	void PrintStats(bool interval) override;
+
+	FrameJournalStats Stats() const;
+
+	// Path of segment number segment.
+	std::string SegmentPath(uint64_t segment) const {
+		char number[32];
+		snprintf(number, sizeof(number), "-%06llu.fjr", static_cast<unsigned long long>(segment));
+		return (std::filesystem::path(config_.directory) / (config_.name + number)).string();
+	}
+
+private:
+	struct Segment {
+		uint64_t number{ 0 };
+		MappedFile file;
+		FrameJournalHeader* header{ nullptr };
+		FrameJournalIndexEntry* index{ nullptr };
+		uint64_t recordCount{ 0 }; // appended, ahead of the header's count until flushed
+		uint64_t durableEnd{ 0 };  // background thread: data written back so far
+		std::chrono::steady_clock::time_point opened;
+	};
+
+	enum class JobKind : uint8_t { Flush, Prepare, Close };
+
+	struct Job {
+		JobKind kind{ JobKind::Flush };
+		std::shared_ptr<Segment> segment;
+		uint64_t begin{ 0 }; // Flush: range written; Close: bytes to keep; Prepare: segment number
+		uint64_t end{ 0 };   // Prepare: 1 for a retry, which fails quietly
+		uint64_t records{ 0 }; // Flush: records that end with the range
+	};
+
+	std::shared_ptr<Segment> CreateSegment(uint64_t number, bool report = true);
+	bool Rollover(bool full);
+	void QueueFlush(uint64_t end);
+	void Post(JobKind kind, std::shared_ptr<Segment> segment, uint64_t begin = 0, uint64_t end = 0, uint64_t records = 0);
+	void BackgroundLoop();
+
+	FrameJournalConfig config_;
+	UtcTimecodeAnchor timecodeAnchor_;
+	FrameRing<Job> jobs_;
+	std::thread background_;
+
+	// Writer side.
+	std::shared_ptr<Segment> current_;
+	uint64_t writeOffset_{ 0 };
+	uint64_t flushedTo_{ 0 };
+	uint64_t nextSegment_{ 0 }; // the one being prepared
+	bool stalled_{ false };     // no next segment; retrying
+	std::chrono::steady_clock::time_point retryAt_;
+
+	// Handed from the background thread to the writer at a rollover.
+	std::mutex spareMutex_;
+	std::condition_variable spareReady_;
+	std::shared_ptr<Segment> spare_;
+	bool sparePending_{ false };
+
+	std::atomic<uint64_t> records_{ 0 };
+	std::atomic<uint64_t> bytes_{ 0 };
+	std::atomic<uint64_t> segments_{ 0 };
+	std::atomic<uint64_t> rejected_{ 0 };
+	std::atomic<uint64_t> segmentWaits_{ 0 };
+	std::atomic<uint64_t> segmentFailures_{ 0 };
+	std::atomic<bool> stopped_{ false };
+	std::atomic<uint64_t> flushes_{ 0 };
+	std::atomic<uint64_t> flushFailures_{ 0 };
+	LatencyHistogram flushLatency_;
+	FrameJournalStats reported_; // as of the last periodic report
+	bool stopReported_{ false };
+};
+
+inline std::shared_ptr<FrameJournal::Segment> FrameJournal::CreateSegment(uint64_t number, bool report) {
+	auto segment = std::make_shared<Segment>();
+	segment->number = number;
+	const std::string path = SegmentPath(number);
+	if (!segment->file.Create(path, config_.segmentBytes)) {
+		if (report) {
+			std::cerr << "Failed to create journal segment " << path << "." << std::endl;
+		}
+		return nullptr;
+	}
+
+	const uint64_t indexOffset = kFrameJournalAlignment;
+	const uint64_t dataOffset = indexOffset + AlignJournalBytes(uint64_t(config_.indexEntries) * sizeof(FrameJournalIndexEntry));
+	if (dataOffset >= config_.segmentBytes) {
+		std::cerr << "A journal segment of " << config_.segmentBytes << " bytes has no room past its index." << std::endl;
+		return nullptr;
+	}
+
+	uint8_t* data = segment->file.Data();
+	segment->header = reinterpret_cast<FrameJournalHeader*>(data);
+	segment->index = reinterpret_cast<FrameJournalIndexEntry*>(data + indexOffset);
+	FrameJournalHeader& header = *segment->header;
+	memcpy(header.magic, kFrameJournalMagic, sizeof(header.magic));
+	header.version = 1;
+	header.headerBytes = sizeof(FrameJournalHeader);
+	header.segment = number;
+	header.fileBytes = config_.segmentBytes;
+	header.indexOffset = indexOffset;
+	header.indexEntries = config_.indexEntries;
+	header.recordBytes = sizeof(FrameJournalRecord);
+	header.dataOffset = dataOffset;
+	header.recordCount = 0;
+	header.dataEnd = dataOffset;
+	segment->durableEnd = dataOffset;
+	header.createdTimecode = timecodeAnchor_.Timecode(std::chrono::steady_clock::now());
+	header.closed = 0;
+
+	segment->file.Prefault(dataOffset, config_.prefaultBytes);
+	return segment;
+}
+
+inline bool FrameJournal::Open() {
+	std::error_code error;
+	std::filesystem::create_directories(config_.directory, error);
+	if (error) {
+		std::cerr << "Failed to create " << config_.directory << ": " << error.message() << std::endl;
+		return false;
+	}
+
+	current_ = CreateSegment(0);
+	if (!current_) {
+		return false;
+	}
+	current_->opened = std::chrono::steady_clock::now();
+	writeOffset_ = flushedTo_ = current_->header->dataOffset;
+	segments_.store(1, std::memory_order_relaxed);
+
+	background_ = std::thread([this]() { BackgroundLoop(); });
+	nextSegment_ = 1;
+	Post(JobKind::Prepare, nullptr, nextSegment_);
+	return true;
+}
+
+inline bool FrameJournal::Append(const FrameLayout& layout, const uint8_t* data, uint64_t frameIndex, std::chrono::steady_clock::time_point captured) {
+	if (!current_) {
+		rejected_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	const uint64_t recordBytes = AlignJournalBytes(sizeof(FrameJournalRecord) + layout.totalBytes);
+	const auto now = std::chrono::steady_clock::now();
+	auto full = [&]() {
+		return writeOffset_ + recordBytes > current_->file.Size() || current_->recordCount == current_->header->indexEntries;
+	};
+	const bool expired = config_.segmentSeconds > 0.0 && now - current_->opened >= std::chrono::duration<double>(config_.segmentSeconds);
+	// A segment that has only expired takes more records until the next one
+	// is there; one too small for a single record is not rolled over.
+	if ((expired || full()) && current_->recordCount != 0) {
+		Rollover(full());
+	}
+	if (full()) {
+		rejected_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	TRACE_SPAN("journal append", frameIndex);
+	uint8_t* base = current_->file.Data() + writeOffset_;
+	FrameJournalRecord record = {};
+	record.magic = kFrameJournalRecordMagic;
+	record.recordBytes = sizeof(FrameJournalRecord);
+	record.frameIndex = frameIndex;
+	record.timecode = timecodeAnchor_.Timecode(captured);
+	record.steadyNs = std::chrono::duration_cast<std::chrono::nanoseconds>(captured.time_since_epoch()).count();
+	strncpy(record.formatName, PixelFormatName(layout.format), sizeof(record.formatName) - 1);
+	record.format = static_cast<uint32_t>(layout.format);
+	record.width = layout.width;
+	record.height = layout.height;
+	record.planeCount = layout.planeCount;
+	for (uint32_t plane = 0; plane < 3; ++plane) {
+		record.planeOffset[plane] = layout.planeOffset[plane];
+		record.planePitch[plane] = layout.planePitch[plane];
+	}
+	record.payloadBytes = layout.totalBytes;
+
+	// Nothing reads the pages back before they are written out, so they
+	// bypass the caches the live path is using.
+	CopyRowNonTemporal(reinterpret_cast<const uint8_t*>(&record), base, sizeof(record));
+	CopyRowNonTemporal(data, base + sizeof(record), layout.totalBytes);
+	StoreFence();
+
+	current_->index[current_->recordCount++] = { writeOffset_, frameIndex, record.timecode, layout.totalBytes };
+	writeOffset_ += recordBytes;
+
+	records_.fetch_add(1, std::memory_order_relaxed);
+	bytes_.fetch_add(layout.totalBytes, std::memory_order_relaxed);
+	if (writeOffset_ - flushedTo_ >= config_.flushBytes) {
+		QueueFlush(writeOffset_);
+	}
+	return true;
+}
+
+// Takes the spare the background thread prepared and hands it the finished
+// segment to close. Only a full segment waits for a spare that is not ready
+// yet; an expired one keeps taking records. Without a spare the current
+// segment stays, and the spare is asked for again every retrySeconds; the
+// writer does not wait for those attempts.
+inline bool FrameJournal::Rollover(bool full) {
+	TRACE_SPAN("journal rollover", current_->number);
+	std::shared_ptr<Segment> next;
+	bool pending = false;
+	{
+		std::unique_lock<std::mutex> lock(spareMutex_);
+		if (!spare_ && sparePending_ && !stalled_ && full) {
+			segmentWaits_.fetch_add(1, std::memory_order_relaxed);
+			spareReady_.wait(lock, [this]() { return spare_ || !sparePending_; });
+		}
+		next = std::move(spare_);
+		pending = sparePending_;
+	}
+	if (!next) {
+		if (pending && !stalled_) {
+			return false; // expired, and the spare is still on its way
+		}
+		const auto now = std::chrono::steady_clock::now();
+		const auto retry = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(config_.retrySeconds));
+		if (!stalled_) {
+			stalled_ = true;
+			retryAt_ = now + retry;
+		}
+		else if (!pending && now >= retryAt_) {
+			Post(JobKind::Prepare, nullptr, nextSegment_, 1);
+			retryAt_ = now + retry;
+		}
+		stopped_.store(full, std::memory_order_relaxed);
+		return false;
+	}
+	stalled_ = false;
+	stopped_.store(false, std::memory_order_relaxed);
+
+	QueueFlush(writeOffset_);
+	Post(JobKind::Close, std::move(current_), writeOffset_);
+	current_ = std::move(next);
+	current_->opened = std::chrono::steady_clock::now();
+	writeOffset_ = flushedTo_ = current_->header->dataOffset;
+	segments_.fetch_add(1, std::memory_order_relaxed);
+	Post(JobKind::Prepare, nullptr, ++nextSegment_);
+	return true;
+}
+
+// Every record that ends by end goes with the batch, so the header the job
+// writes counts exactly those.
+inline void FrameJournal::QueueFlush(uint64_t end) {
+	if (end > flushedTo_) {
+		Post(JobKind::Flush, current_, flushedTo_, end, current_->recordCount);
+		flushedTo_ = end;
+	}
+}
+
+inline void FrameJournal::Post(JobKind kind, std::shared_ptr<Segment> segment, uint64_t begin, uint64_t end, uint64_t records) {
+	if (kind == JobKind::Prepare) {
+		std::lock_guard<std::mutex> lock(spareMutex_);
+		sparePending_ = true;
+	}
+	Job job;
+	job.kind = kind;
+	job.segment = std::move(segment);
+	job.begin = begin;
+	job.end = end;
+	job.records = records;
+	jobs_.Push(job);
+}
+
+inline void FrameJournal::BackgroundLoop() {
+	TRACE_THREAD_NAME("journal");
+	Job job;
+	while (jobs_.Pop(job)) {
+		switch (job.kind) {
+		case JobKind::Flush: {
+			TRACE_SPAN_ARG("journal flush", "bytes", job.end - job.begin);
+			MappedFile& file = job.segment->file;
+			FrameJournalHeader& header = *job.segment->header;
+			const auto start = std::chrono::steady_clock::now();
+			// The header only counts the batch once it and its index entries
+			// are on disk; a batch that failed goes again with the next one.
+			const uint64_t begin = job.segment->durableEnd;
+			bool flushed = file.Flush(begin, job.end - begin)
+				&& file.Flush(header.indexOffset, header.dataOffset - header.indexOffset);
+			if (flushed) {
+				job.segment->durableEnd = job.end;
+				header.dataEnd = job.end;
+				std::atomic_thread_fence(std::memory_order_release);
+				header.recordCount = job.records;
+				flushed = file.Flush(0, kFrameJournalAlignment);
+			}
+			flushLatency_.Record(std::chrono::steady_clock::now() - start);
+			flushes_.fetch_add(1, std::memory_order_relaxed);
+			if (!flushed) {
+				flushFailures_.fetch_add(1, std::memory_order_relaxed);
+			}
+			// Keep prefaultBytes faulted in ahead of what was just written.
+			file.Prefault(job.begin + config_.prefaultBytes, job.end - job.begin);
+			break;
+		}
+		case JobKind::Prepare: {
+			std::shared_ptr<Segment> segment = CreateSegment(job.begin, job.end == 0);
+			if (!segment) {
+				segmentFailures_.fetch_add(1, std::memory_order_relaxed);
+			}
+			std::lock_guard<std::mutex> lock(spareMutex_);
+			spare_ = std::move(segment);
+			sparePending_ = false;
+			spareReady_.notify_all();
+			break;
+		}
+		case JobKind::Close: {
+			job.segment->header->closed = 1;
+			job.segment->file.Flush(0, kFrameJournalAlignment);
+			job.segment->file.Close(job.begin);
+			break;
+		}
+		}
+		job.segment.reset();
+	}
+}
+
+inline void FrameJournal::Close() {
+	if (!background_.joinable()) {
+		return;
+	}
+	if (current_) {
+		QueueFlush(writeOffset_);
+		Post(JobKind::Close, std::move(current_), writeOffset_);
+	}
+	jobs_.Close();
+	background_.join();
+
+	// The spare was never written to.
+	std::shared_ptr<Segment> spare = std::move(spare_);
+	if (spare) {
+		spare->file.Close(0);
+		std::error_code error;
+		std::filesystem::remove(SegmentPath(spare->number), error);
+	}
+}
+
+inline FrameJournalStats FrameJournal::Stats() const {
+	FrameJournalStats stats;
+	stats.records = records_.load(std::memory_order_relaxed);
+	stats.bytes = bytes_.load(std::memory_order_relaxed);
+	stats.segments = segments_.load(std::memory_order_relaxed);
+	stats.rejected = rejected_.load(std::memory_order_relaxed);
+	stats.segmentWaits = segmentWaits_.load(std::memory_order_relaxed);
+	stats.segmentFailures = segmentFailures_.load(std::memory_order_relaxed);
+	stats.stopped = stopped_.load(std::memory_order_relaxed);
+	stats.flushes = flushes_.load(std::memory_order_relaxed);
+	stats.flushFailures = flushFailures_.load(std::memory_order_relaxed);
+	stats.flush = flushLatency_.Snapshot();
+	return stats;
+}
+
+inline void FrameJournal::PrintStats(bool interval) {
+	auto ms = [](uint64_t nanoseconds) { return nanoseconds / 1e6; };
+	const FrameJournalStats stats = Stats();
+	const LatencySnapshot flush = interval ? stats.flush.Since(reported_.flush) : stats.flush;
+	std::cout << "Journal " << config_.name << ": " << stats.records << " records, " << stats.bytes / (1024 * 1024) << " MiB in "
+		<< stats.segments << " segments, " << stats.rejected << " rejected, " << stats.segmentWaits << " waits for a segment, "
+		<< stats.segmentFailures << " failed to create, "
+		<< stats.flushes << " flushes (" << stats.flushFailures << " failed), flush p50 " << ms(flush.ValueAtPercentile(50.0))
+		<< " max " << ms(flush.max) << " ms" << std::endl;
+	if (stats.stopped != stopReported_) {
+		if (stats.stopped) {
+			std::cout << "Journal " << config_.name << ": recording stopped, the next segment could not be created; retrying every "
+				<< config_.retrySeconds << " s" << std::endl;
+		}
+		else {
+			std::cout << "Journal " << config_.name << ": recording resumed" << std::endl;
+		}
+		stopReported_ = stats.stopped;
+	}
+	if (interval) {
+		reported_ = stats;
+	}
+}
+
+// A finished segment, mapped read-only.
+class FrameJournalReader {
+public:
+	bool Open(const std::string& path) {
+		if (!file_.OpenReadOnly(path) || file_.Size() < kFrameJournalAlignment) {
+			return false;
+		}
+		const FrameJournalHeader& header = Header();
+		return memcmp(header.magic, kFrameJournalMagic, sizeof(header.magic)) == 0
+			&& header.dataOffset <= file_.Size()
+			&& header.recordCount <= header.indexEntries
+			&& header.indexOffset + uint64_t(header.indexEntries) * sizeof(FrameJournalIndexEntry) <= header.dataOffset;
+	}
+
+	const FrameJournalHeader& Header() const {
+		return *reinterpret_cast<const FrameJournalHeader*>(file_.Data());
+	}
+
+	uint64_t RecordCount() const {
+		return Header().recordCount;
+	}
+
+	const FrameJournalIndexEntry& Entry(uint64_t record) const {
+		return reinterpret_cast<const FrameJournalIndexEntry*>(file_.Data() + Header().indexOffset)[record];
+	}
+
+	// Record number record, or null past the end, beyond the file, or where
+	// the record was not written whole, as at the tail of a crashed segment.
+	const FrameJournalRecord* Record(uint64_t record) const {
+		if (record >= RecordCount()) {
+			return nullptr;
+		}
+		const FrameJournalIndexEntry& entry = Entry(record);
+		if (entry.offset + sizeof(FrameJournalRecord) + entry.payloadBytes > file_.Size()) {
+			return nullptr;
+		}
+		const FrameJournalRecord* header = reinterpret_cast<const FrameJournalRecord*>(file_.Data() + entry.offset);
+		if (header->magic != kFrameJournalRecordMagic || header->recordBytes != sizeof(FrameJournalRecord)) {
+			return nullptr;
+		}
+		return header;
+	}
+
+	const uint8_t* Payload(const FrameJournalRecord& record) const {
+		return reinterpret_cast<const uint8_t*>(&record) + record.recordBytes;
+	}
+
+	// The record of frameIndex, by binary search of the index; null if the
+	// segment does not hold it.
+	const FrameJournalRecord* FindFrame(uint64_t frameIndex) const {
+		uint64_t first = 0;
+		uint64_t last = RecordCount();
+		while (first < last) {
+			const uint64_t middle = first + (last - first) / 2;
+			if (Entry(middle).frameIndex < frameIndex) {
+				first = middle + 1;
+			}
+			else {
+				last = middle;
+			}
+		}
+		return first < RecordCount() && Entry(first).frameIndex == frameIndex ? Record(first) : nullptr;
+	}
+
+	uint64_t FileBytes() const {
+		return file_.Size();
+	}
+
+private:
+	MappedFile file_;
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+// Sends frames on a steady cadence.
+//
+// A frame is scheduled a jitter buffer after its capture time, snapped to the
+// next slot of an output clock that ticks once per frame period. The clock
+// follows the capture times by a fraction of the error per frame, so a camera
+// that runs slightly off its nominal rate drags the cadence along instead of
+// slipping a slot, while the capture and delivery jitter stays out of it. A
+// frame that is not ready by its slot goes out as soon as it is, and a pause
+// longer than kMaxSkippedSlots restarts the clock.
+//
+// The pacer measures the jitter of the frames it is given (when they are
+// ready) and of the frames it sends, as the distance of each interval from the
+// nearest whole number of periods, so the difference is what it removed.
+//
+// A pacer is used from one thread.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+#include "LatencyHistogram.h"
+
+struct FramePacerStats {
+	uint64_t frames{ 0 };
+	uint64_t late{ 0 };     // not ready by their slot; sent as soon as they were
+	uint64_t skipped{ 0 };  // slots without a frame
+	uint64_t restarts{ 0 }; // pauses that restarted the clock
+	LatencySnapshot inputJitter;
+	LatencySnapshot outputJitter;
+};
+
+class FramePacer {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr int64_t kMaxSkippedSlots = 30;
+	// The clock moves 1/kTracking of the way to each frame's target.
+	static constexpr int64_t kTracking = 16;
+	// WaitUntil() sleeps until this long before the deadline and yields after.
+	static constexpr std::chrono::microseconds kSpinTime{ 2000 };
+
+	FramePacer(Clock::duration period, Clock::duration jitterBuffer)
+		: period_(period), jitterBuffer_(jitterBuffer) {}
+
+	FramePacer(const FramePacer&) = delete;
+	FramePacer& operator=(const FramePacer&) = delete;
+
+	Clock::duration Period() const {
+		return period_;
+	}
+
+	Clock::duration JitterBuffer() const {
+		return jitterBuffer_;
+	}
+
+	// When to send a frame captured at captured that is ready at ready.
+	Clock::time_point Schedule(Clock::time_point captured, Clock::time_point ready) {
+		Observe(ready, lastReady_, inputJitter_);
+		lastReady_ = ready;
+		++frames_;
+
+		const Clock::time_point target = captured + jitterBuffer_;
+		Clock::time_point deadline;
+		if (lastDeadline_ == Clock::time_point()) {
+			deadline = target;
+		}
+		else {
+			const double slots = std::chrono::duration<double>(target - lastDeadline_) / period_;
+			const int64_t slot = (std::max)(static_cast<int64_t>(std::llround(slots)), int64_t(1));
+			if (slot > kMaxSkippedSlots) {
+				++restarts_;
+				deadline = target;
+			}
+			else {
+				skipped_ += slot - 1;
+				const Clock::time_point ideal = lastDeadline_ + period_ * slot;
+				deadline = ideal + (target - ideal) / kTracking;
+			}
+		}
+
+		if (deadline < ready) {
+			++late_;
+			deadline = ready;
+		}
+		lastDeadline_ = deadline;
+		return deadline;
+	}
+
+	// Records when the scheduled frame went out.
+	void Sent(Clock::time_point sent) {
+		Observe(sent, lastSent_, outputJitter_);
+		lastSent_ = sent;
+	}
+
+	// Sleeps until close to deadline, then yields until it passes: plain
+	// sleeps on Windows can overshoot by a whole timer tick.
+	static void WaitUntil(Clock::time_point deadline) {
+		if (deadline - Clock::now() > kSpinTime) {
+			std::this_thread::sleep_until(deadline - kSpinTime);
+		}
+		while (Clock::now() < deadline) {
+			std::this_thread::yield();
+		}
+	}
+
+	FramePacerStats Stats() const {
+		FramePacerStats stats;
+		stats.frames = frames_;
+		stats.late = late_;
+		stats.skipped = skipped_;
+		stats.restarts = restarts_;
+		stats.inputJitter = inputJitter_.Snapshot();
+		stats.outputJitter = outputJitter_.Snapshot();
+		return stats;
+	}
+
+private:
+	void Observe(Clock::time_point time, Clock::time_point last, LatencyHistogram& jitter) {
+		if (last == Clock::time_point()) {
+			return;
+		}
+		const Clock::duration interval = time - last;
+		const int64_t slots = (std::max)(static_cast<int64_t>(std::llround(std::chrono::duration<double>(interval) / period_)), int64_t(1));
+		if (slots <= kMaxSkippedSlots) {
+			const Clock::duration error = interval - period_ * slots;
+			jitter.Record(error < Clock::duration::zero() ? -error : error);
+		}
+	}
+
+	Clock::duration period_;
+	Clock::duration jitterBuffer_;
+	Clock::time_point lastDeadline_;
+	Clock::time_point lastReady_;
+	Clock::time_point lastSent_;
+	uint64_t frames_{ 0 };
+	uint64_t late_{ 0 };
+	uint64_t skipped_{ 0 };
+	uint64_t restarts_{ 0 };
+	LatencyHistogram inputJitter_;
+	LatencyHistogram outputJitter_;
+};
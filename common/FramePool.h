@@ -0,0 +1,190 @@
+#pragma once
+
+// Preallocated, reference-counted frame buffers.
+//
+// A pool holds one or more classes of buffers, each with a fixed FrameLayout
+// and depth, all allocated when the class is added. Acquire() hands out a free
+// buffer of a class as a FrameRef. Copies of a ref share the buffer, and it
+// goes back to its class when the last one is dropped, so a stage that keeps
+// reading a frame after it returns (an asynchronous sender) simply holds a ref
+// until it is done with it.
+//
+// Acquire() and the release are lock-free and never allocate. An exhausted
+// class returns an empty ref and counts it rather than growing.
+//
+// Every FrameRef must be dropped before the pool is destroyed.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "PixelFormat.h"
+
+// Counters of one buffer class, read from any thread; inUse is a snapshot.
+struct FramePoolStats {
+	FrameLayout layout;
+	uint32_t depth{ 0 };
+	uint32_t inUse{ 0 };
+	uint32_t highWater{ 0 }; // most buffers ever held at once
+	uint64_t acquired{ 0 };
+	uint64_t exhausted{ 0 }; // Acquire() calls that found every buffer held
+};
+
+struct FramePoolClass;
+
+// One pooled buffer; refs is the number of FrameRefs pointing at it.
+struct FrameBuffer {
+	uint8_t* data{ nullptr };
+	std::atomic<uint32_t> refs{ 0 };
+	FramePoolClass* owner{ nullptr };
+};
+
+struct FramePoolClass {
+	static constexpr size_t kAlignment = 64;
+
+	FrameLayout layout;
+	uint32_t depth{ 0 };
+	std::unique_ptr<FrameBuffer[]> buffers;
+
+	std::atomic<uint32_t> inUse{ 0 };
+	std::atomic<uint32_t> highWater{ 0 };
+	std::atomic<uint64_t> acquired{ 0 };
+	std::atomic<uint64_t> exhausted{ 0 };
+
+	~FramePoolClass() {
+		for (uint32_t i = 0; buffers && i < depth; ++i) {
+			::operator delete(buffers[i].data, std::align_val_t(kAlignment));
+		}
+	}
+};
+
+class FrameRef {
+public:
+	FrameRef() = default;
+
+	FrameRef(const FrameRef& other) : buffer_(other.buffer_) {
+		if (buffer_) {
+			buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	FrameRef(FrameRef&& other) noexcept : buffer_(std::exchange(other.buffer_, nullptr)) {}
+
+	FrameRef& operator=(FrameRef other) noexcept {
+		std::swap(buffer_, other.buffer_);
+		return *this;
+	}
+
+	~FrameRef() {
+		Reset();
+	}
+
+	// Drops this ref; the last one returns the buffer to its class.
+	void Reset() {
+		if (buffer_ && buffer_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			buffer_->owner->inUse.fetch_sub(1, std::memory_order_relaxed);
+		}
+		buffer_ = nullptr;
+	}
+
+	explicit operator bool() const {
+		return buffer_ != nullptr;
+	}
+
+	uint8_t* Data() const {
+		return buffer_->data;
+	}
+
+	const FrameLayout& Layout() const {
+		return buffer_->owner->layout;
+	}
+
+	uint32_t UseCount() const {
+		return buffer_ ? buffer_->refs.load(std::memory_order_relaxed) : 0;
+	}
+
+private:
+	friend class FramePool;
+
+	explicit FrameRef(FrameBuffer* buffer) : buffer_(buffer) {}
+
+	FrameBuffer* buffer_{ nullptr };
+};
+
+class FramePool {
+public:
+	FramePool() = default;
+
+	FramePool(const FramePool&) = delete;
+	FramePool& operator=(const FramePool&) = delete;
+
+	// Allocates depth buffers of layout.totalBytes, 64-byte aligned, and
+	// returns the class index to acquire them with. Call before any Acquire().
+	bool AddClass(const FrameLayout& layout, uint32_t depth, uint32_t& index) {
+		auto bufferClass = std::make_unique<FramePoolClass>();
+		bufferClass->layout = layout;
+		bufferClass->buffers = std::make_unique<FrameBuffer[]>((std::max)(depth, 1u));
+		for (uint32_t i = 0; i < (std::max)(depth, 1u); ++i) {
+			FrameBuffer& buffer = bufferClass->buffers[i];
+			buffer.data = static_cast<uint8_t*>(::operator new(layout.totalBytes, std::align_val_t(FramePoolClass::kAlignment), std::nothrow));
+			if (!buffer.data) {
+				return false;
+			}
+			buffer.owner = bufferClass.get();
+			bufferClass->depth = i + 1;
+		}
+
+		index = static_cast<uint32_t>(classes_.size());
+		classes_.push_back(std::move(bufferClass));
+		return true;
+	}
+
+	uint32_t ClassCount() const {
+		return static_cast<uint32_t>(classes_.size());
+	}
+
+	// A free buffer of the class, or an empty ref if every one is held.
+	// Buffers are tried in order, so the recently released ones, still warm
+	// in cache, are reused first.
+	FrameRef Acquire(uint32_t index) {
+		FramePoolClass& bufferClass = *classes_[index];
+		for (uint32_t i = 0; i < bufferClass.depth; ++i) {
+			FrameBuffer& buffer = bufferClass.buffers[i];
+			uint32_t expected = 0;
+			if (buffer.refs.load(std::memory_order_relaxed) == 0
+				&& buffer.refs.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+				bufferClass.acquired.fetch_add(1, std::memory_order_relaxed);
+				// A release racing with this acquire may not have decremented
+				// inUse yet, so it can briefly read one above depth.
+				const uint32_t inUse = (std::min)(bufferClass.inUse.fetch_add(1, std::memory_order_relaxed) + 1, bufferClass.depth);
+				uint32_t highWater = bufferClass.highWater.load(std::memory_order_relaxed);
+				while (inUse > highWater && !bufferClass.highWater.compare_exchange_weak(highWater, inUse, std::memory_order_relaxed)) {
+				}
+				return FrameRef(&buffer);
+			}
+		}
+
+		bufferClass.exhausted.fetch_add(1, std::memory_order_relaxed);
+		return FrameRef();
+	}
+
+	FramePoolStats Stats(uint32_t index) const {
+		const FramePoolClass& bufferClass = *classes_[index];
+		FramePoolStats stats;
+		stats.layout = bufferClass.layout;
+		stats.depth = bufferClass.depth;
+		stats.inUse = (std::min)(bufferClass.inUse.load(std::memory_order_relaxed), bufferClass.depth);
+		stats.highWater = bufferClass.highWater.load(std::memory_order_relaxed);
+		stats.acquired = bufferClass.acquired.load(std::memory_order_relaxed);
+		stats.exhausted = bufferClass.exhausted.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+private:
+	std::vector<std::unique_ptr<FramePoolClass>> classes_;
+};
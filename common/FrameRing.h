@@ -0,0 +1,312 @@
+#pragma once
+
+// Bounded ring of frame slots between two pipeline stages, with a policy for
+// what happens when the downstream stage falls behind.
+//
+// One thread pushes and one thread pops. Every slot carries a sequence number
+// saying whether it is free, filled or being read, and the read index is
+// claimed with a compare-exchange, so the producer can also take the oldest
+// frame out to make room for a new one. Indices sit on their own cache lines,
+// away from the counters. Slots are allocated at construction and values are
+// moved in and out.
+//
+// Policies, applied by Push():
+//   DropNewest - a full ring refuses the new frame (TryPush() always does)
+//   DropOldest - the oldest queued frame is dropped to make room
+//   Block      - the producer waits for a free slot
+//   Latest     - a single-slot mailbox: the newest frame replaces the queued one
+//
+// Pop() sleeps on an atomic wait when the ring is empty. Every pop records how
+// long the frame waited in the ring.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+enum class HandoffPolicy {
+	DropNewest,
+	DropOldest,
+	Block,
+	Latest,
+};
+
+inline const char* HandoffPolicyName(HandoffPolicy policy) {
+	switch (policy) {
+	case HandoffPolicy::DropNewest: return "drop-newest";
+	case HandoffPolicy::DropOldest: return "drop-oldest";
+	case HandoffPolicy::Block: return "block";
+	case HandoffPolicy::Latest: return "latest";
+	default: return "unknown";
+	}
+}
+
+constexpr HandoffPolicy kHandoffPolicies[] = {
+	HandoffPolicy::DropNewest, HandoffPolicy::DropOldest, HandoffPolicy::Block, HandoffPolicy::Latest,
+};
+
+// Counters of a ring, read from any thread; occupancy is a snapshot.
+struct FrameRingStats {
+	HandoffPolicy policy{ HandoffPolicy::DropNewest };
+	uint32_t capacity{ 0 };
+	uint32_t occupancy{ 0 };
+	uint32_t highWater{ 0 }; // most slots ever filled at once
+	uint64_t pushed{ 0 };
+	uint64_t overflows{ 0 }; // new frames refused because the ring was full
+	uint64_t evicted{ 0 };   // queued frames dropped for a newer one
+	uint64_t blocked{ 0 };   // pushes that had to wait for a slot
+	uint64_t popped{ 0 };
+	double meanAge{ 0.0 };   // seconds a popped frame spent in the ring
+	double maxAge{ 0.0 };
+
+	uint64_t Dropped() const {
+		return overflows + evicted;
+	}
+};
+
+template <typename T>
+class FrameRing {
+public:
+	// Latest always has one slot.
+	explicit FrameRing(uint32_t capacity, HandoffPolicy policy = HandoffPolicy::DropNewest)
+		: capacity_(policy == HandoffPolicy::Latest ? 1u : (std::max)(capacity, 1u)),
+		policy_(policy),
+		slots_(std::make_unique<Slot[]>(capacity_)) {
+		for (uint32_t i = 0; i < capacity_; ++i) {
+			slots_[i].sequence.store(uint64_t(i) * 2, std::memory_order_relaxed);
+		}
+	}
+
+	FrameRing(const FrameRing&) = delete;
+	FrameRing& operator=(const FrameRing&) = delete;
+
+	uint32_t Capacity() const {
+		return capacity_;
+	}
+
+	HandoffPolicy Policy() const {
+		return policy_;
+	}
+
+	// Producer only. Moves value into the next slot, or returns false and
+	// leaves value untouched when the ring is full.
+	bool TryPush(T& value) {
+		if (TryPushSlot(value)) {
+			return true;
+		}
+		Count(overflows_);
+		return false;
+	}
+
+	// Producer only. Pushes according to the policy. Returns false, leaving
+	// value untouched, if the frame was refused (DropNewest) or the ring was
+	// closed while waiting (Block).
+	bool Push(T& value) {
+		switch (policy_) {
+		case HandoffPolicy::DropOldest:
+		case HandoffPolicy::Latest:
+			return PushEvicting(value);
+		case HandoffPolicy::Block:
+			return PushBlocking(value);
+		default:
+			return TryPush(value);
+		}
+	}
+
+	// Consumer only. Moves the oldest value out, or returns false when empty.
+	bool TryPop(T& value) {
+		std::chrono::steady_clock::time_point pushTime;
+		if (!ClaimOldest(value, pushTime)) {
+			return false;
+		}
+
+		const double age = std::chrono::duration<double>(std::chrono::steady_clock::now() - pushTime).count();
+		Count(popped_);
+		totalAge_.store(totalAge_.load(std::memory_order_relaxed) + age, std::memory_order_relaxed);
+		if (age > maxAge_.load(std::memory_order_relaxed)) {
+			maxAge_.store(age, std::memory_order_relaxed);
+		}
+
+		if (policy_ == HandoffPolicy::Block) {
+			space_.fetch_add(1, std::memory_order_release);
+			space_.notify_one();
+		}
+		return true;
+	}
+
+	// Consumer only. Waits for a value; returns false once the ring is closed
+	// and drained.
+	bool Pop(T& value) {
+		for (;;) {
+			const uint32_t signal = signal_.load(std::memory_order_acquire);
+			if (TryPop(value)) {
+				return true;
+			}
+			if (closed_.load(std::memory_order_acquire)) {
+				return TryPop(value);
+			}
+			signal_.wait(signal, std::memory_order_acquire);
+		}
+	}
+
+	// Either side. Wakes a waiting Pop() or blocked Push(); values already
+	// pushed can still be popped.
+	void Close() {
+		closed_.store(true, std::memory_order_release);
+		signal_.fetch_add(1, std::memory_order_release);
+		signal_.notify_all();
+		space_.fetch_add(1, std::memory_order_release);
+		space_.notify_all();
+	}
+
+	bool Closed() const {
+		return closed_.load(std::memory_order_acquire);
+	}
+
+	FrameRingStats Stats() const {
+		FrameRingStats stats;
+		const uint64_t tail = tail_.load(std::memory_order_acquire);
+		const uint64_t head = head_.load(std::memory_order_acquire);
+		stats.policy = policy_;
+		stats.capacity = capacity_;
+		stats.occupancy = static_cast<uint32_t>(head > tail ? head - tail : 0);
+		stats.highWater = highWater_.load(std::memory_order_relaxed);
+		stats.pushed = pushed_.load(std::memory_order_relaxed);
+		stats.overflows = overflows_.load(std::memory_order_relaxed);
+		stats.evicted = evicted_.load(std::memory_order_relaxed);
+		stats.blocked = blocked_.load(std::memory_order_relaxed);
+		stats.popped = popped_.load(std::memory_order_relaxed);
+		stats.meanAge = stats.popped ? totalAge_.load(std::memory_order_relaxed) / stats.popped : 0.0;
+		stats.maxAge = maxAge_.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+private:
+	// sequence == 2 * position: free for the push at position.
+	// sequence == 2 * position + 1: filled by that push, ready to pop.
+	// A claimed slot stays filled until it has been read, then becomes free
+	// for the push one lap later. The factor of two keeps "filled" and "free
+	// again" apart when there is a single slot.
+	struct Slot {
+		std::atomic<uint64_t> sequence{ 0 };
+		std::chrono::steady_clock::time_point pushTime;
+		T value{};
+	};
+
+	// Counters have a single writer each, so no read-modify-write is needed.
+	static void Count(std::atomic<uint64_t>& counter) {
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	bool TryPushSlot(T& value) {
+		const uint64_t head = head_.load(std::memory_order_relaxed);
+		Slot& slot = slots_[head % capacity_];
+		if (slot.sequence.load(std::memory_order_acquire) != head * 2) {
+			return false;
+		}
+
+		slot.value = std::move(value);
+		slot.pushTime = std::chrono::steady_clock::now();
+		slot.sequence.store(head * 2 + 1, std::memory_order_release);
+		head_.store(head + 1, std::memory_order_release);
+
+		Count(pushed_);
+		const uint64_t tail = tail_.load(std::memory_order_acquire);
+		const uint32_t occupancy = static_cast<uint32_t>(head + 1 > tail ? head + 1 - tail : 0);
+		if (occupancy > highWater_.load(std::memory_order_relaxed)) {
+			highWater_.store((std::min)(occupancy, capacity_), std::memory_order_relaxed);
+		}
+
+		signal_.fetch_add(1, std::memory_order_release);
+		signal_.notify_one();
+		return true;
+	}
+
+	// Either side. Claims the oldest filled slot and moves its value out.
+	bool ClaimOldest(T& value, std::chrono::steady_clock::time_point& pushTime) {
+		uint64_t tail = tail_.load(std::memory_order_relaxed);
+		for (;;) {
+			Slot& slot = slots_[tail % capacity_];
+			const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence != tail * 2 + 1) {
+				// Empty, or the other side moved tail on; reload and retry in
+				// the latter case.
+				const uint64_t current = tail_.load(std::memory_order_relaxed);
+				if (current == tail) {
+					return false;
+				}
+				tail = current;
+				continue;
+			}
+			if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+				value = std::move(slot.value);
+				pushTime = slot.pushTime;
+				slot.sequence.store((tail + capacity_) * 2, std::memory_order_release);
+				return true;
+			}
+		}
+	}
+
+	// Drops the oldest frame when full. If the consumer is still reading the
+	// slot the push needs, wait for it instead of dropping a second frame.
+	bool PushEvicting(T& value) {
+		bool evicted = false;
+		while (!TryPushSlot(value)) {
+			T oldest{};
+			std::chrono::steady_clock::time_point pushTime;
+			if (!evicted && ClaimOldest(oldest, pushTime)) {
+				evicted = true;
+				Count(evicted_);
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+		return true;
+	}
+
+	bool PushBlocking(T& value) {
+		bool waited = false;
+		for (;;) {
+			const uint32_t space = space_.load(std::memory_order_acquire);
+			if (TryPushSlot(value)) {
+				return true;
+			}
+			if (closed_.load(std::memory_order_acquire)) {
+				return false;
+			}
+			if (!waited) {
+				waited = true;
+				Count(blocked_);
+			}
+			space_.wait(space, std::memory_order_acquire);
+		}
+	}
+
+	const uint32_t capacity_;
+	const HandoffPolicy policy_;
+	std::unique_ptr<Slot[]> slots_;
+
+	alignas(64) std::atomic<uint64_t> head_{ 0 };
+	alignas(64) std::atomic<uint64_t> tail_{ 0 };
+
+	// Written by the producer only.
+	alignas(64) std::atomic<uint64_t> pushed_{ 0 };
+	std::atomic<uint64_t> overflows_{ 0 };
+	std::atomic<uint64_t> evicted_{ 0 };
+	std::atomic<uint64_t> blocked_{ 0 };
+	std::atomic<uint32_t> highWater_{ 0 };
+
+	// Written by the consumer only.
+	alignas(64) std::atomic<uint64_t> popped_{ 0 };
+	std::atomic<double> totalAge_{ 0.0 };
+	std::atomic<double> maxAge_{ 0.0 };
+
+	// Bumped on every push and on Close(), for Pop() to sleep on; space_ on
+	// every pop of a Block ring and on Close(), for Push() to sleep on.
+	alignas(64) std::atomic<uint32_t> signal_{ 0 };
+	std::atomic<uint32_t> space_{ 0 };
+	std::atomic<bool> closed_{ false };
+};
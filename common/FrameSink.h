@@ -0,0 +1,50 @@
+#pragma once
+
+// Where converted frames go.
+//
+// The pipeline hands every converted frame to its sink on the conversion
+// thread. The frame, and each of its proxies, is a pool buffer (see
+// FramePool.h): a sink that reads it after Send() returns, like an
+// asynchronous network sender, keeps the ref until it is done, and the buffer
+// is recycled once it lets go.
+
+#include <chrono>
+#include <cstdint>
+
+#include "FramePool.h"
+#include "ProxyPyramid.h"
+
+struct SinkFrame {
+	FrameRef frame;
+	uint64_t index{ 0 }; // position in the converted stream
+	std::chrono::steady_clock::time_point captured;
+	// Lower resolutions of the same frame (ProxyPyramid levels); empty without
+	// proxies or when no buffer was free.
+	FrameRef proxies[ProxyPyramid::kLevelCount];
+
+	// Drops the frame and its proxies.
+	void Reset() {
+		frame.Reset();
+		for (FrameRef& proxy : proxies) {
+			proxy.Reset();
+		}
+	}
+};
+
+class FrameSink {
+public:
+	virtual ~FrameSink() = default;
+
+	// Sends one frame; frame.frame may be moved from.
+	virtual void Send(SinkFrame& frame) = 0;
+
+	// Called once after the last frame. Releases every frame still held, so
+	// the pool can go.
+	virtual void Flush() {}
+
+	// Prints the sink's own counters along with the pipeline's, over the last
+	// reporting interval or the whole run.
+	virtual void PrintStats(bool interval) {
+		(void)interval;
+	}
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+// Per-frame pipeline spans, written as Chrome trace-event JSON for
+// chrome://tracing or ui.perfetto.dev.
+//
+// The pipeline marks spans with TRACE_SPAN / TRACE_SPAN_ARG and names its
+// threads with TRACE_THREAD_NAME. Those expand to nothing unless the build
+// defines FRAME_TRACING=1, so a normal build makes no tracing calls at all.
+// With it, a span costs two clock reads and one store into a ring owned by the
+// calling thread, and nothing is recorded until FrameTracer::Start().
+//
+// Each thread's ring is allocated on its first span after Start() and then
+// overwritten in place, so a long run keeps the most recent events. WriteJson()
+// can be called at any time from any thread; events overwritten while it
+// copies a ring are left out.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef FRAME_TRACING
+#define FRAME_TRACING 0
+#endif
+
+// One complete span; times are nanoseconds since Start().
+struct TraceEvent {
+	const char* name{ nullptr };
+	const char* argName{ nullptr };
+	uint64_t arg{ 0 };
+	int64_t begin{ 0 };
+	int64_t end{ 0 };
+};
+
+struct TraceThreadBuffer {
+	uint32_t tid{ 0 };
+	std::string name;
+	std::vector<TraceEvent> events;
+	std::atomic<uint64_t> begun{ 0 };   // events whose slot is being or has been written
+	std::atomic<uint64_t> written{ 0 }; // events complete
+};
+
+class FrameTracer {
+public:
+	static FrameTracer& Instance() {
+		static FrameTracer tracer;
+		return tracer;
+	}
+
+	// Starts recording, with room for eventsPerThread spans per thread.
+	void Start(uint32_t eventsPerThread = 1u << 16) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		eventsPerThread_ = (std::max)(eventsPerThread, 1u);
+		epoch_ = std::chrono::steady_clock::now();
+		enabled_.store(true, std::memory_order_release);
+	}
+
+	// Stops recording; what was recorded stays available to WriteJson().
+	void Stop() {
+		enabled_.store(false, std::memory_order_release);
+	}
+
+	bool Enabled() const {
+		return enabled_.load(std::memory_order_relaxed);
+	}
+
+	std::chrono::steady_clock::time_point Epoch() const {
+		return epoch_;
+	}
+
+	// Names the calling thread in the trace. Can be called before Start().
+	void SetThreadName(const char* name) {
+		TraceThreadBuffer* buffer = ThreadBuffer(false);
+		std::lock_guard<std::mutex> lock(mutex_);
+		buffer->name = name;
+	}
+
+	void Record(const char* name, const char* argName, uint64_t arg,
+		std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+		TraceThreadBuffer* buffer = ThreadBuffer(true);
+		const uint64_t index = buffer->written.load(std::memory_order_relaxed);
+		buffer->begun.store(index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		TraceEvent& event = buffer->events[index % buffer->events.size()];
+		event.name = name;
+		event.argName = argName;
+		event.arg = arg;
+		event.begin = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - epoch_).count();
+		event.end = std::chrono::duration_cast<std::chrono::nanoseconds>(end - epoch_).count();
+		buffer->written.store(index + 1, std::memory_order_release);
+	}
+
+	// Copies the events every thread has recorded so far, oldest first per
+	// thread.
+	std::vector<std::pair<const TraceThreadBuffer*, std::vector<TraceEvent>>> Collect() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::vector<std::pair<const TraceThreadBuffer*, std::vector<TraceEvent>>> threads;
+		for (const auto& buffer : buffers_) {
+			const uint64_t capacity = buffer->events.size();
+			if (capacity == 0) {
+				threads.emplace_back(buffer.get(), std::vector<TraceEvent>());
+				continue;
+			}
+			const uint64_t before = buffer->written.load(std::memory_order_acquire);
+			const uint64_t first = before > capacity ? before - capacity : 0;
+
+			std::vector<TraceEvent> events;
+			events.reserve(static_cast<size_t>(before - first));
+			for (uint64_t i = first; i < before; ++i) {
+				events.push_back(buffer->events[i % capacity]);
+			}
+
+			// Drop what the thread overwrote while we copied, including the
+			// slot it may be writing now.
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const uint64_t after = buffer->begun.load(std::memory_order_relaxed);
+			const uint64_t valid = after > capacity ? after - capacity : 0;
+			if (valid > first) {
+				events.erase(events.begin(), events.begin() + static_cast<ptrdiff_t>((std::min)(valid - first, before - first)));
+			}
+			threads.emplace_back(buffer.get(), std::move(events));
+		}
+		return threads;
+	}
+
+	bool WriteJson(const char* path) {
+		std::ofstream out(path, std::ios::binary);
+		if (!out) {
+			return false;
+		}
+
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		bool first = true;
+		auto separator = [&]() {
+			out << (first ? "" : ",\n");
+			first = false;
+		};
+
+		for (const auto& [buffer, events] : Collect()) {
+			if (!buffer->name.empty()) {
+				separator();
+				out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+					<< ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+			}
+			for (const TraceEvent& event : events) {
+				separator();
+				out << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+					<< ",\"ts\":" << event.begin / 1000 << "." << Fraction(event.begin)
+					<< ",\"dur\":" << (event.end - event.begin) / 1000 << "." << Fraction(event.end - event.begin);
+				if (event.argName) {
+					out << ",\"args\":{\"" << event.argName << "\":" << event.arg << "}";
+				}
+				out << "}";
+			}
+		}
+		out << "\n]}\n";
+		return static_cast<bool>(out);
+	}
+
+private:
+	FrameTracer() = default;
+
+	// Microsecond fraction of a nanosecond count, as three digits.
+	static std::string Fraction(int64_t nanoseconds) {
+		const int64_t rest = ((nanoseconds % 1000) + 1000) % 1000;
+		std::string digits = std::to_string(rest);
+		return std::string(3 - digits.size(), '0') + digits;
+	}
+
+	// The calling thread's buffer, registered on first use. The event ring is
+	// only allocated once the thread records.
+	TraceThreadBuffer* ThreadBuffer(bool recording) {
+		thread_local TraceThreadBuffer* buffer = nullptr;
+		if (!buffer || (recording && buffer->events.empty())) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!buffer) {
+				auto created = std::make_unique<TraceThreadBuffer>();
+				created->tid = static_cast<uint32_t>(buffers_.size() + 1);
+				buffer = created.get();
+				buffers_.push_back(std::move(created));
+			}
+			if (recording) {
+				buffer->events.resize(eventsPerThread_);
+			}
+		}
+		return buffer;
+	}
+
+	std::mutex mutex_;
+	std::vector<std::unique_ptr<TraceThreadBuffer>> buffers_;
+	uint32_t eventsPerThread_{ 1u << 16 };
+	std::chrono::steady_clock::time_point epoch_{ std::chrono::steady_clock::now() };
+	std::atomic<bool> enabled_{ false };
+};
+
+// Records the span from construction to destruction, if the tracer is on.
+class TraceSpan {
+public:
+	TraceSpan(const char* name, const char* argName, uint64_t arg)
+		: name_(name), argName_(argName), arg_(arg),
+		enabled_(FrameTracer::Instance().Enabled()) {
+		if (enabled_) {
+			begin_ = std::chrono::steady_clock::now();
+		}
+	}
+
+	~TraceSpan() {
+		if (enabled_) {
+			FrameTracer::Instance().Record(name_, argName_, arg_, begin_, std::chrono::steady_clock::now());
+		}
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* name_;
+	const char* argName_;
+	uint64_t arg_;
+	bool enabled_;
+	std::chrono::steady_clock::time_point begin_;
+};
+
+#if FRAME_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN_ARG(name, argName, arg) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name, argName, static_cast<uint64_t>(arg))
+#define TRACE_SPAN(name, frame) TRACE_SPAN_ARG(name, "frame", frame)
+#define TRACE_THREAD_NAME(name) FrameTracer::Instance().SetThreadName(name)
+#else
+#define TRACE_SPAN_ARG(name, argName, arg) ((void)0)
+#define TRACE_SPAN(name, frame) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
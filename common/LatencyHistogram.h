@@ -0,0 +1,148 @@
+#pragma once
+
+// Log-linear latency histograms, in the style of HdrHistogram.
+//
+// Values are nanoseconds. Below kSubBuckets each value has its own bucket;
+// above, every power of two is split into kSubBuckets equal steps, so a
+// reported value is within 1/kSubBuckets (about 3%) of the recorded one from
+// 1 ns up to 2^(kMaxExponent + 1) ns (about 36 minutes); longer values are
+// clamped.
+//
+// Record() is a relaxed increment of one bucket plus the running sum and max,
+// safe from any number of threads and without locks. Readers take a
+// Snapshot(), and the difference of two snapshots gives the percentiles of
+// just the interval between them.
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+struct LatencySnapshot {
+	std::vector<uint64_t> counts;
+	uint64_t count{ 0 };
+	uint64_t sum{ 0 };
+	uint64_t max{ 0 }; // exact for a whole snapshot, bucket-accurate for an interval
+
+	// Smallest value v such that at least percentile % of the samples are
+	// <= v, as the upper end of its bucket. 0 when empty.
+	uint64_t ValueAtPercentile(double percentile) const;
+
+	double Mean() const {
+		return count ? static_cast<double>(sum) / count : 0.0;
+	}
+
+	// Samples recorded after earlier was taken.
+	LatencySnapshot Since(const LatencySnapshot& earlier) const;
+
+	// Adds the samples of another histogram, as if they had been recorded
+	// here.
+	void Add(const LatencySnapshot& other);
+};
+
+class LatencyHistogram {
+public:
+	static constexpr uint32_t kSubBucketBits = 5;
+	static constexpr uint32_t kSubBuckets = 1u << kSubBucketBits;
+	static constexpr uint32_t kMaxExponent = 40;
+	static constexpr uint32_t kBucketCount = kSubBuckets + (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+	LatencyHistogram() = default;
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	static uint32_t BucketFor(uint64_t value) {
+		value = (std::min)(value, (uint64_t(1) << (kMaxExponent + 1)) - 1);
+		if (value < kSubBuckets) {
+			return static_cast<uint32_t>(value);
+		}
+		const uint32_t exponent = static_cast<uint32_t>(std::bit_width(value)) - 1;
+		const uint32_t shift = exponent - kSubBucketBits;
+		return kSubBuckets + shift * kSubBuckets + static_cast<uint32_t>((value >> shift) - kSubBuckets);
+	}
+
+	// Largest value that lands in bucket.
+	static uint64_t BucketUpperValue(uint32_t bucket) {
+		if (bucket < kSubBuckets) {
+			return bucket;
+		}
+		const uint32_t shift = (bucket - kSubBuckets) / kSubBuckets;
+		const uint64_t step = (bucket - kSubBuckets) % kSubBuckets + kSubBuckets;
+		return ((step + 1) << shift) - 1;
+	}
+
+	void Record(uint64_t nanoseconds) {
+		counts_[BucketFor(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(nanoseconds, std::memory_order_relaxed);
+		uint64_t max = max_.load(std::memory_order_relaxed);
+		while (nanoseconds > max && !max_.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+		}
+	}
+
+	void Record(std::chrono::steady_clock::duration duration) {
+		const int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+		Record(static_cast<uint64_t>((std::max)(nanoseconds, int64_t(0))));
+	}
+
+	LatencySnapshot Snapshot() const {
+		LatencySnapshot snapshot;
+		snapshot.counts.resize(kBucketCount);
+		for (uint32_t i = 0; i < kBucketCount; ++i) {
+			snapshot.counts[i] = counts_[i].load(std::memory_order_relaxed);
+			snapshot.count += snapshot.counts[i];
+		}
+		snapshot.sum = sum_.load(std::memory_order_relaxed);
+		snapshot.max = max_.load(std::memory_order_relaxed);
+		return snapshot;
+	}
+
+private:
+	std::atomic<uint64_t> counts_[kBucketCount]{};
+	std::atomic<uint64_t> sum_{ 0 };
+	std::atomic<uint64_t> max_{ 0 };
+};
+
+inline uint64_t LatencySnapshot::ValueAtPercentile(double percentile) const {
+	if (!count) {
+		return 0;
+	}
+	const double clamped = (std::min)((std::max)(percentile, 0.0), 100.0);
+	const uint64_t rank = (std::max)(uint64_t(1), static_cast<uint64_t>(clamped / 100.0 * count + 0.5));
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < counts.size(); ++i) {
+		seen += counts[i];
+		if (seen >= rank) {
+			return (std::min)(LatencyHistogram::BucketUpperValue(i), max);
+		}
+	}
+	return max;
+}
+
+inline LatencySnapshot LatencySnapshot::Since(const LatencySnapshot& earlier) const {
+	LatencySnapshot interval;
+	interval.counts.resize(counts.size());
+	for (size_t i = 0; i < counts.size(); ++i) {
+		interval.counts[i] = counts[i] - (i < earlier.counts.size() ? earlier.counts[i] : 0);
+		interval.count += interval.counts[i];
+		if (interval.counts[i]) {
+			interval.max = (std::min)(LatencyHistogram::BucketUpperValue(static_cast<uint32_t>(i)), max);
+		}
+	}
+	interval.sum = sum - earlier.sum;
+	return interval;
+}
+
+inline void LatencySnapshot::Add(const LatencySnapshot& other) {
+	if (counts.size() < other.counts.size()) {
+		counts.resize(other.counts.size());
+	}
+	for (size_t i = 0; i < other.counts.size(); ++i) {
+		counts[i] += other.counts[i];
+	}
+	count += other.count;
+	sum += other.sum;
+	max = (std::max)(max, other.max);
+}
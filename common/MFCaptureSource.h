@@ -0,0 +1,65 @@
+#pragma once
+
+// CaptureSource over a Media Foundation source reader (see CaptureSource.h).
+//
+// The reader is set up by the app, which negotiates the media type; this only
+// reads its first video stream. The clock MFGetSystemTime() reads is passed
+// along as the source clock; when the device stamps on it the capture times
+// are exact, and CaptureClock falls back to estimating them when it does not.
+
+#include <Windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <wrl/client.h>
+
+#include <memory>
+
+#include "CaptureSource.h"
+#include "MFFrameHandle.h"
+#include "SlotPool.h"
+
+class MFCaptureSource : public CaptureSource {
+public:
+	MFCaptureSource(Microsoft::WRL::ComPtr<IMFSourceReader> reader, const CaptureFormat& format)
+		: reader_(std::move(reader)), format_(format) {}
+
+	const char* Name() const override {
+		return "Media Foundation";
+	}
+
+	CaptureFormat Format() const override {
+		return format_;
+	}
+
+	void ReserveSamples(uint32_t count) override {
+		samples_.Reserve(SlotPool::SlotBytesFor<MFSampleFrameSource>(), count);
+	}
+
+	CaptureReadStatus Read(CapturedSample& sample) override {
+		DWORD streamIndex = 0;
+		DWORD flags = 0;
+		LONGLONG timestamp = 0;
+		Microsoft::WRL::ComPtr<IMFSample> mfSample;
+		HRESULT hr = reader_->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &streamIndex, &flags, &timestamp, mfSample.GetAddressOf());
+		sample.sourceNow = MFGetSystemTime();
+		if (FAILED(hr)) {
+			return CaptureReadStatus::Failed;
+		}
+		if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+			return CaptureReadStatus::EndOfStream;
+		}
+		if (!mfSample) {
+			return CaptureReadStatus::NoSample;
+		}
+
+		sample.frame = std::allocate_shared<MFSampleFrameSource>(SlotAllocator<MFSampleFrameSource>(samples_), mfSample.Get(), format_.format == PixelFormat::MJPG);
+		sample.timestamp = timestamp;
+		return CaptureReadStatus::Sample;
+	}
+
+private:
+	Microsoft::WRL::ComPtr<IMFSourceReader> reader_;
+	CaptureFormat format_;
+	SlotPool samples_;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+// FrameHandle sources over Media Foundation samples (see FrameHandle.h).
+//
+// A sample with one buffer is locked in place with IMF2DBuffer2::Lock2DSize;
+// only a sample split over several buffers goes through
+// ConvertToContiguousBuffer, which allocates and copies. Compressed (MJPG)
+// buffers have no 2D interface and are locked as plain memory buffers, with
+// their current length in place of the pitch.
+
+#include <Windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <wrl/client.h>
+
+#include <utility>
+
+#include "FrameHandle.h"
+
+class MFLockableBuffer : public LockableFrameBuffer {
+public:
+	void Reset(Microsoft::WRL::ComPtr<IMF2DBuffer2> buffer) {
+		buffer_ = std::move(buffer);
+		compressed_.Reset();
+	}
+
+	void ResetCompressed(Microsoft::WRL::ComPtr<IMFMediaBuffer> buffer) {
+		buffer_.Reset();
+		compressed_ = std::move(buffer);
+	}
+
+	bool Lock(const uint8_t*& scanline0, ptrdiff_t& pitch) override {
+		if (compressed_) {
+			BYTE* data = nullptr;
+			DWORD length = 0;
+			if (FAILED(compressed_->Lock(&data, nullptr, &length))) {
+				return false;
+			}
+			scanline0 = data;
+			pitch = static_cast<ptrdiff_t>(length);
+			return true;
+		}
+
+		BYTE* bufferStart = nullptr;
+		BYTE* firstRow = nullptr;
+		LONG rowPitch = 0;
+		DWORD length = 0;
+		if (FAILED(buffer_->Lock2DSize(MF2DBuffer_LockFlags_Read, &firstRow, &rowPitch, &bufferStart, &length))) {
+			return false;
+		}
+		scanline0 = firstRow;
+		pitch = rowPitch;
+		return true;
+	}
+
+	void Unlock() override {
+		if (compressed_) {
+			compressed_->Unlock();
+			return;
+		}
+		buffer_->Unlock2D();
+	}
+
+private:
+	Microsoft::WRL::ComPtr<IMF2DBuffer2> buffer_;
+	Microsoft::WRL::ComPtr<IMFMediaBuffer> compressed_;
+};
+
+// Holds a reference to the sample, so a queued frame keeps its buffer, and
+// the buffer it locks.
+class MFSampleFrameSource : public CapturedFrameSource {
+public:
+	MFSampleFrameSource(IMFSample* sample, bool compressed) : sample_(sample), compressed_(compressed) {}
+
+	uint32_t BufferCount() override {
+		DWORD count = 0;
+		return SUCCEEDED(sample_->GetBufferCount(&count)) ? static_cast<uint32_t>(count) : 0;
+	}
+
+	LockableFrameBuffer* SingleBuffer() override {
+		Microsoft::WRL::ComPtr<IMFMediaBuffer> buffer;
+		if (FAILED(sample_->GetBufferByIndex(0, buffer.GetAddressOf()))) {
+			return nullptr;
+		}
+		return Lockable(buffer);
+	}
+
+	LockableFrameBuffer* ContiguousCopy() override {
+		Microsoft::WRL::ComPtr<IMFMediaBuffer> buffer;
+		if (FAILED(sample_->ConvertToContiguousBuffer(buffer.GetAddressOf()))) {
+			return nullptr;
+		}
+		return Lockable(buffer);
+	}
+
+private:
+	LockableFrameBuffer* Lockable(const Microsoft::WRL::ComPtr<IMFMediaBuffer>& buffer) {
+		if (compressed_) {
+			buffer_.ResetCompressed(buffer);
+			return &buffer_;
+		}
+		Microsoft::WRL::ComPtr<IMF2DBuffer2> buffer2D;
+		if (FAILED(buffer.As(&buffer2D))) {
+			return nullptr;
+		}
+		buffer_.Reset(std::move(buffer2D));
+		return &buffer_;
+	}
+
+	Microsoft::WRL::ComPtr<IMFSample> sample_;
+	bool compressed_;
+	MFLockableBuffer buffer_;
+};
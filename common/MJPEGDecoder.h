@@ -0,0 +1,229 @@
+#pragma once
+
+// MJPEG frames decoded straight into the output buffer.
+//
+// LibjpegMJPEGDecoder decodes with libjpeg-turbo in builds with MJPEG_LIBJPEG
+// defined (include and link libjpeg-turbo: -ljpeg, jpeg.lib). It asks for raw
+// YCbCr one iMCU row at a time, with libjpeg's upsampling and colour
+// conversion off, and packs each row into the UYVY or NV12 output while it is
+// still in cache, so a frame is written once and never exists as RGB or as an
+// intermediate YUY2 frame.
+//
+// A decoder keeps its libjpeg state and row strips across frames and is used
+// by one thread at a time; FrameConverter keeps one per frame it can have in
+// flight. Without MJPEG_LIBJPEG there is no decoder, MJPEGDecodesTo() is false
+// for every format, and MJPG cameras go through the Media Foundation decoder
+// the source reader inserts, to YUY2.
+
+#ifdef MJPEG_LIBJPEG
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "PixelFormat.h"
+
+#if defined(_MSC_VER) && defined(MJPEG_LIBJPEG)
+#pragma comment(lib, "jpeg.lib")
+#endif
+
+// Whether this build decodes MJPG straight into format.
+inline bool MJPEGDecodesTo(PixelFormat format) {
+#ifdef MJPEG_LIBJPEG
+	return format == PixelFormat::UYVY || format == PixelFormat::NV12;
+#else
+	(void)format;
+	return false;
+#endif
+}
+
+// One decoder instance, used by one thread at a time.
+class MJPEGDecoder {
+public:
+	virtual ~MJPEGDecoder() = default;
+
+	virtual const char* Name() const = 0;
+
+	// Decodes a JPEG frame of layout's size into dest, laid out as layout
+	// (UYVY or NV12). Fails on a corrupt frame, leaving dest partly written.
+	virtual bool Decode(const uint8_t* jpeg, size_t size, const FrameLayout& layout, uint8_t* dest) = 0;
+};
+
+#ifdef MJPEG_LIBJPEG
+
+class LibjpegMJPEGDecoder : public MJPEGDecoder {
+public:
+	LibjpegMJPEGDecoder() {
+		info_.err = jpeg_std_error(&error_.manager);
+		error_.manager.error_exit = [](j_common_ptr info) {
+			longjmp(reinterpret_cast<Error*>(info->err)->jump, 1);
+		};
+		error_.manager.output_message = [](j_common_ptr) {};
+		jpeg_create_decompress(&info_);
+	}
+
+	~LibjpegMJPEGDecoder() override {
+		jpeg_destroy_decompress(&info_);
+	}
+
+	LibjpegMJPEGDecoder(const LibjpegMJPEGDecoder&) = delete;
+	LibjpegMJPEGDecoder& operator=(const LibjpegMJPEGDecoder&) = delete;
+
+	const char* Name() const override {
+		return "libjpeg";
+	}
+
+	// Nothing with a destructor may live in this frame: libjpeg errors
+	// longjmp back to the setjmp.
+	bool Decode(const uint8_t* jpeg, size_t size, const FrameLayout& layout, uint8_t* dest) override {
+		if (setjmp(error_.jump)) {
+			jpeg_abort_decompress(&info_);
+			return false;
+		}
+
+		jpeg_mem_src(&info_, jpeg, static_cast<unsigned long>(size));
+		if (jpeg_read_header(&info_, TRUE) != JPEG_HEADER_OK || info_.image_width != layout.width || info_.image_height != layout.height
+			|| info_.num_components != 3 || info_.jpeg_color_space != JCS_YCbCr || (layout.width & 1) != 0) {
+			jpeg_abort_decompress(&info_);
+			return false;
+		}
+		info_.raw_data_out = TRUE;
+		info_.out_color_space = JCS_YCbCr;
+		info_.do_fancy_upsampling = FALSE;
+		jpeg_start_decompress(&info_);
+		if (!SetupStrip()) {
+			jpeg_abort_decompress(&info_);
+			return false;
+		}
+
+		while (info_.output_scanline < info_.output_height) {
+			const uint32_t firstRow = info_.output_scanline;
+			jpeg_read_raw_data(&info_, strip_, stripRows_);
+			const uint32_t rows = (std::min)(stripRows_, layout.height - firstRow);
+			if (layout.format == PixelFormat::NV12) {
+				PackNV12(firstRow, rows, layout, dest);
+			}
+			else {
+				PackUYVY(firstRow, rows, layout, dest);
+			}
+		}
+		jpeg_finish_decompress(&info_);
+		return true;
+	}
+
+private:
+	struct Error {
+		jpeg_error_mgr manager;
+		jmp_buf jump;
+	};
+
+	// Sizes the rows of one iMCU row of every component, reusing them across
+	// frames of the same size. Cb and Cr must be sampled alike, and luma a
+	// whole multiple as finely.
+	bool SetupStrip() {
+		const jpeg_component_info* components = info_.comp_info;
+		if (components[1].h_samp_factor != components[2].h_samp_factor || components[1].v_samp_factor != components[2].v_samp_factor
+			|| info_.max_h_samp_factor % components[1].h_samp_factor != 0 || info_.max_v_samp_factor % components[1].v_samp_factor != 0) {
+			return false;
+		}
+		chromaColumns_ = static_cast<uint32_t>(info_.max_h_samp_factor / components[1].h_samp_factor);
+		chromaRows_ = static_cast<uint32_t>(info_.max_v_samp_factor / components[1].v_samp_factor);
+		stripRows_ = static_cast<uint32_t>(info_.max_v_samp_factor * DCTSIZE);
+
+		const uint32_t mcuColumns = (info_.image_width + info_.max_h_samp_factor * DCTSIZE - 1) / (info_.max_h_samp_factor * DCTSIZE);
+		for (int c = 0; c < 3; ++c) {
+			const size_t width = static_cast<size_t>(mcuColumns) * components[c].h_samp_factor * DCTSIZE;
+			const uint32_t rows = static_cast<uint32_t>(components[c].v_samp_factor * DCTSIZE);
+			if (storage_[c].size() < width * rows) {
+				storage_[c].resize(width * rows);
+			}
+			rowPointers_[c].resize(rows);
+			for (uint32_t row = 0; row < rows; ++row) {
+				rowPointers_[c][row] = storage_[c].data() + width * row;
+			}
+			strip_[c] = rowPointers_[c].data();
+		}
+		uRow_.resize(info_.image_width / 2);
+		vRow_.resize(info_.image_width / 2);
+		return true;
+	}
+
+	// One chroma value per pixel pair of row, averaged with nextRow when it is
+	// set. Rows at half the luma width are used as they are.
+	const uint8_t* ChromaPairs(const uint8_t* row, const uint8_t* nextRow, uint32_t pairs, std::vector<uint8_t>& out) const {
+		if (chromaColumns_ == 2) {
+			if (!nextRow) {
+				return row;
+			}
+			for (uint32_t i = 0; i < pairs; ++i) {
+				out[i] = static_cast<uint8_t>((row[i] + nextRow[i] + 1) >> 1);
+			}
+			return out.data();
+		}
+		for (uint32_t i = 0; i < pairs; ++i) {
+			const uint32_t x = 2 * i / chromaColumns_;
+			uint32_t value = chromaColumns_ == 1 ? (row[x] + row[x + 1] + 1) >> 1 : row[x];
+			if (nextRow) {
+				const uint32_t next = chromaColumns_ == 1 ? (nextRow[x] + nextRow[x + 1] + 1) >> 1 : nextRow[x];
+				value = (value + next + 1) >> 1;
+			}
+			out[i] = static_cast<uint8_t>(value);
+		}
+		return out.data();
+	}
+
+	void PackUYVY(uint32_t firstRow, uint32_t rows, const FrameLayout& layout, uint8_t* dest) {
+		const uint32_t pairs = layout.width / 2;
+		for (uint32_t row = 0; row < rows; ++row) {
+			const uint8_t* y = strip_[0][row];
+			const uint8_t* u = ChromaPairs(strip_[1][row / chromaRows_], nullptr, pairs, uRow_);
+			const uint8_t* v = ChromaPairs(strip_[2][row / chromaRows_], nullptr, pairs, vRow_);
+			uint8_t* out = dest + layout.planePitch[0] * (firstRow + row);
+			for (uint32_t i = 0; i < pairs; ++i) {
+				out[4 * i + 0] = u[i];
+				out[4 * i + 1] = y[2 * i];
+				out[4 * i + 2] = v[i];
+				out[4 * i + 3] = y[2 * i + 1];
+			}
+		}
+	}
+
+	// Strips hold an even number of rows, so a row pair never straddles two;
+	// the row past an odd frame height is the strip's padding.
+	void PackNV12(uint32_t firstRow, uint32_t rows, const FrameLayout& layout, uint8_t* dest) {
+		const uint32_t pairs = layout.width / 2;
+		for (uint32_t row = 0; row < rows; ++row) {
+			memcpy(dest + layout.planePitch[0] * (firstRow + row), strip_[0][row], layout.width);
+		}
+		for (uint32_t row = 0; row < rows; row += 2) {
+			const bool average = chromaRows_ == 1;
+			const uint32_t chromaRow = row / chromaRows_;
+			const uint8_t* u = ChromaPairs(strip_[1][chromaRow], average ? strip_[1][row + 1] : nullptr, pairs, uRow_);
+			const uint8_t* v = ChromaPairs(strip_[2][chromaRow], average ? strip_[2][row + 1] : nullptr, pairs, vRow_);
+			uint8_t* out = dest + layout.planeOffset[1] + layout.planePitch[1] * ((firstRow + row) / 2);
+			for (uint32_t i = 0; i < pairs; ++i) {
+				out[2 * i + 0] = u[i];
+				out[2 * i + 1] = v[i];
+			}
+		}
+	}
+
+	jpeg_decompress_struct info_{};
+	Error error_{};
+	uint32_t stripRows_{ 0 };
+	uint32_t chromaColumns_{ 1 }; // luma columns per chroma column
+	uint32_t chromaRows_{ 1 };    // luma rows per chroma row
+	JSAMPARRAY strip_[3]{};
+	std::vector<JSAMPROW> rowPointers_[3];
+	std::vector<uint8_t> storage_[3];
+	std::vector<uint8_t> uRow_;
+	std::vector<uint8_t> vRow_;
+};
+
+#endif // MJPEG_LIBJPEG
@@ -0,0 +1,153 @@
+#pragma once
+
+// Capture media type negotiation.
+//
+// The examples enumerate every native media type the camera offers, describe
+// each one as a MediaTypeCandidate and let SelectMediaType pick the cheapest
+// one that meets the configured floor. The scoring is a pure function of the
+// candidate list and kConversionCosts, so it can be exercised without a camera
+// against media type lists recorded from real devices.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PixelFormat.h"
+
+struct MediaTypeCandidate {
+	uint32_t index{ 0 };            // native media type index on the source
+	PixelFormat format{ PixelFormat::Unknown };
+	uint32_t width{ 0 };
+	uint32_t height{ 0 };
+	uint32_t frameRateNumerator{ 0 };
+	uint32_t frameRateDenominator{ 1 };
+
+	double FrameRate() const {
+		return frameRateDenominator ? static_cast<double>(frameRateNumerator) / frameRateDenominator : 0.0;
+	}
+};
+
+struct NegotiationConstraints {
+	uint32_t minWidth{ 1920 };
+	uint32_t minHeight{ 1080 };
+	double minFrameRate{ 30.0 };
+};
+
+// Work needed per pixel to turn a captured frame into the sink's format, in
+// rough units of "one pass over the pixels". Pairs missing from the table have
+// no conversion path and are never selected.
+struct ConversionCost {
+	PixelFormat source;
+	PixelFormat sink;
+	uint32_t cost;
+};
+
+inline constexpr ConversionCost kConversionCosts[] = {
+	{ PixelFormat::UYVY, PixelFormat::UYVY, 0 }, // passthrough
+	{ PixelFormat::YUY2, PixelFormat::YUY2, 0 }, // passthrough
+	{ PixelFormat::YUY2, PixelFormat::UYVY, 1 }, // packed byte swap
+	{ PixelFormat::YUY2, PixelFormat::NV12, 1 }, // fused 4:2:2 -> 4:2:0
+	{ PixelFormat::YUY2, PixelFormat::I420, 1 }, // fused 4:2:2 -> 4:2:0
+	{ PixelFormat::YUY2, PixelFormat::BGRA, 2 }, // fixed-point matrix + 4 bytes/pixel written
+	{ PixelFormat::YUY2, PixelFormat::BGRX, 2 },
+	{ PixelFormat::YUY2, PixelFormat::RGBA, 2 },
+	{ PixelFormat::YUY2, PixelFormat::RGBX, 2 },
+	{ PixelFormat::NV12, PixelFormat::NV12, 0 }, // passthrough
+	{ PixelFormat::NV12, PixelFormat::UYVY, 1 }, // chroma upsample + interleave
+	{ PixelFormat::MJPG, PixelFormat::UYVY, 5 }, // decode straight to it (libjpeg), or to YUY2 + byte swap
+	{ PixelFormat::MJPG, PixelFormat::NV12, 5 }, // decode straight to it (libjpeg), or to YUY2 + fused 4:2:0
+	{ PixelFormat::MJPG, PixelFormat::I420, 5 }, // decode to YUY2 + fused 4:2:0
+	{ PixelFormat::MJPG, PixelFormat::BGRA, 6 }, // decode to YUY2 + matrix
+	{ PixelFormat::MJPG, PixelFormat::BGRX, 6 },
+	{ PixelFormat::MJPG, PixelFormat::RGBA, 6 },
+	{ PixelFormat::MJPG, PixelFormat::RGBX, 6 },
+};
+
+// Returns the conversion cost, or -1 if the sink cannot be fed from source.
+inline int ConversionCostFor(PixelFormat source, PixelFormat sink) {
+	for (const ConversionCost& entry : kConversionCosts) {
+		if (entry.source == source && entry.sink == sink) {
+			return static_cast<int>(entry.cost);
+		}
+	}
+	return -1;
+}
+
+inline bool MeetsConstraints(const MediaTypeCandidate& candidate, const NegotiationConstraints& constraints) {
+	return candidate.width >= constraints.minWidth
+		&& candidate.height >= constraints.minHeight
+		&& candidate.FrameRate() + 1e-3 >= constraints.minFrameRate;
+}
+
+// Total work per second: every captured pixel is touched once on ingest plus
+// the conversion passes to every sink format, scaled by the pixel rate. -1 if
+// any of the sinks cannot be fed from the candidate.
+inline double MediaTypeScore(const MediaTypeCandidate& candidate, const std::vector<PixelFormat>& sinks) {
+	double passes = 1.0;
+	for (PixelFormat sink : sinks) {
+		const int cost = ConversionCostFor(candidate.format, sink);
+		if (cost < 0) {
+			return -1.0;
+		}
+		passes += cost;
+	}
+	const double pixelRate = static_cast<double>(candidate.width) * candidate.height * candidate.FrameRate();
+	return passes * pixelRate;
+}
+
+inline double MediaTypeScore(const MediaTypeCandidate& candidate, PixelFormat sink) {
+	return MediaTypeScore(candidate, std::vector<PixelFormat>{ sink });
+}
+
+struct NegotiationResult {
+	ptrdiff_t selected{ -1 };      // position in the candidate list, -1 if nothing is convertible
+	bool meetsConstraints{ false };
+	double score{ 0.0 };
+};
+
+// Picks the lowest-scoring convertible candidate that meets the constraints,
+// preferring the higher frame rate and then the earlier native index on ties.
+// If no candidate meets the constraints, falls back to the convertible
+// candidate with the highest pixel rate and reports meetsConstraints = false.
+// With several sinks, a candidate must feed every one of them.
+inline NegotiationResult SelectMediaType(const std::vector<MediaTypeCandidate>& candidates, const std::vector<PixelFormat>& sinks,
+	const NegotiationConstraints& constraints) {
+	NegotiationResult best;
+	NegotiationResult fallback;
+	double fallbackPixelRate = -1.0;
+
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		const MediaTypeCandidate& candidate = candidates[i];
+		const double score = MediaTypeScore(candidate, sinks);
+		if (score < 0.0) {
+			continue;
+		}
+
+		if (!MeetsConstraints(candidate, constraints)) {
+			const double pixelRate = static_cast<double>(candidate.width) * candidate.height * candidate.FrameRate();
+			if (pixelRate > fallbackPixelRate) {
+				fallbackPixelRate = pixelRate;
+				fallback.selected = static_cast<ptrdiff_t>(i);
+				fallback.score = score;
+			}
+			continue;
+		}
+
+		bool better = best.selected < 0 || score < best.score;
+		if (!better && score == best.score) {
+			better = candidate.FrameRate() > candidates[best.selected].FrameRate();
+		}
+
+		if (better) {
+			best.selected = static_cast<ptrdiff_t>(i);
+			best.meetsConstraints = true;
+			best.score = score;
+		}
+	}
+
+	return best.selected >= 0 ? best : fallback;
+}
+
+inline NegotiationResult SelectMediaType(const std::vector<MediaTypeCandidate>& candidates, PixelFormat sink, const NegotiationConstraints& constraints) {
+	return SelectMediaType(candidates, std::vector<PixelFormat>{ sink }, constraints);
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+// Several captures at once, a pipeline each, on one shared conversion pool.
+//
+// Every camera gets a FanOutPipeline of its own: its own capture thread,
+// capture ring, frame pools, sinks, and a convert/send thread started by
+// Run(). Their converters all split frames across one BandPool sized to the
+// machine instead of a pool per camera competing for the same cores. The
+// pool takes the cameras' frames in turn (see BandPool.h), so a camera's
+// convert latency includes waiting for the others' frames.
+//
+// Run() blocks until every camera has stopped, and reports throughput and
+// latency per camera and over all of them; the cameras' own pipelines keep
+// quiet, and their full stats are printed one after another at the end.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BandPool.h"
+#include "CapturePipeline.h"
+#include "CaptureSource.h"
+#include "LatencyHistogram.h"
+#include "SinkFanOut.h"
+
+struct MultiCaptureConfig {
+	unsigned workers{ 0 };       // shared conversion workers; 0 = one per hardware thread
+	double reportSeconds{ 5.0 }; // interval of the periodic stats; 0 = only at the end
+	bool printStats{ true };
+};
+
+// What one camera, or all of them, did over a run or an interval.
+struct CameraStats {
+	uint64_t framesSent{ 0 };
+	uint64_t captureDropped{ 0 }; // by the capture ring
+	uint64_t missed{ 0 };         // gaps in the capture timestamps
+	LatencySnapshot convert;
+	LatencySnapshot endToEnd;
+
+	CameraStats Since(const CameraStats& earlier) const {
+		CameraStats interval;
+		interval.framesSent = framesSent - earlier.framesSent;
+		interval.captureDropped = captureDropped - earlier.captureDropped;
+		interval.missed = missed - earlier.missed;
+		interval.convert = convert.Since(earlier.convert);
+		interval.endToEnd = endToEnd.Since(earlier.endToEnd);
+		return interval;
+	}
+
+	void Add(const CameraStats& other) {
+		framesSent += other.framesSent;
+		captureDropped += other.captureDropped;
+		missed += other.missed;
+		convert.Add(other.convert);
+		endToEnd.Add(other.endToEnd);
+	}
+};
+
+class MultiCapture {
+public:
+	explicit MultiCapture(const MultiCaptureConfig& config) : config_(config), workers_(config.workers) {}
+
+	MultiCapture(const MultiCapture&) = delete;
+	MultiCapture& operator=(const MultiCapture&) = delete;
+
+	BandPool& Workers() {
+		return workers_;
+	}
+
+	// A pipeline for source that converts on the shared workers. Add its sinks
+	// and Initialize() it before Run(). The pipeline's own stats are off.
+	FanOutPipeline& AddCamera(const std::string& name, CaptureSource& source, const PipelineConfig& config);
+
+	size_t CameraCount() const {
+		return cameras_.size();
+	}
+
+	FanOutPipeline& Camera(size_t camera) {
+		return *cameras_[camera]->pipeline;
+	}
+
+	const std::string& CameraName(size_t camera) const {
+		return cameras_[camera]->name;
+	}
+
+	// Runs every camera on a thread of its own until all have stopped. poll,
+	// if set, is called on this thread every few milliseconds meanwhile.
+	void Run(const std::function<void()>& poll = nullptr);
+
+	// Stops every camera once its queued frames are sent. Any thread.
+	void Stop() {
+		for (std::unique_ptr<CameraEntry>& camera : cameras_) {
+			camera->pipeline->Stop();
+		}
+	}
+
+	CameraStats Stats(size_t camera) const;
+
+	// Every camera's counts added up, and their latencies merged.
+	CameraStats TotalStats() const;
+
+	void PrintStats(bool interval);
+
+private:
+	struct CameraEntry {
+		std::string name;
+		CaptureFormat format;
+		std::unique_ptr<FanOutPipeline> pipeline;
+		CameraStats reported; // as of the last periodic report
+	};
+
+	void PrintCamera(const std::string& name, const CameraStats& stats, double seconds);
+
+	MultiCaptureConfig config_;
+	BandPool workers_;
+	std::vector<std::unique_ptr<CameraEntry>> cameras_;
+	BandPoolStats reportedWorkers_;
+	std::chrono::steady_clock::time_point runStart_;
+	std::chrono::steady_clock::time_point reportedAt_;
+};
+
+inline FanOutPipeline& MultiCapture::AddCamera(const std::string& name, CaptureSource& source, const PipelineConfig& config) {
+	PipelineConfig quiet = config;
+	quiet.printStats = false;
+	auto camera = std::make_unique<CameraEntry>();
+	camera->name = name;
+	camera->format = source.Format();
+	camera->pipeline = std::make_unique<FanOutPipeline>(quiet, source, &workers_);
+	cameras_.push_back(std::move(camera));
+	return *cameras_.back()->pipeline;
+}
+
+inline void MultiCapture::Run(const std::function<void()>& poll) {
+	if (config_.printStats) {
+		std::cout << "Capturing " << cameras_.size() << " cameras on " << workers_.WorkerCount() << " shared conversion workers" << std::endl;
+	}
+
+	std::atomic<size_t> running{ cameras_.size() };
+	std::vector<std::thread> threads;
+	threads.reserve(cameras_.size());
+	for (std::unique_ptr<CameraEntry>& camera : cameras_) {
+		threads.emplace_back([&running, pipeline = camera->pipeline.get()]() {
+			pipeline->Run();
+			running.fetch_sub(1, std::memory_order_release);
+		});
+	}
+
+	runStart_ = reportedAt_ = std::chrono::steady_clock::now();
+	while (running.load(std::memory_order_acquire) != 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		if (poll) {
+			poll();
+		}
+		const auto now = std::chrono::steady_clock::now();
+		if (config_.printStats && config_.reportSeconds > 0.0 && now - reportedAt_ >= std::chrono::duration<double>(config_.reportSeconds)) {
+			PrintStats(true);
+		}
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	if (!config_.printStats) {
+		return;
+	}
+	for (std::unique_ptr<CameraEntry>& camera : cameras_) {
+		std::cout << "Camera " << camera->name << ":" << std::endl;
+		camera->pipeline->Pipeline().PrintStats(false);
+	}
+	PrintStats(false);
+}
+
+inline CameraStats MultiCapture::Stats(size_t camera) const {
+	const CapturePipeline& pipeline = cameras_[camera]->pipeline->Pipeline();
+	CameraStats stats;
+	stats.framesSent = pipeline.FramesSent();
+	stats.captureDropped = pipeline.RingStats().Dropped();
+	stats.missed = pipeline.GapStats().missed;
+	stats.convert = pipeline.Latency(kStageConvert);
+	stats.endToEnd = pipeline.Latency(kStageEndToEnd);
+	return stats;
+}
+
+inline CameraStats MultiCapture::TotalStats() const {
+	CameraStats total;
+	for (size_t i = 0; i < cameras_.size(); ++i) {
+		total.Add(Stats(i));
+	}
+	return total;
+}
+
+// One line per camera and one for all of them, over the last interval or,
+// at the end of Run(), the whole run; then how often a camera's frame had to
+// wait for the shared workers.
+inline void MultiCapture::PrintStats(bool interval) {
+	const auto now = std::chrono::steady_clock::now();
+	const double seconds = std::chrono::duration<double>(now - (interval ? reportedAt_ : runStart_)).count();
+	std::cout << (interval ? "Cameras, last interval:" : "Cameras, whole run:") << std::endl;
+
+	CameraStats total;
+	for (size_t i = 0; i < cameras_.size(); ++i) {
+		CameraEntry& camera = *cameras_[i];
+		const CameraStats current = Stats(i);
+		const CameraStats shown = interval ? current.Since(camera.reported) : current;
+		PrintCamera(camera.name + " (" + PixelFormatName(camera.format.format) + " " + std::to_string(camera.format.width) + "x"
+			+ std::to_string(camera.format.height) + ")", shown, seconds);
+		total.Add(shown);
+		if (interval) {
+			camera.reported = current;
+		}
+	}
+	PrintCamera("all " + std::to_string(cameras_.size()) + " cameras", total, seconds);
+
+	const BandPoolStats workers = workers_.Stats();
+	const uint64_t runs = workers.runs - (interval ? reportedWorkers_.runs : 0);
+	const uint64_t waited = workers.waited - (interval ? reportedWorkers_.waited : 0);
+	std::cout << "Shared workers: " << workers_.WorkerCount() << " threads, " << runs << " frames, " << waited
+		<< " waited for another camera's frame" << std::endl;
+	if (interval) {
+		reportedWorkers_ = workers;
+		reportedAt_ = now;
+	}
+}
+
+inline void MultiCapture::PrintCamera(const std::string& name, const CameraStats& stats, double seconds) {
+	auto ms = [](uint64_t nanoseconds) { return nanoseconds / 1e6; };
+	std::cout << "  " << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+		<< std::setw(8) << stats.framesSent << " frames" << std::setw(8) << (seconds > 0.0 ? stats.framesSent / seconds : 0.0) << " fps, "
+		<< stats.captureDropped << " dropped, "
+		<< stats.missed << " missed; convert p50 " << std::setprecision(3) << ms(stats.convert.ValueAtPercentile(50.0))
+		<< " p99 " << ms(stats.convert.ValueAtPercentile(99.0)) << ", end-to-end p50 " << ms(stats.endToEnd.ValueAtPercentile(50.0))
+		<< " p99 " << ms(stats.endToEnd.ValueAtPercentile(99.0)) << " ms" << std::defaultfloat << std::endl;
+}
@@ -0,0 +1,406 @@
+#pragma once
+
+// Mirror, flip and quarter-turn rotation of packed 4:2:2 frames (YUY2/UYVY),
+// applied while converting between the two byte orders.
+//
+// The eight orientations are built from three steps:
+//   - reading the source bottom-up, which only negates the pitch,
+//   - mirroring each row, a byte shuffle that reverses pixel pairs,
+//   - transposing, where output rows are source columns.
+// Transposing packed 4:2:2 changes which pixels share chroma: an output pixel
+// pair is one source pixel from each of two source rows, so its U and V are
+// the rounded average of those two rows' samples. Each source chroma sample is
+// used by two output rows, as 4:2:2 is full resolution vertically.
+//
+// Source pitches may be negative (bottom-up buffers); pass pScanline0 from
+// IMF2DBuffer2::Lock2DSize and its pitch, not the buffer start.
+//
+// The transposing orientations do not get near the cost of a plain
+// conversion: on one AVX-512 core they take 2.3x to 3x plain at both 1080p
+// and 2160p. Every 16-byte store goes to a different destination row, and
+// wider AVX2 blocks (16 columns x 16 rows with 32-byte stores, or 32 columns
+// x 8 rows) and streaming stores of those partial lines all measured slower.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "BandPool.h"
+#include "FrameConvert.h"
+#include "PixelConvert.h"
+#include "PixelFormat.h"
+
+// Clockwise rotations. A portrait camera with a selfie mirror is Transpose
+// (rotate 90, then mirror) or Transverse (rotate 270, then mirror).
+enum class Orientation {
+	Identity,
+	Mirror,     // left-right
+	Flip,       // top-bottom
+	Rotate90,
+	Rotate180,
+	Rotate270,
+	Transpose,  // output (x, y) = source (y, x)
+	Transverse, // output (x, y) = source (width - 1 - y, height - 1 - x)
+};
+
+constexpr Orientation kOrientations[] = { Orientation::Identity, Orientation::Mirror, Orientation::Flip, Orientation::Rotate90,
+	Orientation::Rotate180, Orientation::Rotate270, Orientation::Transpose, Orientation::Transverse };
+
+inline const char* OrientationName(Orientation orientation) {
+	switch (orientation) {
+	case Orientation::Mirror: return "mirror";
+	case Orientation::Flip: return "flip";
+	case Orientation::Rotate90: return "rotate90";
+	case Orientation::Rotate180: return "rotate180";
+	case Orientation::Rotate270: return "rotate270";
+	case Orientation::Transpose: return "transpose";
+	case Orientation::Transverse: return "transverse";
+	default: return "none";
+	}
+}
+
+struct OrientationSteps {
+	bool flipSource{ false }; // read source rows bottom-up
+	bool mirror{ false };     // reverse each row (untransposed only)
+	bool transpose{ false };
+	bool flipDest{ false };   // write transposed rows bottom-up
+};
+
+inline OrientationSteps StepsFor(Orientation orientation) {
+	switch (orientation) {
+	case Orientation::Mirror: return { false, true, false, false };
+	case Orientation::Flip: return { true, false, false, false };
+	case Orientation::Rotate180: return { true, true, false, false };
+	case Orientation::Transpose: return { false, false, true, false };
+	case Orientation::Rotate90: return { true, false, true, false };
+	case Orientation::Rotate270: return { false, false, true, true };
+	case Orientation::Transverse: return { true, false, true, true };
+	default: return {};
+	}
+}
+
+inline bool SwapsAxes(Orientation orientation) {
+	return StepsFor(orientation).transpose;
+}
+
+// Byte offsets of U, V and the even/odd luma in a pixel pair.
+template <bool kYUY2>
+struct Packed422Offsets {
+	static constexpr uint8_t kY0 = kYUY2 ? 0 : 1;
+	static constexpr uint8_t kU = kYUY2 ? 1 : 0;
+	static constexpr uint8_t kY1 = kYUY2 ? 2 : 3;
+	static constexpr uint8_t kV = kYUY2 ? 3 : 2;
+};
+
+// Same order in and out: a plain row copy, with the YUY2ToUYVYRowFunc signature.
+inline void CopyRow422(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	memcpy(dst, src, static_cast<size_t>(width) * 2);
+}
+
+//
+// Mirrored row: output pair k is source pair (width / 2 - 1 - k) with its two
+// luma samples swapped. width must be even.
+//
+
+// Source byte for each output byte of a mirrored pair.
+template <bool kSrcYUY2, bool kDstYUY2>
+struct MirrorPairOrder {
+	using Src = Packed422Offsets<kSrcYUY2>;
+	static constexpr uint8_t kOrder[4] = {
+		kDstYUY2 ? Src::kY1 : Src::kU,
+		kDstYUY2 ? Src::kU : Src::kY1,
+		kDstYUY2 ? Src::kY0 : Src::kV,
+		kDstYUY2 ? Src::kV : Src::kY0,
+	};
+};
+
+template <bool kSrcYUY2, bool kDstYUY2>
+inline void MirrorRow422_Scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	using Order = MirrorPairOrder<kSrcYUY2, kDstYUY2>;
+	const uint32_t pairs = width / 2;
+
+	for (uint32_t k = 0; k < pairs; ++k) {
+		const uint8_t* s = src + (pairs - 1 - k) * 4;
+		for (int t = 0; t < 4; ++t) {
+			dst[k * 4 + t] = s[Order::kOrder[t]];
+		}
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+// Reverses the four pairs of a 16-byte vector and reorders each pair.
+template <bool kSrcYUY2, bool kDstYUY2>
+inline __m128i MirrorPairsMask() {
+	using Order = MirrorPairOrder<kSrcYUY2, kDstYUY2>;
+	alignas(16) int8_t mask[16];
+	for (int j = 0; j < 4; ++j) {
+		for (int t = 0; t < 4; ++t) {
+			mask[j * 4 + t] = static_cast<int8_t>((3 - j) * 4 + Order::kOrder[t]);
+		}
+	}
+	return _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+}
+
+// Walks the source backwards 16 bytes at a time.
+template <bool kSrcYUY2, bool kDstYUY2>
+PIXEL_CONVERT_TARGET("ssse3")
+inline void MirrorRow422_SSSE3(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	const __m128i mask = MirrorPairsMask<kSrcYUY2, kDstYUY2>();
+	const size_t bytes = static_cast<size_t>(width / 2) * 4;
+	size_t i = 0;
+
+	for (; i + 16 <= bytes; i += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + bytes - i - 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, mask));
+	}
+
+	// The remaining output pairs come from the first source pairs.
+	MirrorRow422_Scalar<kSrcYUY2, kDstYUY2>(src, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+
+// Reverses pairs within each 128-bit lane, then swaps the lanes.
+template <bool kSrcYUY2, bool kDstYUY2>
+PIXEL_CONVERT_TARGET("avx2")
+inline void MirrorRow422_AVX2(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	const __m128i laneMask = MirrorPairsMask<kSrcYUY2, kDstYUY2>();
+	const __m256i mask = _mm256_inserti128_si256(_mm256_castsi128_si256(laneMask), laneMask, 1);
+	const size_t bytes = static_cast<size_t>(width / 2) * 4;
+	size_t i = 0;
+
+	for (; i + 32 <= bytes; i += 32) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + bytes - i - 32));
+		const __m256i shuffled = _mm256_shuffle_epi8(v, mask);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permute2x128_si256(shuffled, shuffled, 0x01));
+	}
+
+	MirrorRow422_SSSE3<kSrcYUY2, kDstYUY2>(src, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+
+#endif
+
+//
+// Transpose: source columns [0, columns) become destination rows, source rows
+// [0, rows) become destination pixels. columns and rows must be even; pitches
+// are signed, so flipped variants are the same kernel with negated pitches.
+//
+
+using Transpose422Func = void (*)(const uint8_t* src, ptrdiff_t srcPitch, uint8_t* dst, ptrdiff_t dstPitch, uint32_t columns, uint32_t rows);
+
+template <bool kSrcYUY2, bool kDstYUY2>
+inline void Transpose422_Scalar(const uint8_t* src, ptrdiff_t srcPitch, uint8_t* dst, ptrdiff_t dstPitch, uint32_t columns, uint32_t rows) {
+	using Src = Packed422Offsets<kSrcYUY2>;
+	using Dst = Packed422Offsets<kDstYUY2>;
+
+	for (uint32_t c = 0; c < columns; ++c) {
+		uint8_t* out = dst + static_cast<ptrdiff_t>(c) * dstPitch;
+		const size_t luma = c * 2 + Src::kY0;
+		const size_t chroma = (c & ~1u) * 2;
+
+		for (uint32_t r = 0; r + 1 < rows; r += 2) {
+			const uint8_t* row0 = src + static_cast<ptrdiff_t>(r) * srcPitch;
+			const uint8_t* row1 = row0 + srcPitch;
+			uint8_t* pair = out + r * 2;
+			pair[Dst::kY0] = row0[luma];
+			pair[Dst::kY1] = row1[luma];
+			pair[Dst::kU] = static_cast<uint8_t>((row0[chroma + Src::kU] + row1[chroma + Src::kU] + 1) >> 1);
+			pair[Dst::kV] = static_cast<uint8_t>((row0[chroma + Src::kV] + row1[chroma + Src::kV] + 1) >> 1);
+		}
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+// One 16-column x 8-row block. Each row is split into 16 luma bytes and 8 UV
+// pairs; row pairs are averaged (pavgb rounds up, like the scalar kernel) and
+// every UV word doubled so there is one per column. Interleaving UV words with
+// the two rows' luma gives one output pixel pair per column for each row pair,
+// and a 4x4 dword transpose per 4 columns assembles the output rows.
+template <bool kSrcYUY2, bool kDstYUY2>
+PIXEL_CONVERT_TARGET("ssse3")
+inline void Transpose422Block_SSSE3(const uint8_t* src, ptrdiff_t srcPitch, uint8_t* dst, ptrdiff_t dstPitch) {
+	const __m128i split = kSrcYUY2
+		? _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15)
+		: _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, 0, 2, 4, 6, 8, 10, 12, 14);
+
+	__m128i luma[8];
+	__m128i uv[4];
+	for (int r = 0; r < 8; ++r) {
+		const uint8_t* row = src + r * srcPitch;
+		const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row)), split);
+		const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 16)), split);
+		luma[r] = _mm_unpacklo_epi64(a, b);
+		const __m128i chroma = _mm_unpackhi_epi64(a, b);
+		uv[r / 2] = (r & 1) ? _mm_avg_epu8(uv[r / 2], chroma) : chroma;
+	}
+
+	// pairs[k][g]: output pairs of row pair k for columns 4g .. 4g + 3.
+	__m128i pairs[4][4];
+	for (int k = 0; k < 4; ++k) {
+		const __m128i lumaLo = _mm_unpacklo_epi8(luma[2 * k], luma[2 * k + 1]);
+		const __m128i lumaHi = _mm_unpackhi_epi8(luma[2 * k], luma[2 * k + 1]);
+		const __m128i uvLo = _mm_unpacklo_epi16(uv[k], uv[k]);
+		const __m128i uvHi = _mm_unpackhi_epi16(uv[k], uv[k]);
+		if (kDstYUY2) {
+			pairs[k][0] = _mm_unpacklo_epi8(lumaLo, uvLo);
+			pairs[k][1] = _mm_unpackhi_epi8(lumaLo, uvLo);
+			pairs[k][2] = _mm_unpacklo_epi8(lumaHi, uvHi);
+			pairs[k][3] = _mm_unpackhi_epi8(lumaHi, uvHi);
+		}
+		else {
+			pairs[k][0] = _mm_unpacklo_epi8(uvLo, lumaLo);
+			pairs[k][1] = _mm_unpackhi_epi8(uvLo, lumaLo);
+			pairs[k][2] = _mm_unpacklo_epi8(uvHi, lumaHi);
+			pairs[k][3] = _mm_unpackhi_epi8(uvHi, lumaHi);
+		}
+	}
+
+	for (int g = 0; g < 4; ++g) {
+		const __m128i t0 = _mm_unpacklo_epi32(pairs[0][g], pairs[1][g]);
+		const __m128i t1 = _mm_unpacklo_epi32(pairs[2][g], pairs[3][g]);
+		const __m128i t2 = _mm_unpackhi_epi32(pairs[0][g], pairs[1][g]);
+		const __m128i t3 = _mm_unpackhi_epi32(pairs[2][g], pairs[3][g]);
+		uint8_t* out = dst + (g * 4) * dstPitch;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi64(t0, t1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + dstPitch), _mm_unpackhi_epi64(t0, t1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * dstPitch), _mm_unpacklo_epi64(t2, t3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3 * dstPitch), _mm_unpackhi_epi64(t2, t3));
+	}
+}
+
+// Tiles of kTransposeTileRows source rows: within a tile each 16-column
+// block is walked down the rows, so the destination rows are written in
+// 2048-byte runs and the source lines are reused from L2 by the next block.
+// With 4K pitches every source and destination row is its own page, so a
+// tile of a 256-column band touches about 1300 pages: enough to cut the
+// number of tiles per frame, few enough to stay in the second-level TLB.
+// Edges that do not fill a block go scalar.
+constexpr uint32_t kTransposeTileRows = 1024;
+
+template <bool kSrcYUY2, bool kDstYUY2>
+PIXEL_CONVERT_TARGET("ssse3")
+inline void Transpose422_SSSE3(const uint8_t* src, ptrdiff_t srcPitch, uint8_t* dst, ptrdiff_t dstPitch, uint32_t columns, uint32_t rows) {
+	const uint32_t blockColumns = columns & ~15u;
+	const uint32_t blockRows = rows & ~7u;
+
+	for (uint32_t tile = 0; tile < blockRows; tile += kTransposeTileRows) {
+		const uint32_t tileEnd = (std::min)(tile + kTransposeTileRows, blockRows);
+		for (uint32_t c = 0; c < blockColumns; c += 16) {
+			for (uint32_t r = tile; r < tileEnd; r += 8) {
+				Transpose422Block_SSSE3<kSrcYUY2, kDstYUY2>(src + static_cast<ptrdiff_t>(r) * srcPitch + c * 2, srcPitch,
+					dst + static_cast<ptrdiff_t>(c) * dstPitch + r * 2, dstPitch);
+			}
+		}
+	}
+
+	if (blockRows < rows) {
+		Transpose422_Scalar<kSrcYUY2, kDstYUY2>(src + static_cast<ptrdiff_t>(blockRows) * srcPitch, srcPitch,
+			dst + blockRows * 2, dstPitch, blockColumns, rows - blockRows);
+	}
+	if (blockColumns < columns) {
+		Transpose422_Scalar<kSrcYUY2, kDstYUY2>(src + blockColumns * 2, srcPitch,
+			dst + static_cast<ptrdiff_t>(blockColumns) * dstPitch, dstPitch, columns - blockColumns, rows);
+	}
+}
+
+#endif
+
+// Row kernels for the untransposed orientations and the transpose kernel, for
+// one source and destination byte order. The transpose has no AVX2 variant,
+// see the note at the top of this file.
+struct OrientationKernels {
+	YUY2ToUYVYRowFunc row{ nullptr };    // Identity and Flip
+	YUY2ToUYVYRowFunc mirror{ nullptr }; // Mirror and Rotate180
+	Transpose422Func transpose{ nullptr };
+};
+
+template <bool kSrcYUY2, bool kDstYUY2>
+inline OrientationKernels MakeOrientationKernels(SimdLevel level) {
+	OrientationKernels kernels;
+	kernels.row = kSrcYUY2 == kDstYUY2 ? CopyRow422 : GetYUY2ToUYVYRow(level);
+	kernels.mirror = MirrorRow422_Scalar<kSrcYUY2, kDstYUY2>;
+	kernels.transpose = Transpose422_Scalar<kSrcYUY2, kDstYUY2>;
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+	case SimdLevel::AVX512:
+	case SimdLevel::AVX2:
+		kernels.mirror = MirrorRow422_AVX2<kSrcYUY2, kDstYUY2>;
+		kernels.transpose = Transpose422_SSSE3<kSrcYUY2, kDstYUY2>;
+		break;
+	case SimdLevel::SSSE3:
+		kernels.mirror = MirrorRow422_SSSE3<kSrcYUY2, kDstYUY2>;
+		kernels.transpose = Transpose422_SSSE3<kSrcYUY2, kDstYUY2>;
+		break;
+	default:
+		break;
+	}
+#endif
+	return kernels;
+}
+
+// sourceFormat and destFormat are YUY2 or UYVY.
+inline OrientationKernels GetOrientationKernels(SimdLevel level, PixelFormat sourceFormat, PixelFormat destFormat) {
+	const bool srcYUY2 = sourceFormat == PixelFormat::YUY2;
+	const bool dstYUY2 = destFormat == PixelFormat::YUY2;
+	if (srcYUY2) {
+		return dstYUY2 ? MakeOrientationKernels<true, true>(level) : MakeOrientationKernels<true, false>(level);
+	}
+	return dstYUY2 ? MakeOrientationKernels<false, true>(level) : MakeOrientationKernels<false, false>(level);
+}
+
+// Output size for a width x height source.
+inline void OrientedSize(Orientation orientation, uint32_t width, uint32_t height, uint32_t& outWidth, uint32_t& outHeight) {
+	outWidth = SwapsAxes(orientation) ? height : width;
+	outHeight = SwapsAxes(orientation) ? width : height;
+}
+
+// Converts a width x height packed 4:2:2 frame (width even, and height even if
+// the orientation transposes) into destData with the orientation applied.
+// Bands are output rows starting at multiples of kPackedBandRowMultiple;
+// bandDone(firstRow, lastRow) runs after each, as for YUY2ToUYVYWithPitch.
+template <typename BandHook = NoBandHook>
+inline void OrientPacked422WithPitch(BandPool& pool, const OrientationKernels& kernels, Orientation orientation,
+	const uint8_t* srcData, ptrdiff_t pitch, uint32_t width, uint32_t height,
+	uint8_t* destData, ptrdiff_t destPitch, const BandHook& bandDone = BandHook()) {
+	const OrientationSteps steps = StepsFor(orientation);
+
+	if (steps.flipSource) {
+		srcData += static_cast<ptrdiff_t>(height - 1) * pitch;
+		pitch = -pitch;
+	}
+
+	if (!steps.transpose) {
+		const YUY2ToUYVYRowFunc convertRow = steps.mirror ? kernels.mirror : kernels.row;
+		const uint32_t bandRows = BandPool::BandRowsFor(static_cast<size_t>(width) * 4, 256 * 1024, kPackedBandRowMultiple);
+
+		pool.Run(height, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+			for (uint32_t y = firstRow; y < lastRow; ++y) {
+				convertRow(srcData + static_cast<ptrdiff_t>(y) * pitch, destData + static_cast<ptrdiff_t>(y) * destPitch, width);
+			}
+			// row may be a streaming-store kernel.
+			StoreFence();
+			bandDone(firstRow, lastRow);
+		});
+		return;
+	}
+
+	// Output row y is source column y, or width - 1 - y with flipDest. Bands
+	// of at least 32 output rows read whole 64-byte lines of every source row;
+	// 256 keeps a band's tiles within the TLB (see kTransposeTileRows) and
+	// still gives 1080p eight bands.
+	const uint32_t bandRows = 256;
+
+	pool.Run(width, bandRows, [&](uint32_t firstRow, uint32_t lastRow) {
+		const uint32_t columns = lastRow - firstRow;
+		if (steps.flipDest) {
+			kernels.transpose(srcData + static_cast<size_t>(width - lastRow) * 2, pitch,
+				destData + static_cast<ptrdiff_t>(lastRow - 1) * destPitch, -destPitch, columns, height);
+		}
+		else {
+			kernels.transpose(srcData + static_cast<size_t>(firstRow) * 2, pitch,
+				destData + static_cast<ptrdiff_t>(firstRow) * destPitch, destPitch, columns, height);
+		}
+		bandDone(firstRow, lastRow);
+	});
+}
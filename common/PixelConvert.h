@@ -0,0 +1,731 @@
+#pragma once
+
+// Pixel format conversion kernels shared by the examples and the benchmarks.
+//
+// Every kernel has a scalar reference implementation plus SIMD variants. The
+// variant is picked once from CPUID (see ActiveSimdLevel) and handed out as a
+// plain function pointer, so the hot loops never re-check CPU features.
+//
+// This header is deliberately free of Windows / Media Foundation types so the
+// kernels can be built and verified on any platform.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXEL_CONVERT_X86 1
+#if defined(_M_X64) || defined(__x86_64__)
+#define PIXEL_CONVERT_X64 1
+#endif
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC allows any intrinsic in any function; GCC/Clang need the ISA enabled per function.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define PIXEL_CONVERT_TARGET(isa)
+#else
+#define PIXEL_CONVERT_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+enum class SimdLevel {
+	Scalar,
+	SSSE3,
+	AVX2,
+	AVX512,
+};
+
+inline const char* SimdLevelName(SimdLevel level) {
+	switch (level) {
+	case SimdLevel::SSSE3: return "SSSE3";
+	case SimdLevel::AVX2: return "AVX2";
+	case SimdLevel::AVX512: return "AVX-512";
+	default: return "Scalar";
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+inline void CpuId(int leaf, int subleaf, int regs[4]) {
+#if defined(_MSC_VER)
+	__cpuidex(regs, leaf, subleaf);
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	regs[0] = static_cast<int>(a);
+	regs[1] = static_cast<int>(b);
+	regs[2] = static_cast<int>(c);
+	regs[3] = static_cast<int>(d);
+#endif
+}
+
+inline uint64_t ReadXCR0() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t lo = 0, hi = 0;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+}
+#endif
+
+// Highest SIMD level both the CPU and the OS (saved register state) support.
+inline SimdLevel DetectSimdLevel() {
+#if defined(PIXEL_CONVERT_X86)
+	int regs[4] = {};
+	CpuId(0, 0, regs);
+	const int maxLeaf = regs[0];
+
+	CpuId(1, 0, regs);
+	const bool ssse3 = (regs[2] & (1 << 9)) != 0;
+	const bool osxsave = (regs[2] & (1 << 27)) != 0;
+	const bool avx = (regs[2] & (1 << 28)) != 0;
+
+	if (!ssse3) {
+		return SimdLevel::Scalar;
+	}
+
+	if (!osxsave || !avx || maxLeaf < 7) {
+		return SimdLevel::SSSE3;
+	}
+
+	const uint64_t xcr0 = ReadXCR0();
+	if ((xcr0 & 0x6) != 0x6) {
+		return SimdLevel::SSSE3;
+	}
+
+	CpuId(7, 0, regs);
+	const bool avx2 = (regs[1] & (1 << 5)) != 0;
+	const bool avx512f = (regs[1] & (1 << 16)) != 0;
+	const bool avx512bw = (regs[1] & (1 << 30)) != 0;
+
+	if (!avx2) {
+		return SimdLevel::SSSE3;
+	}
+
+#if defined(PIXEL_CONVERT_X64)
+	if (avx512f && avx512bw && (xcr0 & 0xE6) == 0xE6) {
+		return SimdLevel::AVX512;
+	}
+#else
+	(void)avx512f;
+	(void)avx512bw;
+#endif
+
+	return SimdLevel::AVX2;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+// Detected once, on first use.
+inline SimdLevel ActiveSimdLevel() {
+	static const SimdLevel level = DetectSimdLevel();
+	return level;
+}
+
+//
+// YUY2 (Y0 U Y1 V) -> UYVY (U Y0 V Y1)
+//
+// Both formats are packed 4:2:2, so the conversion is a swap of every byte pair.
+// Width is in pixels and must be even.
+//
+
+using YUY2ToUYVYRowFunc = void (*)(const uint8_t* src, uint8_t* dst, uint32_t width);
+
+inline void YUY2ToUYVYRow_Scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	for (uint32_t x = 0; x < width; x += 2) {
+		uint32_t idx = x * 2;
+		dst[idx] = src[idx + 1];     // U
+		dst[idx + 1] = src[idx];     // Y0
+		dst[idx + 2] = src[idx + 3]; // V
+		dst[idx + 3] = src[idx + 2]; // Y1
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+PIXEL_CONVERT_TARGET("ssse3")
+inline void YUY2ToUYVYRow_SSSE3(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const size_t bytes = static_cast<size_t>(width) * 2;
+	size_t i = 0;
+
+	for (; i + 32 <= bytes; i += 32) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(a, swap));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 16), _mm_shuffle_epi8(b, swap));
+	}
+
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(a, swap));
+	}
+
+	YUY2ToUYVYRow_Scalar(src + i, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+inline void YUY2ToUYVYRow_AVX2(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	const __m256i swap = _mm256_setr_epi8(
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const size_t bytes = static_cast<size_t>(width) * 2;
+	size_t i = 0;
+
+	for (; i + 64 <= bytes; i += 64) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(a, swap));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), _mm256_shuffle_epi8(b, swap));
+	}
+
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(a, swap));
+	}
+
+	YUY2ToUYVYRow_Scalar(src + i, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+
+#if defined(PIXEL_CONVERT_X64)
+PIXEL_CONVERT_TARGET("avx512f,avx512bw")
+inline void YUY2ToUYVYRow_AVX512(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	// Same 1, 0, 3, 2, ... byte pattern as the SSSE3/AVX2 variants, in every 128-bit lane.
+	const __m512i swap = _mm512_set4_epi32(0x0E0F0C0D, 0x0A0B0809, 0x06070405, 0x02030001);
+	const size_t bytes = static_cast<size_t>(width) * 2;
+	size_t i = 0;
+
+	for (; i + 64 <= bytes; i += 64) {
+		__m512i a = _mm512_loadu_si512(src + i);
+		_mm512_storeu_si512(dst + i, _mm512_shuffle_epi8(a, swap));
+	}
+
+	// Masked load/store covers the tail, including rows shorter than one vector.
+	if (i < bytes) {
+		const __mmask64 mask = (1ULL << (bytes - i)) - 1;
+		__m512i a = _mm512_maskz_loadu_epi8(mask, src + i);
+		_mm512_mask_storeu_epi8(dst + i, mask, _mm512_shuffle_epi8(a, swap));
+	}
+}
+#endif
+
+#endif
+
+// Best available implementation at or below the requested level.
+inline YUY2ToUYVYRowFunc GetYUY2ToUYVYRow(SimdLevel level) {
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+#if defined(PIXEL_CONVERT_X64)
+	case SimdLevel::AVX512: return YUY2ToUYVYRow_AVX512;
+#else
+	case SimdLevel::AVX512:
+#endif
+	case SimdLevel::AVX2: return YUY2ToUYVYRow_AVX2;
+	case SimdLevel::SSSE3: return YUY2ToUYVYRow_SSSE3;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return YUY2ToUYVYRow_Scalar;
+}
+
+//
+// Non-temporal YUY2 -> UYVY and row copy
+//
+// Same results through streaming stores, for destinations this process never
+// reads back (frames handed to NDI or the GPU). The stores bypass the cache,
+// so a 16 MB 4K frame does not evict the rest of the working set from the LLC.
+// Leading bytes up to the vector alignment use regular stores. Streaming
+// stores are weakly ordered: call StoreFence() before another thread may read
+// the data (the frame functions fence at the end of every band).
+//
+
+inline void StoreFence() {
+#if defined(PIXEL_CONVERT_X86)
+	_mm_sfence();
+#endif
+}
+
+// Bytes of regular stores needed before dst reaches the given alignment, or
+// SIZE_MAX if it never will at pixel-pair (4-byte) granularity.
+inline size_t NonTemporalHeadBytes(const uint8_t* dst, size_t alignment) {
+	const size_t head = (alignment - (reinterpret_cast<uintptr_t>(dst) & (alignment - 1))) & (alignment - 1);
+	return (head & 3) == 0 ? head : SIZE_MAX;
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+PIXEL_CONVERT_TARGET("ssse3")
+inline void YUY2ToUYVYRowNT_SSSE3(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const size_t bytes = static_cast<size_t>(width) * 2;
+	const size_t head = NonTemporalHeadBytes(dst, 16);
+	if (head >= bytes) {
+		YUY2ToUYVYRow_SSSE3(src, dst, width);
+		return;
+	}
+
+	YUY2ToUYVYRow_Scalar(src, dst, static_cast<uint32_t>(head / 2));
+	size_t i = head;
+
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(a, swap));
+	}
+
+	YUY2ToUYVYRow_Scalar(src + i, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+inline void YUY2ToUYVYRowNT_AVX2(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	const __m256i swap = _mm256_setr_epi8(
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const size_t bytes = static_cast<size_t>(width) * 2;
+	const size_t head = NonTemporalHeadBytes(dst, 32);
+	if (head >= bytes) {
+		YUY2ToUYVYRow_AVX2(src, dst, width);
+		return;
+	}
+
+	YUY2ToUYVYRow_Scalar(src, dst, static_cast<uint32_t>(head / 2));
+	size_t i = head;
+
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		_mm256_stream_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(a, swap));
+	}
+
+	YUY2ToUYVYRowNT_SSSE3(src + i, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+
+#if defined(PIXEL_CONVERT_X64)
+PIXEL_CONVERT_TARGET("avx512f,avx512bw")
+inline void YUY2ToUYVYRowNT_AVX512(const uint8_t* src, uint8_t* dst, uint32_t width) {
+	const __m512i swap = _mm512_set4_epi32(0x0E0F0C0D, 0x0A0B0809, 0x06070405, 0x02030001);
+	const size_t bytes = static_cast<size_t>(width) * 2;
+	const size_t head = NonTemporalHeadBytes(dst, 64);
+	if (head >= bytes) {
+		YUY2ToUYVYRow_AVX512(src, dst, width);
+		return;
+	}
+
+	YUY2ToUYVYRow_Scalar(src, dst, static_cast<uint32_t>(head / 2));
+	size_t i = head;
+
+	for (; i + 64 <= bytes; i += 64) {
+		__m512i a = _mm512_loadu_si512(src + i);
+		_mm512_stream_si512(reinterpret_cast<__m512i*>(dst + i), _mm512_shuffle_epi8(a, swap));
+	}
+
+	YUY2ToUYVYRowNT_AVX2(src + i, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+#endif
+
+PIXEL_CONVERT_TARGET("sse2")
+inline void CopyRowNT_SSE2(const uint8_t* src, uint8_t* dst, size_t bytes) {
+	const size_t head = NonTemporalHeadBytes(dst, 16);
+	if (head >= bytes) {
+		memcpy(dst, src, bytes);
+		return;
+	}
+
+	memcpy(dst, src, head);
+	size_t i = head;
+
+	for (; i + 64 <= bytes; i += 64) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+		const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32));
+		const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48));
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), a);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 16), b);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 32), c);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 48), d);
+	}
+
+	for (; i + 16 <= bytes; i += 16) {
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+	}
+
+	memcpy(dst + i, src + i, bytes - i);
+}
+
+#endif
+
+// Streaming-store counterpart of GetYUY2ToUYVYRow. Falls back to the regular
+// kernels where there is no streaming variant.
+inline YUY2ToUYVYRowFunc GetYUY2ToUYVYRowNonTemporal(SimdLevel level) {
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+#if defined(PIXEL_CONVERT_X64)
+	case SimdLevel::AVX512: return YUY2ToUYVYRowNT_AVX512;
+#else
+	case SimdLevel::AVX512:
+#endif
+	case SimdLevel::AVX2: return YUY2ToUYVYRowNT_AVX2;
+	case SimdLevel::SSSE3: return YUY2ToUYVYRowNT_SSSE3;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return YUY2ToUYVYRow_Scalar;
+}
+
+inline void CopyRowNonTemporal(const uint8_t* src, uint8_t* dst, size_t bytes) {
+#if defined(PIXEL_CONVERT_X86)
+	CopyRowNT_SSE2(src, dst, bytes);
+#else
+	memcpy(dst, src, bytes);
+#endif
+}
+
+//
+// YUY2 -> NV12 / I420
+//
+// Consumes two source rows per call. Luma is copied from both rows, and the
+// chroma of the pair is averaged vertically ((a + b + 1) >> 1, like pavgb) in
+// the same pass. For an odd final row pass the same row as src0 and src1.
+// Width is in pixels and must be even.
+//
+
+using YUY2ToNV12RowFunc = void (*)(const uint8_t* src0, const uint8_t* src1, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstUV, uint32_t width);
+using YUY2ToI420RowFunc = void (*)(const uint8_t* src0, const uint8_t* src1, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV, uint32_t width);
+
+inline void YUY2ToNV12Row_Scalar(const uint8_t* src0, const uint8_t* src1, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstUV, uint32_t width) {
+	for (uint32_t x = 0; x < width; x += 2) {
+		const uint32_t idx = x * 2;
+		dstY0[x] = src0[idx];
+		dstY0[x + 1] = src0[idx + 2];
+		dstY1[x] = src1[idx];
+		dstY1[x + 1] = src1[idx + 2];
+		dstUV[x] = static_cast<uint8_t>((src0[idx + 1] + src1[idx + 1] + 1) >> 1);     // U
+		dstUV[x + 1] = static_cast<uint8_t>((src0[idx + 3] + src1[idx + 3] + 1) >> 1); // V
+	}
+}
+
+inline void YUY2ToI420Row_Scalar(const uint8_t* src0, const uint8_t* src1, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV, uint32_t width) {
+	for (uint32_t x = 0; x < width; x += 2) {
+		const uint32_t idx = x * 2;
+		dstY0[x] = src0[idx];
+		dstY0[x + 1] = src0[idx + 2];
+		dstY1[x] = src1[idx];
+		dstY1[x + 1] = src1[idx + 2];
+		dstU[x / 2] = static_cast<uint8_t>((src0[idx + 1] + src1[idx + 1] + 1) >> 1);
+		dstV[x / 2] = static_cast<uint8_t>((src0[idx + 3] + src1[idx + 3] + 1) >> 1);
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+PIXEL_CONVERT_TARGET("ssse3")
+inline void YUY2ToNV12Row_SSSE3(const uint8_t* src0, const uint8_t* src1, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstUV, uint32_t width) {
+	const __m128i evenBytes = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i oddBytes = _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	uint32_t x = 0;
+
+	// 16 pixels (32 source bytes) per row per iteration.
+	for (; x + 16 <= width; x += 16) {
+		const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + x * 2));
+		const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + x * 2 + 16));
+		const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + x * 2));
+		const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + x * 2 + 16));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dstY0 + x),
+			_mm_unpacklo_epi64(_mm_shuffle_epi8(a0, evenBytes), _mm_shuffle_epi8(a1, evenBytes)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dstY1 + x),
+			_mm_unpacklo_epi64(_mm_shuffle_epi8(b0, evenBytes), _mm_shuffle_epi8(b1, evenBytes)));
+
+		// Odd bytes are already in U V U V order, which is the NV12 chroma layout.
+		const __m128i c0 = _mm_avg_epu8(a0, b0);
+		const __m128i c1 = _mm_avg_epu8(a1, b1);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dstUV + x),
+			_mm_unpacklo_epi64(_mm_shuffle_epi8(c0, oddBytes), _mm_shuffle_epi8(c1, oddBytes)));
+	}
+
+	YUY2ToNV12Row_Scalar(src0 + x * 2, src1 + x * 2, dstY0 + x, dstY1 + x, dstUV + x, width - x);
+}
+
+PIXEL_CONVERT_TARGET("ssse3")
+inline void YUY2ToI420Row_SSSE3(const uint8_t* src0, const uint8_t* src1, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV, uint32_t width) {
+	const __m128i evenBytes = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i splitUV = _mm_setr_epi8(1, 5, 9, 13, 3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + x * 2));
+		const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + x * 2 + 16));
+		const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + x * 2));
+		const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + x * 2 + 16));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dstY0 + x),
+			_mm_unpacklo_epi64(_mm_shuffle_epi8(a0, evenBytes), _mm_shuffle_epi8(a1, evenBytes)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dstY1 + x),
+			_mm_unpacklo_epi64(_mm_shuffle_epi8(b0, evenBytes), _mm_shuffle_epi8(b1, evenBytes)));
+
+		// Each half yields U0..U3 V0..V3; interleaving dwords gives U0..U7 V0..V7.
+		const __m128i c0 = _mm_shuffle_epi8(_mm_avg_epu8(a0, b0), splitUV);
+		const __m128i c1 = _mm_shuffle_epi8(_mm_avg_epu8(a1, b1), splitUV);
+		const __m128i uv = _mm_unpacklo_epi32(c0, c1);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dstU + x / 2), uv);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dstV + x / 2), _mm_srli_si128(uv, 8));
+	}
+
+	YUY2ToI420Row_Scalar(src0 + x * 2, src1 + x * 2, dstY0 + x, dstY1 + x, dstU + x / 2, dstV + x / 2, width - x);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+inline void YUY2ToNV12Row_AVX2(const uint8_t* src0, const uint8_t* src1, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstUV, uint32_t width) {
+	const __m256i evenBytes = _mm256_setr_epi8(
+		0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1,
+		0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i oddBytes = _mm256_setr_epi8(
+		1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1,
+		1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	uint32_t x = 0;
+
+	// 32 pixels per row per iteration. The in-lane shuffles leave the qwords in
+	// 0, 2, 1, 3 order, which the final permute restores.
+	for (; x + 32 <= width; x += 32) {
+		const __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + x * 2));
+		const __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + x * 2 + 32));
+		const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + x * 2));
+		const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + x * 2 + 32));
+
+		const __m256i ya = _mm256_unpacklo_epi64(_mm256_shuffle_epi8(a0, evenBytes), _mm256_shuffle_epi8(a1, evenBytes));
+		const __m256i yb = _mm256_unpacklo_epi64(_mm256_shuffle_epi8(b0, evenBytes), _mm256_shuffle_epi8(b1, evenBytes));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dstY0 + x), _mm256_permute4x64_epi64(ya, 0xD8));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dstY1 + x), _mm256_permute4x64_epi64(yb, 0xD8));
+
+		const __m256i c0 = _mm256_avg_epu8(a0, b0);
+		const __m256i c1 = _mm256_avg_epu8(a1, b1);
+		const __m256i uv = _mm256_unpacklo_epi64(_mm256_shuffle_epi8(c0, oddBytes), _mm256_shuffle_epi8(c1, oddBytes));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dstUV + x), _mm256_permute4x64_epi64(uv, 0xD8));
+	}
+
+	YUY2ToNV12Row_SSSE3(src0 + x * 2, src1 + x * 2, dstY0 + x, dstY1 + x, dstUV + x, width - x);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+inline void YUY2ToI420Row_AVX2(const uint8_t* src0, const uint8_t* src1, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV, uint32_t width) {
+	const __m256i evenBytes = _mm256_setr_epi8(
+		0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1,
+		0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i splitUV = _mm256_setr_epi8(
+		1, 5, 9, 13, 3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1,
+		1, 5, 9, 13, 3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i orderUV = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	uint32_t x = 0;
+
+	for (; x + 32 <= width; x += 32) {
+		const __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + x * 2));
+		const __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + x * 2 + 32));
+		const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + x * 2));
+		const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + x * 2 + 32));
+
+		const __m256i ya = _mm256_unpacklo_epi64(_mm256_shuffle_epi8(a0, evenBytes), _mm256_shuffle_epi8(a1, evenBytes));
+		const __m256i yb = _mm256_unpacklo_epi64(_mm256_shuffle_epi8(b0, evenBytes), _mm256_shuffle_epi8(b1, evenBytes));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dstY0 + x), _mm256_permute4x64_epi64(ya, 0xD8));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dstY1 + x), _mm256_permute4x64_epi64(yb, 0xD8));
+
+		const __m256i c0 = _mm256_shuffle_epi8(_mm256_avg_epu8(a0, b0), splitUV);
+		const __m256i c1 = _mm256_shuffle_epi8(_mm256_avg_epu8(a1, b1), splitUV);
+		const __m256i uv = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi32(c0, c1), orderUV);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dstU + x / 2), _mm256_castsi256_si128(uv));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dstV + x / 2), _mm256_extracti128_si256(uv, 1));
+	}
+
+	YUY2ToI420Row_SSSE3(src0 + x * 2, src1 + x * 2, dstY0 + x, dstY1 + x, dstU + x / 2, dstV + x / 2, width - x);
+}
+
+#endif
+
+inline YUY2ToNV12RowFunc GetYUY2ToNV12Row(SimdLevel level) {
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+	case SimdLevel::AVX512:
+	case SimdLevel::AVX2: return YUY2ToNV12Row_AVX2;
+	case SimdLevel::SSSE3: return YUY2ToNV12Row_SSSE3;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return YUY2ToNV12Row_Scalar;
+}
+
+inline YUY2ToI420RowFunc GetYUY2ToI420Row(SimdLevel level) {
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+	case SimdLevel::AVX512:
+	case SimdLevel::AVX2: return YUY2ToI420Row_AVX2;
+	case SimdLevel::SSSE3: return YUY2ToI420Row_SSSE3;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return YUY2ToI420Row_Scalar;
+}
+
+//
+// NV12 -> UYVY
+//
+// Upsamples 4:2:0 chroma to 4:2:2 while interleaving with luma. Chroma rows
+// sit halfway between two luma rows, so every luma row has a near chroma row
+// (y / 2) and a far one (the neighbour on the other side, clamped at the
+// edges). Nearest uses the near row only; linear weights them 3:1,
+// (3 * near + far + 2) >> 2. Width is in pixels and must be even.
+//
+
+enum class ChromaFilter {
+	Nearest,
+	Linear,
+};
+
+inline const char* ChromaFilterName(ChromaFilter filter) {
+	return filter == ChromaFilter::Nearest ? "nearest" : "linear";
+}
+
+using NV12ToUYVYRowFunc = void (*)(const uint8_t* srcY, const uint8_t* srcUVNear, const uint8_t* srcUVFar, uint8_t* dst, uint32_t width);
+
+inline void NV12ToUYVYRow_Nearest_Scalar(const uint8_t* srcY, const uint8_t* srcUVNear, const uint8_t* /*srcUVFar*/, uint8_t* dst, uint32_t width) {
+	for (uint32_t x = 0; x < width; x += 2) {
+		dst[x * 2 + 0] = srcUVNear[x];     // U
+		dst[x * 2 + 1] = srcY[x];          // Y0
+		dst[x * 2 + 2] = srcUVNear[x + 1]; // V
+		dst[x * 2 + 3] = srcY[x + 1];      // Y1
+	}
+}
+
+inline void NV12ToUYVYRow_Linear_Scalar(const uint8_t* srcY, const uint8_t* srcUVNear, const uint8_t* srcUVFar, uint8_t* dst, uint32_t width) {
+	for (uint32_t x = 0; x < width; x += 2) {
+		dst[x * 2 + 0] = static_cast<uint8_t>((3 * srcUVNear[x] + srcUVFar[x] + 2) >> 2);
+		dst[x * 2 + 1] = srcY[x];
+		dst[x * 2 + 2] = static_cast<uint8_t>((3 * srcUVNear[x + 1] + srcUVFar[x + 1] + 2) >> 2);
+		dst[x * 2 + 3] = srcY[x + 1];
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+// UV bytes are already in U V U V order, so byte-interleaving them with luma
+// yields U Y0 V Y1 directly.
+PIXEL_CONVERT_TARGET("ssse3")
+inline void NV12ToUYVYRow_Nearest_SSSE3(const uint8_t* srcY, const uint8_t* srcUVNear, const uint8_t* srcUVFar, uint8_t* dst, uint32_t width) {
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcY + x));
+		const __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcUVNear + x));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2), _mm_unpacklo_epi8(uv, y));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2 + 16), _mm_unpackhi_epi8(uv, y));
+	}
+
+	NV12ToUYVYRow_Nearest_Scalar(srcY + x, srcUVNear + x, srcUVFar + x, dst + x * 2, width - x);
+}
+
+// Widens to 16 bits for the 3:1 blend so the result matches the scalar
+// rounding exactly.
+PIXEL_CONVERT_TARGET("ssse3")
+inline __m128i BlendChroma31_SSSE3(__m128i nearRow, __m128i farRow) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+
+	const __m128i nearLo = _mm_unpacklo_epi8(nearRow, zero);
+	const __m128i nearHi = _mm_unpackhi_epi8(nearRow, zero);
+	const __m128i farLo = _mm_unpacklo_epi8(farRow, zero);
+	const __m128i farHi = _mm_unpackhi_epi8(farRow, zero);
+
+	const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(nearLo, _mm_slli_epi16(nearLo, 1)), farLo), two), 2);
+	const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(nearHi, _mm_slli_epi16(nearHi, 1)), farHi), two), 2);
+	return _mm_packus_epi16(lo, hi);
+}
+
+PIXEL_CONVERT_TARGET("ssse3")
+inline void NV12ToUYVYRow_Linear_SSSE3(const uint8_t* srcY, const uint8_t* srcUVNear, const uint8_t* srcUVFar, uint8_t* dst, uint32_t width) {
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcY + x));
+		const __m128i uv = BlendChroma31_SSSE3(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(srcUVNear + x)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(srcUVFar + x)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2), _mm_unpacklo_epi8(uv, y));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2 + 16), _mm_unpackhi_epi8(uv, y));
+	}
+
+	NV12ToUYVYRow_Linear_Scalar(srcY + x, srcUVNear + x, srcUVFar + x, dst + x * 2, width - x);
+}
+
+// The in-lane unpacks produce output bytes 0-15 / 32-47 (lo) and 16-31 /
+// 48-63 (hi); the cross-lane permutes put them back in order.
+PIXEL_CONVERT_TARGET("avx2")
+inline void StoreUYVY32_AVX2(uint8_t* dst, __m256i uv, __m256i y) {
+	const __m256i lo = _mm256_unpacklo_epi8(uv, y);
+	const __m256i hi = _mm256_unpackhi_epi8(uv, y);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+inline void NV12ToUYVYRow_Nearest_AVX2(const uint8_t* srcY, const uint8_t* srcUVNear, const uint8_t* srcUVFar, uint8_t* dst, uint32_t width) {
+	uint32_t x = 0;
+
+	for (; x + 32 <= width; x += 32) {
+		StoreUYVY32_AVX2(dst + x * 2,
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcUVNear + x)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcY + x)));
+	}
+
+	NV12ToUYVYRow_Nearest_SSSE3(srcY + x, srcUVNear + x, srcUVFar + x, dst + x * 2, width - x);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+inline void NV12ToUYVYRow_Linear_AVX2(const uint8_t* srcY, const uint8_t* srcUVNear, const uint8_t* srcUVFar, uint8_t* dst, uint32_t width) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i two = _mm256_set1_epi16(2);
+	uint32_t x = 0;
+
+	for (; x + 32 <= width; x += 32) {
+		const __m256i nearRow = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcUVNear + x));
+		const __m256i farRow = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcUVFar + x));
+
+		// Unpack and pack are both in-lane, so the byte order survives the round trip.
+		const __m256i nearLo = _mm256_unpacklo_epi8(nearRow, zero);
+		const __m256i nearHi = _mm256_unpackhi_epi8(nearRow, zero);
+		const __m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_add_epi16(nearLo, _mm256_slli_epi16(nearLo, 1)), _mm256_unpacklo_epi8(farRow, zero)), two), 2);
+		const __m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_add_epi16(nearHi, _mm256_slli_epi16(nearHi, 1)), _mm256_unpackhi_epi8(farRow, zero)), two), 2);
+
+		StoreUYVY32_AVX2(dst + x * 2, _mm256_packus_epi16(lo, hi),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcY + x)));
+	}
+
+	NV12ToUYVYRow_Linear_SSSE3(srcY + x, srcUVNear + x, srcUVFar + x, dst + x * 2, width - x);
+}
+
+#endif
+
+inline NV12ToUYVYRowFunc GetNV12ToUYVYRow(SimdLevel level, ChromaFilter filter) {
+	const bool linear = filter == ChromaFilter::Linear;
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+	case SimdLevel::AVX512:
+	case SimdLevel::AVX2: return linear ? NV12ToUYVYRow_Linear_AVX2 : NV12ToUYVYRow_Nearest_AVX2;
+	case SimdLevel::SSSE3: return linear ? NV12ToUYVYRow_Linear_SSSE3 : NV12ToUYVYRow_Nearest_SSSE3;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return linear ? NV12ToUYVYRow_Linear_Scalar : NV12ToUYVYRow_Nearest_Scalar;
+}
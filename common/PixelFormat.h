@@ -0,0 +1,102 @@
+#pragma once
+
+// Pixel formats understood by the capture negotiation and the converters, and
+// the memory layout of a tightly packed frame in each of them.
+
+#include <cstddef>
+#include <cstdint>
+
+enum class PixelFormat {
+	Unknown,
+	YUY2,
+	UYVY,
+	NV12,
+	I420,
+	MJPG,
+	RGB32,
+	BGRA,
+	BGRX,
+	RGBA,
+	RGBX,
+};
+
+inline const char* PixelFormatName(PixelFormat format) {
+	switch (format) {
+	case PixelFormat::YUY2: return "YUY2";
+	case PixelFormat::UYVY: return "UYVY";
+	case PixelFormat::NV12: return "NV12";
+	case PixelFormat::I420: return "I420";
+	case PixelFormat::MJPG: return "MJPG";
+	case PixelFormat::RGB32: return "RGB32";
+	case PixelFormat::BGRA: return "BGRA";
+	case PixelFormat::BGRX: return "BGRX";
+	case PixelFormat::RGBA: return "RGBA";
+	case PixelFormat::RGBX: return "RGBX";
+	default: return "Unknown";
+	}
+}
+
+// Planes of a packed frame laid out back to back, the way NDI expects planar
+// video: Y, then interleaved UV (NV12) or U then V (I420), with each chroma
+// line half as long as a luma line for I420.
+struct FrameLayout {
+	PixelFormat format{ PixelFormat::Unknown };
+	uint32_t width{ 0 };
+	uint32_t height{ 0 };
+	uint32_t planeCount{ 0 };
+	size_t planeOffset[3]{};
+	size_t planePitch[3]{};
+	size_t totalBytes{ 0 };
+};
+
+// Byte order of the 32-bit RGB formats is the name order; X bytes are written
+// as 255 like A.
+inline bool IsRGBFormat(PixelFormat format) {
+	return format == PixelFormat::BGRA || format == PixelFormat::BGRX || format == PixelFormat::RGBA || format == PixelFormat::RGBX;
+}
+
+inline FrameLayout PackedFrameLayout(PixelFormat format, uint32_t width, uint32_t height) {
+	FrameLayout layout;
+	layout.format = format;
+	layout.width = width;
+	layout.height = height;
+
+	const size_t chromaHeight = (static_cast<size_t>(height) + 1) / 2;
+
+	switch (format) {
+	case PixelFormat::YUY2:
+	case PixelFormat::UYVY:
+		layout.planeCount = 1;
+		layout.planePitch[0] = static_cast<size_t>(width) * 2;
+		break;
+	case PixelFormat::RGB32:
+	case PixelFormat::BGRA:
+	case PixelFormat::BGRX:
+	case PixelFormat::RGBA:
+	case PixelFormat::RGBX:
+		layout.planeCount = 1;
+		layout.planePitch[0] = static_cast<size_t>(width) * 4;
+		break;
+	case PixelFormat::NV12:
+		layout.planeCount = 2;
+		layout.planePitch[0] = width;
+		layout.planePitch[1] = width;
+		layout.planeOffset[1] = layout.planePitch[0] * height;
+		layout.totalBytes = layout.planeOffset[1] + layout.planePitch[1] * chromaHeight;
+		return layout;
+	case PixelFormat::I420:
+		layout.planeCount = 3;
+		layout.planePitch[0] = width;
+		layout.planePitch[1] = width / 2;
+		layout.planePitch[2] = width / 2;
+		layout.planeOffset[1] = layout.planePitch[0] * height;
+		layout.planeOffset[2] = layout.planeOffset[1] + layout.planePitch[1] * chromaHeight;
+		layout.totalBytes = layout.planeOffset[2] + layout.planePitch[2] * chromaHeight;
+		return layout;
+	default:
+		return layout;
+	}
+
+	layout.totalBytes = layout.planePitch[0] * height;
+	return layout;
+}
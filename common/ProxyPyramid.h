@@ -0,0 +1,226 @@
+#pragma once
+
+// Half and quarter resolution UYVY proxies, built while a frame is converted.
+//
+// Each level is a 2x2 box filter of the one above it: four luma samples per
+// output luma, and the two horizontally adjacent chroma samples of both rows
+// per output chroma, so the 4:2:2 siting is kept. The quarter level is filtered
+// from the rounded half level, not from a 4x4 box of the source.
+//
+// ProcessBand() is meant to be the band hook of a conversion (see
+// YUY2ToUYVYWithPitch): it reads the band's source rows right after the
+// conversion did, while they are still in L1/L2, and writes the matching half
+// rows and the quarter rows filtered from those. Bands must start at multiples
+// of kRowMultiple rows so each band owns whole 4-row groups.
+//
+// The levels are written into buffers the caller points them at with
+// SetOutputs() before each frame; the pipeline takes them from a FramePool
+// (see FramePool.h), so a sink holds a proxy for as long as it holds the frame.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "PixelConvert.h"
+#include "PixelFormat.h"
+
+//
+// 2x2 box filter, packed 4:2:2 (YUY2 or UYVY) -> UYVY at half the width
+//
+// dstWidth is in output pixels and must be even; each row must hold
+// 2 * dstWidth source pixels. Every output byte is (a + b + c + d + 2) >> 2.
+//
+
+using HalveRow422Func = void (*)(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dstWidth);
+
+// Source byte pairs summed into output U, Y0, V, Y1, per 8-byte (4-pixel) group.
+template <bool kSourceYUY2>
+struct HalveRow422Pairs {
+	static constexpr uint8_t kFirst[4] = { 0, 1, 2, 5 };
+	static constexpr uint8_t kSecond[4] = { 4, 3, 6, 7 };
+};
+
+template <>
+struct HalveRow422Pairs<true> {
+	static constexpr uint8_t kFirst[4] = { 1, 0, 3, 4 };
+	static constexpr uint8_t kSecond[4] = { 5, 2, 7, 6 };
+};
+
+template <bool kSourceYUY2>
+inline void HalveRow422_Scalar(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dstWidth) {
+	using Pairs = HalveRow422Pairs<kSourceYUY2>;
+
+	for (uint32_t g = 0; g < dstWidth / 2; ++g) {
+		const uint8_t* a = row0 + g * 8;
+		const uint8_t* b = row1 + g * 8;
+		for (int i = 0; i < 4; ++i) {
+			const int p = Pairs::kFirst[i];
+			const int q = Pairs::kSecond[i];
+			dst[g * 4 + i] = static_cast<uint8_t>((a[p] + a[q] + b[p] + b[q] + 2) >> 2);
+		}
+	}
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+// pshufb puts every pair next to each other, pmaddubsw with 1s sums the pairs
+// of each row into words, and the two rows are added before rounding.
+template <bool kSourceYUY2>
+PIXEL_CONVERT_TARGET("ssse3")
+inline void HalveRow422_SSSE3(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dstWidth) {
+	using Pairs = HalveRow422Pairs<kSourceYUY2>;
+	const __m128i pairs = _mm_setr_epi8(
+		Pairs::kFirst[0], Pairs::kSecond[0], Pairs::kFirst[1], Pairs::kSecond[1],
+		Pairs::kFirst[2], Pairs::kSecond[2], Pairs::kFirst[3], Pairs::kSecond[3],
+		Pairs::kFirst[0] + 8, Pairs::kSecond[0] + 8, Pairs::kFirst[1] + 8, Pairs::kSecond[1] + 8,
+		Pairs::kFirst[2] + 8, Pairs::kSecond[2] + 8, Pairs::kFirst[3] + 8, Pairs::kSecond[3] + 8);
+	const __m128i ones = _mm_set1_epi8(1);
+	const __m128i round = _mm_set1_epi16(2);
+	const size_t bytes = static_cast<size_t>(dstWidth) * 2;
+	size_t i = 0;
+
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i sums[2];
+		for (int half = 0; half < 2; ++half) {
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + i * 2 + half * 16));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + i * 2 + half * 16));
+			const __m128i sum = _mm_add_epi16(
+				_mm_maddubs_epi16(_mm_shuffle_epi8(a, pairs), ones),
+				_mm_maddubs_epi16(_mm_shuffle_epi8(b, pairs), ones));
+			sums[half] = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(sums[0], sums[1]));
+	}
+
+	HalveRow422_Scalar<kSourceYUY2>(row0 + i * 2, row1 + i * 2, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+
+// Same steps on 32-byte vectors. The pair shuffle stays within 128-bit lanes,
+// and the lane-wise pack is put back in order with one permute.
+template <bool kSourceYUY2>
+PIXEL_CONVERT_TARGET("avx2")
+inline void HalveRow422_AVX2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dstWidth) {
+	using Pairs = HalveRow422Pairs<kSourceYUY2>;
+	const __m256i pairs = _mm256_setr_epi8(
+		Pairs::kFirst[0], Pairs::kSecond[0], Pairs::kFirst[1], Pairs::kSecond[1],
+		Pairs::kFirst[2], Pairs::kSecond[2], Pairs::kFirst[3], Pairs::kSecond[3],
+		Pairs::kFirst[0] + 8, Pairs::kSecond[0] + 8, Pairs::kFirst[1] + 8, Pairs::kSecond[1] + 8,
+		Pairs::kFirst[2] + 8, Pairs::kSecond[2] + 8, Pairs::kFirst[3] + 8, Pairs::kSecond[3] + 8,
+		Pairs::kFirst[0], Pairs::kSecond[0], Pairs::kFirst[1], Pairs::kSecond[1],
+		Pairs::kFirst[2], Pairs::kSecond[2], Pairs::kFirst[3], Pairs::kSecond[3],
+		Pairs::kFirst[0] + 8, Pairs::kSecond[0] + 8, Pairs::kFirst[1] + 8, Pairs::kSecond[1] + 8,
+		Pairs::kFirst[2] + 8, Pairs::kSecond[2] + 8, Pairs::kFirst[3] + 8, Pairs::kSecond[3] + 8);
+	const __m256i ones = _mm256_set1_epi8(1);
+	const __m256i round = _mm256_set1_epi16(2);
+	const size_t bytes = static_cast<size_t>(dstWidth) * 2;
+	size_t i = 0;
+
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i sums[2];
+		for (int half = 0; half < 2; ++half) {
+			const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + i * 2 + half * 32));
+			const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + i * 2 + half * 32));
+			const __m256i sum = _mm256_add_epi16(
+				_mm256_maddubs_epi16(_mm256_shuffle_epi8(a, pairs), ones),
+				_mm256_maddubs_epi16(_mm256_shuffle_epi8(b, pairs), ones));
+			sums[half] = _mm256_srli_epi16(_mm256_add_epi16(sum, round), 2);
+		}
+		const __m256i packed = _mm256_packus_epi16(sums[0], sums[1]);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	HalveRow422_SSSE3<kSourceYUY2>(row0 + i * 2, row1 + i * 2, dst + i, static_cast<uint32_t>((bytes - i) / 2));
+}
+
+#endif
+
+// sourceFormat is YUY2 or UYVY.
+inline HalveRow422Func GetHalveRow422(SimdLevel level, PixelFormat sourceFormat) {
+	const bool yuy2 = sourceFormat == PixelFormat::YUY2;
+#if defined(PIXEL_CONVERT_X86)
+	switch (level) {
+	case SimdLevel::AVX512:
+	case SimdLevel::AVX2: return yuy2 ? HalveRow422_AVX2<true> : HalveRow422_AVX2<false>;
+	case SimdLevel::SSSE3: return yuy2 ? HalveRow422_SSSE3<true> : HalveRow422_SSSE3<false>;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return yuy2 ? HalveRow422_Scalar<true> : HalveRow422_Scalar<false>;
+}
+
+class ProxyPyramid {
+public:
+	// Level 0 is half resolution, level 1 quarter resolution.
+	static constexpr uint32_t kLevelCount = 2;
+	static constexpr uint32_t kRowMultiple = 1u << kLevelCount;
+
+	// width x height is the full-resolution frame.
+	ProxyPyramid(uint32_t width, uint32_t height, SimdLevel level = ActiveSimdLevel())
+		: halveYUY2_(GetHalveRow422(level, PixelFormat::YUY2)),
+		halveUYVY_(GetHalveRow422(level, PixelFormat::UYVY)) {
+		uint32_t levelWidth = width;
+		uint32_t levelHeight = height;
+		for (uint32_t i = 0; i < kLevelCount; ++i) {
+			levelWidth = (levelWidth / 2) & ~1u;
+			levelHeight /= 2;
+			layouts_[i] = PackedFrameLayout(PixelFormat::UYVY, levelWidth, levelHeight);
+		}
+	}
+
+	ProxyPyramid(const ProxyPyramid&) = delete;
+	ProxyPyramid& operator=(const ProxyPyramid&) = delete;
+
+	const FrameLayout& Layout(uint32_t level) const {
+		return layouts_[level];
+	}
+
+	// Points every level at its buffer for the next frame, each of Layout(i).
+	// Call once per frame, before the conversion that feeds ProcessBand().
+	// Each level is filtered from the one above, so a null level (no buffer
+	// was free) and every level below it are skipped; with null levels,
+	// all are.
+	void SetOutputs(uint8_t* const* levels) {
+		for (uint32_t i = 0; i < kLevelCount; ++i) {
+			outputs_[i] = levels ? levels[i] : nullptr;
+		}
+	}
+
+	// Builds the proxy rows covered by full-resolution rows [firstRow, lastRow)
+	// of src, a YUY2 or UYVY frame. firstRow must be a multiple of kRowMultiple;
+	// lastRow too, unless it is the last row of the frame.
+	void ProcessBand(const uint8_t* src, ptrdiff_t pitch, PixelFormat sourceFormat, uint32_t firstRow, uint32_t lastRow) {
+		const HalveRow422Func halveSource = sourceFormat == PixelFormat::YUY2 ? halveYUY2_ : halveUYVY_;
+		const uint8_t* rows = src;
+		ptrdiff_t rowPitch = pitch;
+
+		for (uint32_t i = 0; i < kLevelCount; ++i) {
+			const FrameLayout& layout = layouts_[i];
+			const size_t destPitch = layout.planePitch[0];
+			uint8_t* dest = outputs_[i];
+			if (!dest) {
+				break;
+			}
+			const uint32_t first = firstRow >> (i + 1);
+			const uint32_t last = (std::min)(lastRow >> (i + 1), layout.height);
+
+			for (uint32_t y = first; y < last; ++y) {
+				(i == 0 ? halveSource : halveUYVY_)(
+					rows + static_cast<ptrdiff_t>(y * 2) * rowPitch,
+					rows + static_cast<ptrdiff_t>(y * 2 + 1) * rowPitch,
+					dest + y * destPitch,
+					layout.width);
+			}
+
+			rows = dest;
+			rowPitch = static_cast<ptrdiff_t>(destPitch);
+		}
+	}
+
+private:
+	HalveRow422Func halveYUY2_;
+	HalveRow422Func halveUYVY_;
+	FrameLayout layouts_[kLevelCount];
+	uint8_t* outputs_[kLevelCount]{};
+};
@@ -0,0 +1,356 @@
+#pragma once
+
+// One capture feeding several sinks.
+//
+// FanOutPipeline groups its sinks by conversion: sinks whose ConversionConfig
+// gives the same output frames share one FrameConverter, and each converted
+// frame is a pool buffer handed to all of them as FrameRef copies, so only a
+// sink that needs a different output costs another conversion.
+//
+// Every sink sits behind a SinkQueue, a FrameRing with its own handoff policy
+// drained by a thread of its own, so a slow sink drops its own frames rather
+// than stalling the conversion and the other sinks. Block makes it wait
+// instead, stalling everything behind it. A queue depth of 0 sends on the
+// conversion thread, as a single-sink pipeline does, which suits a sink whose
+// Send() only hands the frame on (NDI's async send). Proxies are pool buffers
+// like the frame, so queued sinks get them too.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BandPool.h"
+#include "CapturePipeline.h"
+#include "CaptureSource.h"
+#include "ColorConvert.h"
+#include "FrameConverter.h"
+#include "FrameRing.h"
+#include "FrameSink.h"
+#include "FrameTracer.h"
+#include "LatencyHistogram.h"
+
+struct SinkQueueConfig {
+	uint32_t depth{ 2 }; // frames queued for the sink; 0 = send on the conversion thread
+	HandoffPolicy policy{ HandoffPolicy::Latest };
+};
+
+// Counters of one sink. offered counts every frame the conversion handed it,
+// dropped or not.
+struct SinkQueueStats {
+	uint64_t offered{ 0 };
+	uint64_t sent{ 0 };
+	FrameRingStats queue;
+	LatencySnapshot send;
+};
+
+// Whether two configs give the same output frames. Thread counts and store
+// modes do not change the pixels.
+inline bool SameConversion(const ConversionConfig& a, const ConversionConfig& b) {
+	return a.outputFormat == b.outputFormat
+		&& a.chromaFilter == b.chromaFilter
+		&& a.outputWidth == b.outputWidth
+		&& a.outputHeight == b.outputHeight
+		&& a.crop.x == b.crop.x && a.crop.y == b.crop.y && a.crop.width == b.crop.width && a.crop.height == b.crop.height
+		&& a.scaleFilter == b.scaleFilter
+		&& a.ptzDemo == b.ptzDemo
+		&& a.proxies == b.proxies
+		&& a.orientation == b.orientation;
+}
+
+// Runs a sink behind a queue of its own. Send() and Flush() are called from
+// the conversion thread; the wrapped sink's Send() from the queue's thread,
+// or from the conversion thread with a depth of 0. One run: after Flush() the
+// queue takes no more frames.
+class SinkQueue : public FrameSink {
+public:
+	SinkQueue(std::string name, FrameSink& sink, const SinkQueueConfig& config)
+		: name_(std::move(name)), sink_(sink), config_(config), ring_((std::max)(config.depth, 1u), config.policy) {
+		if (config_.depth != 0) {
+			thread_ = std::thread([this]() { Drain(); });
+		}
+	}
+
+	~SinkQueue() override {
+		Close();
+	}
+
+	SinkQueue(const SinkQueue&) = delete;
+	SinkQueue& operator=(const SinkQueue&) = delete;
+
+	const std::string& Name() const {
+		return name_;
+	}
+
+	bool Inline() const {
+		return config_.depth == 0;
+	}
+
+	// Pool buffers the sink can hold at once: the queued frames, the one being
+	// sent, and the last one sent, which an asynchronous sink keeps.
+	uint32_t BuffersHeld() const {
+		return Inline() ? 1 : ring_.Capacity() + 2;
+	}
+
+	// The queue gets its own ref; frame is left as it was.
+	void Send(SinkFrame& frame) override {
+		offered_.store(offered_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		SinkFrame copy = frame;
+		if (Inline()) {
+			Deliver(copy);
+			return;
+		}
+		ring_.Push(copy);
+	}
+
+	// Sends what is still queued, then flushes the sink.
+	void Flush() override {
+		Close();
+		sink_.Flush();
+	}
+
+	void PrintStats(bool interval) override {
+		auto ms = [](uint64_t nanoseconds) { return nanoseconds / 1e6; };
+		const SinkQueueStats stats = Stats();
+		const LatencySnapshot send = interval ? stats.send.Since(reportedSend_) : stats.send;
+		std::cout << "Sink " << name_;
+		if (Inline()) {
+			std::cout << " (inline): " << stats.offered << " offered, " << stats.sent << " sent";
+		}
+		else {
+			std::cout << " (" << HandoffPolicyName(stats.queue.policy) << ", " << stats.queue.capacity << " queued): " << stats.offered << " offered, "
+				<< stats.sent << " sent, " << stats.queue.Dropped() << " dropped, " << stats.queue.blocked << " blocked, wait "
+				<< stats.queue.meanAge * 1000 << " ms mean, " << stats.queue.maxAge * 1000 << " ms max";
+		}
+		std::cout << "; send p50 " << ms(send.ValueAtPercentile(50.0)) << " p99 " << ms(send.ValueAtPercentile(99.0))
+			<< " max " << ms(send.max) << " ms" << std::endl;
+		if (interval) {
+			reportedSend_ = stats.send;
+		}
+	}
+
+	SinkQueueStats Stats() const {
+		SinkQueueStats stats;
+		stats.offered = offered_.load(std::memory_order_relaxed);
+		stats.sent = sent_.load(std::memory_order_relaxed);
+		stats.queue = ring_.Stats();
+		stats.send = send_.Snapshot();
+		return stats;
+	}
+
+private:
+	void Close() {
+		ring_.Close();
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+	void Drain() {
+		TRACE_THREAD_NAME(name_.c_str());
+		SinkFrame frame;
+		while (ring_.Pop(frame)) {
+			Deliver(frame);
+			frame.Reset();
+		}
+	}
+
+	void Deliver(SinkFrame& frame) {
+		const auto start = std::chrono::steady_clock::now();
+		{
+			TRACE_SPAN("sink send", frame.index);
+			sink_.Send(frame);
+		}
+		send_.Record(std::chrono::steady_clock::now() - start);
+		sent_.store(sent_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	std::string name_;
+	FrameSink& sink_;
+	SinkQueueConfig config_;
+	FrameRing<SinkFrame> ring_;
+	std::thread thread_;
+	std::atomic<uint64_t> offered_{ 0 };
+	std::atomic<uint64_t> sent_{ 0 };
+	LatencyHistogram send_;
+	LatencySnapshot reportedSend_; // as of the last periodic report
+};
+
+// Hands every frame of one conversion to each of its sinks' queues, the
+// queued sinks first so their threads start while the inline ones send.
+class SinkFanOut : public FrameSink {
+public:
+	void Add(SinkQueue& sink) {
+		if (sink.Inline()) {
+			sinks_.push_back(&sink);
+		}
+		else {
+			sinks_.insert(sinks_.begin() + queued_++, &sink);
+		}
+	}
+
+	const std::vector<SinkQueue*>& Sinks() const {
+		return sinks_;
+	}
+
+	uint32_t BuffersHeld() const {
+		uint32_t held = 0;
+		for (const SinkQueue* sink : sinks_) {
+			held += sink->BuffersHeld();
+		}
+		return held;
+	}
+
+	void Send(SinkFrame& frame) override {
+		for (SinkQueue* sink : sinks_) {
+			sink->Send(frame);
+		}
+	}
+
+	void Flush() override {
+		for (SinkQueue* sink : sinks_) {
+			sink->Flush();
+		}
+	}
+
+	void PrintStats(bool interval) override {
+		for (SinkQueue* sink : sinks_) {
+			sink->PrintStats(interval);
+		}
+	}
+
+private:
+	std::vector<SinkQueue*> sinks_;
+	size_t queued_{ 0 };
+};
+
+// A CapturePipeline with one output per distinct conversion, each fanned out
+// to the sinks that asked for it. The converters run on workerPool when one
+// is given, otherwise each on a pool of its own.
+class FanOutPipeline {
+public:
+	FanOutPipeline(const PipelineConfig& config, CaptureSource& source, BandPool* workerPool = nullptr)
+		: config_(config), source_(source), workerPool_(workerPool) {}
+
+	FanOutPipeline(const FanOutPipeline&) = delete;
+	FanOutPipeline& operator=(const FanOutPipeline&) = delete;
+
+	// Adds a sink fed with frames converted as conversion says. Call before
+	// Initialize().
+	void AddSink(const std::string& name, FrameSink& sink, const ConversionConfig& conversion, const SinkQueueConfig& queue = SinkQueueConfig());
+
+	// Sets up a converter per distinct conversion, and the pipeline with a
+	// pool per converter deep enough for all of its sinks.
+	bool Initialize(const YUVColorimetry& colorimetry);
+
+	void Run(const std::function<void()>& afterFrame = nullptr) {
+		pipeline_->Run(afterFrame);
+	}
+
+	// Any thread, once initialized.
+	void Stop() {
+		pipeline_->Stop();
+	}
+
+	CapturePipeline& Pipeline() {
+		return *pipeline_;
+	}
+
+	size_t ConversionCount() const {
+		return groups_.size();
+	}
+
+	size_t SinkCount() const {
+		return sinks_.size();
+	}
+
+	// The converter feeding sink i (in the order added), set up once
+	// initialized.
+	FrameConverter& ConverterFor(size_t sink) {
+		return *groups_[sinkGroups_[sink]]->converter;
+	}
+
+	SinkQueueStats SinkStats(size_t sink) const {
+		return sinks_[sink]->Stats();
+	}
+
+private:
+	struct Group {
+		ConversionConfig conversion;
+		std::unique_ptr<FrameConverter> converter;
+		SinkFanOut fanOut;
+	};
+
+	PipelineConfig config_;
+	CaptureSource& source_;
+	BandPool* workerPool_;
+	// Declared before the sinks, so it outlives the frames they still hold.
+	std::unique_ptr<CapturePipeline> pipeline_;
+	std::vector<std::unique_ptr<SinkQueue>> sinks_;
+	std::vector<size_t> sinkGroups_;
+	std::vector<std::unique_ptr<Group>> groups_;
+};
+
+inline void FanOutPipeline::AddSink(const std::string& name, FrameSink& sink, const ConversionConfig& conversion, const SinkQueueConfig& queue) {
+	size_t group = 0;
+	while (group < groups_.size() && !SameConversion(groups_[group]->conversion, conversion)) {
+		++group;
+	}
+	if (group == groups_.size()) {
+		auto added = std::make_unique<Group>();
+		added->conversion = conversion;
+		groups_.push_back(std::move(added));
+	}
+
+	sinks_.push_back(std::make_unique<SinkQueue>(name, sink, queue));
+	sinkGroups_.push_back(group);
+	groups_[group]->fanOut.Add(*sinks_.back());
+}
+
+// Each pool holds one frame being converted and one spare on top of what the
+// sinks can hold, and never less than the configured depth.
+inline bool FanOutPipeline::Initialize(const YUVColorimetry& colorimetry) {
+	if (groups_.empty()) {
+		std::cerr << "No sinks to send to." << std::endl;
+		return false;
+	}
+
+	const CaptureFormat capture = source_.Format();
+	for (std::unique_ptr<Group>& group : groups_) {
+		group->converter = workerPool_
+			? std::make_unique<FrameConverter>(group->conversion, *workerPool_)
+			: std::make_unique<FrameConverter>(group->conversion);
+		if (!group->converter->Setup(capture, colorimetry)) {
+			return false;
+		}
+	}
+
+	auto poolDepth = [&](const Group& group) { return (std::max)(config_.poolDepth, group.fanOut.BuffersHeld() + 2); };
+	PipelineConfig config = config_;
+	config.poolDepth = poolDepth(*groups_[0]);
+	pipeline_ = std::make_unique<CapturePipeline>(config, source_, *groups_[0]->converter, groups_[0]->fanOut);
+	for (size_t i = 1; i < groups_.size(); ++i) {
+		pipeline_->AddOutput(*groups_[i]->converter, groups_[i]->fanOut, poolDepth(*groups_[i]));
+	}
+
+	if (config_.printStats) {
+		std::cout << "Fan-out: " << sinks_.size() << " sinks on " << groups_.size() << " conversions" << std::endl;
+		for (const std::unique_ptr<Group>& group : groups_) {
+			const FrameLayout& layout = group->converter->OutputLayout();
+			std::cout << "  " << PixelFormatName(layout.format) << " " << layout.width << "x" << layout.height << " ->";
+			for (const SinkQueue* sink : group->fanOut.Sinks()) {
+				std::cout << " " << sink->Name();
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	return pipeline_->Initialize();
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+// Fixed storage for the small objects the capture path makes per frame.
+//
+// A SlotPool holds a fixed number of equal slots, all allocated when it is
+// reserved. SlotAllocator hands them to std::allocate_shared, so a shared_ptr
+// made with it keeps its object and control block in one slot, and the slot
+// goes back to the pool when the last copy is dropped. This is how captured
+// samples and frame handles stay shared_ptrs without a heap allocation per
+// frame.
+//
+// Allocation and release are lock-free, the way FramePool's are. A request
+// that finds every slot held, or that does not fit a slot, goes to the heap
+// and is counted as an overflow rather than failing, so an undersized pool
+// shows up in the stats.
+//
+// Every object must be released before the pool is destroyed.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+class SlotPool {
+public:
+	// Room for the control block allocate_shared puts next to the object.
+	static constexpr size_t kControlBlockBytes = 4 * sizeof(void*);
+	static constexpr size_t kAlignment = alignof(std::max_align_t);
+
+	// Slot size for objects of type T made with allocate_shared.
+	template <typename T>
+	static constexpr size_t SlotBytesFor() {
+		return (sizeof(T) + kControlBlockBytes + kAlignment - 1) / kAlignment * kAlignment;
+	}
+
+	SlotPool() = default;
+
+	SlotPool(size_t slotBytes, uint32_t count) {
+		Reserve(slotBytes, count);
+	}
+
+	SlotPool(const SlotPool&) = delete;
+	SlotPool& operator=(const SlotPool&) = delete;
+
+	// Allocates count slots of slotBytes. Call before any Allocate(); until
+	// then, and with count 0, every allocation overflows.
+	void Reserve(size_t slotBytes, uint32_t count) {
+		slotBytes_ = (slotBytes + kAlignment - 1) / kAlignment * kAlignment;
+		count_ = count;
+		storage_.reset(count ? new std::byte[slotBytes_ * count] : nullptr);
+		used_.reset(count ? new std::atomic<bool>[count] : nullptr);
+		for (uint32_t i = 0; i < count; ++i) {
+			used_[i].store(false, std::memory_order_relaxed);
+		}
+	}
+
+	// Slots are tried in order, so the recently released ones, still warm in
+	// cache, are reused first.
+	void* Allocate(size_t bytes, size_t alignment) {
+		if (bytes <= slotBytes_ && alignment <= kAlignment) {
+			for (uint32_t i = 0; i < count_; ++i) {
+				bool expected = false;
+				if (!used_[i].load(std::memory_order_relaxed)
+					&& used_[i].compare_exchange_strong(expected, true, std::memory_order_acquire, std::memory_order_relaxed)) {
+					return storage_.get() + slotBytes_ * i;
+				}
+			}
+		}
+		overflows_.fetch_add(1, std::memory_order_relaxed);
+		return ::operator new(bytes);
+	}
+
+	void Deallocate(void* pointer) {
+		const std::byte* slot = static_cast<const std::byte*>(pointer);
+		if (storage_ && slot >= storage_.get() && slot < storage_.get() + slotBytes_ * count_) {
+			used_[(slot - storage_.get()) / slotBytes_].store(false, std::memory_order_release);
+			return;
+		}
+		::operator delete(pointer);
+	}
+
+	uint32_t SlotCount() const {
+		return count_;
+	}
+
+	// Allocations that went to the heap.
+	uint64_t Overflows() const {
+		return overflows_.load(std::memory_order_relaxed);
+	}
+
+private:
+	size_t slotBytes_{ 0 };
+	uint32_t count_{ 0 };
+	std::unique_ptr<std::byte[]> storage_;
+	std::unique_ptr<std::atomic<bool>[]> used_;
+	std::atomic<uint64_t> overflows_{ 0 };
+};
+
+template <typename T>
+class SlotAllocator {
+public:
+	using value_type = T;
+
+	explicit SlotAllocator(SlotPool& pool) noexcept : pool_(&pool) {}
+
+	template <typename U>
+	SlotAllocator(const SlotAllocator<U>& other) noexcept : pool_(other.pool_) {}
+
+	T* allocate(size_t count) {
+		return static_cast<T*>(pool_->Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* pointer, size_t) noexcept {
+		pool_->Deallocate(pointer);
+	}
+
+	template <typename U>
+	bool operator==(const SlotAllocator<U>& other) const noexcept {
+		return pool_ == other.pool_;
+	}
+
+	template <typename U>
+	bool operator!=(const SlotAllocator<U>& other) const noexcept {
+		return pool_ != other.pool_;
+	}
+
+private:
+	template <typename U>
+	friend class SlotAllocator;
+
+	SlotPool* pool_;
+};
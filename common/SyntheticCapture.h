@@ -0,0 +1,254 @@
+#pragma once
+
+// A capture source that needs no camera.
+//
+// SyntheticCaptureSource delivers moving colour bars with a box crossing them,
+// in YUY2, UYVY or NV12, at any size, frame rate and row padding. kPhases
+// frames of the motion are rendered up front and delivered in turn, so reading
+// a sample costs nothing but the bookkeeping, and the pipeline behind it can
+// be driven well past camera rates. Frames are read in place like a locked
+// capture buffer and must not outlive the source, which also holds the
+// samples' storage.
+//
+// Timestamps are the frame's slot on the nominal frame clock plus jitterMs,
+// moved by up to jitterMs either way. dropRate of the frames are skipped,
+// leaving a gap in the timestamps as a camera that drops frames would. In
+// realtime mode a frame is delivered twice jitterMs after its slot, so no
+// stamp is ever in the future, and the source clock is readable, as Media
+// Foundation's is; otherwise frames come as fast as they are read.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "FrameHandle.h"
+#include "FramePacer.h"
+#include "PixelFormat.h"
+#include "SlotPool.h"
+
+struct SyntheticCaptureConfig {
+	PixelFormat format{ PixelFormat::YUY2 }; // YUY2, UYVY or NV12
+	uint32_t width{ 1280 };
+	uint32_t height{ 720 };
+	uint32_t frameRateNumerator{ 60 };
+	uint32_t frameRateDenominator{ 1 };
+	uint32_t pitchPadding{ 0 }; // bytes after every row
+	double jitterMs{ 0.0 };     // timestamps off their slot by up to this much either way
+	double dropRate{ 0.0 };     // fraction of frames that are never delivered
+	bool realtime{ true };      // deliver on the frame clock rather than as fast as read
+	uint64_t frameCount{ 0 };   // frames to generate, including dropped ones; 0 = endless
+	uint64_t seed{ 1 };
+};
+
+class SyntheticFrameBuffer : public LockableFrameBuffer {
+public:
+	SyntheticFrameBuffer(const uint8_t* data, ptrdiff_t pitch) : data_(data), pitch_(pitch) {}
+
+	bool Lock(const uint8_t*& scanline0, ptrdiff_t& pitch) override {
+		scanline0 = data_;
+		pitch = pitch_;
+		return true;
+	}
+
+	void Unlock() override {}
+
+private:
+	const uint8_t* data_;
+	ptrdiff_t pitch_;
+};
+
+class SyntheticFrameSource : public CapturedFrameSource {
+public:
+	SyntheticFrameSource(const uint8_t* data, ptrdiff_t pitch) : buffer_(data, pitch) {}
+
+	uint32_t BufferCount() override {
+		return 1;
+	}
+
+	LockableFrameBuffer* SingleBuffer() override {
+		return &buffer_;
+	}
+
+	LockableFrameBuffer* ContiguousCopy() override {
+		return &buffer_;
+	}
+
+private:
+	SyntheticFrameBuffer buffer_;
+};
+
+class SyntheticCaptureSource : public CaptureSource {
+public:
+	static constexpr uint32_t kPhases = 8;
+
+	explicit SyntheticCaptureSource(const SyntheticCaptureConfig& config) : config_(config), random_(config.seed | 1) {
+		if (config_.format != PixelFormat::UYVY && config_.format != PixelFormat::NV12) {
+			config_.format = PixelFormat::YUY2;
+		}
+		config_.width = (std::max)(config_.width & ~1u, 2u);
+		config_.height = (std::max)(config_.format == PixelFormat::NV12 ? config_.height & ~1u : config_.height, 2u);
+		if (config_.frameRateNumerator == 0 || config_.frameRateDenominator == 0) {
+			config_.frameRateNumerator = 60;
+			config_.frameRateDenominator = 1;
+		}
+		jitter_ = static_cast<int64_t>((std::max)(config_.jitterMs, 0.0) * 10000.0);
+
+		const bool packed = config_.format != PixelFormat::NV12;
+		pitch_ = static_cast<size_t>(config_.width) * (packed ? 2 : 1) + config_.pitchPadding;
+		const size_t rows = packed ? config_.height : config_.height + config_.height / 2;
+		for (uint32_t phase = 0; phase < kPhases; ++phase) {
+			frames_[phase].assign(pitch_ * rows, 0);
+			Render(phase, frames_[phase].data());
+		}
+	}
+
+	const char* Name() const override {
+		return "synthetic";
+	}
+
+	CaptureFormat Format() const override {
+		CaptureFormat format;
+		format.format = config_.format;
+		format.width = config_.width;
+		format.height = config_.height;
+		format.frameRateNumerator = config_.frameRateNumerator;
+		format.frameRateDenominator = config_.frameRateDenominator;
+		return format;
+	}
+
+	const SyntheticCaptureConfig& Config() const {
+		return config_;
+	}
+
+	// The rendered frame that sample index shows.
+	const uint8_t* Frame(uint64_t index) const {
+		return frames_[index % kPhases].data();
+	}
+
+	size_t Pitch() const {
+		return pitch_;
+	}
+
+	void ReserveSamples(uint32_t count) override {
+		samples_.Reserve(SlotPool::SlotBytesFor<SyntheticFrameSource>(), count);
+	}
+
+	CaptureReadStatus Read(CapturedSample& sample) override {
+		using Clock = std::chrono::steady_clock;
+		if (next_ == 0) {
+			start_ = Clock::now();
+		}
+
+		for (;;) {
+			if (config_.frameCount != 0 && next_ >= config_.frameCount) {
+				return CaptureReadStatus::EndOfStream;
+			}
+			const uint64_t index = next_++;
+			const int64_t slot = static_cast<int64_t>(index * 10'000'000ull * config_.frameRateDenominator / config_.frameRateNumerator);
+			const int64_t jitter = jitter_ ? static_cast<int64_t>(Random() * 2.0 * jitter_) : 0;
+
+			if (config_.realtime) {
+				FramePacer::WaitUntil(start_ + Hundreds(slot + 2 * jitter_));
+			}
+			if (config_.dropRate > 0.0 && Random() < config_.dropRate) {
+				continue;
+			}
+
+			sample.frame = std::allocate_shared<SyntheticFrameSource>(SlotAllocator<SyntheticFrameSource>(samples_), Frame(index),
+				static_cast<ptrdiff_t>(pitch_));
+			sample.timestamp = slot + jitter;
+			sample.sourceNow = config_.realtime
+				? std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count() / 100
+				: kNoSourceClock;
+			return CaptureReadStatus::Sample;
+		}
+	}
+
+private:
+	struct Color {
+		uint8_t y, u, v;
+	};
+
+	static std::chrono::steady_clock::duration Hundreds(int64_t hundredNs) {
+		return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(hundredNs * 100));
+	}
+
+	// 75% colour bars (BT.601, limited range), scrolled left by one kPhases-th
+	// of the width per phase, under a white box moving corner to corner.
+	Color ColorAt(uint32_t x, uint32_t y, uint32_t phase) const {
+		static constexpr Color kBars[8] = {
+			{ 180, 128, 128 }, { 162, 44, 142 }, { 131, 156, 44 }, { 112, 72, 58 },
+			{ 84, 184, 198 }, { 65, 100, 212 }, { 35, 212, 114 }, { 16, 128, 128 },
+		};
+		const uint32_t width = config_.width;
+		const uint32_t height = config_.height;
+		const uint32_t box = (std::max)(height / 4, 2u);
+		const uint32_t boxX = phase * (width - (std::min)(box, width)) / (kPhases - 1);
+		const uint32_t boxY = phase * (height - box) / (kPhases - 1);
+		if (x >= boxX && x < boxX + box && y >= boxY && y < boxY + box) {
+			return { 235, 128, 128 };
+		}
+		const uint32_t shift = phase * width / kPhases;
+		return kBars[static_cast<uint64_t>((x + shift) % width) * 8 / width];
+	}
+
+	void Render(uint32_t phase, uint8_t* data) const {
+		const uint32_t width = config_.width;
+		const uint32_t height = config_.height;
+		for (uint32_t y = 0; y < height; ++y) {
+			uint8_t* row = data + pitch_ * y;
+			for (uint32_t x = 0; x < width; x += 2) {
+				const Color left = ColorAt(x, y, phase);
+				const Color right = ColorAt(x + 1, y, phase);
+				if (config_.format == PixelFormat::YUY2) {
+					row[x * 2 + 0] = left.y;
+					row[x * 2 + 1] = left.u;
+					row[x * 2 + 2] = right.y;
+					row[x * 2 + 3] = left.v;
+				}
+				else if (config_.format == PixelFormat::UYVY) {
+					row[x * 2 + 0] = left.u;
+					row[x * 2 + 1] = left.y;
+					row[x * 2 + 2] = left.v;
+					row[x * 2 + 3] = right.y;
+				}
+				else {
+					row[x] = left.y;
+					row[x + 1] = right.y;
+				}
+			}
+		}
+
+		if (config_.format == PixelFormat::NV12) {
+			uint8_t* chroma = data + pitch_ * height;
+			for (uint32_t y = 0; y < height / 2; ++y) {
+				uint8_t* row = chroma + pitch_ * y;
+				for (uint32_t x = 0; x < width; x += 2) {
+					const Color color = ColorAt(x, y * 2, phase);
+					row[x] = color.u;
+					row[x + 1] = color.v;
+				}
+			}
+		}
+	}
+
+	// Uniform in [0, 1).
+	double Random() {
+		random_ ^= random_ << 13;
+		random_ ^= random_ >> 7;
+		random_ ^= random_ << 17;
+		return static_cast<double>(random_ >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	SyntheticCaptureConfig config_;
+	size_t pitch_{ 0 };
+	int64_t jitter_{ 0 }; // 100 ns units
+	std::vector<uint8_t> frames_[kPhases];
+	uint64_t next_{ 0 };
+	uint64_t random_;
+	std::chrono::steady_clock::time_point start_;
+	SlotPool samples_;
+};